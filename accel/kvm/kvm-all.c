@@ -129,8 +129,37 @@ static QLIST_HEAD(, KVMResampleFd) kvm_resample_fd_list =
 
 static QemuMutex kml_slots_lock;
 
-#define kvm_slots_lock()    qemu_mutex_lock(&kml_slots_lock)
-#define kvm_slots_unlock()  qemu_mutex_unlock(&kml_slots_lock)
+/*
+ * Dirty ring reapers publish dirty bits into KVMSlot.dirty_bmap while only
+ * holding their own lock, so the slots lock takes all of those first.
+ */
+static void kvm_slots_lock(void)
+{
+    KVMState *s = kvm_state;
+    unsigned int i;
+
+    for (i = 0; s && i < s->nr_reapers; i++) {
+        qemu_mutex_lock(&s->reapers[i].lock);
+    }
+    qemu_mutex_lock(&kml_slots_lock);
+}
+
+static void kvm_slots_unlock(void)
+{
+    KVMState *s = kvm_state;
+    unsigned int i;
+
+    qemu_mutex_unlock(&kml_slots_lock);
+    for (i = s ? s->nr_reapers : 0; i > 0; i--) {
+        qemu_mutex_unlock(&s->reapers[i - 1].lock);
+    }
+}
+
+static struct KVMDirtyRingReaper *kvm_dirty_ring_reaper_of(KVMState *s,
+                                                           CPUState *cpu)
+{
+    return &s->reapers[cpu->cpu_index % s->nr_reapers];
+}
 
 static void kvm_slot_init_dirty_bitmap(KVMSlot *mem);
 
@@ -506,7 +535,14 @@ static int do_kvm_destroy_vcpu(CPUState *cpu)
     }
 
     if (cpu->kvm_dirty_gfns) {
+        struct KVMDirtyRingReaper *r = kvm_dirty_ring_reaper_of(s, cpu);
+
+        qemu_mutex_lock(&r->lock);
         ret = munmap(cpu->kvm_dirty_gfns, s->kvm_dirty_ring_bytes);
+        if (ret == 0) {
+            cpu->kvm_dirty_gfns = NULL;
+        }
+        qemu_mutex_unlock(&r->lock);
         if (ret < 0) {
             goto err;
         }
@@ -762,7 +798,11 @@ static bool kvm_slot_get_dirty_log(KVMState *s, KVMSlot *slot)
     return ret == 0;
 }
 
-/* Should be with all slots_lock held for the address spaces. */
+/*
+ * Should be with all slots_lock held for the address spaces, or with the
+ * lock of the reaper owning the ring the page comes from.  In the latter
+ * case other reapers may be setting bits in the same words.
+ */
 static void kvm_dirty_ring_mark_page(KVMState *s, uint32_t as_id,
                                      uint32_t slot_id, uint64_t offset)
 {
@@ -781,7 +821,7 @@ static void kvm_dirty_ring_mark_page(KVMState *s, uint32_t as_id,
         return;
     }
 
-    set_bit(offset, mem->dirty_bmap);
+    set_bit_atomic(offset, mem->dirty_bmap);
 }
 
 static bool dirty_gfn_is_dirtied(struct kvm_dirty_gfn *gfn)
@@ -815,8 +855,9 @@ static void dirty_gfn_set_collected(struct kvm_dirty_gfn *gfn)
 }
 
 /*
- * Should be with all slots_lock held for the address spaces.  It returns the
- * dirty page we've collected on this dirty ring.
+ * Should be with all slots_lock held for the address spaces, or with the
+ * lock of the reaper owning @cpu.  It returns the dirty page we've collected
+ * on this dirty ring.
  */
 static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
 {
@@ -827,9 +868,9 @@ static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
     /*
      * It's possible that we race with vcpu creation code where the vcpu is
      * put onto the vcpus list but not yet initialized the dirty ring
-     * structures.  If so, skip it.
+     * structures, or with its destruction.  If so, skip it.
      */
-    if (!cpu->created) {
+    if (!cpu->created || !dirty_gfns) {
         return 0;
     }
 
@@ -885,6 +926,66 @@ static uint64_t kvm_dirty_ring_reap_locked(KVMState *s, CPUState* cpu)
     return total;
 }
 
+/*
+ * Collect the rings owned by reaper @r, or only the ring of @cpu if it is
+ * not NULL, without the slots lock.  Must be called with @r->lock held.
+ */
+static uint64_t kvm_dirty_ring_reap_group(KVMState *s,
+                                          struct KVMDirtyRingReaper *r,
+                                          CPUState *cpu)
+{
+    uint64_t total = 0;
+    int64_t stamp;
+    int ret;
+
+    stamp = get_clock();
+
+    if (cpu) {
+        total = kvm_dirty_ring_reap_one(s, cpu);
+    } else {
+        QEMU_LOCK_GUARD(&qemu_cpu_list_lock);
+        CPU_FOREACH(cpu) {
+            if (kvm_dirty_ring_reaper_of(s, cpu) == r) {
+                total += kvm_dirty_ring_reap_one(s, cpu);
+            }
+        }
+    }
+
+    if (total) {
+        /*
+         * Other reapers may be resetting the rings concurrently, so the
+         * count does not have to match what we collected.  Either way all
+         * the entries collected above are reset when this returns, and the
+         * bits we set only become visible to the slots lock holders after
+         * @r->lock is released.
+         */
+        ret = kvm_vm_ioctl(s, KVM_RESET_DIRTY_RINGS);
+        assert(ret >= 0);
+    }
+
+    stamp = get_clock() - stamp;
+
+    if (total) {
+        trace_kvm_dirty_ring_reap(total, stamp / 1000);
+    }
+
+    return total;
+}
+
+/*
+ * Collect the ring of @cpu, along with the other rings owned by the same
+ * reaper unless @only_cpu is set.  Called by the vCPU thread when its ring
+ * is full.
+ */
+static uint64_t kvm_dirty_ring_reap_cpu(KVMState *s, CPUState *cpu,
+                                        bool only_cpu)
+{
+    struct KVMDirtyRingReaper *r = kvm_dirty_ring_reaper_of(s, cpu);
+
+    QEMU_LOCK_GUARD(&r->lock);
+    return kvm_dirty_ring_reap_group(s, r, only_cpu ? cpu : NULL);
+}
+
 /*
  * Currently for simplicity, we must hold BQL before calling this.  We can
  * consider to drop the BQL if we're clear with all the race conditions.
@@ -1443,6 +1544,62 @@ int kvm_set_memory_attributes_shared(hwaddr start, uint64_t size)
     return kvm_set_memory_attributes(start, size, 0);
 }
 
+/*
+ * Mark the slots that adding @section would register and that already exist
+ * with the same parameters, so that the transaction neither deletes nor
+ * re-creates them.  Return true if all the slots of @section exist.
+ *
+ * Called with KVMMemoryListener.slots_lock held, before the deletions of
+ * the transaction are applied.
+ */
+static bool kvm_keep_phys_mem(KVMMemoryListener *kml,
+                              MemoryRegionSection *section)
+{
+    MemoryRegion *mr = section->mr;
+    hwaddr start_addr, size, slot_size, mr_offset;
+    ram_addr_t ram_start_offset;
+    bool all_kept = true;
+    void *ram;
+    int flags;
+
+    if (!memory_region_is_ram(mr)) {
+        return false;
+    }
+
+    size = kvm_align_section(section, &start_addr);
+    if (!size) {
+        return false;
+    }
+
+    mr_offset = section->offset_within_region + start_addr -
+        section->offset_within_address_space;
+    ram = memory_region_get_ram_ptr(mr) + mr_offset;
+    ram_start_offset = memory_region_get_ram_addr(mr) + mr_offset;
+    flags = kvm_mem_flags(mr);
+
+    do {
+        KVMSlot *mem;
+
+        slot_size = MIN(kvm_max_slot_size, size);
+        mem = kvm_lookup_matching_slot(kml, start_addr, slot_size);
+        if (mem && mem->ram == ram && mem->flags == flags &&
+            mem->ram_start_offset == ram_start_offset &&
+            mem->guest_memfd == mr->ram_block->guest_memfd &&
+            mem->guest_memfd_offset == (uint8_t *)ram - mr->ram_block->host) {
+            trace_kvm_keep_slot(kml->as_id, mem->slot, start_addr, slot_size);
+            mem->keep = true;
+        } else {
+            all_kept = false;
+        }
+        start_addr += slot_size;
+        ram_start_offset += slot_size;
+        ram += slot_size;
+        size -= slot_size;
+    } while (size);
+
+    return all_kept;
+}
+
 /* Called with KVMMemoryListener.slots_lock held */
 static void kvm_set_phys_mem(KVMMemoryListener *kml,
                              MemoryRegionSection *section, bool add)
@@ -1486,6 +1643,12 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
             if (!mem) {
                 return;
             }
+            if (mem->keep) {
+                /* Re-added as is by the same transaction, leave it alone */
+                start_addr += slot_size;
+                size -= slot_size;
+                continue;
+            }
             if (mem->flags & KVM_MEM_LOG_DIRTY_PAGES) {
                 /*
                  * NOTE: We should be aware of the fact that here we're only
@@ -1533,6 +1696,15 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
     /* register the new slot */
     do {
         slot_size = MIN(kvm_max_slot_size, size);
+        mem = kvm_lookup_matching_slot(kml, start_addr, slot_size);
+        if (mem && mem->keep) {
+            mem->keep = false;
+            start_addr += slot_size;
+            ram_start_offset += slot_size;
+            ram += slot_size;
+            size -= slot_size;
+            continue;
+        }
         mem = kvm_alloc_slot(kml);
         mem->as_id = kml->as_id;
         mem->memory_size = slot_size;
@@ -1570,16 +1742,16 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
 
 static void *kvm_dirty_ring_reaper_thread(void *data)
 {
-    KVMState *s = data;
-    struct KVMDirtyRingReaper *r = &s->reaper;
+    struct KVMDirtyRingReaper *r = data;
+    KVMState *s = kvm_state;
 
     rcu_register_thread();
 
-    trace_kvm_dirty_ring_reaper("init");
+    trace_kvm_dirty_ring_reaper(r->index, "init");
 
     while (true) {
         r->reaper_state = KVM_DIRTY_RING_REAPER_WAIT;
-        trace_kvm_dirty_ring_reaper("wait");
+        trace_kvm_dirty_ring_reaper(r->index, "wait");
         /*
          * TODO: provide a smarter timeout rather than a constant?
          */
@@ -1590,12 +1762,12 @@ static void *kvm_dirty_ring_reaper_thread(void *data)
             continue;
         }
 
-        trace_kvm_dirty_ring_reaper("wakeup");
+        trace_kvm_dirty_ring_reaper(r->index, "wakeup");
         r->reaper_state = KVM_DIRTY_RING_REAPER_REAPING;
 
-        bql_lock();
-        kvm_dirty_ring_reap(s, NULL);
-        bql_unlock();
+        qemu_mutex_lock(&r->lock);
+        kvm_dirty_ring_reap_group(s, r, NULL);
+        qemu_mutex_unlock(&r->lock);
 
         r->reaper_iteration++;
     }
@@ -1603,13 +1775,34 @@ static void *kvm_dirty_ring_reaper_thread(void *data)
     g_assert_not_reached();
 }
 
-static void kvm_dirty_ring_reaper_init(KVMState *s)
+/* By default, one reaper per this many vCPUs, up to the maximum below */
+#define KVM_DIRTY_RING_VCPUS_PER_REAPER     64
+#define KVM_DIRTY_RING_MAX_AUTO_REAPERS     8
+
+static void kvm_dirty_ring_reaper_init(KVMState *s, unsigned int max_cpus)
 {
-    struct KVMDirtyRingReaper *r = &s->reaper;
+    unsigned int i, n = s->kvm_dirty_ring_reapers;
+
+    if (!n) {
+        n = DIV_ROUND_UP(max_cpus, KVM_DIRTY_RING_VCPUS_PER_REAPER);
+        n = MIN(n, KVM_DIRTY_RING_MAX_AUTO_REAPERS);
+    }
+
+    s->reapers = g_new0(struct KVMDirtyRingReaper, n);
+    for (i = 0; i < n; i++) {
+        s->reapers[i].index = i;
+        qemu_mutex_init(&s->reapers[i].lock);
+    }
+    s->nr_reapers = n;
 
-    qemu_thread_create(&r->reaper_thr, "kvm-reaper",
-                       kvm_dirty_ring_reaper_thread,
-                       s, QEMU_THREAD_JOINABLE);
+    for (i = 0; i < n; i++) {
+        struct KVMDirtyRingReaper *r = &s->reapers[i];
+        g_autofree char *name = g_strdup_printf("kvm-reaper-%u", i);
+
+        qemu_thread_create(&r->reaper_thr, name,
+                           kvm_dirty_ring_reaper_thread,
+                           r, QEMU_THREAD_JOINABLE);
+    }
 }
 
 static int kvm_dirty_ring_init(KVMState *s)
@@ -1713,10 +1906,24 @@ static void kvm_region_commit(MemoryListener *listener)
         return;
     }
 
+    kvm_slots_lock();
+
+    /*
+     * Slots that a transaction removes and then adds back unchanged, for
+     * example because a neighbouring range was remapped and the sections
+     * were split differently, are left alone: every KVM memslot update has
+     * a cost that grows with the number of memslots.
+     */
+    if (!QSIMPLEQ_EMPTY(&kml->transaction_del)) {
+        QSIMPLEQ_FOREACH(u2, &kml->transaction_add, next) {
+            u2->keep = kvm_keep_phys_mem(kml, &u2->section);
+        }
+    }
+
     /*
      * We have to be careful when regions to add overlap with ranges to remove.
      * We have to simulate atomic KVM memslot updates by making sure no ioctl()
-     * is currently active.
+     * is currently active.  Sections whose slots are all kept cause no gap.
      *
      * The lists are order by addresses, so it's easy to find overlaps.
      */
@@ -1725,6 +1932,11 @@ static void kvm_region_commit(MemoryListener *listener)
     while (u1 && u2) {
         Range r1, r2;
 
+        if (u2->keep) {
+            u2 = QSIMPLEQ_NEXT(u2, next);
+            continue;
+        }
+
         range_init_nofail(&r1, u1->section.offset_within_address_space,
                           int128_get64(u1->section.size));
         range_init_nofail(&r2, u2->section.offset_within_address_space,
@@ -1741,7 +1953,6 @@ static void kvm_region_commit(MemoryListener *listener)
         }
     }
 
-    kvm_slots_lock();
     if (need_inhibit) {
         accel_ioctl_inhibit_begin();
     }
@@ -2667,6 +2878,14 @@ static int kvm_init(MachineState *ms)
         nc++;
     }
 
+    if (s->kvm_dirty_ring_reapers > ms->smp.max_cpus) {
+        ret = -EINVAL;
+        error_report("Number of dirty ring reapers requested (%" PRIu32 ") "
+                     "exceeds the maximum number of cpus (%u)",
+                     s->kvm_dirty_ring_reapers, ms->smp.max_cpus);
+        goto err;
+    }
+
     missing_cap = kvm_check_extension_list(s, kvm_required_capabilites);
     if (!missing_cap) {
         missing_cap =
@@ -2767,7 +2986,7 @@ static int kvm_init(MachineState *ms)
     }
 
     if (s->kvm_dirty_ring_size) {
-        kvm_dirty_ring_reaper_init(s);
+        kvm_dirty_ring_reaper_init(s, ms->smp.max_cpus);
     }
 
     if (kvm_check_extension(kvm_state, KVM_CAP_BINARY_STATS_FD)) {
@@ -3232,19 +3451,16 @@ int kvm_cpu_exec(CPUState *cpu)
              * still full.  Got kicked by KVM_RESET_DIRTY_RINGS.
              */
             trace_kvm_dirty_ring_full(cpu->cpu_index);
-            bql_lock();
+            qatomic_inc(&cpu->dirty_ring_full_exits);
             /*
              * We throttle vCPU by making it sleep once it exit from kernel
              * due to dirty ring full. In the dirtylimit scenario, reaping
              * all vCPUs after a single vCPU dirty ring get full result in
              * the miss of sleep, so just reap the ring-fulled vCPU.
+             * Otherwise reap the vCPUs sharing its reaper, which does not
+             * need the BQL nor the slots lock.
              */
-            if (dirtylimit_in_service()) {
-                kvm_dirty_ring_reap(kvm_state, cpu);
-            } else {
-                kvm_dirty_ring_reap(kvm_state, NULL);
-            }
-            bql_unlock();
+            kvm_dirty_ring_reap_cpu(kvm_state, cpu, dirtylimit_in_service());
             dirtylimit_vcpu_execute(cpu);
             ret = 0;
             break;
@@ -3907,6 +4123,35 @@ static void kvm_set_dirty_ring_size(Object *obj, Visitor *v,
     s->kvm_dirty_ring_size = value;
 }
 
+static void kvm_get_dirty_ring_reapers(Object *obj, Visitor *v,
+                                       const char *name, void *opaque,
+                                       Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint32_t value = s->kvm_dirty_ring_reapers;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void kvm_set_dirty_ring_reapers(Object *obj, Visitor *v,
+                                       const char *name, void *opaque,
+                                       Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint32_t value;
+
+    if (s->fd != -1) {
+        error_setg(errp, "Cannot set properties after the accelerator has been initialized");
+        return;
+    }
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+
+    s->kvm_dirty_ring_reapers = value;
+}
+
 static char *kvm_get_device(Object *obj,
                             Error **errp G_GNUC_UNUSED)
 {
@@ -3952,6 +4197,7 @@ static void kvm_accel_instance_init(Object *obj)
     /* KVM dirty ring is by default off */
     s->kvm_dirty_ring_size = 0;
     s->kvm_dirty_ring_with_bitmap = false;
+    s->kvm_dirty_ring_reapers = 0;
     s->kvm_eager_split_size = 0;
     s->notify_vmexit = NOTIFY_VMEXIT_OPTION_RUN;
     s->notify_window = 0;
@@ -4000,6 +4246,12 @@ static void kvm_accel_class_init(ObjectClass *oc, void *data)
     object_class_property_set_description(oc, "dirty-ring-size",
         "Size of KVM dirty page ring buffer (default: 0, i.e. use bitmap)");
 
+    object_class_property_add(oc, "dirty-ring-reapers", "uint32",
+        kvm_get_dirty_ring_reapers, kvm_set_dirty_ring_reapers,
+        NULL, NULL);
+    object_class_property_set_description(oc, "dirty-ring-reapers",
+        "Number of threads collecting the KVM dirty rings (default: 0, i.e. auto)");
+
     object_class_property_add_str(oc, "device", kvm_get_device, kvm_set_device);
     object_class_property_set_description(oc, "device",
         "Path to the device node to use (default: /dev/kvm)");
@@ -4186,6 +4438,45 @@ exit:
     return list;
 }
 
+/* Statistics kept by QEMU rather than by the kernel */
+#define KVM_STATS_DIRTY_RING_FULL_EXITS "dirty_ring_full_exits"
+
+static StatsList *add_dirty_ring_stats(CPUState *cpu, strList *names,
+                                       StatsList *stats_list)
+{
+    Stats *stats;
+
+    if (!kvm_state->kvm_dirty_ring_size ||
+        !apply_str_list_filter(KVM_STATS_DIRTY_RING_FULL_EXITS, names)) {
+        return stats_list;
+    }
+
+    stats = g_new0(Stats, 1);
+    stats->name = g_strdup(KVM_STATS_DIRTY_RING_FULL_EXITS);
+    stats->value = g_new0(StatsValue, 1);
+    stats->value->u.scalar = qatomic_read__nocheck(&cpu->dirty_ring_full_exits);
+    stats->value->type = QTYPE_QNUM;
+
+    QAPI_LIST_PREPEND(stats_list, stats);
+    return stats_list;
+}
+
+static StatsSchemaValueList *add_dirty_ring_schema(StatsSchemaValueList *list)
+{
+    StatsSchemaValueList *schema_entry;
+
+    if (!kvm_state->kvm_dirty_ring_size) {
+        return list;
+    }
+
+    schema_entry = g_new0(StatsSchemaValueList, 1);
+    schema_entry->value = g_new0(StatsSchemaValue, 1);
+    schema_entry->value->type = STATS_TYPE_CUMULATIVE;
+    schema_entry->value->name = g_strdup(KVM_STATS_DIRTY_RING_FULL_EXITS);
+    schema_entry->next = list;
+    return schema_entry;
+}
+
 /* Cached stats descriptors */
 typedef struct StatsDescriptors {
     const char *ident; /* cache key, currently the StatsTarget */
@@ -4302,6 +4593,10 @@ static void query_stats(StatsResultList **result, StatsTarget target,
         stats_list = add_kvmstat_entry(pdesc, stats, stats_list, errp);
     }
 
+    if (target == STATS_TARGET_VCPU) {
+        stats_list = add_dirty_ring_stats(cpu, names, stats_list);
+    }
+
     if (!stats_list) {
         return;
     }
@@ -4346,6 +4641,10 @@ static void query_stats_schema(StatsSchemaList **result, StatsTarget target,
         stats_list = add_kvmschema_entry(pdesc, stats_list, errp);
     }
 
+    if (target == STATS_TARGET_VCPU) {
+        stats_list = add_dirty_ring_schema(stats_list);
+    }
+
     add_stats_schema(result, STATS_PROVIDER_KVM, target, stats_list);
 }
 
@@ -212,6 +212,137 @@ static void gen_mem_cb(struct qemu_plugin_regular_cb *cb,
     tcg_temp_free_i32(cpu_index);
 }
 
+static TCGv_ptr gen_mem_buffer_entry_ptr(struct qemu_plugin_mem_buffer *buf)
+{
+    qemu_plugin_u64 count = {
+        .score = buf->score,
+        .offset = offsetof(struct qemu_plugin_mem_buffer_entry, count),
+    };
+    return gen_plugin_u64_ptr(count);
+}
+
+/*
+ * Append a record to the vCPU's buffer.  This must not branch, as ebb
+ * temps may be live across the memory access: room is made beforehand
+ * by gen_mem_buffer_flush_cb.  That is only impossible for instructions
+ * with more accesses than the buffer has records.  For them, the index
+ * is clamped so that the excess records overwrite the last one instead
+ * of overflowing the buffer, i.e. they are dropped.
+ */
+static void gen_mem_buffer_cb(struct qemu_plugin_mem_buffer_cb *cb,
+                              qemu_plugin_meminfo_t meminfo, TCGv_i64 addr)
+{
+    struct qemu_plugin_mem_buffer *buf = cb->buf;
+    intptr_t rec_ofs = offsetof(struct qemu_plugin_mem_buffer_entry, records);
+    TCGv_ptr ptr = gen_mem_buffer_entry_ptr(buf);
+    TCGv_ptr rec = tcg_temp_ebb_new_ptr();
+    TCGv_i64 idx = tcg_temp_ebb_new_i64();
+    TCGv_i64 ofs = tcg_temp_ebb_new_i64();
+
+    tcg_gen_ld_i64(idx, ptr, 0);
+    tcg_gen_umin_i64(idx, idx, tcg_constant_i64(buf->n_records - 1));
+    tcg_gen_muli_i64(ofs, idx, sizeof(struct qemu_plugin_mem_record));
+    tcg_gen_trunc_i64_ptr(rec, ofs);
+    tcg_gen_add_ptr(rec, rec, ptr);
+    tcg_gen_st_i64(addr, rec,
+                   rec_ofs + offsetof(struct qemu_plugin_mem_record, vaddr));
+    tcg_gen_st_i64(tcg_constant_i64(cb->pc), rec,
+                   rec_ofs + offsetof(struct qemu_plugin_mem_record, pc));
+    tcg_gen_st_i32(tcg_constant_i32(meminfo), rec,
+                   rec_ofs + offsetof(struct qemu_plugin_mem_record, info));
+    tcg_gen_addi_i64(idx, idx, 1);
+    tcg_gen_st_i64(idx, ptr, 0);
+
+    tcg_temp_free_i64(ofs);
+    tcg_temp_free_i64(idx);
+    tcg_temp_free_ptr(rec);
+    tcg_temp_free_ptr(ptr);
+}
+
+/*
+ * Make accesses from helpers leave room for @need inline records, see
+ * exec_mem_buffer_op().  Instructions are translated concurrently.
+ */
+static void plugin_mem_buffer_reserve(struct qemu_plugin_mem_buffer *buf,
+                                      size_t need)
+{
+    size_t cur = qatomic_read(&buf->max_need);
+
+    while (cur < need) {
+        size_t old = qatomic_cmpxchg(&buf->max_need, cur, need);
+        if (old == cur) {
+            break;
+        }
+        cur = old;
+    }
+}
+
+/*
+ * At the start of an instruction, flush the vCPU's buffer unless it
+ * has room for the @need records the instruction may append to it.
+ */
+static void gen_mem_buffer_flush_cb(struct qemu_plugin_mem_buffer_cb *cb,
+                                    size_t need)
+{
+    struct qemu_plugin_mem_buffer *buf = cb->buf;
+    uint64_t limit = buf->n_records > need ? buf->n_records - need : 0;
+    TCGv_ptr ptr = gen_mem_buffer_entry_ptr(buf);
+    TCGv_i64 count = tcg_temp_ebb_new_i64();
+    TCGLabel *after_flush = gen_new_label();
+
+    tcg_gen_ld_i64(count, ptr, 0);
+    tcg_gen_brcondi_i64(TCG_COND_LEU, count, limit, after_flush);
+    TCGv_i32 cpu_index = gen_cpu_index();
+    tcg_gen_call2(cb->f.vcpu_udata, cb->info, NULL,
+                  tcgv_i32_temp(cpu_index),
+                  tcgv_ptr_temp(tcg_constant_ptr(buf)));
+    tcg_temp_free_i32(cpu_index);
+    gen_set_label(after_flush);
+
+    tcg_temp_free_i64(count);
+    tcg_temp_free_ptr(ptr);
+}
+
+static void gen_mem_buffer_flush_cbs(struct qemu_plugin_insn *insn,
+                                     TCGOp *op)
+{
+    const GArray *cbs = insn->mem_cbs;
+    size_t n_mem_ops = 0;
+    int i, j, n;
+
+    /* Count the memory accesses instrumented for this instruction. */
+    for (op = QTAILQ_NEXT(op, link);
+         op && op->opc != INDEX_op_insn_start;
+         op = QTAILQ_NEXT(op, link)) {
+        if (op->opc == INDEX_op_plugin_mem_cb) {
+            n_mem_ops++;
+        }
+    }
+    if (!n_mem_ops) {
+        return;
+    }
+
+    for (i = 0, n = (cbs ? cbs->len : 0); i < n; i++) {
+        struct qemu_plugin_dyn_cb *cb =
+            &g_array_index(cbs, struct qemu_plugin_dyn_cb, i);
+        size_t need = 0;
+
+        if (cb->type != PLUGIN_CB_MEM_BUFFER) {
+            continue;
+        }
+        for (j = 0; j < n; j++) {
+            struct qemu_plugin_dyn_cb *other =
+                &g_array_index(cbs, struct qemu_plugin_dyn_cb, j);
+            if (other->type == PLUGIN_CB_MEM_BUFFER &&
+                other->mem_buffer.buf == cb->mem_buffer.buf) {
+                need += n_mem_ops;
+            }
+        }
+        plugin_mem_buffer_reserve(cb->mem_buffer.buf, need);
+        gen_mem_buffer_flush_cb(&cb->mem_buffer, need);
+    }
+}
+
 static void inject_cb(struct qemu_plugin_dyn_cb *cb)
 
 {
@@ -249,6 +380,11 @@ static void inject_mem_cb(struct qemu_plugin_dyn_cb *cb,
             inject_cb(cb);
         }
         break;
+    case PLUGIN_CB_MEM_BUFFER:
+        if (rw & cb->mem_buffer.rw) {
+            gen_mem_buffer_cb(&cb->mem_buffer, meminfo, addr);
+        }
+        break;
     default:
         g_assert_not_reached();
     }
@@ -324,6 +460,7 @@ static void plugin_gen_inject(struct qemu_plugin_tb *plugin_tb)
                 assert(insn != NULL);
 
                 gen_enable_mem_helper(plugin_tb, insn);
+                gen_mem_buffer_flush_cbs(insn, op);
 
                 cbs = insn->insn_cbs;
                 for (i = 0, n = (cbs ? cbs->len : 0); i < n; i++) {
@@ -183,8 +183,50 @@ struct PageDesc {
     QemuSpin lock;
     /* list of TBs intersecting this ram page */
     uintptr_t first_tb;
+    /*
+     * Sub-page map of translated bytes: bit i is set if some TB covers
+     * the i-th 1/64th of the page.  Bits are set when a TB is added and
+     * only recomputed when the page's TB list is walked for invalidation,
+     * so the map may be stale in the conservative direction.  Read without
+     * the lock by tb_invalidate_phys_range_fast().
+     */
+    uint64_t code_mask;
 };
 
+#define PAGE_CODE_MASK_BITS  6
+
+/* Return the bits of PageDesc.code_mask covering [start, last]. */
+static uint64_t page_code_mask(tb_page_addr_t start, tb_page_addr_t last)
+{
+    unsigned shift = TARGET_PAGE_BITS - PAGE_CODE_MASK_BITS;
+    unsigned first = (start & ~TARGET_PAGE_MASK) >> shift;
+    unsigned end = (last & ~TARGET_PAGE_MASK) >> shift;
+
+    return MAKE_64BIT_MASK(first, end - first + 1);
+}
+
+/*
+ * Return in [*pstart, *plast] the part of @tb that lies within the
+ * page it is linked into as page @n.
+ */
+static void tb_page_range(const TranslationBlock *tb, unsigned int n,
+                          tb_page_addr_t *pstart, tb_page_addr_t *plast)
+{
+    tb_page_addr_t tb_start, tb_last;
+
+    /* NOTE: this is subtle as a TB may span two physical pages */
+    tb_start = tb_page_addr0(tb);
+    tb_last = tb_start + tb->size - 1;
+    if (n == 0) {
+        tb_last = MIN(tb_last, tb_start | ~TARGET_PAGE_MASK);
+    } else {
+        tb_start = tb_page_addr1(tb);
+        tb_last = tb_start + (tb_last & ~TARGET_PAGE_MASK);
+    }
+    *pstart = tb_start;
+    *plast = tb_last;
+}
+
 void page_table_config_init(void)
 {
     uint32_t v_l1_bits;
@@ -664,6 +706,7 @@ static void tb_remove_all_1(int level, void **lp)
         for (i = 0; i < V_L2_SIZE; ++i) {
             page_lock(&pd[i]);
             pd[i].first_tb = (uintptr_t)NULL;
+            qatomic_set(&pd[i].code_mask, 0);
             page_unlock(&pd[i]);
         }
     } else {
@@ -690,10 +733,15 @@ static void tb_remove_all(void)
  */
 static void tb_page_add(PageDesc *p, TranslationBlock *tb, unsigned int n)
 {
+    tb_page_addr_t tb_start, tb_last;
     bool page_already_protected;
 
     assert_page_locked(p);
 
+    tb_page_range(tb, n, &tb_start, &tb_last);
+    qatomic_set(&p->code_mask,
+                p->code_mask | page_code_mask(tb_start, tb_last));
+
     tb->page_next[n] = p->first_tb;
     page_already_protected = p->first_tb != 0;
     p->first_tb = (uintptr_t)tb | n;
@@ -1102,6 +1150,7 @@ tb_invalidate_phys_page_range__locked(struct page_collection *pages,
 {
     TranslationBlock *tb;
     PageForEachNext n;
+    uint64_t code_mask = 0;
 #ifdef TARGET_HAS_PRECISE_SMC
     bool current_tb_modified = false;
     TranslationBlock *current_tb = retaddr ? tcg_tb_lookup(retaddr) : NULL;
@@ -1111,22 +1160,17 @@ tb_invalidate_phys_page_range__locked(struct page_collection *pages,
     tcg_debug_assert(((start ^ last) & TARGET_PAGE_MASK) == 0);
 
     /*
-     * We remove all the TBs in the range [start, last].
+     * We remove all the TBs in the range [start, last], and rebuild the
+     * code map from the ones that survive.
      * XXX: see if in some cases it could be faster to invalidate all the code
      */
     PAGE_FOR_EACH_TB(start, last, p, tb, n) {
         tb_page_addr_t tb_start, tb_last;
 
-        /* NOTE: this is subtle as a TB may span two physical pages */
-        tb_start = tb_page_addr0(tb);
-        tb_last = tb_start + tb->size - 1;
-        if (n == 0) {
-            tb_last = MIN(tb_last, tb_start | ~TARGET_PAGE_MASK);
+        tb_page_range(tb, n, &tb_start, &tb_last);
+        if (tb_last < start || tb_start > last) {
+            code_mask |= page_code_mask(tb_start, tb_last);
         } else {
-            tb_start = tb_page_addr1(tb);
-            tb_last = tb_start + (tb_last & ~TARGET_PAGE_MASK);
-        }
-        if (!(tb_last < start || tb_start > last)) {
 #ifdef TARGET_HAS_PRECISE_SMC
             if (current_tb == tb &&
                 (tb_cflags(current_tb) & CF_COUNT_MASK) != 1) {
@@ -1144,6 +1188,7 @@ tb_invalidate_phys_page_range__locked(struct page_collection *pages,
             tb_phys_invalidate__locked(tb);
         }
     }
+    qatomic_set(&p->code_mask, code_mask);
 
     /* if no code remaining, no need to continue to use slow writes */
     if (!p->first_tb) {
@@ -1221,6 +1266,29 @@ void tb_invalidate_phys_range_fast(ram_addr_t ram_addr,
                                    uintptr_t retaddr)
 {
     struct page_collection *pages;
+    PageDesc *p;
+
+    /*
+     * The TLB protects code at page granularity, so stores to data that
+     * shares a page with code all come here.  Filter out the ones that
+     * do not touch translated bytes without taking the page lock.
+     * A TB being linked concurrently may be missed, but in that case
+     * the store could as well have been ordered before its translation.
+     *
+     * A page without TBs, e.g. after tb_flush(), must take the locked
+     * path: it unprotects the page, or all stores to it would keep
+     * coming here.  That has to happen under the page lock so that it
+     * can't race with tb_page_add() protecting the page again.
+     */
+    p = page_find(ram_addr >> TARGET_PAGE_BITS);
+    if (!p) {
+        return;
+    }
+    if (qatomic_read(&p->first_tb) &&
+        !(qatomic_read(&p->code_mask) &
+          page_code_mask(ram_addr, ram_addr + size - 1))) {
+        return;
+    }
 
     pages = page_collection_lock(ram_addr, ram_addr + size - 1);
     tb_invalidate_phys_page_fast__locked(pages, ram_addr, size, retaddr);
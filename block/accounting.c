@@ -71,6 +71,7 @@ void block_acct_cleanup(BlockAcctStats *stats)
     QSLIST_FOREACH_SAFE(s, &stats->intervals, entries, next) {
         g_free(s);
     }
+    g_free(stats->queue_merged);
     qemu_mutex_destroy(&stats->lock);
 }
 
@@ -278,6 +279,37 @@ void block_acct_merge_done(BlockAcctStats *stats, enum BlockAcctType type,
     qemu_mutex_unlock(&stats->lock);
 }
 
+/*
+ * Start accounting merges separately for each of @nr_queues queues of the
+ * device, or stop doing so if @nr_queues is 0.  The counters start at 0.
+ */
+void block_acct_set_queues(BlockAcctStats *stats, unsigned nr_queues)
+{
+    qemu_mutex_lock(&stats->lock);
+    g_free(stats->queue_merged);
+    stats->queue_merged = nr_queues ? g_new0(uint64_t[BLOCK_MAX_IOTYPE],
+                                             nr_queues) : NULL;
+    stats->nr_queues = nr_queues;
+    qemu_mutex_unlock(&stats->lock);
+}
+
+/*
+ * Like block_acct_merge_done(), but also account the merged requests to
+ * @queue of the device
+ */
+void block_acct_queue_merge_done(BlockAcctStats *stats, unsigned queue,
+                                 enum BlockAcctType type, int num_requests)
+{
+    assert(type < BLOCK_MAX_IOTYPE);
+
+    qemu_mutex_lock(&stats->lock);
+    stats->merged[type] += num_requests;
+    if (queue < stats->nr_queues) {
+        stats->queue_merged[queue][type] += num_requests;
+    }
+    qemu_mutex_unlock(&stats->lock);
+}
+
 int64_t block_acct_idle_time_ns(BlockAcctStats *stats)
 {
     return qemu_clock_get_ns(clock_type) - stats->last_access_time_ns;
@@ -26,6 +26,7 @@
 #include "qemu/coroutine.h"
 #include "qemu/ratelimit.h"
 #include "block/aio_task.h"
+#include "block/copy-tuner.h"
 #include "qemu/error-report.h"
 #include "qemu/memalign.h"
 
@@ -33,6 +34,8 @@
 #define BLOCK_COPY_MAX_BUFFER (1 * MiB)
 #define BLOCK_COPY_MAX_MEM (128 * MiB)
 #define BLOCK_COPY_MAX_WORKERS 64
+#define BLOCK_COPY_ADAPTIVE_MAX_CHUNK (16 * MiB)
+#define BLOCK_COPY_ADAPTIVE_START_DEPTH 8
 #define BLOCK_COPY_SLICE_TIME 100000000ULL /* ns */
 #define BLOCK_COPY_CLUSTER_SIZE_DEFAULT (1 << 16)
 
@@ -54,6 +57,7 @@ typedef struct BlockCopyCallState {
     int max_workers;
     int64_t max_chunk;
     bool ignore_ratelimit;
+    bool adaptive;
     BlockCopyAsyncCallbackFunc cb;
     void *cb_opaque;
     /* Coroutine where async block-copy is running */
@@ -160,6 +164,10 @@ typedef struct BlockCopyState {
     ProgressMeter *progress;
     SharedResource *mem;
     RateLimit rate_limit;
+
+    /* Only used by calls from block_copy_async() if @adaptive is set */
+    bool adaptive;
+    CopyTuner tuner;
 } BlockCopyState;
 
 /* Called with lock held */
@@ -193,7 +201,13 @@ block_copy_task_create(BlockCopyState *s, BlockCopyCallState *call_state,
     int64_t max_chunk;
 
     QEMU_LOCK_GUARD(&s->lock);
-    max_chunk = MIN_NON_ZERO(block_copy_chunk_size(s), call_state->max_chunk);
+    if (call_state->adaptive &&
+        (s->method == COPY_READ_WRITE || s->method == COPY_RANGE_SMALL)) {
+        max_chunk = copy_tuner_chunk(&s->tuner);
+    } else {
+        max_chunk = block_copy_chunk_size(s);
+    }
+    max_chunk = MIN_NON_ZERO(max_chunk, call_state->max_chunk);
     if (!bdrv_dirty_bitmap_next_dirty_area(s->copy_bitmap,
                                            offset, offset + bytes,
                                            max_chunk, &offset, &bytes))
@@ -269,6 +283,9 @@ void block_copy_state_free(BlockCopyState *s)
         return;
     }
 
+    if (s->adaptive) {
+        copy_tuner_destroy(&s->tuner);
+    }
     ratelimit_destroy(&s->rate_limit);
     bdrv_release_dirty_bitmap(s->copy_bitmap);
     shres_destroy(s->mem);
@@ -453,6 +470,30 @@ void block_copy_set_progress_meter(BlockCopyState *s, ProgressMeter *pm)
     s->progress = pm;
 }
 
+/* Only set before running the job, no need for locking. */
+void block_copy_set_adaptive(BlockCopyState *s, int max_workers,
+                             int64_t max_chunk)
+{
+    int64_t chunk_limit;
+
+    assert(!s->adaptive && max_workers > 0);
+
+    chunk_limit = MIN(MIN_NON_ZERO(max_chunk, BLOCK_COPY_ADAPTIVE_MAX_CHUNK),
+                      s->max_transfer);
+    chunk_limit = MAX(chunk_limit, s->cluster_size);
+
+    copy_tuner_init(&s->tuner, s->cluster_size, chunk_limit, max_workers, 0,
+                    MIN(MAX(s->cluster_size, BLOCK_COPY_MAX_BUFFER),
+                        chunk_limit),
+                    BLOCK_COPY_ADAPTIVE_START_DEPTH);
+    s->adaptive = true;
+}
+
+BlockJobAdaptiveInfo *block_copy_get_adaptive_info(BlockCopyState *s)
+{
+    return s->adaptive ? copy_tuner_get_info(&s->tuner) : NULL;
+}
+
 /*
  * Takes ownership of @task
  *
@@ -584,6 +625,7 @@ static coroutine_fn int block_copy_task_entry(AioTask *task)
     BlockCopyState *s = t->s;
     bool error_is_read = false;
     BlockCopyMethod method = t->method;
+    int64_t start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     int ret = -1;
 
     WITH_GRAPH_RDLOCK_GUARD() {
@@ -591,6 +633,12 @@ static coroutine_fn int block_copy_task_entry(AioTask *task)
                                  &error_is_read);
     }
 
+    if (t->call_state->adaptive && ret >= 0 && t->method != COPY_WRITE_ZEROES) {
+        copy_tuner_request_done(&s->tuner, t->req.bytes,
+                                qemu_clock_get_ns(QEMU_CLOCK_REALTIME) -
+                                start_ns);
+    }
+
     WITH_QEMU_LOCK_GUARD(&s->lock) {
         if (s->method == t->method) {
             s->method = method;
@@ -824,6 +872,10 @@ block_copy_dirty_clusters(BlockCopyCallState *call_state)
         if (!aio && bytes) {
             aio = aio_task_pool_new(call_state->max_workers);
         }
+        if (aio && call_state->adaptive) {
+            aio_task_pool_set_max_busy_tasks(aio,
+                    MIN(copy_tuner_depth(&s->tuner), call_state->max_workers));
+        }
 
         ret = block_copy_task_run(aio, task);
         if (ret < 0) {
@@ -983,6 +1035,7 @@ BlockCopyCallState *block_copy_async(BlockCopyState *s,
         .bytes = bytes,
         .max_workers = max_workers,
         .max_chunk = max_chunk,
+        .adaptive = s->adaptive,
         .cb = cb,
         .cb_opaque = cb_opaque,
 
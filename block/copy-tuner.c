@@ -0,0 +1,162 @@
+/*
+ * copy_tuner API
+ *
+ * Adaptive request size and queue depth for block jobs that copy data
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/lockable.h"
+#include "qemu/timer.h"
+#include "qemu/units.h"
+
+#include "block/copy-tuner.h"
+#include "trace.h"
+
+/* Length of a sampling period */
+#define COPY_TUNER_PERIOD_NS (100 * SCALE_MS)
+
+static int64_t copy_tuner_clamp_chunk(CopyTuner *t, int64_t chunk)
+{
+    chunk = MIN(MAX(chunk, t->min_chunk), t->max_chunk);
+    return MAX(QEMU_ALIGN_DOWN(chunk, t->min_chunk), t->min_chunk);
+}
+
+/* The maximum depth for requests of @chunk bytes */
+static int copy_tuner_depth_limit(CopyTuner *t, int64_t chunk)
+{
+    if (!t->max_bytes) {
+        return t->max_depth;
+    }
+    return MAX(MIN(t->max_bytes / chunk, t->max_depth), 1);
+}
+
+void copy_tuner_init(CopyTuner *t, int64_t min_chunk, int64_t max_chunk,
+                     int max_depth, int64_t max_bytes,
+                     int64_t chunk, int depth)
+{
+    assert(min_chunk > 0 && max_chunk >= min_chunk && max_depth > 0);
+    assert(max_bytes >= 0);
+
+    *t = (CopyTuner) {
+        .min_chunk = min_chunk,
+        .max_chunk = max_chunk,
+        .max_depth = max_depth,
+        .max_bytes = max_bytes,
+        .chunk_ceiling = max_chunk,
+    };
+    t->chunk = copy_tuner_clamp_chunk(t, chunk);
+    t->depth = MIN(MAX(depth, 1), copy_tuner_depth_limit(t, t->chunk));
+    qemu_mutex_init(&t->lock);
+}
+
+void copy_tuner_destroy(CopyTuner *t)
+{
+    qemu_mutex_destroy(&t->lock);
+}
+
+int64_t copy_tuner_chunk(CopyTuner *t)
+{
+    QEMU_LOCK_GUARD(&t->lock);
+    return t->chunk;
+}
+
+int copy_tuner_depth(CopyTuner *t)
+{
+    QEMU_LOCK_GUARD(&t->lock);
+    return t->depth;
+}
+
+/* Called with lock held at the end of a sampling period */
+static void copy_tuner_adjust(CopyTuner *t, int64_t elapsed_ns)
+{
+    uint64_t prev_throughput = t->throughput;
+    bool chunk_grown = t->chunk_grown;
+    uint64_t ns_per_kib;
+
+    t->chunk_grown = false;
+    t->throughput = (double)t->period_bytes * NANOSECONDS_PER_SECOND /
+                    elapsed_ns;
+    t->latency_ns = t->period_latency_ns / t->period_reqs;
+    ns_per_kib = t->period_latency_ns * KiB / MAX(t->period_bytes, 1);
+
+    if (!t->base_ns_per_kib || ns_per_kib < t->base_ns_per_kib) {
+        t->base_ns_per_kib = ns_per_kib;
+    } else {
+        /* Let the base follow a target that has become slower for good */
+        t->base_ns_per_kib = MIN(ns_per_kib,
+                                 t->base_ns_per_kib + t->base_ns_per_kib / 64 + 1);
+    }
+
+    if (ns_per_kib > 2 * t->base_ns_per_kib) {
+        /* Requests are queueing up: back off in size and number */
+        t->depth = MAX(t->depth / 2, 1);
+        t->chunk = copy_tuner_clamp_chunk(t, t->chunk / 2);
+    } else if (chunk_grown &&
+               t->throughput < prev_throughput - prev_throughput / 8) {
+        /* Larger requests made the copy slower: go back and stay there */
+        t->chunk = copy_tuner_clamp_chunk(t, t->chunk / 2);
+        t->chunk_ceiling = t->chunk;
+    } else if (t->depth < copy_tuner_depth_limit(t, t->chunk)) {
+        t->depth++;
+    } else if (t->chunk < t->chunk_ceiling) {
+        /*
+         * With @max_bytes, larger requests mean fewer of them.  Otherwise
+         * the depth limit doesn't depend on the chunk size and this only
+         * changes the chunk size.
+         */
+        t->chunk = copy_tuner_clamp_chunk(t, MIN(t->chunk * 2,
+                                                 t->chunk_ceiling));
+        t->depth = MIN(t->depth, copy_tuner_depth_limit(t, t->chunk));
+        t->chunk_grown = true;
+    }
+
+    trace_copy_tuner_adjust(t, t->throughput, t->latency_ns, ns_per_kib,
+                            t->base_ns_per_kib, t->chunk, t->depth);
+}
+
+void copy_tuner_request_done(CopyTuner *t, int64_t bytes, int64_t latency_ns)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int64_t elapsed_ns;
+
+    QEMU_LOCK_GUARD(&t->lock);
+
+    if (!t->period_start_ns) {
+        t->period_start_ns = now - latency_ns;
+    }
+
+    t->period_bytes += bytes;
+    t->period_reqs++;
+    t->period_latency_ns += latency_ns;
+
+    /* Only judge periods that saw at least a full queue of requests */
+    elapsed_ns = now - t->period_start_ns;
+    if (elapsed_ns < COPY_TUNER_PERIOD_NS || t->period_reqs < t->depth) {
+        return;
+    }
+
+    copy_tuner_adjust(t, elapsed_ns);
+
+    t->period_start_ns = now;
+    t->period_bytes = 0;
+    t->period_reqs = 0;
+    t->period_latency_ns = 0;
+}
+
+BlockJobAdaptiveInfo *copy_tuner_get_info(CopyTuner *t)
+{
+    BlockJobAdaptiveInfo *info = g_new(BlockJobAdaptiveInfo, 1);
+
+    QEMU_LOCK_GUARD(&t->lock);
+    *info = (BlockJobAdaptiveInfo) {
+        .chunk_size = t->chunk,
+        .max_in_flight = t->depth,
+        .throughput = t->throughput,
+        .latency_ns = t->latency_ns,
+    };
+
+    return info;
+}
@@ -20,8 +20,10 @@
 
 #include "qemu/osdep.h"
 
+#include "block/aio_task.h"
 #include "block/block_int.h"
 #include "block/qdict.h"
+#include "block/thread-pool.h"
 #include "sysemu/block-backend.h"
 #include "crypto/block.h"
 #include "qapi/opts-visitor.h"
@@ -466,6 +468,91 @@ static int block_crypto_reopen_prepare(BDRVReopenState *state,
  */
 #define BLOCK_CRYPTO_MAX_IO_SIZE (1024 * 1024)
 
+/* Number of threads working on one request, and their minimum share of it */
+#define BLOCK_CRYPTO_MAX_WORKERS 4
+#define BLOCK_CRYPTO_MIN_WORKER_SIZE (64 * 1024)
+
+typedef int BlockCryptoEncDecFunc(QCryptoBlock *block, uint64_t offset,
+                                  uint8_t *buf, size_t len, Error **errp);
+
+typedef struct BlockCryptoEncDecTask {
+    AioTask task;
+
+    QCryptoBlock *block;
+    uint64_t offset;
+    uint8_t *buf;
+    size_t len;
+    BlockCryptoEncDecFunc *func;
+} BlockCryptoEncDecTask;
+
+static int block_crypto_encdec_pool_func(void *opaque)
+{
+    BlockCryptoEncDecTask *t = opaque;
+
+    return t->func(t->block, t->offset, t->buf, t->len, NULL);
+}
+
+static int coroutine_fn block_crypto_encdec_task_entry(AioTask *task)
+{
+    BlockCryptoEncDecTask *t = container_of(task, BlockCryptoEncDecTask, task);
+
+    return thread_pool_submit_co(block_crypto_encdec_pool_func, t);
+}
+
+/*
+ * Encrypts or decrypts @len bytes of @buf, starting at payload offset
+ * @offset, in the thread pool rather than in the AioContext of the request.
+ * Large requests are split across several threads.
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+static int coroutine_fn
+block_crypto_co_encdec(QCryptoBlock *block, uint64_t offset, uint8_t *buf,
+                       size_t len, BlockCryptoEncDecFunc *func)
+{
+    uint64_t sector_size = qcrypto_block_get_sector_size(block);
+    AioTaskPool *pool;
+    size_t chunk, done;
+    int ret;
+
+    chunk = MAX(DIV_ROUND_UP(len, BLOCK_CRYPTO_MAX_WORKERS),
+                BLOCK_CRYPTO_MIN_WORKER_SIZE);
+    chunk = QEMU_ALIGN_UP(chunk, sector_size);
+    if (chunk >= len) {
+        BlockCryptoEncDecTask t = {
+            .block = block,
+            .offset = offset,
+            .buf = buf,
+            .len = len,
+            .func = func,
+        };
+
+        return thread_pool_submit_co(block_crypto_encdec_pool_func, &t);
+    }
+
+    pool = aio_task_pool_new(BLOCK_CRYPTO_MAX_WORKERS);
+    for (done = 0; done < len && aio_task_pool_status(pool) == 0;
+         done += chunk) {
+        BlockCryptoEncDecTask *t = g_new(BlockCryptoEncDecTask, 1);
+
+        *t = (BlockCryptoEncDecTask) {
+            .task.func = block_crypto_encdec_task_entry,
+            .block = block,
+            .offset = offset + done,
+            .buf = buf + done,
+            .len = MIN(chunk, len - done),
+            .func = func,
+        };
+        aio_task_pool_start_task(pool, &t->task);
+    }
+
+    aio_task_pool_wait_all(pool);
+    ret = aio_task_pool_status(pool);
+    aio_task_pool_free(pool);
+
+    return ret;
+}
+
 static int coroutine_fn GRAPH_RDLOCK
 block_crypto_co_preadv(BlockDriverState *bs, int64_t offset, int64_t bytes,
                        QEMUIOVector *qiov, BdrvRequestFlags flags)
@@ -508,8 +595,9 @@ block_crypto_co_preadv(BlockDriverState *bs, int64_t offset, int64_t bytes,
             goto cleanup;
         }
 
-        if (qcrypto_block_decrypt(crypto->block, offset + bytes_done,
-                                  cipher_data, cur_bytes, NULL) < 0) {
+        if (block_crypto_co_encdec(crypto->block, offset + bytes_done,
+                                   cipher_data, cur_bytes,
+                                   qcrypto_block_decrypt) < 0) {
             ret = -EIO;
             goto cleanup;
         }
@@ -565,8 +653,9 @@ block_crypto_co_pwritev(BlockDriverState *bs, int64_t offset, int64_t bytes,
 
         qemu_iovec_to_buf(qiov, bytes_done, cipher_data, cur_bytes);
 
-        if (qcrypto_block_encrypt(crypto->block, offset + bytes_done,
-                                  cipher_data, cur_bytes, NULL) < 0) {
+        if (block_crypto_co_encdec(crypto->block, offset + bytes_done,
+                                   cipher_data, cur_bytes,
+                                   qcrypto_block_encrypt) < 0) {
             ret = -EIO;
             goto cleanup;
         }
@@ -80,6 +80,8 @@ BlockExport *blk_exp_add(BlockExportOptions *export, Error **errp)
     BlockDriverState *bs;
     BlockBackend *blk = NULL;
     AioContext *ctx;
+    AioContext **multithread_ctxs = NULL;
+    size_t num_multithread_ctxs = 0;
     uint64_t perm;
     int ret;
 
@@ -115,19 +117,57 @@ BlockExport *blk_exp_add(BlockExportOptions *export, Error **errp)
 
     ctx = bdrv_get_aio_context(bs);
 
-    if (export->iothread) {
-        IOThread *iothread;
+    if (export->has_iothreads) {
+        strList *e;
+        size_t i = 0;
+
+        if (export->iothread) {
+            error_setg(errp, "iothread and iothreads are mutually exclusive");
+            return NULL;
+        }
+        if (!export->iothreads) {
+            error_setg(errp, "iothreads must not be empty");
+            return NULL;
+        }
+        if (!drv->supports_multithread) {
+            error_setg(errp, "Export type '%s' does not support iothreads",
+                       BlockExportType_str(export->type));
+            return NULL;
+        }
+
+        for (e = export->iothreads; e; e = e->next) {
+            num_multithread_ctxs++;
+        }
+        multithread_ctxs = g_new(AioContext *, num_multithread_ctxs);
+
+        for (e = export->iothreads; e; e = e->next) {
+            IOThread *iothread = iothread_by_id(e->value);
+
+            if (!iothread) {
+                error_setg(errp, "iothread \"%s\" not found", e->value);
+                goto fail;
+            }
+            multithread_ctxs[i++] = iothread_get_aio_context(iothread);
+        }
+    }
+
+    if (export->iothread || multithread_ctxs) {
         AioContext *new_ctx;
         Error **set_context_errp;
 
-        iothread = iothread_by_id(export->iothread);
-        if (!iothread) {
-            error_setg(errp, "iothread \"%s\" not found", export->iothread);
-            goto fail;
+        if (multithread_ctxs) {
+            new_ctx = multithread_ctxs[0];
+        } else {
+            IOThread *iothread = iothread_by_id(export->iothread);
+
+            if (!iothread) {
+                error_setg(errp, "iothread \"%s\" not found",
+                           export->iothread);
+                goto fail;
+            }
+            new_ctx = iothread_get_aio_context(iothread);
         }
 
-        new_ctx = iothread_get_aio_context(iothread);
-
         /* Ignore errors with fixed-iothread=false */
         set_context_errp = fixed_iothread ? errp : NULL;
         ret = bdrv_try_change_aio_context(bs, new_ctx, NULL, set_context_errp);
@@ -178,6 +218,8 @@ BlockExport *blk_exp_add(BlockExportOptions *export, Error **errp)
         .id         = g_strdup(export->id),
         .ctx        = ctx,
         .blk        = blk,
+        .multithread_ctxs = multithread_ctxs,
+        .num_multithread_ctxs = num_multithread_ctxs,
     };
 
     ret = drv->create(exp, export, errp);
@@ -195,6 +237,7 @@ fail:
         blk_set_dev_ops(blk, NULL, NULL);
         blk_unref(blk);
     }
+    g_free(multithread_ctxs);
     if (exp) {
         g_free(exp->id);
         g_free(exp);
@@ -202,6 +245,19 @@ fail:
     return NULL;
 }
 
+/*
+ * Returns the AioContext in which the @idx-th unit of work of @exp, e.g. a
+ * client connection, should run.  Without the iothreads option, this is
+ * always exp->ctx.
+ */
+AioContext *blk_exp_get_aio_context(BlockExport *exp, unsigned int idx)
+{
+    if (exp->multithread_ctxs) {
+        return exp->multithread_ctxs[idx % exp->num_multithread_ctxs];
+    }
+    return exp->ctx;
+}
+
 void blk_exp_ref(BlockExport *exp)
 {
     assert(qatomic_read(&exp->refcount) > 0);
@@ -219,6 +275,7 @@ static void blk_exp_delete_bh(void *opaque)
     blk_set_dev_ops(exp->blk, NULL, NULL);
     blk_unref(exp->blk);
     qapi_event_send_block_export_deleted(exp->id);
+    g_free(exp->multithread_ctxs);
     g_free(exp->id);
     g_free(exp);
 }
@@ -56,6 +56,8 @@ typedef struct FuseExport {
     char *mountpoint;
     bool writable;
     bool growable;
+    /* Serializes requests that grow the image, see fuse_co_grow() */
+    CoMutex grow_lock;
     /* Whether allow_other was used as a mount option or not */
     bool allow_other;
 
@@ -64,6 +66,27 @@ typedef struct FuseExport {
     gid_t st_gid;
 } FuseExport;
 
+/*
+ * A read, write or fallocate request that is processed in a coroutine, so
+ * that the export can receive further requests while it waits for the
+ * block layer.
+ */
+typedef struct FuseIORequest {
+    FuseExport *exp;
+    fuse_req_t req;
+    size_t size;
+    off_t offset;
+    /* fallocate() mode */
+    int mode;
+
+    /* Data to write, points into @recv_buf or into exp->fuse_buf */
+    const char *buf;
+    /* Receive buffer taken over from exp->fuse_buf, freed on completion */
+    void *recv_buf;
+    /* Set on completion as long as the request handler is still running */
+    bool *done;
+} FuseIORequest;
+
 static GHashTable *exports;
 static const struct fuse_lowlevel_ops fuse_ops;
 
@@ -178,6 +201,7 @@ static int fuse_export_create(BlockExport *blk_exp,
     exp->mountpoint = g_strdup(args->mountpoint);
     exp->writable = blk_exp_args->writable;
     exp->growable = args->growable;
+    qemu_co_mutex_init(&exp->grow_lock);
 
     /* set default */
     if (!args->has_allow_other) {
@@ -485,6 +509,31 @@ static int fuse_do_truncate(const FuseExport *exp, int64_t size,
     return ret;
 }
 
+/*
+ * Grow the image to at least @size bytes.  Concurrent requests may grow it,
+ * too, so the length is checked again while holding grow_lock, and the
+ * image is never shrunk here: a request that wants a smaller size than
+ * another one that got there first has nothing left to do.
+ */
+static int coroutine_fn fuse_co_grow(FuseExport *exp, int64_t size,
+                                     bool req_zero_write,
+                                     PreallocMode prealloc)
+{
+    int64_t length;
+
+    QEMU_LOCK_GUARD(&exp->grow_lock);
+
+    length = blk_co_getlength(exp->common.blk);
+    if (length < 0) {
+        return length;
+    }
+    if (size <= length) {
+        return 0;
+    }
+
+    return fuse_do_truncate(exp, size, req_zero_write, prealloc);
+}
+
 /**
  * Let clients set file attributes.  Only resizing and changing
  * permissions (st_mode, st_uid, st_gid) is allowed.
@@ -571,123 +620,201 @@ static void fuse_open(fuse_req_t req, fuse_ino_t inode,
 }
 
 /**
- * Handle client reads from the exported image.
+ * Start processing @io in a coroutine.  It keeps the export and its
+ * in-flight counter raised until fuse_io_request_done().
  */
-static void fuse_read(fuse_req_t req, fuse_ino_t inode,
-                      size_t size, off_t offset, struct fuse_file_info *fi)
+static void fuse_io_request_start(FuseIORequest *io, CoroutineEntry *entry)
 {
-    FuseExport *exp = fuse_req_userdata(req);
+    blk_exp_ref(&io->exp->common);
+    qatomic_inc(&io->exp->in_flight);
+
+    qemu_coroutine_enter(qemu_coroutine_create(entry, io));
+}
+
+static void fuse_io_request_done(FuseIORequest *io)
+{
+    FuseExport *exp = io->exp;
+
+    if (io->done) {
+        *io->done = true;
+    }
+    free(io->recv_buf);
+    g_free(io);
+
+    if (qatomic_fetch_dec(&exp->in_flight) == 1) {
+        aio_wait_kick(); /* wake AIO_WAIT_WHILE() */
+    }
+    blk_exp_unref(&exp->common);
+}
+
+static void coroutine_fn fuse_co_read(void *opaque)
+{
+    FuseIORequest *io = opaque;
+    FuseExport *exp = io->exp;
+    size_t size = io->size;
     int64_t length;
     void *buf;
     int ret;
 
-    /* Limited by max_read, should not happen */
-    if (size > FUSE_MAX_BOUNCE_BYTES) {
-        fuse_reply_err(req, EINVAL);
-        return;
-    }
-
     /**
      * Clients will expect short reads at EOF, so we have to limit
      * offset+size to the image length.
      */
-    length = blk_getlength(exp->common.blk);
+    length = blk_co_getlength(exp->common.blk);
     if (length < 0) {
-        fuse_reply_err(req, -length);
-        return;
+        fuse_reply_err(io->req, -length);
+        goto out;
     }
 
-    if (offset + size > length) {
-        size = length - offset;
+    if (io->offset + size > length) {
+        size = length - io->offset;
     }
 
     buf = qemu_try_blockalign(blk_bs(exp->common.blk), size);
     if (!buf) {
-        fuse_reply_err(req, ENOMEM);
-        return;
+        fuse_reply_err(io->req, ENOMEM);
+        goto out;
     }
 
-    ret = blk_pread(exp->common.blk, offset, size, buf, 0);
+    ret = blk_co_pread(exp->common.blk, io->offset, size, buf, 0);
     if (ret >= 0) {
-        fuse_reply_buf(req, buf, size);
+        fuse_reply_buf(io->req, buf, size);
     } else {
-        fuse_reply_err(req, -ret);
+        fuse_reply_err(io->req, -ret);
     }
 
     qemu_vfree(buf);
+out:
+    fuse_io_request_done(io);
 }
 
 /**
- * Handle client writes to the exported image.
+ * Handle client reads from the exported image.
  */
-static void fuse_write(fuse_req_t req, fuse_ino_t inode, const char *buf,
-                       size_t size, off_t offset, struct fuse_file_info *fi)
+static void fuse_read(fuse_req_t req, fuse_ino_t inode,
+                      size_t size, off_t offset, struct fuse_file_info *fi)
 {
     FuseExport *exp = fuse_req_userdata(req);
-    int64_t length;
-    int ret;
+    FuseIORequest *io;
 
-    /* Limited by max_write, should not happen */
-    if (size > BDRV_REQUEST_MAX_BYTES) {
+    /* Limited by max_read, should not happen */
+    if (size > FUSE_MAX_BOUNCE_BYTES) {
         fuse_reply_err(req, EINVAL);
         return;
     }
 
-    if (!exp->writable) {
-        fuse_reply_err(req, EACCES);
-        return;
-    }
+    io = g_new(FuseIORequest, 1);
+    *io = (FuseIORequest) {
+        .exp    = exp,
+        .req    = req,
+        .size   = size,
+        .offset = offset,
+    };
+    fuse_io_request_start(io, fuse_co_read);
+}
+
+static void coroutine_fn fuse_co_write(void *opaque)
+{
+    FuseIORequest *io = opaque;
+    FuseExport *exp = io->exp;
+    size_t size = io->size;
+    int64_t length;
+    int ret;
 
     /**
      * Clients will expect short writes at EOF, so we have to limit
      * offset+size to the image length.
      */
-    length = blk_getlength(exp->common.blk);
+    length = blk_co_getlength(exp->common.blk);
     if (length < 0) {
-        fuse_reply_err(req, -length);
-        return;
+        fuse_reply_err(io->req, -length);
+        goto out;
     }
 
-    if (offset + size > length) {
+    if (io->offset + size > length) {
         if (exp->growable) {
-            ret = fuse_do_truncate(exp, offset + size, true, PREALLOC_MODE_OFF);
+            ret = fuse_co_grow(exp, io->offset + size, true,
+                               PREALLOC_MODE_OFF);
             if (ret < 0) {
-                fuse_reply_err(req, -ret);
-                return;
+                fuse_reply_err(io->req, -ret);
+                goto out;
             }
         } else {
-            size = length - offset;
+            size = length - io->offset;
         }
     }
 
-    ret = blk_pwrite(exp->common.blk, offset, size, buf, 0);
+    ret = blk_co_pwrite(exp->common.blk, io->offset, size, io->buf, 0);
     if (ret >= 0) {
-        fuse_reply_write(req, size);
+        fuse_reply_write(io->req, size);
     } else {
-        fuse_reply_err(req, -ret);
+        fuse_reply_err(io->req, -ret);
     }
+
+out:
+    fuse_io_request_done(io);
 }
 
 /**
- * Let clients perform various fallocate() operations.
+ * Handle client writes to the exported image.
  */
-static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
-                           off_t offset, off_t length,
-                           struct fuse_file_info *fi)
+static void fuse_write(fuse_req_t req, fuse_ino_t inode, const char *buf,
+                       size_t size, off_t offset, struct fuse_file_info *fi)
 {
     FuseExport *exp = fuse_req_userdata(req);
-    int64_t blk_len;
-    int ret;
+    FuseIORequest *io;
+    bool done = false;
+
+    /* Limited by max_write, should not happen */
+    if (size > BDRV_REQUEST_MAX_BYTES) {
+        fuse_reply_err(req, EINVAL);
+        return;
+    }
 
     if (!exp->writable) {
         fuse_reply_err(req, EACCES);
         return;
     }
 
-    blk_len = blk_getlength(exp->common.blk);
+    io = g_new(FuseIORequest, 1);
+    *io = (FuseIORequest) {
+        .exp    = exp,
+        .req    = req,
+        .size   = size,
+        .offset = offset,
+        .buf    = buf,
+        .done   = &done,
+    };
+    fuse_io_request_start(io, fuse_co_write);
+
+    if (!done) {
+        /*
+         * @buf points into the receive buffer, which the next request would
+         * overwrite.  Hand it over to the request instead of copying the
+         * data; libfuse allocates a new one for the next request.
+         */
+        assert(buf >= (char *)exp->fuse_buf.mem &&
+               buf < (char *)exp->fuse_buf.mem + exp->fuse_buf.size);
+        io->done = NULL;
+        io->recv_buf = exp->fuse_buf.mem;
+        exp->fuse_buf.mem = NULL;
+    }
+}
+
+static void coroutine_fn fuse_co_fallocate(void *opaque)
+{
+    FuseIORequest *io = opaque;
+    FuseExport *exp = io->exp;
+    int mode = io->mode;
+    off_t offset = io->offset;
+    off_t length = io->size;
+    int64_t blk_len;
+    int ret = 0;
+
+    blk_len = blk_co_getlength(exp->common.blk);
     if (blk_len < 0) {
-        fuse_reply_err(req, -blk_len);
-        return;
+        fuse_reply_err(io->req, -blk_len);
+        goto out;
     }
 
 #ifdef CONFIG_FALLOCATE_PUNCH_HOLE
@@ -697,36 +824,46 @@ static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
 #endif /* CONFIG_FALLOCATE_PUNCH_HOLE */
 
     if (!mode) {
-        /* We can only fallocate at the EOF with a truncate */
-        if (offset < blk_len) {
-            fuse_reply_err(req, EOPNOTSUPP);
-            return;
-        }
+        /*
+         * We can only fallocate at the EOF with a truncate.  Check that
+         * while holding grow_lock, so that no other request moves the EOF.
+         */
+        WITH_QEMU_LOCK_GUARD(&exp->grow_lock) {
+            blk_len = blk_co_getlength(exp->common.blk);
+            if (blk_len < 0) {
+                ret = blk_len;
+                break;
+            }
+            if (offset < blk_len) {
+                ret = -EOPNOTSUPP;
+                break;
+            }
 
-        if (offset > blk_len) {
-            /* No preallocation needed here */
-            ret = fuse_do_truncate(exp, offset, true, PREALLOC_MODE_OFF);
-            if (ret < 0) {
-                fuse_reply_err(req, -ret);
-                return;
+            if (offset > blk_len) {
+                /* No preallocation needed here */
+                ret = fuse_do_truncate(exp, offset, true, PREALLOC_MODE_OFF);
+                if (ret < 0) {
+                    break;
+                }
             }
-        }
 
-        ret = fuse_do_truncate(exp, offset + length, true,
-                               PREALLOC_MODE_FALLOC);
+            ret = fuse_do_truncate(exp, offset + length, true,
+                                   PREALLOC_MODE_FALLOC);
+        }
     }
 #ifdef CONFIG_FALLOCATE_PUNCH_HOLE
     else if (mode & FALLOC_FL_PUNCH_HOLE) {
         if (!(mode & FALLOC_FL_KEEP_SIZE)) {
-            fuse_reply_err(req, EINVAL);
-            return;
+            fuse_reply_err(io->req, EINVAL);
+            goto out;
         }
 
         do {
             int size = MIN(length, BDRV_REQUEST_MAX_BYTES);
 
-            ret = blk_pwrite_zeroes(exp->common.blk, offset, size,
-                                    BDRV_REQ_MAY_UNMAP | BDRV_REQ_NO_FALLBACK);
+            ret = blk_co_pwrite_zeroes(exp->common.blk, offset, size,
+                                       BDRV_REQ_MAY_UNMAP |
+                                       BDRV_REQ_NO_FALLBACK);
             if (ret == -ENOTSUP) {
                 /*
                  * fallocate() specifies to return EOPNOTSUPP for unsupported
@@ -744,19 +881,19 @@ static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
     else if (mode & FALLOC_FL_ZERO_RANGE) {
         if (!(mode & FALLOC_FL_KEEP_SIZE) && offset + length > blk_len) {
             /* No need for zeroes, we are going to write them ourselves */
-            ret = fuse_do_truncate(exp, offset + length, false,
-                                   PREALLOC_MODE_OFF);
+            ret = fuse_co_grow(exp, offset + length, false,
+                               PREALLOC_MODE_OFF);
             if (ret < 0) {
-                fuse_reply_err(req, -ret);
-                return;
+                fuse_reply_err(io->req, -ret);
+                goto out;
             }
         }
 
         do {
             int size = MIN(length, BDRV_REQUEST_MAX_BYTES);
 
-            ret = blk_pwrite_zeroes(exp->common.blk,
-                                    offset, size, 0);
+            ret = blk_co_pwrite_zeroes(exp->common.blk,
+                                       offset, size, 0);
             offset += size;
             length -= size;
         } while (ret == 0 && length > 0);
@@ -766,7 +903,35 @@ static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
         ret = -EOPNOTSUPP;
     }
 
-    fuse_reply_err(req, ret < 0 ? -ret : 0);
+    fuse_reply_err(io->req, ret < 0 ? -ret : 0);
+out:
+    fuse_io_request_done(io);
+}
+
+/**
+ * Let clients perform various fallocate() operations.
+ */
+static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
+                           off_t offset, off_t length,
+                           struct fuse_file_info *fi)
+{
+    FuseExport *exp = fuse_req_userdata(req);
+    FuseIORequest *io;
+
+    if (!exp->writable) {
+        fuse_reply_err(req, EACCES);
+        return;
+    }
+
+    io = g_new(FuseIORequest, 1);
+    *io = (FuseIORequest) {
+        .exp    = exp,
+        .req    = req,
+        .size   = length,
+        .offset = offset,
+        .mode   = mode,
+    };
+    fuse_io_request_start(io, fuse_co_fallocate);
 }
 
 /**
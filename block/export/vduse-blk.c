@@ -33,6 +33,15 @@ typedef struct VduseBlkExport {
     char *recon_file;
     unsigned int inflight; /* atomic */
     bool vqs_started;
+
+    /*
+     * libvduse is not thread-safe. When virtqueues are processed in other
+     * iothreads, each control request is handled by dev_co while virtqueue
+     * processing is paused, see vduse_blk_pause_vqs().
+     */
+    Coroutine *dev_co;
+    bool vqs_paused;
+    bool wait_idle; /* atomic */
 } VduseBlkExport;
 
 typedef struct VduseBlkReq {
@@ -51,6 +60,11 @@ static void vduse_blk_inflight_inc(VduseBlkExport *vblk_exp)
 static void vduse_blk_inflight_dec(VduseBlkExport *vblk_exp)
 {
     if (qatomic_fetch_dec(&vblk_exp->inflight) == 1) {
+        /* Only one of this and vduse_blk_pause_vqs() may clear wait_idle */
+        if (qatomic_xchg(&vblk_exp->wait_idle, false)) {
+            aio_co_wake(vblk_exp->dev_co);
+        }
+
         /* Wake AIO_WAIT_WHILE() */
         aio_wait_kick();
 
@@ -92,6 +106,34 @@ static void coroutine_fn vduse_blk_virtio_process_req(void *opaque)
     vduse_blk_inflight_dec(vblk_exp);
 }
 
+/* The AioContext in which the kicks of @vq are handled */
+static AioContext *vduse_blk_queue_aio_context(VduseBlkExport *vblk_exp,
+                                               VduseVirtq *vq)
+{
+    int i;
+
+    for (i = 0; i < vblk_exp->num_queues; i++) {
+        if (vduse_dev_get_queue(vblk_exp->dev, i) == vq) {
+            return blk_exp_get_aio_context(&vblk_exp->export, i);
+        }
+    }
+    return vblk_exp->export.ctx;
+}
+
+/* Whether some virtqueues are processed outside of the export's AioContext */
+static bool vduse_blk_has_foreign_vqs(VduseBlkExport *vblk_exp)
+{
+    int i;
+
+    for (i = 0; i < vblk_exp->num_queues; i++) {
+        if (blk_exp_get_aio_context(&vblk_exp->export, i) !=
+            vblk_exp->export.ctx) {
+            return true;
+        }
+    }
+    return false;
+}
+
 static void vduse_blk_vq_handler(VduseDev *dev, VduseVirtq *vq)
 {
     VduseBlkExport *vblk_exp = vduse_dev_get_priv(dev);
@@ -135,8 +177,12 @@ static void vduse_blk_enable_queue(VduseDev *dev, VduseVirtq *vq)
     if (!vblk_exp->vqs_started) {
         return; /* vduse_blk_drained_end() will start vqs later */
     }
+    if (vblk_exp->vqs_paused) {
+        return; /* vduse_blk_resume_vqs() will start vqs later */
+    }
 
-    aio_set_fd_handler(vblk_exp->export.ctx, vduse_queue_get_fd(vq),
+    aio_set_fd_handler(vduse_blk_queue_aio_context(vblk_exp, vq),
+                       vduse_queue_get_fd(vq),
                        on_vduse_vq_kick, NULL, NULL, NULL, vq);
     /* Make sure we don't miss any kick after reconnecting */
     eventfd_write(vduse_queue_get_fd(vq), 1);
@@ -151,7 +197,7 @@ static void vduse_blk_disable_queue(VduseDev *dev, VduseVirtq *vq)
         return;
     }
 
-    aio_set_fd_handler(vblk_exp->export.ctx, fd,
+    aio_set_fd_handler(vduse_blk_queue_aio_context(vblk_exp, vq), fd,
                        NULL, NULL, NULL, NULL, NULL);
 }
 
@@ -160,11 +206,93 @@ static const VduseOps vduse_blk_ops = {
     .disable_queue = vduse_blk_disable_queue,
 };
 
+static void vduse_blk_attach_ctx(VduseBlkExport *vblk_exp, AioContext *ctx);
+static void vduse_blk_detach_ctx(VduseBlkExport *vblk_exp);
+
+/*
+ * Stop virtqueue processing in all AioContexts and wait until no request is
+ * in flight any more. A kick handler that an iothread started before its fd
+ * was detached has returned once this coroutine has run in the iothread.
+ */
+static void coroutine_fn vduse_blk_pause_vqs(VduseBlkExport *vblk_exp)
+{
+    AioContext *home = qemu_get_current_aio_context();
+    g_autoptr(GPtrArray) ctxs = g_ptr_array_new();
+    guint i;
+
+    vblk_exp->vqs_paused = true;
+
+    if (vblk_exp->vqs_started) {
+        for (uint16_t j = 0; j < vblk_exp->num_queues; j++) {
+            VduseVirtq *vq = vduse_dev_get_queue(vblk_exp->dev, j);
+            AioContext *ctx = vduse_blk_queue_aio_context(vblk_exp, vq);
+
+            if (ctx != home && !g_ptr_array_find(ctxs, ctx, NULL)) {
+                g_ptr_array_add(ctxs, ctx);
+            }
+            vduse_blk_disable_queue(vblk_exp->dev, vq);
+        }
+    }
+
+    for (i = 0; i < ctxs->len; i++) {
+        aio_co_reschedule_self(g_ptr_array_index(ctxs, i));
+    }
+    if (ctxs->len) {
+        aio_co_reschedule_self(home);
+    }
+
+    qatomic_set(&vblk_exp->wait_idle, true);
+    smp_mb(); /* read inflight after publishing wait_idle */
+    if (qatomic_read(&vblk_exp->inflight) > 0 ||
+        !qatomic_xchg(&vblk_exp->wait_idle, false)) {
+        /* vduse_blk_inflight_dec() wakes us */
+        qemu_coroutine_yield();
+    }
+}
+
+static void vduse_blk_resume_vqs(VduseBlkExport *vblk_exp)
+{
+    vblk_exp->vqs_paused = false;
+
+    if (vblk_exp->vqs_started) {
+        for (uint16_t i = 0; i < vblk_exp->num_queues; i++) {
+            VduseVirtq *vq = vduse_dev_get_queue(vblk_exp->dev, i);
+            vduse_blk_enable_queue(vblk_exp->dev, vq);
+        }
+    }
+}
+
+static void coroutine_fn vduse_blk_dev_co(void *opaque)
+{
+    VduseBlkExport *vblk_exp = opaque;
+
+    vduse_blk_pause_vqs(vblk_exp);
+    vduse_dev_handler(vblk_exp->dev);
+    vduse_blk_resume_vqs(vblk_exp);
+
+    /* Drains wait for dev_co, so the AioContext can't have changed */
+    vblk_exp->dev_co = NULL;
+    vduse_blk_attach_ctx(vblk_exp, vblk_exp->export.ctx);
+
+    aio_wait_kick();
+    blk_exp_unref(&vblk_exp->export);
+}
+
 static void on_vduse_dev_kick(void *opaque)
 {
     VduseDev *dev = opaque;
+    VduseBlkExport *vblk_exp = vduse_dev_get_priv(dev);
+
+    if (!vduse_blk_has_foreign_vqs(vblk_exp)) {
+        vduse_dev_handler(dev);
+        return;
+    }
 
-    vduse_dev_handler(dev);
+    /* vduse_blk_dev_co() handles the request and then attaches us again */
+    vduse_blk_detach_ctx(vblk_exp);
+    blk_exp_ref(&vblk_exp->export);
+    vblk_exp->dev_co = qemu_coroutine_create(vduse_blk_dev_co, vblk_exp);
+    qemu_coroutine_enter(vblk_exp->dev_co);
 }
 
 static void vduse_blk_attach_ctx(VduseBlkExport *vblk_exp, AioContext *ctx)
@@ -255,7 +383,7 @@ static bool vduse_blk_drained_poll(void *opaque)
     BlockExport *exp = opaque;
     VduseBlkExport *vblk_exp = container_of(exp, VduseBlkExport, export);
 
-    return qatomic_read(&vblk_exp->inflight) > 0;
+    return qatomic_read(&vblk_exp->inflight) > 0 || vblk_exp->dev_co;
 }
 
 static const BlockDevOps vduse_block_ops = {
@@ -416,4 +544,5 @@ const BlockExportDriver blk_exp_vduse_blk = {
     .create             = vduse_blk_exp_create,
     .delete             = vduse_blk_exp_delete,
     .request_shutdown   = vduse_blk_exp_request_shutdown,
+    .supports_multithread = true,
 };
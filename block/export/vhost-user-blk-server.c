@@ -103,6 +103,14 @@ static void vu_blk_process_vq(VuDev *vu_dev, int idx)
     }
 }
 
+/* With the iothreads option, virtqueues are spread over the iothreads */
+static AioContext *vu_blk_get_queue_aio_context(VuServer *server, int idx)
+{
+    VuBlkExport *vexp = container_of(server, VuBlkExport, vu_server);
+
+    return blk_exp_get_aio_context(&vexp->export, idx);
+}
+
 static void vu_blk_queue_set_started(VuDev *vu_dev, int idx, bool started)
 {
     VuVirtq *vq;
@@ -360,6 +368,7 @@ static int vu_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
         g_free(vexp->handler.serial);
         return -EADDRNOTAVAIL;
     }
+    vexp->vu_server.get_queue_aio_context = vu_blk_get_queue_aio_context;
 
     return 0;
 }
@@ -379,4 +388,5 @@ const BlockExportDriver blk_exp_vhost_user_blk = {
     .create             = vu_blk_exp_create,
     .delete             = vu_blk_exp_delete,
     .request_shutdown   = vu_blk_exp_request_shutdown,
+    .supports_multithread = true,
 };
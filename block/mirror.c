@@ -18,16 +18,20 @@
 #include "trace.h"
 #include "block/blockjob_int.h"
 #include "block/block_int.h"
+#include "block/copy-tuner.h"
 #include "block/dirty-bitmap.h"
 #include "sysemu/block-backend.h"
 #include "qapi/error.h"
 #include "qemu/ratelimit.h"
 #include "qemu/bitmap.h"
 #include "qemu/memalign.h"
+#include "qemu/units.h"
 
 #define MAX_IN_FLIGHT 16
 #define MAX_IO_BYTES (1 << 20) /* 1 Mb */
 #define DEFAULT_MIRROR_BUF_SIZE (MAX_IN_FLIGHT * MAX_IO_BYTES)
+#define ADAPTIVE_MAX_IN_FLIGHT 64
+#define ADAPTIVE_MAX_IO_BYTES (16 * MiB)
 
 /* The mirroring buffer is a list of granularity-sized chunks.
  * Free chunks are organized in a list.
@@ -94,6 +98,15 @@ typedef struct MirrorBlockJob {
     bool prepared;
     bool in_drain;
     bool base_ro;
+
+    /*
+     * To be accessed with atomics.  Written only under the BQL by
+     * mirror_change(), which initializes @tuner before setting it for the
+     * first time.
+     */
+    bool adaptive;
+    bool tuner_initialized;
+    CopyTuner tuner;
 } MirrorBlockJob;
 
 typedef struct MirrorBDSOpaque {
@@ -119,6 +132,9 @@ struct MirrorOp {
     Coroutine *co;
     MirrorOp *waiting_for_op;
 
+    /* Start time of the copy, only set by mirror_co_read() */
+    int64_t start_ns;
+
     QTAILQ_ENTRY(MirrorOp) next;
 };
 
@@ -128,6 +144,16 @@ typedef enum MirrorMethod {
     MIRROR_METHOD_DISCARD,
 } MirrorMethod;
 
+static bool mirror_adaptive(MirrorBlockJob *s)
+{
+    return qatomic_load_acquire(&s->adaptive);
+}
+
+static int mirror_max_in_flight(MirrorBlockJob *s)
+{
+    return mirror_adaptive(s) ? copy_tuner_depth(&s->tuner) : MAX_IN_FLIGHT;
+}
+
 static BlockErrorAction mirror_error_action(MirrorBlockJob *s, bool read,
                                             int error)
 {
@@ -266,6 +292,11 @@ static void coroutine_fn mirror_read_complete(MirrorOp *op, int ret)
     }
 
     ret = blk_co_pwritev(s->target, op->offset, op->qiov.size, &op->qiov, 0);
+    if (ret >= 0 && mirror_adaptive(s)) {
+        copy_tuner_request_done(&s->tuner, op->bytes,
+                                qemu_clock_get_ns(QEMU_CLOCK_REALTIME) -
+                                op->start_ns);
+    }
     mirror_write_complete(op, ret);
 }
 
@@ -396,6 +427,7 @@ static void coroutine_fn mirror_co_read(void *opaque)
     s->in_flight++;
     s->bytes_in_flight += op->bytes;
     op->is_in_flight = true;
+    op->start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     trace_mirror_one_iteration(s, op->offset, op->bytes);
 
     WITH_GRAPH_RDLOCK_GUARD() {
@@ -490,6 +522,10 @@ static void coroutine_fn GRAPH_UNLOCKED mirror_iteration(MirrorBlockJob *s)
     bool write_zeroes_ok = bdrv_can_write_zeroes_with_unmap(blk_bs(s->target));
     int max_io_bytes = MAX(s->buf_size / MAX_IN_FLIGHT, MAX_IO_BYTES);
 
+    if (mirror_adaptive(s)) {
+        max_io_bytes = copy_tuner_chunk(&s->tuner);
+    }
+
     bdrv_graph_co_rdlock();
     source = s->mirror_top_bs->backing->bs;
     bdrv_graph_co_rdunlock();
@@ -600,7 +636,7 @@ static void coroutine_fn GRAPH_UNLOCKED mirror_iteration(MirrorBlockJob *s)
             }
         }
 
-        while (s->in_flight >= MAX_IN_FLIGHT) {
+        while (s->in_flight >= mirror_max_in_flight(s)) {
             trace_mirror_yield_in_flight(s, offset, s->in_flight);
             mirror_wait_for_free_in_flight_slot(s);
         }
@@ -866,7 +902,7 @@ static int coroutine_fn GRAPH_UNLOCKED mirror_dirty_init(MirrorBlockJob *s)
                 return 0;
             }
 
-            if (s->in_flight >= MAX_IN_FLIGHT) {
+            if (s->in_flight >= mirror_max_in_flight(s)) {
                 trace_mirror_yield(s, UINT64_MAX, s->buf_free_count,
                                    s->in_flight);
                 mirror_wait_for_free_in_flight_slot(s);
@@ -1069,7 +1105,8 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
         }
         if (delta < BLOCK_JOB_SLICE_TIME &&
             iostatus == BLOCK_DEVICE_IO_STATUS_OK) {
-            if (s->in_flight >= MAX_IN_FLIGHT || s->buf_free_count == 0 ||
+            if (s->in_flight >= mirror_max_in_flight(s) ||
+                s->buf_free_count == 0 ||
                 (cnt == 0 && s->in_flight > 0)) {
                 trace_mirror_yield(s, cnt, s->buf_free_count, s->in_flight);
                 mirror_wait_for_free_in_flight_slot(s);
@@ -1258,6 +1295,26 @@ static bool commit_active_cancel(Job *job, bool force)
     return force || !job_is_ready(job);
 }
 
+static void mirror_set_adaptive(MirrorBlockJob *s, bool adaptive)
+{
+    GLOBAL_STATE_CODE();
+
+    if (adaptive && !s->tuner_initialized) {
+        int64_t max_chunk = MIN(s->buf_size, ADAPTIVE_MAX_IO_BYTES);
+
+        copy_tuner_init(&s->tuner, s->granularity,
+                        MAX(QEMU_ALIGN_DOWN(max_chunk, s->granularity),
+                            s->granularity),
+                        ADAPTIVE_MAX_IN_FLIGHT, s->buf_size,
+                        MAX(s->buf_size / MAX_IN_FLIGHT, MAX_IO_BYTES),
+                        MAX_IN_FLIGHT);
+        s->tuner_initialized = true;
+    }
+
+    /* Pairs with qatomic_load_acquire() in mirror_adaptive() */
+    qatomic_store_release(&s->adaptive, adaptive);
+}
+
 static void mirror_change(BlockJob *job, BlockJobChangeOptions *opts,
                           Error **errp)
 {
@@ -1272,7 +1329,12 @@ static void mirror_change(BlockJob *job, BlockJobChangeOptions *opts,
 
     GLOBAL_STATE_CODE();
 
-    if (qatomic_read(&s->copy_mode) == change_opts->copy_mode) {
+    if (change_opts->has_adaptive) {
+        mirror_set_adaptive(s, change_opts->adaptive);
+    }
+
+    if (!change_opts->has_copy_mode ||
+        qatomic_read(&s->copy_mode) == change_opts->copy_mode) {
         return;
     }
 
@@ -1297,14 +1359,25 @@ static void mirror_query(BlockJob *job, BlockJobInfo *info)
 
     info->u.mirror = (BlockJobInfoMirror) {
         .actively_synced = qatomic_read(&s->actively_synced),
+        .adaptive = mirror_adaptive(s) ? copy_tuner_get_info(&s->tuner) : NULL,
     };
 }
 
+static void mirror_free(Job *job)
+{
+    MirrorBlockJob *s = container_of(job, MirrorBlockJob, common.job);
+
+    if (s->tuner_initialized) {
+        copy_tuner_destroy(&s->tuner);
+    }
+    block_job_free(job);
+}
+
 static const BlockJobDriver mirror_job_driver = {
     .job_driver = {
         .instance_size          = sizeof(MirrorBlockJob),
         .job_type               = JOB_TYPE_MIRROR,
-        .free                   = block_job_free,
+        .free                   = mirror_free,
         .user_resume            = block_job_user_resume,
         .run                    = mirror_run,
         .prepare                = mirror_prepare,
@@ -1322,7 +1395,7 @@ static const BlockJobDriver commit_active_job_driver = {
     .job_driver = {
         .instance_size          = sizeof(MirrorBlockJob),
         .job_type               = JOB_TYPE_COMMIT,
-        .free                   = block_job_free,
+        .free                   = mirror_free,
         .user_resume            = block_job_user_resume,
         .run                    = mirror_run,
         .prepare                = mirror_prepare,
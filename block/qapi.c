@@ -525,6 +525,24 @@ static void bdrv_query_blk_stats(BlockDeviceStats *ds, BlockBackend *blk)
     ds->wr_merged = stats->merged[BLOCK_ACCT_WRITE];
     ds->zone_append_merged = stats->merged[BLOCK_ACCT_ZONE_APPEND];
     ds->unmap_merged = stats->merged[BLOCK_ACCT_UNMAP];
+
+    qemu_mutex_lock(&stats->lock);
+    if (stats->nr_queues) {
+        BlockQueueStatsList **tail = &ds->queues;
+        unsigned i;
+
+        ds->has_queues = true;
+        for (i = 0; i < stats->nr_queues; i++) {
+            BlockQueueStats *qs = g_new0(BlockQueueStats, 1);
+
+            qs->rd_merged = stats->queue_merged[i][BLOCK_ACCT_READ];
+            qs->wr_merged = stats->queue_merged[i][BLOCK_ACCT_WRITE];
+            qs->unmap_merged = stats->queue_merged[i][BLOCK_ACCT_UNMAP];
+            QAPI_LIST_APPEND(tail, qs);
+        }
+    }
+    qemu_mutex_unlock(&stats->lock);
+
     ds->flush_operations = stats->nr_ops[BLOCK_ACCT_FLUSH];
     ds->wr_total_time_ns = stats->total_time_ns[BLOCK_ACCT_WRITE];
     ds->zone_append_total_time_ns =
@@ -69,7 +69,9 @@ int coroutine_fn qcow2_shrink_l1_table(BlockDriverState *bs,
         qcow2_free_clusters(bs, s->l1_table[i] & L1E_OFFSET_MASK,
                             s->cluster_size, QCOW2_DISCARD_ALWAYS);
         s->l1_table[i] = 0;
+        qcow2_metadata_tree_invalidate(s);
     }
+    qcow2_extent_map_clear(s);
     return 0;
 
 fail:
@@ -183,6 +185,7 @@ int qcow2_grow_l1_table(BlockDriverState *bs, uint64_t min_size,
     s->l1_table = new_l1_table;
     old_l1_size = s->l1_size;
     s->l1_size = new_l1_size;
+    qcow2_metadata_tree_invalidate(s);
     qcow2_free_clusters(bs, old_l1_table_offset, old_l1_size * L1E_SIZE,
                         QCOW2_DISCARD_OTHER);
     return 0;
@@ -358,6 +361,7 @@ static int GRAPH_RDLOCK l2_allocate(BlockDriverState *bs, int l1_index)
     /* update the L1 entry */
     trace_qcow2_l2_allocate_write_l1(bs, l1_index);
     s->l1_table[l1_index] = l2_offset | QCOW_OFLAG_COPIED;
+    qcow2_metadata_tree_invalidate(s);
     ret = qcow2_write_l1_entry(bs, l1_index);
     if (ret < 0) {
         goto fail;
@@ -372,6 +376,7 @@ fail:
         qcow2_cache_put(s->l2_table_cache, (void **) &l2_slice);
     }
     s->l1_table[l1_index] = old_l2_offset;
+    qcow2_metadata_tree_invalidate(s);
     if (l2_offset > 0) {
         qcow2_free_clusters(bs, l2_offset, s->l2_size * l2_entry_size(s),
                             QCOW2_DISCARD_ALWAYS);
@@ -562,6 +567,137 @@ do_perform_cow_write(BlockDriverState *bs, uint64_t cluster_offset,
     return 0;
 }
 
+/*
+ * The extent map caches runs of guest clusters that are stored in
+ * contiguous host clusters, so that large requests to mostly preallocated
+ * images can be mapped in one step instead of one L2 lookup per slice.
+ * It only covers standard data clusters in images without subclusters.
+ * Extents are removed when the L2 entries they describe are changed,
+ * which all happens with s->lock held, as do the lookups.
+ */
+
+static Qcow2Extent *extent_map_lookup(BDRVQcow2State *s, uint64_t offset)
+{
+    IntervalTreeNode *node;
+
+    node = interval_tree_iter_first(&s->extent_map, offset, offset);
+    return node ? container_of(node, Qcow2Extent, node) : NULL;
+}
+
+static void extent_map_remove(BDRVQcow2State *s, Qcow2Extent *e)
+{
+    interval_tree_remove(&e->node, &s->extent_map);
+    s->extent_map_size--;
+    g_free(e);
+}
+
+/*
+ * Drops all extents that overlap with the given guest range.  Must be called
+ * whenever L2 entries in that range are modified.
+ */
+void qcow2_extent_map_invalidate(BDRVQcow2State *s, uint64_t offset,
+                                 uint64_t bytes)
+{
+    IntervalTreeNode *node;
+
+    if (!s->extent_map_size || !bytes) {
+        return;
+    }
+
+    while ((node = interval_tree_iter_first(&s->extent_map, offset,
+                                            offset + bytes - 1))) {
+        extent_map_remove(s, container_of(node, Qcow2Extent, node));
+    }
+}
+
+/* Drops the whole extent map, e.g. when the L1 table changes */
+void qcow2_extent_map_clear(BDRVQcow2State *s)
+{
+    IntervalTreeNode *node;
+
+    while ((node = interval_tree_iter_first(&s->extent_map, 0, UINT64_MAX))) {
+        extent_map_remove(s, container_of(node, Qcow2Extent, node));
+    }
+    assert(s->extent_map_size == 0);
+}
+
+static void extent_map_add(BDRVQcow2State *s, uint64_t offset,
+                           uint64_t host_offset, uint64_t bytes, bool copied)
+{
+    Qcow2Extent *e;
+
+    qcow2_extent_map_invalidate(s, offset, bytes);
+
+    /* Merge with the neighbours if the run continues on the host */
+    e = offset ? extent_map_lookup(s, offset - 1) : NULL;
+    if (e && e->copied == copied &&
+        e->host_offset + (offset - e->node.start) == host_offset) {
+        bytes += offset - e->node.start;
+        offset = e->node.start;
+        host_offset = e->host_offset;
+        extent_map_remove(s, e);
+    }
+
+    e = extent_map_lookup(s, offset + bytes);
+    if (e && e->copied == copied &&
+        host_offset + bytes == e->host_offset) {
+        bytes += e->node.last + 1 - e->node.start;
+        extent_map_remove(s, e);
+    }
+
+    if (s->extent_map_size >= QCOW2_MAX_EXTENTS) {
+        /* Too fragmented, start over with the current working set */
+        qcow2_extent_map_clear(s);
+    }
+
+    e = g_new(Qcow2Extent, 1);
+    *e = (Qcow2Extent) {
+        .node.start = offset,
+        .node.last = offset + bytes - 1,
+        .host_offset = host_offset,
+        .copied = copied,
+    };
+    interval_tree_insert(&e->node, &s->extent_map);
+    s->extent_map_size++;
+}
+
+/*
+ * Adds the run of contiguous standard data clusters that starts at guest
+ * @offset, whose L2 entry is at @l2_index in @l2_slice, to the extent map.
+ * The run ends at the end of the slice; neighbouring extents from other
+ * slices are merged with it.
+ */
+static void GRAPH_RDLOCK
+extent_map_populate(BlockDriverState *bs, uint64_t offset, uint64_t *l2_slice,
+                    int l2_index)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t l2_entry = get_l2_entry(s, l2_slice, l2_index);
+    uint64_t host_offset = l2_entry & L2E_OFFSET_MASK;
+    bool copied = l2_entry & QCOW_OFLAG_COPIED;
+    int i;
+
+    if (!s->use_extent_map || has_subclusters(s) ||
+        qcow2_get_cluster_type(bs, l2_entry) != QCOW2_CLUSTER_NORMAL ||
+        offset_into_cluster(s, host_offset)) {
+        return;
+    }
+
+    for (i = l2_index + 1; i < s->l2_slice_size; i++) {
+        uint64_t next_host_offset =
+            host_offset + ((uint64_t)(i - l2_index) << s->cluster_bits);
+
+        l2_entry = get_l2_entry(s, l2_slice, i);
+        if (qcow2_get_cluster_type(bs, l2_entry) != QCOW2_CLUSTER_NORMAL ||
+            (l2_entry & L2E_OFFSET_MASK) != next_host_offset ||
+            !!(l2_entry & QCOW_OFLAG_COPIED) != copied) {
+            break;
+        }
+    }
+
+    extent_map_add(s, start_of_cluster(s, offset), host_offset,
+                   (uint64_t)(i - l2_index) << s->cluster_bits, copied);
+}
 
 /*
  * get_host_offset
@@ -596,6 +732,16 @@ int qcow2_get_host_offset(BlockDriverState *bs, uint64_t offset,
     QCow2SubclusterType type;
     int ret;
 
+    if (s->use_extent_map) {
+        Qcow2Extent *e = extent_map_lookup(s, offset);
+        if (e) {
+            *host_offset = e->host_offset + (offset - e->node.start);
+            *bytes = MIN(*bytes, e->node.last + 1 - offset);
+            *subcluster_type = QCOW2_SUBCLUSTER_NORMAL;
+            return 0;
+        }
+    }
+
     offset_in_cluster = offset_into_cluster(s, offset);
     bytes_needed = (uint64_t) *bytes + offset_in_cluster;
 
@@ -718,6 +864,11 @@ int qcow2_get_host_offset(BlockDriverState *bs, uint64_t offset,
         ret = -EIO;
         goto fail;
     }
+
+    if (type == QCOW2_SUBCLUSTER_NORMAL) {
+        extent_map_populate(bs, offset, l2_slice,
+                            offset_to_l2_slice_index(s, offset));
+    }
     qcow2_cache_put(s->l2_table_cache, (void **) &l2_slice);
 
     bytes_available = ((int64_t)sc + sc_index) << s->subcluster_bits;
@@ -742,6 +893,51 @@ fail:
     return ret;
 }
 
+/*
+ * qcow2_get_l2_entry
+ *
+ * Stores the L2 entry of the active L1 table for guest @offset in
+ * *l2_entry, or 0 if there is no L2 table for it.  Nothing is allocated.
+ *
+ * Returns 0 on success, -errno in error cases.
+ */
+int qcow2_get_l2_entry(BlockDriverState *bs, uint64_t offset,
+                       uint64_t *l2_entry)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t l1_index, l2_offset, *l2_slice;
+    int ret;
+
+    *l2_entry = 0;
+
+    l1_index = offset_to_l1_index(s, offset);
+    if (l1_index >= s->l1_size) {
+        return 0;
+    }
+
+    l2_offset = s->l1_table[l1_index] & L1E_OFFSET_MASK;
+    if (!l2_offset) {
+        return 0;
+    }
+
+    if (offset_into_cluster(s, l2_offset)) {
+        qcow2_signal_corruption(bs, true, -1, -1, "L2 table offset %#" PRIx64
+                                " unaligned (L1 index: %#" PRIx64 ")",
+                                l2_offset, l1_index);
+        return -EIO;
+    }
+
+    ret = l2_load(bs, offset, l2_offset, &l2_slice);
+    if (ret < 0) {
+        return ret;
+    }
+
+    *l2_entry = get_l2_entry(s, l2_slice, offset_to_l2_slice_index(s, offset));
+    qcow2_cache_put(s->l2_table_cache, (void **) &l2_slice);
+
+    return 0;
+}
+
 /*
  * get_cluster_table
  *
@@ -875,6 +1071,8 @@ qcow2_alloc_compressed_cluster_offset(BlockDriverState *bs, uint64_t offset,
     BLKDBG_CO_EVENT(bs->file, BLKDBG_L2_UPDATE_COMPRESSED);
     qcow2_cache_entry_mark_dirty(s->l2_table_cache, l2_slice);
     set_l2_entry(s, l2_slice, l2_index, cluster_offset);
+    qcow2_extent_map_invalidate(s, start_of_cluster(s, offset),
+                                s->cluster_size);
     if (has_subclusters(s)) {
         set_l2_bitmap(s, l2_slice, l2_index, 0);
     }
@@ -1062,6 +1260,8 @@ int coroutine_fn qcow2_alloc_cluster_link_l2(BlockDriverState *bs,
         goto err;
     }
     qcow2_cache_entry_mark_dirty(s->l2_table_cache, l2_slice);
+    qcow2_extent_map_invalidate(s, m->offset,
+                                (uint64_t)m->nb_clusters << s->cluster_bits);
 
     assert(l2_index + m->nb_clusters <= s->l2_slice_size);
     assert(m->cow_end.offset + m->cow_end.nb_bytes <=
@@ -1081,7 +1281,9 @@ int coroutine_fn qcow2_alloc_cluster_link_l2(BlockDriverState *bs,
         /* The offset must fit in the offset field of the L2 table entry */
         assert((offset & L2E_OFFSET_MASK) == offset);
 
-        set_l2_entry(s, l2_slice, l2_index + i, offset | QCOW_OFLAG_COPIED);
+        /* Clusters in the deduplication table may be shared at any time */
+        set_l2_entry(s, l2_slice, l2_index + i,
+                     m->dedup ? offset : offset | QCOW_OFLAG_COPIED);
 
         /* Update bitmap with the subclusters that were just written */
         if (has_subclusters(s) && !m->prealloc) {
@@ -1104,6 +1306,11 @@ int coroutine_fn qcow2_alloc_cluster_link_l2(BlockDriverState *bs,
 
     qcow2_cache_put(s->l2_table_cache, (void **) &l2_slice);
 
+    if (m->dedup) {
+        assert(m->nb_clusters == 1);
+        qcow2_dedup_insert(s, cluster_offset, m->offset, m->dedup_hash);
+    }
+
     /*
      * If this was a COW, we need to decrease the refcount of the old cluster.
      *
@@ -1509,6 +1716,32 @@ handle_copied(BlockDriverState *bs, uint64_t guest_offset,
     assert(*host_offset == INV_OFFSET || offset_into_cluster(s, guest_offset)
                                       == offset_into_cluster(s, *host_offset));
 
+    if (s->use_extent_map) {
+        Qcow2Extent *e = extent_map_lookup(s, guest_offset);
+        if (e && e->copied) {
+            cluster_offset = e->host_offset +
+                (start_of_cluster(s, guest_offset) - e->node.start);
+
+            /* If a specific host_offset is required, check it */
+            if (*host_offset != INV_OFFSET && cluster_offset != *host_offset) {
+                *bytes = 0;
+                return 0;
+            }
+
+            /*
+             * Data clusters in images without subclusters need no
+             * QCowL2Meta, and the extent may span several L2 slices
+             */
+            *bytes = MIN(*bytes, e->node.last + 1 - guest_offset);
+            *bytes = MIN(*bytes, QEMU_ALIGN_DOWN(BDRV_REQUEST_MAX_BYTES,
+                                                 s->cluster_size) -
+                                 offset_into_cluster(s, guest_offset));
+            *host_offset = cluster_offset +
+                           offset_into_cluster(s, guest_offset);
+            return 1;
+        }
+    }
+
     /*
      * Calculate the number of clusters to look for. We stop at L2 slice
      * boundaries to keep things simple.
@@ -1548,6 +1781,8 @@ handle_copied(BlockDriverState *bs, uint64_t guest_offset,
             goto out;
         }
 
+        extent_map_populate(bs, guest_offset, l2_slice, l2_index);
+
         /* We keep all QCOW_OFLAG_COPIED clusters */
         keep_clusters = count_single_write_clusters(bs, nb_clusters, l2_slice,
                                                     l2_index, false);
@@ -1917,6 +2152,8 @@ discard_in_l2_slice(BlockDriverState *bs, uint64_t offset, uint64_t nb_clusters,
     nb_clusters = MIN(nb_clusters, s->l2_slice_size - l2_index);
     assert(nb_clusters <= INT_MAX);
 
+    qcow2_extent_map_invalidate(s, offset, nb_clusters << s->cluster_bits);
+
     for (i = 0; i < nb_clusters; i++) {
         uint64_t old_l2_entry = get_l2_entry(s, l2_slice, l2_index + i);
         uint64_t old_l2_bitmap = get_l2_bitmap(s, l2_slice, l2_index + i);
@@ -2056,6 +2293,8 @@ zero_in_l2_slice(BlockDriverState *bs, uint64_t offset,
     nb_clusters = MIN(nb_clusters, s->l2_slice_size - l2_index);
     assert(nb_clusters <= INT_MAX);
 
+    qcow2_extent_map_invalidate(s, offset, nb_clusters << s->cluster_bits);
+
     for (i = 0; i < nb_clusters; i++) {
         uint64_t old_l2_entry = get_l2_entry(s, l2_slice, l2_index + i);
         uint64_t old_l2_bitmap = get_l2_bitmap(s, l2_slice, l2_index + i);
@@ -2471,6 +2710,8 @@ int qcow2_expand_zero_clusters(BlockDriverState *bs,
     int ret;
     int i, j;
 
+    qcow2_extent_map_clear(s);
+
     if (status_cb) {
         l1_entries = s->l1_size;
         for (i = 0; i < s->nb_snapshots; i++) {
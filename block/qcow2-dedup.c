@@ -0,0 +1,490 @@
+/*
+ * Cluster deduplication for the QCOW version 2 format
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * The deduplication table maps the SHA-256 hash of the content of a data
+ * cluster to its host offset.  A full-cluster write that allocates a new
+ * cluster looks its hash up in the table and, if an identical cluster is
+ * found, takes a reference to that cluster instead of writing the data.
+ *
+ * Clusters in the table may be shared at any time, so they are linked into
+ * the L2 tables without QCOW_OFLAG_COPIED even while their refcount is 1.
+ * Overwriting them always goes through COW and their content never changes
+ * as long as they are allocated.  When a cluster is freed, it is removed
+ * from the table.  Each entry also records the guest offset of the write that
+ * created it, so that a candidate with a refcount of 1 can be checked for
+ * QCOW_OFLAG_COPIED before it is shared.
+ *
+ * The table is limited to QCOW2_MAX_DEDUP_ENTRIES; once it is full, new
+ * clusters are not indexed any more until old ones are freed.
+ *
+ * While the image is open read-write, the table only exists in memory and
+ * the on-disk copy is dropped; it is written back when the image is closed.
+ * If QEMU crashes, the table is simply lost, which is safe.
+ */
+
+#include "qemu/osdep.h"
+#include "block/block-io.h"
+#include "qapi/error.h"
+#include "qemu/bswap.h"
+#include "qemu/memalign.h"
+
+#include "qcow2.h"
+
+typedef struct Qcow2DedupEntry {
+    uint64_t offset;
+    uint64_t guest_offset;
+    uint8_t hash[QCOW2_DEDUP_HASH_SIZE];
+} Qcow2DedupEntry;
+
+/* On-disk format of a table entry */
+typedef struct Qcow2DedupTableEntry {
+    uint64_t offset;
+    uint64_t guest_offset;
+    uint8_t hash[QCOW2_DEDUP_HASH_SIZE];
+} QEMU_PACKED Qcow2DedupTableEntry;
+
+/* Number of table entries that are read or written at once */
+#define DEDUP_TABLE_CHUNK 16384
+
+static guint dedup_hash_hash(gconstpointer key)
+{
+    /* The key already is a cryptographic hash */
+    return ldl_he_p(key);
+}
+
+static gboolean dedup_hash_equal(gconstpointer a, gconstpointer b)
+{
+    return !memcmp(a, b, QCOW2_DEDUP_HASH_SIZE);
+}
+
+static void dedup_init(BDRVQcow2State *s)
+{
+    if (!s->dedup_by_hash) {
+        s->dedup_by_hash = g_hash_table_new_full(dedup_hash_hash,
+                                                 dedup_hash_equal,
+                                                 NULL, g_free);
+        s->dedup_by_offset = g_hash_table_new(g_int64_hash, g_int64_equal);
+    }
+}
+
+void qcow2_dedup_free(BDRVQcow2State *s)
+{
+    if (s->dedup_by_hash) {
+        g_hash_table_destroy(s->dedup_by_offset);
+        g_hash_table_destroy(s->dedup_by_hash);
+        s->dedup_by_offset = NULL;
+        s->dedup_by_hash = NULL;
+    }
+}
+
+/*
+ * Deduplicating writes are only allowed while the on-disk table is dropped,
+ * otherwise it could become stale and be loaded after a crash.
+ */
+bool qcow2_dedup_writable(BDRVQcow2State *s)
+{
+    return s->dedup_by_hash && !s->dedup_table_offset;
+}
+
+bool qcow2_dedup_has_cluster(BDRVQcow2State *s, uint64_t offset)
+{
+    return s->dedup_by_offset &&
+           g_hash_table_contains(s->dedup_by_offset, &offset);
+}
+
+void qcow2_dedup_insert(BDRVQcow2State *s, uint64_t offset,
+                        uint64_t guest_offset, const uint8_t *hash)
+{
+    Qcow2DedupEntry *e;
+
+    if (!s->dedup_by_hash ||
+        g_hash_table_size(s->dedup_by_hash) >= QCOW2_MAX_DEDUP_ENTRIES) {
+        return;
+    }
+
+    /* Keep the first cluster with a given content, and each cluster once */
+    if (g_hash_table_contains(s->dedup_by_hash, hash) ||
+        g_hash_table_contains(s->dedup_by_offset, &offset)) {
+        return;
+    }
+
+    e = g_new(Qcow2DedupEntry, 1);
+    e->offset = offset;
+    e->guest_offset = guest_offset;
+    memcpy(e->hash, hash, QCOW2_DEDUP_HASH_SIZE);
+
+    g_hash_table_insert(s->dedup_by_offset, &e->offset, e);
+    g_hash_table_insert(s->dedup_by_hash, e->hash, e);
+}
+
+/* Called whenever the refcount of a cluster drops to 0 */
+void qcow2_dedup_forget(BDRVQcow2State *s, uint64_t offset)
+{
+    Qcow2DedupEntry *e;
+
+    if (!s->dedup_by_offset) {
+        return;
+    }
+
+    e = g_hash_table_lookup(s->dedup_by_offset, &offset);
+    if (e) {
+        g_hash_table_remove(s->dedup_by_offset, &e->offset);
+        g_hash_table_remove(s->dedup_by_hash, e->hash);
+    }
+}
+
+/*
+ * Returns whether the cluster of @e may be shared with another guest cluster.
+ * A cluster that has QCOW_OFLAG_COPIED set in an L2 entry may be overwritten
+ * in place through that entry, so it must not be shared.  Only the L2 entry
+ * at the guest offset that created the cluster is known; if the cluster has a
+ * refcount of 1 and that entry doesn't refer to it any more, the one L2 entry
+ * that does can't be checked, so the cluster is rejected as well.
+ */
+static int GRAPH_RDLOCK
+dedup_can_share(BlockDriverState *bs, Qcow2DedupEntry *e,
+                uint64_t refcount)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t l2_entry;
+    int ret;
+
+    ret = qcow2_get_l2_entry(bs, e->guest_offset, &l2_entry);
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (qcow2_get_cluster_type(bs, l2_entry) != QCOW2_CLUSTER_NORMAL ||
+        (l2_entry & L2E_OFFSET_MASK) != e->offset) {
+        return refcount > 1;
+    }
+
+    return !(l2_entry & QCOW_OFLAG_COPIED);
+}
+
+/*
+ * qcow2_co_dedup_find()
+ *
+ * Looks for a cluster with the given @hash whose content is identical to the
+ * cluster-sized data in @qiov at @qiov_offset.  Must be called with s->lock
+ * held, which is dropped while comparing the data.
+ *
+ * Returns: 1 if such a cluster was found.  Its host offset is stored in
+ *            @host_offset and a reference was taken on it for the caller.
+ *          0 if there is no such cluster
+ *          a negative error code on failure
+ */
+int coroutine_fn GRAPH_RDLOCK
+qcow2_co_dedup_find(BlockDriverState *bs, const uint8_t *hash,
+                    QEMUIOVector *qiov, size_t qiov_offset,
+                    uint64_t *host_offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2DedupEntry *e;
+    uint64_t offset, refcount;
+    void *buf;
+    int ret;
+
+    if (!qcow2_dedup_writable(s)) {
+        return 0;
+    }
+
+    e = g_hash_table_lookup(s->dedup_by_hash, hash);
+    if (!e) {
+        return 0;
+    }
+    offset = e->offset;
+
+    ret = qcow2_get_refcount(bs, offset >> s->cluster_bits, &refcount);
+    if (ret < 0) {
+        return ret;
+    }
+    if (refcount == 0 || refcount >= s->refcount_max) {
+        return 0;
+    }
+
+    ret = dedup_can_share(bs, e, refcount);
+    if (ret <= 0) {
+        if (ret == 0) {
+            qcow2_dedup_forget(s, offset);
+        }
+        return ret;
+    }
+
+    /*
+     * Pin the cluster: it can't be freed and, as it has no
+     * QCOW_OFLAG_COPIED, nobody can overwrite it while we compare.
+     */
+    ret = qcow2_update_cluster_refcount(bs, offset >> s->cluster_bits, 1,
+                                        false, QCOW2_DISCARD_NEVER);
+    if (ret < 0) {
+        return ret;
+    }
+
+    /* The first half is for the cluster on disk, the second for the data */
+    buf = qemu_try_blockalign(s->data_file->bs, 2 * s->cluster_size);
+    if (!buf) {
+        ret = -ENOMEM;
+        goto fail;
+    }
+    qemu_iovec_to_buf(qiov, qiov_offset, buf + s->cluster_size,
+                      s->cluster_size);
+
+    qemu_co_mutex_unlock(&s->lock);
+    ret = bdrv_co_pread(s->data_file, offset, s->cluster_size, buf, 0);
+    qemu_co_mutex_lock(&s->lock);
+
+    if (ret >= 0) {
+        ret = !memcmp(buf, buf + s->cluster_size, s->cluster_size);
+    }
+    qemu_vfree(buf);
+
+    if (ret == 1) {
+        *host_offset = offset;
+        return 1;
+    }
+
+    if (ret == 0) {
+        /*
+         * Either a SHA-256 collision or, much more likely, the cluster was
+         * modified behind our back.  Don't use it again.
+         */
+        qcow2_dedup_forget(s, offset);
+    }
+
+fail:
+    qcow2_free_clusters(bs, offset, s->cluster_size, QCOW2_DISCARD_NEVER);
+    return ret;
+}
+
+/* Frees the on-disk table, the in-memory one takes over */
+static int GRAPH_RDLOCK qcow2_dedup_drop_table(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t offset = s->dedup_table_offset;
+    uint64_t size = s->dedup_nb_entries * sizeof(Qcow2DedupTableEntry);
+    int ret;
+
+    if (!offset) {
+        return 0;
+    }
+
+    s->dedup_table_offset = 0;
+    s->dedup_nb_entries = 0;
+    ret = qcow2_update_header(bs);
+    if (ret < 0) {
+        s->dedup_table_offset = offset;
+        s->dedup_nb_entries = size / sizeof(Qcow2DedupTableEntry);
+        return ret;
+    }
+
+    qcow2_free_clusters(bs, offset, size, QCOW2_DISCARD_OTHER);
+    return 0;
+}
+
+/*
+ * qcow2_dedup_load()
+ *
+ * Reads the deduplication table into memory.  If the image is writable, the
+ * on-disk table is dropped.
+ */
+int coroutine_fn GRAPH_RDLOCK
+qcow2_dedup_load(BlockDriverState *bs, Error **errp)
+{
+    BDRVQcow2State *s = bs->opaque;
+    g_autofree Qcow2DedupTableEntry *table = NULL;
+    uint64_t i, n;
+    int ret;
+
+    dedup_init(s);
+
+    if (!s->dedup_table_offset) {
+        return 0;
+    }
+
+    table = g_try_new(Qcow2DedupTableEntry, DEDUP_TABLE_CHUNK);
+    if (!table) {
+        error_setg(errp, "Could not allocate memory for the dedup table");
+        return -ENOMEM;
+    }
+
+    for (i = 0; i < s->dedup_nb_entries; i += n) {
+        uint64_t j;
+
+        n = MIN(s->dedup_nb_entries - i, DEDUP_TABLE_CHUNK);
+        ret = bdrv_co_pread(bs->file, s->dedup_table_offset +
+                            i * sizeof(Qcow2DedupTableEntry),
+                            n * sizeof(Qcow2DedupTableEntry), table, 0);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "Could not read the dedup table");
+            return ret;
+        }
+
+        for (j = 0; j < n; j++) {
+            uint64_t offset = be64_to_cpu(table[j].offset);
+            uint64_t guest_offset = be64_to_cpu(table[j].guest_offset);
+
+            if (!offset || offset_into_cluster(s, offset) ||
+                (offset & ~L2E_OFFSET_MASK) ||
+                offset_into_cluster(s, guest_offset)) {
+                error_setg(errp, "Invalid dedup table entry %" PRIu64,
+                           i + j);
+                return -EINVAL;
+            }
+            qcow2_dedup_insert(s, offset, guest_offset, table[j].hash);
+        }
+    }
+
+    if (!bdrv_is_writable(bs)) {
+        return 0;
+    }
+
+    ret = qcow2_dedup_drop_table(bs);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not drop the dedup table");
+        return ret;
+    }
+
+    return 0;
+}
+
+int GRAPH_RDLOCK qcow2_dedup_reopen_rw(BlockDriverState *bs, Error **errp)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int ret;
+
+    if (!s->dedup_by_hash) {
+        return 0;
+    }
+
+    ret = qcow2_dedup_drop_table(bs);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not drop the dedup table");
+        return ret;
+    }
+
+    return 0;
+}
+
+/*
+ * qcow2_dedup_store()
+ *
+ * Writes the in-memory deduplication table to the image.  Only called when
+ * the image stops being writable, so that the table can't become stale.
+ */
+int GRAPH_RDLOCK qcow2_dedup_store(BlockDriverState *bs, Error **errp)
+{
+    BDRVQcow2State *s = bs->opaque;
+    g_autofree Qcow2DedupTableEntry *table = NULL;
+    GHashTableIter iter;
+    Qcow2DedupEntry *e;
+    uint64_t nb_entries, size, i;
+    int64_t offset;
+    int ret;
+
+    if (!qcow2_dedup_writable(s) || !bdrv_is_writable(bs)) {
+        return 0;
+    }
+
+    nb_entries = MIN(g_hash_table_size(s->dedup_by_hash),
+                     QCOW2_MAX_DEDUP_ENTRIES);
+    if (nb_entries == 0) {
+        return 0;
+    }
+
+    size = nb_entries * sizeof(Qcow2DedupTableEntry);
+    table = g_try_malloc0(ROUND_UP(size, s->cluster_size));
+    if (!table) {
+        error_setg(errp, "Could not allocate memory for the dedup table");
+        return -ENOMEM;
+    }
+
+    i = 0;
+    g_hash_table_iter_init(&iter, s->dedup_by_hash);
+    while (i < nb_entries && g_hash_table_iter_next(&iter, NULL, (void **)&e)) {
+        table[i].offset = cpu_to_be64(e->offset);
+        table[i].guest_offset = cpu_to_be64(e->guest_offset);
+        memcpy(table[i].hash, e->hash, QCOW2_DEDUP_HASH_SIZE);
+        i++;
+    }
+
+    offset = qcow2_alloc_clusters(bs, size);
+    if (offset < 0) {
+        error_setg_errno(errp, -offset, "Could not allocate the dedup table");
+        return offset;
+    }
+
+    ret = qcow2_pre_write_overlap_check(bs, 0, offset, size, false);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not write the dedup table");
+        goto fail;
+    }
+
+    ret = bdrv_pwrite(bs->file, offset, ROUND_UP(size, s->cluster_size),
+                      table, 0);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not write the dedup table");
+        goto fail;
+    }
+
+    /* The refcounts of the table must be on disk before the header */
+    ret = qcow2_flush_caches(bs);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not write the dedup table");
+        goto fail;
+    }
+
+    s->dedup_table_offset = offset;
+    s->dedup_nb_entries = nb_entries;
+    ret = qcow2_update_header(bs);
+    if (ret < 0) {
+        s->dedup_table_offset = 0;
+        s->dedup_nb_entries = 0;
+        error_setg_errno(errp, -ret, "Could not update qcow2 header");
+        goto fail;
+    }
+
+    return 0;
+
+fail:
+    qcow2_free_clusters(bs, offset, size, QCOW2_DISCARD_OTHER);
+    return ret;
+}
+
+int coroutine_fn GRAPH_RDLOCK
+qcow2_check_dedup_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
+                            void **refcount_table,
+                            int64_t *refcount_table_size)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    if (!s->dedup_table_offset) {
+        return 0;
+    }
+
+    return qcow2_inc_refcounts_imrt(bs, res, refcount_table,
+                                    refcount_table_size,
+                                    s->dedup_table_offset,
+                                    s->dedup_nb_entries *
+                                    sizeof(Qcow2DedupTableEntry));
+}
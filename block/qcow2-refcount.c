@@ -30,6 +30,7 @@
 #include "qemu/bswap.h"
 #include "qemu/cutils.h"
 #include "qemu/memalign.h"
+#include "block/aio_task.h"
 #include "trace.h"
 
 static int64_t alloc_clusters_noref(BlockDriverState *bs, uint64_t size,
@@ -96,6 +97,7 @@ static void update_max_refcount_table_index(BDRVQcow2State *s)
     }
     /* Set s->max_refcount_table_index to the index of the last used entry */
     s->max_refcount_table_index = i;
+    qcow2_metadata_tree_invalidate(s);
 }
 
 int coroutine_fn qcow2_refcount_init(BlockDriverState *bs)
@@ -137,6 +139,7 @@ void qcow2_refcount_close(BlockDriverState *bs)
 {
     BDRVQcow2State *s = bs->opaque;
     g_free(s->refcount_table);
+    qcow2_metadata_tree_invalidate(s);
 }
 
 
@@ -451,6 +454,7 @@ alloc_refcount_block(BlockDriverState *bs, int64_t cluster_index,
          * that refcount_table_index < s->max_refcount_table_index */
         s->max_refcount_table_index =
             MAX(s->max_refcount_table_index, refcount_table_index);
+        qcow2_metadata_tree_invalidate(s);
 
         /* The new refcount block may be where the caller intended to put its
          * data, so let it restart the search. */
@@ -888,6 +892,8 @@ update_refcount(BlockDriverState *bs, int64_t offset, int64_t length,
         if (refcount == 0) {
             void *table;
 
+            qcow2_dedup_forget(s, cluster_offset);
+
             table = qcow2_cache_is_table_offset(s->refcount_block_cache,
                                                 offset);
             if (table != NULL) {
@@ -1262,6 +1268,9 @@ int qcow2_update_snapshot_refcount(BlockDriverState *bs,
 
     s->cache_discards = true;
 
+    /* The COPIED flags are about to change */
+    qcow2_extent_map_clear(s);
+
     /* WARNING: qcow2_snapshot_goto relies on this function not using the
      * l1_table_offset when it is the current s->l1_table_offset! Be careful
      * when changing this! */
@@ -1379,7 +1388,10 @@ int qcow2_update_snapshot_refcount(BlockDriverState *bs,
                         abort();
                     }
 
-                    if (refcount == 1) {
+                    /* Deduplicated clusters may be shared at any time */
+                    if (refcount == 1 &&
+                        !qcow2_dedup_has_cluster(s, offset))
+                    {
                         entry |= QCOW_OFLAG_COPIED;
                     }
                     if (entry != old_entry) {
@@ -1653,8 +1665,8 @@ fail:
 
 /*
  * Increases the refcount in the given refcount table for the all clusters
- * referenced in the L2 table. While doing so, performs some checks on L2
- * entries.
+ * referenced in the L2 table, which the caller has read from @l2_offset into
+ * @l2_table. While doing so, performs some checks on L2 entries.
  *
  * Returns the number of errors found by the checks or -errno if an internal
  * error occurred.
@@ -1663,24 +1675,15 @@ static int coroutine_fn GRAPH_RDLOCK
 check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
                    void **refcount_table,
                    int64_t *refcount_table_size, int64_t l2_offset,
-                   int flags, BdrvCheckMode fix, bool active)
+                   uint64_t *l2_table, int flags, BdrvCheckMode fix,
+                   bool active)
 {
     BDRVQcow2State *s = bs->opaque;
     uint64_t l2_entry, l2_bitmap;
     uint64_t next_contiguous_offset = 0;
     int i, ret;
-    size_t l2_size_bytes = s->l2_size * l2_entry_size(s);
-    g_autofree uint64_t *l2_table = g_malloc(l2_size_bytes);
     bool metadata_overlap;
 
-    /* Read L2 table from disk */
-    ret = bdrv_co_pread(bs->file, l2_offset, l2_size_bytes, l2_table, 0);
-    if (ret < 0) {
-        fprintf(stderr, "ERROR: I/O error in check_refcounts_l2\n");
-        res->check_errors++;
-        return ret;
-    }
-
     /* Do the actual checks */
     for (i = 0; i < s->l2_size; i++) {
         uint64_t coffset;
@@ -1851,11 +1854,65 @@ check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
     return 0;
 }
 
+typedef struct CheckL2ReadTask {
+    AioTask task;
+    BlockDriverState *bs;
+    int64_t l2_offset;
+    uint64_t *l2_table;
+    int *ret;
+} CheckL2ReadTask;
+
+static int coroutine_fn GRAPH_RDLOCK check_l2_read_task_entry(AioTask *task)
+{
+    CheckL2ReadTask *t = container_of(task, CheckL2ReadTask, task);
+    BDRVQcow2State *s = t->bs->opaque;
+
+    *t->ret = bdrv_co_pread(t->bs->file, t->l2_offset,
+                            s->l2_size * l2_entry_size(s), t->l2_table, 0);
+    return *t->ret;
+}
+
+/*
+ * Reads the @nb_tables L2 tables at @l2_offsets into consecutive L2 table
+ * sized slots of @l2_tables, with all reads in flight at the same time.
+ * The result of each read is stored in the corresponding element of @rets.
+ */
+static void coroutine_fn GRAPH_RDLOCK
+check_read_l2_tables(BlockDriverState *bs, const int64_t *l2_offsets,
+                     int nb_tables, uint64_t *l2_tables, int *rets)
+{
+    BDRVQcow2State *s = bs->opaque;
+    size_t l2_entries = s->l2_size * l2_entry_size(s) / sizeof(uint64_t);
+    AioTaskPool *pool;
+    int i;
+
+    pool = aio_task_pool_new(nb_tables);
+    for (i = 0; i < nb_tables; i++) {
+        CheckL2ReadTask *t = g_new(CheckL2ReadTask, 1);
+
+        *t = (CheckL2ReadTask) {
+            .task.func = check_l2_read_task_entry,
+            .bs = bs,
+            .l2_offset = l2_offsets[i],
+            .l2_table = l2_tables + i * l2_entries,
+            .ret = &rets[i],
+        };
+        aio_task_pool_start_task(pool, &t->task);
+    }
+    aio_task_pool_wait_all(pool);
+    aio_task_pool_free(pool);
+}
+
 /*
  * Increases the refcount for the L1 table, its L2 tables and all referenced
  * clusters in the given refcount table. While doing so, performs some checks
  * on L1 and L2 entries.
  *
+ * The L2 tables are read in batches of up to QCOW2_CHECK_MAX_L2_READS
+ * parallel requests, limited to QCOW2_CHECK_MAX_L2_BUFFER bytes, but are
+ * checked one after another in L1 order, so the result and the messages do
+ * not depend on the order in which the reads complete.
+ *
  * Returns the number of errors found by the checks or -errno if an internal
  * error occurred.
  */
@@ -1867,9 +1924,15 @@ check_refcounts_l1(BlockDriverState *bs, BdrvCheckResult *res,
 {
     BDRVQcow2State *s = bs->opaque;
     size_t l1_size_bytes = l1_size * L1E_SIZE;
+    size_t l2_size_bytes = s->l2_size * l2_entry_size(s);
+    size_t l2_entries = l2_size_bytes / sizeof(uint64_t);
     g_autofree uint64_t *l1_table = NULL;
+    g_autofree uint64_t *l2_tables = NULL;
+    g_autofree int64_t *l2_offsets = NULL;
+    g_autofree int *l2_rets = NULL;
     uint64_t l2_offset;
-    int i, ret;
+    int batch_size;
+    int i, j, next, end, nb_tables, ret;
 
     if (!l1_size) {
         return 0;
@@ -1900,41 +1963,74 @@ check_refcounts_l1(BlockDriverState *bs, BdrvCheckResult *res,
         be64_to_cpus(&l1_table[i]);
     }
 
-    /* Do the actual checks */
-    for (i = 0; i < l1_size; i++) {
-        if (!l1_table[i]) {
-            continue;
-        }
+    batch_size = MIN(QCOW2_CHECK_MAX_L2_READS, l1_size);
+    batch_size = MAX(1, MIN(batch_size,
+                            QCOW2_CHECK_MAX_L2_BUFFER / l2_size_bytes));
+    l2_tables = g_try_malloc(batch_size * l2_size_bytes);
+    if (l2_tables == NULL) {
+        res->check_errors++;
+        return -ENOMEM;
+    }
+    l2_offsets = g_new(int64_t, batch_size);
+    l2_rets = g_new(int, batch_size);
 
-        if (l1_table[i] & L1E_RESERVED_MASK) {
-            fprintf(stderr, "ERROR found L1 entry with reserved bits set: "
-                    "%" PRIx64 "\n", l1_table[i]);
-            res->corruptions++;
+    for (next = 0; next < l1_size; next = end) {
+        /* Read the L2 tables of the next batch of L1 entries */
+        nb_tables = 0;
+        for (end = next; end < l1_size && nb_tables < batch_size; end++) {
+            if (l1_table[end]) {
+                l2_offsets[nb_tables++] = l1_table[end] & L1E_OFFSET_MASK;
+            }
+        }
+        if (nb_tables) {
+            check_read_l2_tables(bs, l2_offsets, nb_tables, l2_tables,
+                                 l2_rets);
         }
 
-        l2_offset = l1_table[i] & L1E_OFFSET_MASK;
+        /* Do the actual checks */
+        for (i = next, j = 0; i < end; i++) {
+            if (!l1_table[i]) {
+                continue;
+            }
 
-        /* Mark L2 table as used */
-        ret = qcow2_inc_refcounts_imrt(bs, res,
-                                       refcount_table, refcount_table_size,
-                                       l2_offset, s->cluster_size);
-        if (ret < 0) {
-            return ret;
-        }
+            if (l1_table[i] & L1E_RESERVED_MASK) {
+                fprintf(stderr, "ERROR found L1 entry with reserved bits set: "
+                        "%" PRIx64 "\n", l1_table[i]);
+                res->corruptions++;
+            }
 
-        /* L2 tables are cluster aligned */
-        if (offset_into_cluster(s, l2_offset)) {
-            fprintf(stderr, "ERROR l2_offset=%" PRIx64 ": Table is not "
-                "cluster aligned; L1 entry corrupted\n", l2_offset);
-            res->corruptions++;
-        }
+            l2_offset = l1_table[i] & L1E_OFFSET_MASK;
 
-        /* Process and check L2 entries */
-        ret = check_refcounts_l2(bs, res, refcount_table,
-                                 refcount_table_size, l2_offset, flags,
-                                 fix, active);
-        if (ret < 0) {
-            return ret;
+            /* Mark L2 table as used */
+            ret = qcow2_inc_refcounts_imrt(bs, res,
+                                           refcount_table, refcount_table_size,
+                                           l2_offset, s->cluster_size);
+            if (ret < 0) {
+                return ret;
+            }
+
+            /* L2 tables are cluster aligned */
+            if (offset_into_cluster(s, l2_offset)) {
+                fprintf(stderr, "ERROR l2_offset=%" PRIx64 ": Table is not "
+                    "cluster aligned; L1 entry corrupted\n", l2_offset);
+                res->corruptions++;
+            }
+
+            if (l2_rets[j] < 0) {
+                fprintf(stderr, "ERROR: I/O error in check_refcounts_l2\n");
+                res->check_errors++;
+                return l2_rets[j];
+            }
+
+            /* Process and check L2 entries */
+            ret = check_refcounts_l2(bs, res, refcount_table,
+                                     refcount_table_size, l2_offset,
+                                     l2_tables + j * l2_entries, flags,
+                                     fix, active);
+            if (ret < 0) {
+                return ret;
+            }
+            j++;
         }
     }
 
@@ -2032,7 +2128,12 @@ check_oflag_copied(BlockDriverState *bs, BdrvCheckResult *res, BdrvCheckMode fix
                         continue;
                     }
                 }
-                if ((refcount == 1) != ((l2_entry & QCOW_OFLAG_COPIED) != 0)) {
+                /*
+                 * With deduplication, clusters are linked without
+                 * QCOW_OFLAG_COPIED even while they have a refcount of 1
+                 */
+                if ((refcount == 1) != ((l2_entry & QCOW_OFLAG_COPIED) != 0) &&
+                    !(refcount == 1 && qcow2_dedup_enabled(s))) {
                     res->corruptions++;
                     fprintf(stderr, "%s OFLAG_COPIED data cluster: "
                             "l2_entry=%" PRIx64 " refcount=%" PRIu64 "\n",
@@ -2293,6 +2394,12 @@ calculate_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
         return ret;
     }
 
+    /* deduplication table */
+    ret = qcow2_check_dedup_refcounts(bs, res, refcount_table, nb_clusters);
+    if (ret < 0) {
+        return ret;
+    }
+
     return check_refblocks(bs, res, fix, rebuild, refcount_table, nb_clusters);
 }
 
@@ -2804,6 +2911,9 @@ qcow2_check_refcounts(BlockDriverState *bs, BdrvCheckResult *res, BdrvCheckMode
     res->bfi.total_clusters =
         size_to_clusters(s, bs->total_sectors * BDRV_SECTOR_SIZE);
 
+    /* Repairs may change L2 entries and COPIED flags behind our back */
+    qcow2_extent_map_clear(s);
+
     ret = calculate_refcounts(bs, res, fix, &rebuild, &refcount_table,
                               &nb_clusters);
     if (ret < 0) {
@@ -2901,6 +3011,159 @@ fail:
     return ret;
 }
 
+/*
+ * Drops the metadata interval tree.  Must be called whenever an L2 table,
+ * refcount block or snapshot L1 table is added, moved or removed, before the
+ * next yield.
+ */
+void qcow2_metadata_tree_invalidate(BDRVQcow2State *s)
+{
+    s->metadata_tree_gen++;
+    s->metadata_tree_valid = false;
+    s->metadata_tree = (IntervalTreeRoot) {};
+    g_free(s->metadata_ranges);
+    s->metadata_ranges = NULL;
+}
+
+static void metadata_tree_add(IntervalTreeRoot *root,
+                              Qcow2MetadataRange *ranges, size_t *nb_ranges,
+                              int type, uint64_t offset, uint64_t size)
+{
+    Qcow2MetadataRange *r = &ranges[(*nb_ranges)++];
+
+    r->type = type;
+    r->node.start = offset;
+    r->node.last = offset + size - 1;
+    interval_tree_insert(&r->node, root);
+}
+
+/*
+ * Builds s->metadata_tree with the QCOW2_OL_TREE checks in @types.
+ *
+ * Reading the inactive L1 tables may yield.  Returns -EAGAIN if the metadata
+ * changed meanwhile, so that the caller can try again.
+ */
+static int GRAPH_RDLOCK qcow2_metadata_tree_build(BlockDriverState *bs,
+                                                  int types)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t gen = s->metadata_tree_gen;
+    IntervalTreeRoot root = {};
+    Qcow2MetadataRange *ranges;
+    size_t nb_ranges = 0, max_ranges = 0;
+    int i, j, ret;
+
+    if ((types & QCOW2_OL_ACTIVE_L2) && s->l1_table) {
+        max_ranges += s->l1_size;
+    }
+    if ((types & QCOW2_OL_REFCOUNT_BLOCK) && s->refcount_table) {
+        max_ranges += s->max_refcount_table_index + 1;
+    }
+    if ((types & (QCOW2_OL_INACTIVE_L1 | QCOW2_OL_INACTIVE_L2)) &&
+        s->snapshots) {
+        for (i = 0; i < s->nb_snapshots; i++) {
+            max_ranges += 1 + s->snapshots[i].l1_size;
+        }
+    }
+
+    ranges = g_try_new(Qcow2MetadataRange, max_ranges);
+    if (max_ranges && ranges == NULL) {
+        return -ENOMEM;
+    }
+
+    if ((types & QCOW2_OL_ACTIVE_L2) && s->l1_table) {
+        for (i = 0; i < s->l1_size; i++) {
+            uint64_t l2_ofs = s->l1_table[i] & L1E_OFFSET_MASK;
+            if (l2_ofs) {
+                metadata_tree_add(&root, ranges, &nb_ranges,
+                                  QCOW2_OL_ACTIVE_L2, l2_ofs, s->cluster_size);
+            }
+        }
+    }
+
+    if ((types & QCOW2_OL_REFCOUNT_BLOCK) && s->refcount_table) {
+        assert(s->max_refcount_table_index < s->refcount_table_size);
+        for (i = 0; i <= s->max_refcount_table_index; i++) {
+            uint64_t rb_ofs = s->refcount_table[i] & REFT_OFFSET_MASK;
+            if (rb_ofs) {
+                metadata_tree_add(&root, ranges, &nb_ranges,
+                                  QCOW2_OL_REFCOUNT_BLOCK, rb_ofs,
+                                  s->cluster_size);
+            }
+        }
+    }
+
+    if ((types & QCOW2_OL_INACTIVE_L1) && s->snapshots) {
+        for (i = 0; i < s->nb_snapshots; i++) {
+            if (s->snapshots[i].l1_size) {
+                metadata_tree_add(&root, ranges, &nb_ranges,
+                                  QCOW2_OL_INACTIVE_L1,
+                                  s->snapshots[i].l1_table_offset,
+                                  s->snapshots[i].l1_size * L1E_SIZE);
+            }
+        }
+    }
+
+    if ((types & QCOW2_OL_INACTIVE_L2) && s->snapshots) {
+        for (i = 0; i < s->nb_snapshots; i++) {
+            uint64_t l1_ofs = s->snapshots[i].l1_table_offset;
+            uint32_t l1_sz  = s->snapshots[i].l1_size;
+            uint64_t l1_sz2 = l1_sz * L1E_SIZE;
+            uint64_t *l1;
+
+            ret = qcow2_validate_table(bs, l1_ofs, l1_sz, L1E_SIZE,
+                                       QCOW_MAX_L1_SIZE, "", NULL);
+            if (ret < 0) {
+                goto fail;
+            }
+
+            l1 = g_try_malloc(l1_sz2);
+
+            if (l1_sz2 && l1 == NULL) {
+                ret = -ENOMEM;
+                goto fail;
+            }
+
+            ret = bdrv_pread(bs->file, l1_ofs, l1_sz2, l1, 0);
+            if (ret < 0 || gen != s->metadata_tree_gen) {
+                g_free(l1);
+                ret = ret < 0 ? ret : -EAGAIN;
+                goto fail;
+            }
+
+            for (j = 0; j < l1_sz; j++) {
+                uint64_t l2_ofs = be64_to_cpu(l1[j]) & L1E_OFFSET_MASK;
+                if (l2_ofs) {
+                    metadata_tree_add(&root, ranges, &nb_ranges,
+                                      QCOW2_OL_INACTIVE_L2, l2_ofs,
+                                      s->cluster_size);
+                }
+            }
+
+            g_free(l1);
+        }
+    }
+
+    if (gen != s->metadata_tree_gen) {
+        ret = -EAGAIN;
+        goto fail;
+    }
+
+    if (!s->metadata_tree_valid) {
+        s->metadata_tree = root;
+        s->metadata_ranges = ranges;
+        s->metadata_tree_valid = true;
+    } else {
+        /* A concurrent request has built the same tree while we yielded */
+        g_free(ranges);
+    }
+    return 0;
+
+fail:
+    g_free(ranges);
+    return ret;
+}
+
 #define overlaps_with(ofs, sz) \
     ranges_overlap(offset, size, ofs, sz)
 
@@ -2912,6 +3175,9 @@ fail:
  * The ign parameter specifies what checks not to perform (being a bitmask of
  * QCow2MetadataOverlap values), i.e., what sections to ignore.
  *
+ * Checks whose cost would grow with the image size are looked up in an
+ * interval tree of the respective metadata, which takes O(log n).
+ *
  * Returns:
  * - 0 if writing to this offset will not affect the mentioned metadata
  * - a positive QCow2MetadataOverlap value indicating one overlapping section
@@ -2923,7 +3189,9 @@ int qcow2_check_metadata_overlap(BlockDriverState *bs, int ign, int64_t offset,
 {
     BDRVQcow2State *s = bs->opaque;
     int chk = s->overlap_check & ~ign;
-    int i, j;
+    IntervalTreeNode *node;
+    uint64_t last;
+    int ret;
 
     if (!size) {
         return 0;
@@ -2958,85 +3226,35 @@ int qcow2_check_metadata_overlap(BlockDriverState *bs, int ign, int64_t offset,
         }
     }
 
-    if ((chk & QCOW2_OL_INACTIVE_L1) && s->snapshots) {
-        for (i = 0; i < s->nb_snapshots; i++) {
-            if (s->snapshots[i].l1_size &&
-                overlaps_with(s->snapshots[i].l1_table_offset,
-                s->snapshots[i].l1_size * L1E_SIZE)) {
-                return QCOW2_OL_INACTIVE_L1;
-            }
-        }
-    }
-
-    if ((chk & QCOW2_OL_ACTIVE_L2) && s->l1_table) {
-        for (i = 0; i < s->l1_size; i++) {
-            if ((s->l1_table[i] & L1E_OFFSET_MASK) &&
-                overlaps_with(s->l1_table[i] & L1E_OFFSET_MASK,
-                s->cluster_size)) {
-                return QCOW2_OL_ACTIVE_L2;
-            }
+    if ((chk & QCOW2_OL_BITMAP_DIRECTORY) &&
+        (s->autoclear_features & QCOW2_AUTOCLEAR_BITMAPS))
+    {
+        if (overlaps_with(s->bitmap_directory_offset,
+                          s->bitmap_directory_size))
+        {
+            return QCOW2_OL_BITMAP_DIRECTORY;
         }
     }
 
-    if ((chk & QCOW2_OL_REFCOUNT_BLOCK) && s->refcount_table) {
-        unsigned last_entry = s->max_refcount_table_index;
-        assert(last_entry < s->refcount_table_size);
-        assert(last_entry + 1 == s->refcount_table_size ||
-               (s->refcount_table[last_entry + 1] & REFT_OFFSET_MASK) == 0);
-        for (i = 0; i <= last_entry; i++) {
-            if ((s->refcount_table[i] & REFT_OFFSET_MASK) &&
-                overlaps_with(s->refcount_table[i] & REFT_OFFSET_MASK,
-                s->cluster_size)) {
-                return QCOW2_OL_REFCOUNT_BLOCK;
-            }
-        }
+    if (!(chk & QCOW2_OL_TREE)) {
+        return 0;
     }
 
-    if ((chk & QCOW2_OL_INACTIVE_L2) && s->snapshots) {
-        for (i = 0; i < s->nb_snapshots; i++) {
-            uint64_t l1_ofs = s->snapshots[i].l1_table_offset;
-            uint32_t l1_sz  = s->snapshots[i].l1_size;
-            uint64_t l1_sz2 = l1_sz * L1E_SIZE;
-            uint64_t *l1;
-            int ret;
-
-            ret = qcow2_validate_table(bs, l1_ofs, l1_sz, L1E_SIZE,
-                                       QCOW_MAX_L1_SIZE, "", NULL);
-            if (ret < 0) {
-                return ret;
-            }
-
-            l1 = g_try_malloc(l1_sz2);
-
-            if (l1_sz2 && l1 == NULL) {
-                return -ENOMEM;
-            }
-
-            ret = bdrv_pread(bs->file, l1_ofs, l1_sz2, l1, 0);
-            if (ret < 0) {
-                g_free(l1);
-                return ret;
-            }
-
-            for (j = 0; j < l1_sz; j++) {
-                uint64_t l2_ofs = be64_to_cpu(l1[j]) & L1E_OFFSET_MASK;
-                if (l2_ofs && overlaps_with(l2_ofs, s->cluster_size)) {
-                    g_free(l1);
-                    return QCOW2_OL_INACTIVE_L2;
-                }
-            }
-
-            g_free(l1);
+    while (!s->metadata_tree_valid) {
+        ret = qcow2_metadata_tree_build(bs, s->overlap_check & QCOW2_OL_TREE);
+        if (ret < 0 && ret != -EAGAIN) {
+            return ret;
         }
     }
 
-    if ((chk & QCOW2_OL_BITMAP_DIRECTORY) &&
-        (s->autoclear_features & QCOW2_AUTOCLEAR_BITMAPS))
+    last = offset + size - 1;
+    for (node = interval_tree_iter_first(&s->metadata_tree, offset, last);
+         node;
+         node = interval_tree_iter_next(node, offset, last))
     {
-        if (overlaps_with(s->bitmap_directory_offset,
-                          s->bitmap_directory_size))
-        {
-            return QCOW2_OL_BITMAP_DIRECTORY;
+        Qcow2MetadataRange *r = container_of(node, Qcow2MetadataRange, node);
+        if (r->type & chk) {
+            return r->type;
         }
     }
 
@@ -3680,6 +3898,7 @@ int coroutine_fn qcow2_shrink_reftable(BlockDriverState *bs)
                                                        REFT_OFFSET_MASK);
             }
             s->refcount_table[i] = 0;
+            qcow2_metadata_tree_invalidate(s);
         }
     }
 
@@ -53,6 +53,7 @@ void qcow2_free_snapshots(BlockDriverState *bs)
     g_free(s->snapshots);
     s->snapshots = NULL;
     s->nb_snapshots = 0;
+    qcow2_metadata_tree_invalidate(s);
 }
 
 /*
@@ -255,6 +256,7 @@ int qcow2_do_read_snapshots(BlockDriverState *bs, bool repair,
 
     assert(offset - s->snapshots_offset <= INT_MAX);
     s->snapshots_size = offset - s->snapshots_offset;
+    qcow2_metadata_tree_invalidate(s);
     return 0;
 
 fail:
@@ -480,6 +482,7 @@ int coroutine_fn qcow2_check_read_snapshot_table(BlockDriverState *bs,
         /* We did not read the snapshot table, so invalidate this information */
         s->snapshots_offset = 0;
         s->nb_snapshots = 0;
+        qcow2_metadata_tree_invalidate(s);
 
         return ret;
     }
@@ -497,6 +500,7 @@ int coroutine_fn qcow2_check_read_snapshot_table(BlockDriverState *bs,
         /* We did not read the snapshot table, so invalidate this information */
         s->snapshots_offset = 0;
         s->nb_snapshots = 0;
+        qcow2_metadata_tree_invalidate(s);
 
         return ret;
     }
@@ -723,12 +727,14 @@ int qcow2_snapshot_create(BlockDriverState *bs, QEMUSnapshotInfo *sn_info)
     }
     s->snapshots = new_snapshot_list;
     s->snapshots[s->nb_snapshots++] = *sn;
+    qcow2_metadata_tree_invalidate(s);
 
     ret = qcow2_write_snapshots(bs);
     if (ret < 0) {
         g_free(s->snapshots);
         s->snapshots = old_snapshot_list;
         s->nb_snapshots--;
+        qcow2_metadata_tree_invalidate(s);
         goto fail;
     }
 
@@ -876,6 +882,8 @@ int qcow2_snapshot_goto(BlockDriverState *bs, const char *snapshot_id)
     for(i = 0;i < s->l1_size; i++) {
         s->l1_table[i] = be64_to_cpu(sn_l1_table[i]);
     }
+    qcow2_metadata_tree_invalidate(s);
+    qcow2_extent_map_clear(s);
 
     if (ret < 0) {
         goto fail;
@@ -939,6 +947,7 @@ int qcow2_snapshot_delete(BlockDriverState *bs,
             s->snapshots + snapshot_index + 1,
             (s->nb_snapshots - snapshot_index - 1) * sizeof(sn));
     s->nb_snapshots--;
+    qcow2_metadata_tree_invalidate(s);
     ret = qcow2_write_snapshots(bs);
     if (ret < 0) {
         error_setg_errno(errp, -ret,
@@ -1071,6 +1080,8 @@ int qcow2_snapshot_load_tmp(BlockDriverState *bs,
     for(i = 0;i < s->l1_size; i++) {
         be64_to_cpus(&s->l1_table[i]);
     }
+    qcow2_metadata_tree_invalidate(s);
+    qcow2_extent_map_clear(s);
 
     return 0;
 }
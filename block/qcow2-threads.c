@@ -1,5 +1,5 @@
 /*
- * Threaded data processing for Qcow2: compression, encryption
+ * Threaded data processing for Qcow2: compression, encryption, hashing
  *
  * Copyright (c) 2004-2006 Fabrice Bellard
  * Copyright (c) 2018 Virtuozzo International GmbH. All rights reserved.
@@ -35,8 +35,10 @@
 
 #include "qcow2.h"
 #include "block/block-io.h"
+#include "block/aio_task.h"
 #include "block/thread-pool.h"
 #include "crypto.h"
+#include "crypto/hash.h"
 
 static int coroutine_fn
 qcow2_co_process(BlockDriverState *bs, ThreadPoolFunc *func, void *arg)
@@ -453,6 +455,23 @@ static int qcow2_encdec_pool_func(void *opaque)
     return data->func(data->block, data->offset, data->buf, data->len, NULL);
 }
 
+/* Requests are split across pool threads in pieces of at least this size */
+#define QCOW2_ENCDEC_MIN_CHUNK (64 * KiB)
+
+typedef struct Qcow2EncDecTask {
+    AioTask task;
+
+    BlockDriverState *bs;
+    Qcow2EncDecData data;
+} Qcow2EncDecTask;
+
+static int coroutine_fn qcow2_encdec_task_entry(AioTask *task)
+{
+    Qcow2EncDecTask *t = container_of(task, Qcow2EncDecTask, task);
+
+    return qcow2_co_process(t->bs, qcow2_encdec_pool_func, &t->data);
+}
+
 static int coroutine_fn
 qcow2_co_encdec(BlockDriverState *bs, uint64_t host_offset,
                 uint64_t guest_offset, void *buf, size_t len,
@@ -466,7 +485,10 @@ qcow2_co_encdec(BlockDriverState *bs, uint64_t host_offset,
         .len = len,
         .func = func,
     };
+    AioTaskPool *pool;
     uint64_t sector_size;
+    size_t chunk, done;
+    int ret;
 
     assert(s->crypto);
 
@@ -475,7 +497,43 @@ qcow2_co_encdec(BlockDriverState *bs, uint64_t host_offset,
     assert(QEMU_IS_ALIGNED(host_offset, sector_size));
     assert(QEMU_IS_ALIGNED(len, sector_size));
 
-    return len == 0 ? 0 : qcow2_co_process(bs, qcow2_encdec_pool_func, &arg);
+    if (len == 0) {
+        return 0;
+    }
+
+    /*
+     * The IV of each sector only depends on its offset, so large requests
+     * can be processed by several threads in parallel instead of being
+     * limited by the speed of a single core.
+     */
+    chunk = MAX(DIV_ROUND_UP(len, QCOW2_MAX_THREADS), QCOW2_ENCDEC_MIN_CHUNK);
+    chunk = QEMU_ALIGN_UP(chunk, sector_size);
+    if (chunk >= len) {
+        return qcow2_co_process(bs, qcow2_encdec_pool_func, &arg);
+    }
+
+    pool = aio_task_pool_new(QCOW2_MAX_THREADS);
+    for (done = 0; done < len && aio_task_pool_status(pool) == 0;
+         done += chunk) {
+        Qcow2EncDecTask *t = g_new(Qcow2EncDecTask, 1);
+
+        *t = (Qcow2EncDecTask) {
+            .task.func = qcow2_encdec_task_entry,
+            .bs = bs,
+            .data = arg,
+        };
+        t->data.offset += done;
+        t->data.buf += done;
+        t->data.len = MIN(chunk, len - done);
+
+        aio_task_pool_start_task(pool, &t->task);
+    }
+
+    aio_task_pool_wait_all(pool);
+    ret = aio_task_pool_status(pool);
+    aio_task_pool_free(pool);
+
+    return ret;
 }
 
 /*
@@ -525,3 +583,53 @@ qcow2_co_decrypt(BlockDriverState *bs, uint64_t host_offset,
     return qcow2_co_encdec(bs, host_offset, guest_offset, buf, len,
                            qcrypto_block_decrypt);
 }
+
+
+/*
+ * Hashing
+ */
+
+typedef struct Qcow2HashData {
+    struct iovec *iov;
+    unsigned int niov;
+    uint8_t *hash;
+} Qcow2HashData;
+
+static int qcow2_hash_pool_func(void *opaque)
+{
+    Qcow2HashData *data = opaque;
+    size_t hash_len = QCOW2_DEDUP_HASH_SIZE;
+
+    return qcrypto_hash_bytesv(QCRYPTO_HASH_ALGO_SHA256, data->iov, data->niov,
+                               &data->hash, &hash_len, NULL);
+}
+
+/*
+ * qcow2_co_hash()
+ *
+ * Computes the deduplication hash of @bytes bytes of @qiov, starting at
+ * @qiov_offset, and stores it in @hash (QCOW2_DEDUP_HASH_SIZE bytes)
+ *
+ * Returns: 0 on success
+ *          -EIO on failure
+ */
+int coroutine_fn
+qcow2_co_hash(BlockDriverState *bs, QEMUIOVector *qiov, size_t qiov_offset,
+              size_t bytes, uint8_t *hash)
+{
+    QEMUIOVector slice;
+    Qcow2HashData arg;
+    int ret;
+
+    qemu_iovec_init_slice(&slice, qiov, qiov_offset, bytes);
+    arg = (Qcow2HashData) {
+        .iov = slice.iov,
+        .niov = slice.niov,
+        .hash = hash,
+    };
+
+    ret = qcow2_co_process(bs, qcow2_hash_pool_func, &arg);
+    qemu_iovec_destroy(&slice);
+
+    return ret < 0 ? -EIO : 0;
+}
@@ -73,6 +73,7 @@ typedef struct {
 #define  QCOW2_EXT_MAGIC_CRYPTO_HEADER 0x0537be77
 #define  QCOW2_EXT_MAGIC_BITMAPS 0x23852875
 #define  QCOW2_EXT_MAGIC_DATA_FILE 0x44415441
+#define  QCOW2_EXT_MAGIC_DEDUP 0x44454450
 
 static int coroutine_fn
 qcow2_co_preadv_compressed(BlockDriverState *bs,
@@ -211,6 +212,7 @@ qcow2_read_extensions(BlockDriverState *bs, uint64_t start_offset,
     uint64_t offset;
     int ret;
     Qcow2BitmapHeaderExt bitmaps_ext;
+    Qcow2DedupHeaderExt dedup_ext;
 
     if (need_update_header != NULL) {
         *need_update_header = false;
@@ -432,6 +434,59 @@ qcow2_read_extensions(BlockDriverState *bs, uint64_t start_offset,
             break;
         }
 
+        case QCOW2_EXT_MAGIC_DEDUP:
+            if (ext.len != sizeof(dedup_ext)) {
+                error_setg(errp, "dedup_ext: Invalid extension length");
+                return -EINVAL;
+            }
+
+            ret = bdrv_co_pread(bs->file, offset, ext.len, &dedup_ext, 0);
+            if (ret < 0) {
+                error_setg_errno(errp, -ret, "dedup_ext: "
+                                 "Could not read ext header");
+                return ret;
+            }
+
+            if (dedup_ext.hash_type != QCOW2_DEDUP_HASH_SHA256) {
+                error_setg(errp, "dedup_ext: Unsupported hash type %u",
+                           dedup_ext.hash_type);
+                return -ENOTSUP;
+            }
+
+            if (!buffer_is_zero(dedup_ext.reserved,
+                                sizeof(dedup_ext.reserved))) {
+                error_setg(errp, "dedup_ext: Reserved field is not zero");
+                return -EINVAL;
+            }
+
+            dedup_ext.nb_entries = be64_to_cpu(dedup_ext.nb_entries);
+            dedup_ext.table_offset = be64_to_cpu(dedup_ext.table_offset);
+
+            if (dedup_ext.nb_entries > QCOW2_MAX_DEDUP_ENTRIES) {
+                error_setg(errp, "dedup_ext: Image has %" PRIu64 " dedup "
+                           "table entries, exceeding the QEMU supported "
+                           "maximum of %d",
+                           dedup_ext.nb_entries, QCOW2_MAX_DEDUP_ENTRIES);
+                return -EINVAL;
+            }
+
+            if (offset_into_cluster(s, dedup_ext.table_offset) ||
+                (dedup_ext.nb_entries == 0) != (dedup_ext.table_offset == 0))
+            {
+                error_setg(errp, "dedup_ext: Invalid dedup table offset");
+                return -EINVAL;
+            }
+
+            s->dedup_nb_entries = dedup_ext.nb_entries;
+            s->dedup_table_offset = dedup_ext.table_offset;
+
+#ifdef DEBUG_EXT
+            printf("Qcow2: Got dedup extension: "
+                   "offset=%" PRIu64 " nb_entries=%" PRIu64 "\n",
+                   s->dedup_table_offset, s->dedup_nb_entries);
+#endif
+            break;
+
         default:
             /* unknown magic - save it in case we need to rewrite the header */
             /* If you add a new feature, make sure to also update the fast
@@ -685,6 +740,7 @@ static const char *const mutable_opts[] = {
     QCOW2_OPT_DISCARD_SNAPSHOT,
     QCOW2_OPT_DISCARD_OTHER,
     QCOW2_OPT_DISCARD_NO_UNREF,
+    QCOW2_OPT_EXTENT_MAP,
     QCOW2_OPT_OVERLAP,
     QCOW2_OPT_OVERLAP_TEMPLATE,
     QCOW2_OPT_OVERLAP_MAIN_HEADER,
@@ -734,6 +790,11 @@ static QemuOptsList qcow2_runtime_opts = {
             .type = QEMU_OPT_BOOL,
             .help = "Do not unreference discarded clusters",
         },
+        {
+            .name = QCOW2_OPT_EXTENT_MAP,
+            .type = QEMU_OPT_BOOL,
+            .help = "Map contiguous data clusters without L2 lookups",
+        },
         {
             .name = QCOW2_OPT_OVERLAP,
             .type = QEMU_OPT_STRING,
@@ -978,6 +1039,7 @@ typedef struct Qcow2ReopenState {
     int overlap_check;
     bool discard_passthrough[QCOW2_DISCARD_MAX];
     bool discard_no_unref;
+    bool use_extent_map;
     uint64_t cache_clean_interval;
     QCryptoBlockOpenOptions *crypto_opts; /* Disk encryption runtime options */
 } Qcow2ReopenState;
@@ -1157,6 +1219,8 @@ qcow2_update_options_prepare(BlockDriverState *bs, Qcow2ReopenState *r,
         goto fail;
     }
 
+    r->use_extent_map = qemu_opt_get_bool(opts, QCOW2_OPT_EXTENT_MAP, false);
+
     switch (s->crypt_method_header) {
     case QCOW_CRYPT_NONE:
         if (encryptfmt) {
@@ -1230,7 +1294,10 @@ static void qcow2_update_options_commit(BlockDriverState *bs,
     s->refcount_block_cache = r->refcount_block_cache;
     s->l2_slice_size = r->l2_slice_size;
 
-    s->overlap_check = r->overlap_check;
+    if (s->overlap_check != r->overlap_check) {
+        s->overlap_check = r->overlap_check;
+        qcow2_metadata_tree_invalidate(s);
+    }
     s->use_lazy_refcounts = r->use_lazy_refcounts;
 
     for (i = 0; i < QCOW2_DISCARD_MAX; i++) {
@@ -1239,6 +1306,11 @@ static void qcow2_update_options_commit(BlockDriverState *bs,
 
     s->discard_no_unref = r->discard_no_unref;
 
+    if (s->use_extent_map != r->use_extent_map) {
+        s->use_extent_map = r->use_extent_map;
+        qcow2_extent_map_clear(s);
+    }
+
     if (s->cache_clean_interval != r->cache_clean_interval) {
         cache_clean_timer_del(bs);
         s->cache_clean_interval = r->cache_clean_interval;
@@ -1729,6 +1801,15 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
         }
     }
 
+    if (qcow2_dedup_enabled(s) &&
+        ((s->incompatible_features & QCOW2_INCOMPAT_DATA_FILE) ||
+         has_subclusters(s) || s->crypt_method_header)) {
+        error_setg(errp, "Deduplication is not supported with external data "
+                   "files, extended L2 entries or encryption");
+        ret = -ENOTSUP;
+        goto fail;
+    }
+
     /* read the backing file name */
     if (header.backing_file_offset != 0) {
         len = header.backing_file_size;
@@ -1880,6 +1961,13 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
         }
     }
 
+    if (qcow2_dedup_enabled(s) && !(flags & (BDRV_O_INACTIVE | BDRV_O_NO_IO))) {
+        ret = qcow2_dedup_load(bs, errp);
+        if (ret < 0) {
+            goto fail;
+        }
+    }
+
 #ifdef DEBUG_ALLOC
     {
         BdrvCheckResult result = {0};
@@ -1902,10 +1990,13 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
     g_free(s->unknown_header_fields);
     cleanup_unknown_header_ext(bs);
     qcow2_free_snapshots(bs);
+    qcow2_dedup_free(s);
     qcow2_refcount_close(bs);
     qemu_vfree(s->l1_table);
     /* else pre-write overlap checks in cache_destroy may crash */
     s->l1_table = NULL;
+    qcow2_metadata_tree_invalidate(s);
+    qcow2_extent_map_clear(s);
     cache_clean_timer_del(bs);
     if (s->l2_table_cache) {
         qcow2_cache_destroy(s->l2_table_cache);
@@ -2073,6 +2164,17 @@ static void qcow2_reopen_commit_post(BDRVReopenState *state)
             error_reportf_err(local_err,
                               "%s: Failed to make dirty bitmaps writable: ",
                               bdrv_get_node_name(state->bs));
+            local_err = NULL;
+        }
+
+        if (qcow2_dedup_reopen_rw(state->bs, &local_err) < 0) {
+            /*
+             * Not fatal either: deduplication stays disabled until the
+             * on-disk table could be dropped.
+             */
+            error_reportf_err(local_err,
+                              "%s: Failed to enable deduplication: ",
+                              bdrv_get_node_name(state->bs));
         }
     }
 }
@@ -2676,6 +2778,107 @@ static coroutine_fn GRAPH_RDLOCK int qcow2_co_pwritev_task_entry(AioTask *task)
                                  t->l2meta);
 }
 
+/*
+ * qcow2_co_pwritev_dedup_task
+ * Writes one full cluster at guest @offset.  If the cluster has to be newly
+ * allocated and an identical cluster is found in the deduplication table,
+ * that cluster is referenced instead of writing the data.
+ * Called with s->lock unlocked
+ */
+static coroutine_fn GRAPH_RDLOCK int
+qcow2_co_pwritev_dedup_task(BlockDriverState *bs, uint64_t offset,
+                            QEMUIOVector *qiov, uint64_t qiov_offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint8_t hash[QCOW2_DEDUP_HASH_SIZE];
+    uint64_t bytes = s->cluster_size;
+    uint64_t host_offset, dup_offset;
+    QCowL2Meta *l2meta = NULL;
+    int ret;
+
+    ret = qcow2_co_hash(bs, qiov, qiov_offset, bytes, hash);
+    if (ret < 0) {
+        return ret;
+    }
+
+    while (bytes != 0) {
+        unsigned int cur_bytes = bytes;
+
+        qemu_co_mutex_lock(&s->lock);
+
+        ret = qcow2_alloc_host_offset(bs, offset, &cur_bytes,
+                                      &host_offset, &l2meta);
+        if (ret < 0) {
+            goto out_locked;
+        }
+
+        /* Only a single newly allocated cluster without COW can be shared */
+        if (l2meta && cur_bytes == s->cluster_size && !l2meta->next &&
+            !l2meta->keep_old_clusters && !l2meta->cow_start.nb_bytes &&
+            !l2meta->cow_end.nb_bytes)
+        {
+            ret = qcow2_co_dedup_find(bs, hash, qiov, qiov_offset,
+                                      &dup_offset);
+            if (ret < 0) {
+                goto out_locked;
+            }
+
+            l2meta->dedup = true;
+            memcpy(l2meta->dedup_hash, hash, QCOW2_DEDUP_HASH_SIZE);
+            if (ret > 0) {
+                trace_qcow2_writev_dedup(qemu_coroutine_self(), offset,
+                                         dup_offset);
+                qcow2_free_clusters(bs, l2meta->alloc_offset, s->cluster_size,
+                                    QCOW2_DISCARD_NEVER);
+                l2meta->alloc_offset = dup_offset;
+                ret = qcow2_handle_l2meta(bs, &l2meta, true);
+                goto out_locked;
+            }
+        }
+
+        ret = qcow2_pre_write_overlap_check(bs, 0, host_offset,
+                                            cur_bytes, true);
+        if (ret < 0) {
+            goto out_locked;
+        }
+
+        qemu_co_mutex_unlock(&s->lock);
+
+        ret = qcow2_co_pwritev_task(bs, host_offset, offset, cur_bytes,
+                                    qiov, qiov_offset, l2meta);
+        l2meta = NULL; /* l2meta is consumed by qcow2_co_pwritev_task() */
+        if (ret < 0) {
+            return ret;
+        }
+
+        bytes -= cur_bytes;
+        offset += cur_bytes;
+        qiov_offset += cur_bytes;
+    }
+
+    return 0;
+
+out_locked:
+    qcow2_handle_l2meta(bs, &l2meta, false);
+    qemu_co_mutex_unlock(&s->lock);
+    return ret;
+}
+
+/*
+ * This function can count as GRAPH_RDLOCK because qcow2_co_pwritev_part() holds
+ * the graph lock and keeps it until this coroutine has terminated.
+ */
+static coroutine_fn GRAPH_RDLOCK int
+qcow2_co_pwritev_dedup_task_entry(AioTask *task)
+{
+    Qcow2AioTask *t = container_of(task, Qcow2AioTask, task);
+
+    assert(!t->subcluster_type && !t->l2meta);
+
+    return qcow2_co_pwritev_dedup_task(t->bs, t->offset, t->qiov,
+                                       t->qiov_offset);
+}
+
 static int coroutine_fn GRAPH_RDLOCK
 qcow2_co_pwritev_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
                       QEMUIOVector *qiov, size_t qiov_offset,
@@ -2704,6 +2907,23 @@ qcow2_co_pwritev_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
                             - offset_in_cluster);
         }
 
+        if (qcow2_dedup_writable(s) && offset_in_cluster == 0 &&
+            cur_bytes >= s->cluster_size)
+        {
+            /* Clusters are allocated by the task after hashing the data */
+            cur_bytes = s->cluster_size;
+            if (!aio && cur_bytes != bytes) {
+                aio = aio_task_pool_new(QCOW2_MAX_WORKERS);
+            }
+            ret = qcow2_add_task(bs, aio, qcow2_co_pwritev_dedup_task_entry,
+                                 0, 0, offset, cur_bytes, qiov, qiov_offset,
+                                 NULL);
+            if (ret < 0) {
+                goto fail_nometa;
+            }
+            goto next;
+        }
+
         qemu_co_mutex_lock(&s->lock);
 
         ret = qcow2_alloc_host_offset(bs, offset, &cur_bytes,
@@ -2731,6 +2951,8 @@ qcow2_co_pwritev_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
             goto fail_nometa;
         }
 
+next:
+
         bytes -= cur_bytes;
         offset += cur_bytes;
         qiov_offset += cur_bytes;
@@ -2773,6 +2995,15 @@ static int GRAPH_RDLOCK qcow2_inactivate(BlockDriverState *bs)
                           bdrv_get_device_or_node_name(bs));
     }
 
+    qcow2_dedup_store(bs, &local_err);
+    if (local_err != NULL) {
+        result = -EINVAL;
+        error_reportf_err(local_err, "Lost deduplication table during "
+                          "inactivation of node '%s': ",
+                          bdrv_get_device_or_node_name(bs));
+        local_err = NULL;
+    }
+
     ret = qcow2_cache_flush(bs, s->l2_table_cache);
     if (ret) {
         result = ret;
@@ -2801,6 +3032,8 @@ qcow2_do_close(BlockDriverState *bs, bool close_data_file)
     qemu_vfree(s->l1_table);
     /* else pre-write overlap checks in cache_destroy may crash */
     s->l1_table = NULL;
+    qcow2_metadata_tree_invalidate(s);
+    qcow2_extent_map_clear(s);
 
     if (!(s->flags & BDRV_O_INACTIVE)) {
         qcow2_inactivate(bs);
@@ -2833,6 +3066,7 @@ qcow2_do_close(BlockDriverState *bs, bool close_data_file)
 
     qcow2_refcount_close(bs);
     qcow2_free_snapshots(bs);
+    qcow2_dedup_free(s);
 }
 
 static void GRAPH_UNLOCKED qcow2_close(BlockDriverState *bs)
@@ -3084,6 +3318,11 @@ int qcow2_update_header(BlockDriverState *bs)
                 .bit  = QCOW2_INCOMPAT_EXTL2_BITNR,
                 .name = "extended L2 entries",
             },
+            {
+                .type = QCOW2_FEAT_TYPE_INCOMPATIBLE,
+                .bit  = QCOW2_INCOMPAT_DEDUP_BITNR,
+                .name = "deduplication",
+            },
             {
                 .type = QCOW2_FEAT_TYPE_COMPATIBLE,
                 .bit  = QCOW2_COMPAT_LAZY_REFCOUNTS_BITNR,
@@ -3129,6 +3368,23 @@ int qcow2_update_header(BlockDriverState *bs)
         buflen -= ret;
     }
 
+    /* Deduplication table extension */
+    if (s->dedup_table_offset != 0) {
+        Qcow2DedupHeaderExt dedup_header = {
+            .hash_type = QCOW2_DEDUP_HASH_SHA256,
+            .nb_entries = cpu_to_be64(s->dedup_nb_entries),
+            .table_offset = cpu_to_be64(s->dedup_table_offset),
+        };
+        ret = header_ext_add(buf, QCOW2_EXT_MAGIC_DEDUP,
+                             &dedup_header, sizeof(dedup_header),
+                             buflen);
+        if (ret < 0) {
+            goto fail;
+        }
+        buf += ret;
+        buflen -= ret;
+    }
+
     /* Keep unknown header extensions */
     QLIST_FOREACH(uext, &s->unknown_header_ext, next) {
         ret = header_ext_add(buf, uext->magic, uext->data, uext->len, buflen);
@@ -3664,6 +3920,27 @@ qcow2_co_create(BlockdevCreateOptions *create_options, Error **errp)
         assert(!qcow2_opts->backing_file);
     }
 
+    if (!qcow2_opts->has_dedup) {
+        qcow2_opts->dedup = false;
+    }
+    if (qcow2_opts->dedup) {
+        if (version < 3) {
+            error_setg(errp, "Deduplication is only supported with "
+                       "compatibility level 1.1 and above (use version=v3 or "
+                       "greater)");
+            ret = -EINVAL;
+            goto out;
+        }
+        if (qcow2_opts->data_file || qcow2_opts->extended_l2 ||
+            qcow2_opts->encrypt)
+        {
+            error_setg(errp, "Deduplication cannot be used together with "
+                       "data-file, extended_l2 or encryption");
+            ret = -EINVAL;
+            goto out;
+        }
+    }
+
     if (qcow2_opts->data_file) {
         if (version < 3) {
             error_setg(errp, "External data files are only supported with "
@@ -3756,6 +4033,11 @@ qcow2_co_create(BlockdevCreateOptions *create_options, Error **errp)
             cpu_to_be64(QCOW2_INCOMPAT_EXTL2);
     }
 
+    if (qcow2_opts->dedup) {
+        header->incompatible_features |=
+            cpu_to_be64(QCOW2_INCOMPAT_DEDUP);
+    }
+
     ret = blk_co_pwrite(blk, 0, cluster_size, header, 0);
     g_free(header);
     if (ret < 0) {
@@ -4908,6 +5190,8 @@ static int GRAPH_RDLOCK make_completely_empty(BlockDriverState *bs)
         goto fail_broken_refcounts;
     }
     memset(s->l1_table, 0, l1_size2);
+    qcow2_metadata_tree_invalidate(s);
+    qcow2_extent_map_clear(s);
 
     BLKDBG_EVENT(bs->file, BLKDBG_EMPTY_IMAGE_PREPARE);
 
@@ -4956,6 +5240,7 @@ static int GRAPH_RDLOCK make_completely_empty(BlockDriverState *bs)
     g_free(s->refcount_table);
     s->refcount_table = new_reftable;
     new_reftable = NULL;
+    qcow2_metadata_tree_invalidate(s);
 
     /* Now the in-memory refcount information again corresponds to the on-disk
      * information (reftable is empty and no refblocks (the refblock cache is
@@ -4973,6 +5258,7 @@ static int GRAPH_RDLOCK make_completely_empty(BlockDriverState *bs)
         goto fail_broken_refcounts;
     }
     s->refcount_table[0] = 2 * s->cluster_size;
+    qcow2_metadata_tree_invalidate(s);
 
     s->free_cluster_index = 0;
     assert(3 + l1_clusters <= s->refcount_block_size);
@@ -5027,7 +5313,7 @@ static int GRAPH_RDLOCK qcow2_make_empty(BlockDriverState *bs)
     if (s->qcow_version >= 3 && !s->snapshots && !s->nb_bitmaps &&
         3 + l1_clusters <= s->refcount_block_size &&
         s->crypt_method_header != QCOW_CRYPT_LUKS &&
-        !has_data_file(bs)) {
+        !has_data_file(bs) && !qcow2_dedup_enabled(s)) {
         /* The following function only works for qcow2 v3 images (it
          * requires the dirty flag) and only as long as there are no
          * features that reserve extra clusters (such as snapshots,
@@ -5036,7 +5322,8 @@ static int GRAPH_RDLOCK qcow2_make_empty(BlockDriverState *bs)
          * additional clusters (image header, refcount table, one
          * refcount block) have to fit inside one refcount block. It
          * only resets the image file, i.e. does not work with an
-         * external data file. */
+         * external data file.  It also bypasses the refcount updates
+         * that keep the deduplication table in sync. */
         return make_completely_empty(bs);
     }
 
@@ -5291,6 +5578,8 @@ qcow2_get_specific_info(BlockDriverState *bs, Error **errp)
             .has_corrupt        = true,
             .has_extended_l2    = true,
             .extended_l2        = has_subclusters(s),
+            .has_dedup          = qcow2_dedup_enabled(s),
+            .dedup              = qcow2_dedup_enabled(s),
             .refcount_bits      = s->refcount_bits,
             .has_bitmaps        = !!bitmaps,
             .bitmaps            = bitmaps,
@@ -6117,6 +6406,11 @@ static QemuOptsList qcow2_create_opts = {
                     "compression",                                      \
             .def_value_str = "zlib"                                     \
         },
+        {
+            .name = BLOCK_OPT_DEDUP,
+            .type = QEMU_OPT_BOOL,
+            .help = "Deduplicate identical data clusters",
+        },
         QCOW_COMMON_OPTIONS,
         { /* end of list */ }
     }
@@ -28,6 +28,7 @@
 #include "crypto/block.h"
 #include "qemu/coroutine.h"
 #include "qemu/units.h"
+#include "qemu/interval-tree.h"
 #include "block/block_int.h"
 
 //#define DEBUG_ALLOC
@@ -71,6 +72,13 @@
 /* Maximum of parallel sub-request per guest request */
 #define QCOW2_MAX_WORKERS 8
 
+/*
+ * Maximum number of L2 tables that qemu-img check reads in parallel, and the
+ * memory it may use for them
+ */
+#define QCOW2_CHECK_MAX_L2_READS 64
+#define QCOW2_CHECK_MAX_L2_BUFFER (32 * MiB)
+
 /* indicate that the refcount of the referenced cluster is exactly one. */
 #define QCOW_OFLAG_COPIED     (1ULL << 63)
 /* indicate that the cluster is compressed (they never have the copied flag) */
@@ -134,6 +142,7 @@
 #define QCOW2_OPT_DISCARD_SNAPSHOT "pass-discard-snapshot"
 #define QCOW2_OPT_DISCARD_OTHER "pass-discard-other"
 #define QCOW2_OPT_DISCARD_NO_UNREF "discard-no-unref"
+#define QCOW2_OPT_EXTENT_MAP "extent-map"
 #define QCOW2_OPT_OVERLAP "overlap-check"
 #define QCOW2_OPT_OVERLAP_TEMPLATE "overlap-check.template"
 #define QCOW2_OPT_OVERLAP_MAIN_HEADER "overlap-check.main-header"
@@ -256,17 +265,20 @@ enum {
     QCOW2_INCOMPAT_DATA_FILE_BITNR  = 2,
     QCOW2_INCOMPAT_COMPRESSION_BITNR = 3,
     QCOW2_INCOMPAT_EXTL2_BITNR      = 4,
+    QCOW2_INCOMPAT_DEDUP_BITNR      = 5,
     QCOW2_INCOMPAT_DIRTY            = 1 << QCOW2_INCOMPAT_DIRTY_BITNR,
     QCOW2_INCOMPAT_CORRUPT          = 1 << QCOW2_INCOMPAT_CORRUPT_BITNR,
     QCOW2_INCOMPAT_DATA_FILE        = 1 << QCOW2_INCOMPAT_DATA_FILE_BITNR,
     QCOW2_INCOMPAT_COMPRESSION      = 1 << QCOW2_INCOMPAT_COMPRESSION_BITNR,
     QCOW2_INCOMPAT_EXTL2            = 1 << QCOW2_INCOMPAT_EXTL2_BITNR,
+    QCOW2_INCOMPAT_DEDUP            = 1 << QCOW2_INCOMPAT_DEDUP_BITNR,
 
     QCOW2_INCOMPAT_MASK             = QCOW2_INCOMPAT_DIRTY
                                     | QCOW2_INCOMPAT_CORRUPT
                                     | QCOW2_INCOMPAT_DATA_FILE
                                     | QCOW2_INCOMPAT_COMPRESSION
-                                    | QCOW2_INCOMPAT_EXTL2,
+                                    | QCOW2_INCOMPAT_EXTL2
+                                    | QCOW2_INCOMPAT_DEDUP,
 };
 
 /* Compatible feature bits */
@@ -322,6 +334,25 @@ typedef struct Qcow2BitmapHeaderExt {
     uint64_t bitmap_directory_offset;
 } QEMU_PACKED Qcow2BitmapHeaderExt;
 
+typedef struct Qcow2DedupHeaderExt {
+    uint8_t hash_type;
+    uint8_t reserved[7];
+    uint64_t nb_entries;
+    uint64_t table_offset;
+} QEMU_PACKED Qcow2DedupHeaderExt;
+
+/* Deduplication hash types */
+#define QCOW2_DEDUP_HASH_SHA256 0
+
+/* Length of the hash of a cluster in the deduplication table */
+#define QCOW2_DEDUP_HASH_SIZE 32
+
+/*
+ * Maximum number of entries in the deduplication table, both in memory and on
+ * disk.  An entry takes about 100 bytes of memory.
+ */
+#define QCOW2_MAX_DEDUP_ENTRIES (1 << 20)
+
 #define QCOW2_MAX_THREADS 4
 
 typedef struct BDRVQcow2State {
@@ -374,6 +405,16 @@ typedef struct BDRVQcow2State {
     uint64_t bitmap_directory_size;
     uint64_t bitmap_directory_offset;
 
+    /*
+     * On-disk deduplication table.  It is only present while the image is
+     * not open read-write; in the meantime the table is kept in memory.
+     */
+    uint64_t dedup_nb_entries;
+    uint64_t dedup_table_offset;
+    /* In-memory deduplication table, Qcow2DedupEntry by hash and offset */
+    GHashTable *dedup_by_hash;
+    GHashTable *dedup_by_offset;
+
     int flags;
     int qcow_version;
     bool use_lazy_refcounts;
@@ -388,9 +429,29 @@ typedef struct BDRVQcow2State {
 
     bool discard_no_unref;
 
+    /*
+     * Interval tree of Qcow2Extent, mapping runs of guest clusters to
+     * contiguous host clusters.  It is filled from the L2 slices that are
+     * looked up anyway and entries are dropped whenever the L2 entries they
+     * were built from change.
+     */
+    bool use_extent_map;
+    IntervalTreeRoot extent_map;
+    unsigned int extent_map_size; /* number of extents */
+
     int overlap_check; /* bitmask of Qcow2MetadataOverlap values */
     bool signaled_corruption;
 
+    /*
+     * Interval tree of the metadata covered by QCOW2_OL_TREE checks.  It is
+     * built on demand by qcow2_check_metadata_overlap() and dropped by
+     * qcow2_metadata_tree_invalidate() whenever that metadata moves.
+     */
+    IntervalTreeRoot metadata_tree;
+    Qcow2MetadataRange *metadata_ranges;
+    bool metadata_tree_valid;
+    uint64_t metadata_tree_gen;
+
     uint64_t incompatible_features;
     uint64_t compatible_features;
     uint64_t autoclear_features;
@@ -488,6 +549,14 @@ typedef struct QCowL2Meta
      */
     bool prealloc;
 
+    /**
+     * Indicates that the (single) cluster is entered into the deduplication
+     * table with @dedup_hash, so it must be linked without
+     * QCOW_OFLAG_COPIED even though it may have a refcount of 1.
+     */
+    bool dedup;
+    uint8_t dedup_hash[QCOW2_DEDUP_HASH_SIZE];
+
     /**
      * The I/O vector with the data from the actual guest write request.
      * If non-NULL, this is meant to be merged together with the data
@@ -588,6 +657,27 @@ typedef enum QCow2MetadataOverlap {
 #define QCOW2_OL_ALL \
     (QCOW2_OL_CACHED | QCOW2_OL_INACTIVE_L2)
 
+/* Overlap checks that are looked up in BDRVQcow2State.metadata_tree */
+#define QCOW2_OL_TREE \
+    (QCOW2_OL_ACTIVE_L2 | QCOW2_OL_REFCOUNT_BLOCK | QCOW2_OL_INACTIVE_L1 | \
+     QCOW2_OL_INACTIVE_L2)
+
+/* A metadata structure in BDRVQcow2State.metadata_tree */
+typedef struct Qcow2MetadataRange {
+    IntervalTreeNode node;
+    int type; /* a single QCow2MetadataOverlap value */
+} Qcow2MetadataRange;
+
+/* A run of data clusters in BDRVQcow2State.extent_map */
+typedef struct Qcow2Extent {
+    IntervalTreeNode node; /* guest offsets */
+    uint64_t host_offset;  /* host offset of node.start */
+    bool copied;           /* all L2 entries have QCOW_OFLAG_COPIED */
+} Qcow2Extent;
+
+/* Beyond this, the extent map is dropped and built again from scratch */
+#define QCOW2_MAX_EXTENTS 65536
+
 #define L1E_OFFSET_MASK 0x00fffffffffffe00ULL
 #define L1E_RESERVED_MASK 0x7f000000000001ffULL
 #define L2E_OFFSET_MASK 0x00fffffffffffe00ULL
@@ -603,6 +693,11 @@ static inline bool has_subclusters(BDRVQcow2State *s)
     return s->incompatible_features & QCOW2_INCOMPAT_EXTL2;
 }
 
+static inline bool qcow2_dedup_enabled(BDRVQcow2State *s)
+{
+    return s->incompatible_features & QCOW2_INCOMPAT_DEDUP;
+}
+
 static inline size_t l2_entry_size(BDRVQcow2State *s)
 {
     return has_subclusters(s) ? L2E_SIZE_EXTENDED : L2E_SIZE_NORMAL;
@@ -892,6 +987,7 @@ int coroutine_fn qcow2_check_refcounts(BlockDriverState *bs, BdrvCheckResult *re
 
 void GRAPH_RDLOCK qcow2_process_discards(BlockDriverState *bs, int ret);
 
+void qcow2_metadata_tree_invalidate(BDRVQcow2State *s);
 int GRAPH_RDLOCK
 qcow2_check_metadata_overlap(BlockDriverState *bs, int ign, int64_t offset,
                              int64_t size);
@@ -927,11 +1023,18 @@ int GRAPH_RDLOCK qcow2_write_l1_entry(BlockDriverState *bs, int l1_index);
 int qcow2_encrypt_sectors(BDRVQcow2State *s, int64_t sector_num,
                           uint8_t *buf, int nb_sectors, bool enc, Error **errp);
 
+void qcow2_extent_map_invalidate(BDRVQcow2State *s, uint64_t offset,
+                                 uint64_t bytes);
+void qcow2_extent_map_clear(BDRVQcow2State *s);
+
 int GRAPH_RDLOCK
 qcow2_get_host_offset(BlockDriverState *bs, uint64_t offset,
                       unsigned int *bytes, uint64_t *host_offset,
                       QCow2SubclusterType *subcluster_type);
 
+int GRAPH_RDLOCK
+qcow2_get_l2_entry(BlockDriverState *bs, uint64_t offset, uint64_t *l2_entry);
+
 int coroutine_fn GRAPH_RDLOCK
 qcow2_alloc_host_offset(BlockDriverState *bs, uint64_t offset,
                         unsigned int *bytes, uint64_t *host_offset,
@@ -1058,6 +1161,30 @@ bool qcow2_supports_persistent_dirty_bitmap(BlockDriverState *bs);
 uint64_t qcow2_get_persistent_dirty_bitmap_size(BlockDriverState *bs,
                                                 uint32_t cluster_size);
 
+/* qcow2-dedup.c functions */
+int coroutine_fn GRAPH_RDLOCK
+qcow2_dedup_load(BlockDriverState *bs, Error **errp);
+int GRAPH_RDLOCK qcow2_dedup_store(BlockDriverState *bs, Error **errp);
+int GRAPH_RDLOCK qcow2_dedup_reopen_rw(BlockDriverState *bs, Error **errp);
+void qcow2_dedup_free(BDRVQcow2State *s);
+
+bool qcow2_dedup_writable(BDRVQcow2State *s);
+bool qcow2_dedup_has_cluster(BDRVQcow2State *s, uint64_t offset);
+void qcow2_dedup_insert(BDRVQcow2State *s, uint64_t offset,
+                        uint64_t guest_offset, const uint8_t *hash);
+void qcow2_dedup_forget(BDRVQcow2State *s, uint64_t offset);
+
+int coroutine_fn GRAPH_RDLOCK
+qcow2_co_dedup_find(BlockDriverState *bs, const uint8_t *hash,
+                    QEMUIOVector *qiov, size_t qiov_offset,
+                    uint64_t *host_offset);
+
+int coroutine_fn GRAPH_RDLOCK
+qcow2_check_dedup_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
+                            void **refcount_table,
+                            int64_t *refcount_table_size);
+
+/* qcow2-threads.c functions */
 ssize_t coroutine_fn
 qcow2_co_compress(BlockDriverState *bs, void *dest, size_t dest_size,
                   const void *src, size_t src_size);
@@ -1070,5 +1197,8 @@ qcow2_co_encrypt(BlockDriverState *bs, uint64_t host_offset,
 int coroutine_fn
 qcow2_co_decrypt(BlockDriverState *bs, uint64_t host_offset,
                  uint64_t guest_offset, void *buf, size_t len);
+int coroutine_fn
+qcow2_co_hash(BlockDriverState *bs, QEMUIOVector *qiov, size_t qiov_offset,
+              size_t bytes, uint8_t *hash);
 
 #endif
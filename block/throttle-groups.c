@@ -39,6 +39,9 @@ static void throttle_group_obj_init(Object *obj);
 static void throttle_group_obj_complete(UserCreatable *obj, Error **errp);
 static void timer_cb(ThrottleGroupMember *tgm, ThrottleDirection direction);
 
+/* Members pay in advance for 1/THROTTLE_GROUP_CREDIT_DIV seconds of I/O */
+#define THROTTLE_GROUP_CREDIT_DIV 100
+
 /* The ThrottleGroup structure (with its ThrottleState) is shared
  * among different ThrottleGroupMembers and it's independent from
  * AioContext, so in order to use it from different threads it needs
@@ -70,11 +73,12 @@ struct ThrottleGroup {
     bool is_initialized;
     char *name; /* This is constant during the lifetime of the group */
 
-    QemuMutex lock; /* This lock protects the following four fields */
+    QemuMutex lock; /* This lock protects the following five fields */
     ThrottleState ts;
     QLIST_HEAD(, ThrottleGroupMember) head;
     ThrottleGroupMember *tokens[THROTTLE_MAX];
     bool any_timer_armed[THROTTLE_MAX];
+    unsigned pending_reqs[THROTTLE_MAX]; /* sum over all members */
     QEMUClockType clock_type;
 
     /* This field is protected by the global QEMU mutex */
@@ -350,10 +354,175 @@ static void coroutine_mixed_fn schedule_next_request(ThrottleGroupMember *tgm,
     }
 }
 
+/* Take one request of @bytes bytes from the credit of a ThrottleGroupMember.
+ *
+ * @tgm:       the ThrottleGroupMember
+ * @bytes:     the number of bytes for this I/O
+ * @direction: the ThrottleDirection
+ * @ret:       whether the credit was large enough
+ */
+static bool throttle_group_take_credit(ThrottleGroupMember *tgm,
+                                       uint64_t bytes,
+                                       ThrottleDirection direction)
+{
+    bool ret = false;
+
+    qemu_spin_lock(&tgm->credit_lock);
+    if (tgm->credit_ops[direction] && tgm->credit_bytes[direction] >= bytes) {
+        tgm->credit_ops[direction]--;
+        tgm->credit_bytes[direction] -= bytes;
+        ret = true;
+    }
+    qemu_spin_unlock(&tgm->credit_lock);
+
+    return ret;
+}
+
+/* Apply whatever is left of the credit of a ThrottleGroupMember to a request
+ * that does not fit into it, so that only the rest needs to be accounted.
+ * Afterwards the credit is too small for any request with data, so later
+ * requests cannot overtake this one.
+ *
+ * @tgm:       the ThrottleGroupMember
+ * @bytes:     the number of bytes for this I/O
+ * @direction: the ThrottleDirection
+ * @ops_paid:  set to the number of operations (0 or 1) already paid for
+ * @ret:       the number of bytes already paid for
+ */
+static uint64_t throttle_group_use_credit(ThrottleGroupMember *tgm,
+                                          uint64_t bytes,
+                                          ThrottleDirection direction,
+                                          uint64_t *ops_paid)
+{
+    uint64_t bytes_paid;
+
+    qemu_spin_lock(&tgm->credit_lock);
+    *ops_paid = MIN(tgm->credit_ops[direction], 1);
+    tgm->credit_ops[direction] -= *ops_paid;
+    bytes_paid = MIN(tgm->credit_bytes[direction], bytes);
+    tgm->credit_bytes[direction] -= bytes_paid;
+    qemu_spin_unlock(&tgm->credit_lock);
+
+    return bytes_paid;
+}
+
+/* Pay in advance for I/O of a ThrottleGroupMember, so that its next requests
+ * don't have to take the group lock. The credit of all members together is
+ * worth at most 1/THROTTLE_GROUP_CREDIT_DIV seconds of the group's limits,
+ * a member gets what the others leave of it. Since it is accounted before
+ * the I/O happens, the limits are never exceeded on average, and the group
+ * as a whole gets at most that much ahead of its limits.
+ *
+ * Only the part of the credit that has been used since the last refill is
+ * paid for again, so whatever is left of it is kept rather than lost.
+ *
+ * No credit is given if a limit is based on cfg.op_size.
+ *
+ * This assumes that tg->lock is held.
+ *
+ * @tgm:       the ThrottleGroupMember
+ * @direction: the ThrottleDirection
+ */
+static void throttle_group_refill_credit(ThrottleGroupMember *tgm,
+                                         ThrottleDirection direction)
+{
+    static const BucketType bucket_types_size[THROTTLE_MAX][2] = {
+        { THROTTLE_BPS_TOTAL, THROTTLE_BPS_READ },
+        { THROTTLE_BPS_TOTAL, THROTTLE_BPS_WRITE }
+    };
+    static const BucketType bucket_types_units[THROTTLE_MAX][2] = {
+        { THROTTLE_OPS_TOTAL, THROTTLE_OPS_READ },
+        { THROTTLE_OPS_TOTAL, THROTTLE_OPS_WRITE }
+    };
+    ThrottleState *ts = tgm->throttle_state;
+    ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
+    ThrottleGroupMember *other;
+    uint64_t bytes_rate = 0, ops_rate = 0;
+    uint64_t ops, bytes, ops_due = 0, bytes_due = 0;
+    uint64_t ops_out = 0, bytes_out = 0;
+    unsigned i;
+
+    if (ts->cfg.op_size) {
+        return;
+    }
+
+    /* The credit is limited by the lowest rate that applies to @direction */
+    for (i = 0; i < ARRAY_SIZE(bucket_types_size[THROTTLE_READ]); i++) {
+        uint64_t avg;
+
+        avg = ts->cfg.buckets[bucket_types_size[direction][i]].avg;
+        if (avg && (!bytes_rate || avg < bytes_rate)) {
+            bytes_rate = avg;
+        }
+
+        avg = ts->cfg.buckets[bucket_types_units[direction][i]].avg;
+        if (avg && (!ops_rate || avg < ops_rate)) {
+            ops_rate = avg;
+        }
+    }
+
+    ops = ops_rate ? ops_rate / THROTTLE_GROUP_CREDIT_DIV : UINT64_MAX;
+    bytes = bytes_rate ? bytes_rate / THROTTLE_GROUP_CREDIT_DIV : UINT64_MAX;
+    if (ops < 2 || !bytes) {
+        /* Not worth it, every request would go through the group anyway */
+        return;
+    }
+
+    /* How much of the slice the members still hold, including @tgm */
+    QLIST_FOREACH(other, &tg->head, round_robin) {
+        qemu_spin_lock(&other->credit_lock);
+        ops_out += other->credit_ops[direction];
+        bytes_out += other->credit_bytes[direction];
+        qemu_spin_unlock(&other->credit_lock);
+    }
+
+    /* Top up with what is left of the slice, unlimited parts cost nothing */
+    qemu_spin_lock(&tgm->credit_lock);
+    if (!ops_rate) {
+        tgm->credit_ops[direction] = UINT64_MAX;
+    } else if (ops_out < ops) {
+        ops_due = ops - ops_out;
+        tgm->credit_ops[direction] += ops_due;
+    }
+    if (!bytes_rate) {
+        tgm->credit_bytes[direction] = UINT64_MAX;
+    } else if (bytes_out < bytes) {
+        bytes_due = bytes - bytes_out;
+        tgm->credit_bytes[direction] += bytes_due;
+    }
+    qemu_spin_unlock(&tgm->credit_lock);
+
+    throttle_account_batch(ts, direction, ops_due, bytes_due);
+}
+
+/* Drop the credit of all members of a group, e.g. because the limits have
+ * changed. The I/O that it was worth remains accounted.
+ *
+ * This assumes that tg->lock is held.
+ *
+ * @tg: the ThrottleGroup
+ */
+static void throttle_group_drop_credits(ThrottleGroup *tg)
+{
+    ThrottleGroupMember *tgm;
+
+    QLIST_FOREACH(tgm, &tg->head, round_robin) {
+        qemu_spin_lock(&tgm->credit_lock);
+        memset(tgm->credit_ops, 0, sizeof(tgm->credit_ops));
+        memset(tgm->credit_bytes, 0, sizeof(tgm->credit_bytes));
+        qemu_spin_unlock(&tgm->credit_lock);
+    }
+}
+
 /* Check if an I/O request needs to be throttled, wait and set a timer
  * if necessary, and schedule the next request using a round robin
  * algorithm.
  *
+ * Requests that fit into the credit of @tgm are started right away without
+ * touching the group at all. Larger requests use up what is left of the
+ * credit and only the rest of them is accounted in the group. The credit
+ * is then refilled, provided that no member of the group is waiting.
+ *
  * @tgm:       the current ThrottleGroupMember
  * @bytes:     the number of bytes for this I/O
  * @direction: the ThrottleDirection
@@ -365,12 +534,20 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
     bool must_wait;
     ThrottleGroupMember *token;
     ThrottleGroup *tg = container_of(tgm->throttle_state, ThrottleGroup, ts);
+    uint64_t ops_paid, bytes_paid;
 
     assert(bytes >= 0);
     assert(direction < THROTTLE_MAX);
 
+    if (throttle_group_take_credit(tgm, bytes, direction)) {
+        return;
+    }
+
     qemu_mutex_lock(&tg->lock);
 
+    /* Whatever credit is left pays for part of this request */
+    bytes_paid = throttle_group_use_credit(tgm, bytes, direction, &ops_paid);
+
     /* First we check if this I/O has to be throttled. */
     token = next_throttle_token(tgm, direction);
     must_wait = throttle_group_schedule_timer(token, direction);
@@ -378,6 +555,7 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
     /* Wait if there's a timer set or queued requests of this type */
     if (must_wait || tgm->pending_reqs[direction]) {
         tgm->pending_reqs[direction]++;
+        tg->pending_reqs[direction]++;
         qemu_mutex_unlock(&tg->lock);
         qemu_co_mutex_lock(&tgm->throttled_reqs_lock);
         qemu_co_queue_wait(&tgm->throttled_reqs[direction],
@@ -385,14 +563,26 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
         qemu_co_mutex_unlock(&tgm->throttled_reqs_lock);
         qemu_mutex_lock(&tg->lock);
         tgm->pending_reqs[direction]--;
+        tg->pending_reqs[direction]--;
     }
 
     /* The I/O will be executed, so do the accounting */
-    throttle_account(tgm->throttle_state, direction, bytes);
+    if (!ops_paid && !bytes_paid) {
+        throttle_account(tgm->throttle_state, direction, bytes);
+    } else {
+        throttle_account_batch(tgm->throttle_state, direction, 1 - ops_paid,
+                               bytes - bytes_paid);
+    }
 
     /* Schedule the next request */
     schedule_next_request(tgm, direction);
 
+    /* Pay for the next few requests now if nobody else has to wait */
+    if (!tg->pending_reqs[direction] && !tg->any_timer_armed[direction] &&
+        !qatomic_read(&tgm->io_limits_disabled)) {
+        throttle_group_refill_credit(tgm, direction);
+    }
+
     qemu_mutex_unlock(&tg->lock);
 }
 
@@ -478,6 +668,7 @@ void throttle_group_config(ThrottleGroupMember *tgm, ThrottleConfig *cfg)
     ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
     qemu_mutex_lock(&tg->lock);
     throttle_config(ts, tg->clock_type, cfg);
+    throttle_group_drop_credits(tg);
     qemu_mutex_unlock(&tg->lock);
 
     throttle_group_restart_tgm(tgm);
@@ -551,6 +742,9 @@ void throttle_group_register_tgm(ThrottleGroupMember *tgm,
     tgm->throttle_state = ts;
     tgm->aio_context = ctx;
     qatomic_set(&tgm->restart_pending, 0);
+    qemu_spin_init(&tgm->credit_lock);
+    memset(tgm->credit_ops, 0, sizeof(tgm->credit_ops));
+    memset(tgm->credit_bytes, 0, sizeof(tgm->credit_bytes));
 
     QEMU_LOCK_GUARD(&tg->lock);
     /* If the ThrottleGroup is new set this ThrottleGroupMember as the token */
@@ -903,6 +1097,7 @@ static void throttle_group_set_limits(Object *obj, Visitor *v,
         goto unlock;
     }
     throttle_config(&tg->ts, tg->clock_type, &cfg);
+    throttle_group_drop_credits(tg);
 
 unlock:
     qemu_mutex_unlock(&tg->lock);
@@ -454,6 +454,21 @@ int qcrypto_block_cipher_encrypt_helper(QCryptoCipher *cipher,
                                           qcrypto_cipher_encrypt, errp);
 }
 
+/*
+ * Only the ESSIV generator has state (a cipher of its own) that must not
+ * be used concurrently; plain and plain64 IVs are computed from the sector
+ * number alone, so that workers processing parts of the same request
+ * don't contend for the lock on every sector.
+ */
+static QemuMutex *qcrypto_block_ivgen_mutex(QCryptoBlock *block)
+{
+    if (block->ivgen &&
+        qcrypto_ivgen_get_algorithm(block->ivgen) == QCRYPTO_IV_GEN_ALGO_ESSIV) {
+        return &block->mutex;
+    }
+    return NULL;
+}
+
 int qcrypto_block_decrypt_helper(QCryptoBlock *block,
                                  int sectorsize,
                                  uint64_t offset,
@@ -468,7 +483,8 @@ int qcrypto_block_decrypt_helper(QCryptoBlock *block,
     }
 
     ret = do_qcrypto_block_cipher_encdec(cipher, block->niv, block->ivgen,
-                                         &block->mutex, sectorsize, offset, buf,
+                                         qcrypto_block_ivgen_mutex(block),
+                                         sectorsize, offset, buf,
                                          len, qcrypto_cipher_decrypt, errp);
 
     qcrypto_block_push_cipher(block, cipher);
@@ -490,7 +506,8 @@ int qcrypto_block_encrypt_helper(QCryptoBlock *block,
     }
 
     ret = do_qcrypto_block_cipher_encdec(cipher, block->niv, block->ivgen,
-                                         &block->mutex, sectorsize, offset, buf,
+                                         qcrypto_block_ivgen_mutex(block),
+                                         sectorsize, offset, buf,
                                          len, qcrypto_cipher_encrypt, errp);
 
     qcrypto_block_push_cipher(block, cipher);
@@ -27,6 +27,9 @@
 #include "qemu/bswap.h"
 #include "crypto/xts.h"
 
+/* Number of blocks passed to the cipher function at once (one sector) */
+#define XTS_BATCH_BLOCKS 32
+
 typedef union {
     uint8_t b[XTS_BLOCK_SIZE];
     uint64_t u[2];
@@ -99,6 +102,66 @@ static inline void xts_tweak_encdec(const void *ctx,
 }
 
 
+/**
+ * xts_tweak_encdec_blocks:
+ * @param ctxt: the cipher context
+ * @param func: the cipher function
+ * @src: buffer providing @nblocks blocks of input text
+ * @dst: buffer to output @nblocks blocks of output text
+ * @nblocks: the number of blocks, at most XTS_BATCH_BLOCKS
+ * @iv: the initialization vector tweak of XTS_BLOCK_SIZE bytes
+ *
+ * Encrypt/decrypt full blocks with consecutive tweaks.  The tweaks are
+ * computed up front so that the cipher function is called only once for
+ * all blocks, which lets it pipeline them (e.g. with AES-NI).  The blocks
+ * are processed in place in @dst, with 64-bit accesses only: mixing them
+ * with 128-bit ones on the same data stalls store-to-load forwarding.
+ */
+static void xts_tweak_encdec_blocks(const void *ctx,
+                                    xts_cipher_func *func,
+                                    const uint8_t *src,
+                                    uint8_t *dst,
+                                    unsigned long nblocks,
+                                    xts_uint128 *iv)
+{
+    uint64_t tweak[XTS_BATCH_BLOCKS][2];
+    uint64_t t0, t1, v;
+    unsigned long i;
+    int j;
+
+    g_assert(nblocks <= XTS_BATCH_BLOCKS);
+
+    t0 = le64_to_cpu(iv->u[0]);
+    t1 = le64_to_cpu(iv->u[1]);
+    for (i = 0; i < nblocks; i++) {
+        tweak[i][0] = cpu_to_le64(t0);
+        tweak[i][1] = cpu_to_le64(t1);
+        for (j = 0; j < 2; j++) {
+            memcpy(&v, src + i * XTS_BLOCK_SIZE + j * 8, 8);
+            v ^= tweak[i][j];
+            memcpy(dst + i * XTS_BLOCK_SIZE + j * 8, &v, 8);
+        }
+
+        /* LFSR the tweak, as xts_mult_x() does */
+        v = t1 >> 63;
+        t1 = (t1 << 1) | (t0 >> 63);
+        t0 = (t0 << 1) ^ (-v & 0x87);
+    }
+    iv->u[0] = cpu_to_le64(t0);
+    iv->u[1] = cpu_to_le64(t1);
+
+    func(ctx, nblocks * XTS_BLOCK_SIZE, dst, dst);
+
+    for (i = 0; i < nblocks; i++) {
+        for (j = 0; j < 2; j++) {
+            memcpy(&v, dst + i * XTS_BLOCK_SIZE + j * 8, 8);
+            v ^= tweak[i][j];
+            memcpy(dst + i * XTS_BLOCK_SIZE + j * 8, &v, 8);
+        }
+    }
+}
+
+
 void xts_decrypt(const void *datactx,
                  const void *tweakctx,
                  xts_cipher_func *encfunc,
@@ -109,7 +172,7 @@ void xts_decrypt(const void *datactx,
                  const uint8_t *src)
 {
     xts_uint128 PP, CC, T;
-    unsigned long i, m, mo, lim;
+    unsigned long i, n, m, mo, lim;
 
     /* get number of blocks */
     m = length >> 4;
@@ -127,23 +190,11 @@ void xts_decrypt(const void *datactx,
     /* encrypt the iv */
     encfunc(tweakctx, XTS_BLOCK_SIZE, T.b, iv);
 
-    if (QEMU_PTR_IS_ALIGNED(src, sizeof(uint64_t)) &&
-        QEMU_PTR_IS_ALIGNED(dst, sizeof(uint64_t))) {
-        xts_uint128 *S = (xts_uint128 *)src;
-        xts_uint128 *D = (xts_uint128 *)dst;
-        for (i = 0; i < lim; i++, S++, D++) {
-            xts_tweak_encdec(datactx, decfunc, S, D, &T);
-        }
-    } else {
-        xts_uint128 D;
-
-        for (i = 0; i < lim; i++) {
-            memcpy(&D, src, XTS_BLOCK_SIZE);
-            xts_tweak_encdec(datactx, decfunc, &D, &D, &T);
-            memcpy(dst, &D, XTS_BLOCK_SIZE);
-            src += XTS_BLOCK_SIZE;
-            dst += XTS_BLOCK_SIZE;
-        }
+    for (i = 0; i < lim; i += n) {
+        n = MIN(lim - i, XTS_BATCH_BLOCKS);
+        xts_tweak_encdec_blocks(datactx, decfunc, src, dst, n, &T);
+        src += n * XTS_BLOCK_SIZE;
+        dst += n * XTS_BLOCK_SIZE;
     }
 
     /* if length is not a multiple of XTS_BLOCK_SIZE then */
@@ -185,7 +236,7 @@ void xts_encrypt(const void *datactx,
                  const uint8_t *src)
 {
     xts_uint128 PP, CC, T;
-    unsigned long i, m, mo, lim;
+    unsigned long i, n, m, mo, lim;
 
     /* get number of blocks */
     m = length >> 4;
@@ -203,24 +254,11 @@ void xts_encrypt(const void *datactx,
     /* encrypt the iv */
     encfunc(tweakctx, XTS_BLOCK_SIZE, T.b, iv);
 
-    if (QEMU_PTR_IS_ALIGNED(src, sizeof(uint64_t)) &&
-        QEMU_PTR_IS_ALIGNED(dst, sizeof(uint64_t))) {
-        xts_uint128 *S = (xts_uint128 *)src;
-        xts_uint128 *D = (xts_uint128 *)dst;
-        for (i = 0; i < lim; i++, S++, D++) {
-            xts_tweak_encdec(datactx, encfunc, S, D, &T);
-        }
-    } else {
-        xts_uint128 D;
-
-        for (i = 0; i < lim; i++) {
-            memcpy(&D, src, XTS_BLOCK_SIZE);
-            xts_tweak_encdec(datactx, encfunc, &D, &D, &T);
-            memcpy(dst, &D, XTS_BLOCK_SIZE);
-
-            dst += XTS_BLOCK_SIZE;
-            src += XTS_BLOCK_SIZE;
-        }
+    for (i = 0; i < lim; i += n) {
+        n = MIN(lim - i, XTS_BATCH_BLOCKS);
+        xts_tweak_encdec_blocks(datactx, encfunc, src, dst, n, &T);
+        src += n * XTS_BLOCK_SIZE;
+        dst += n * XTS_BLOCK_SIZE;
     }
 
     /* if length is not a multiple of XTS_BLOCK_SIZE then */
@@ -52,24 +52,75 @@ static void virtio_blk_init_request(VirtIOBlock *s, VirtQueue *vq,
 
 static void virtio_blk_free_request(VirtIOBlockReq *req)
 {
-    g_free(req);
+    virtqueue_element_free(req);
 }
 
-static void virtio_blk_req_complete(VirtIOBlockReq *req, unsigned char status)
+static void virtio_blk_req_set_status(VirtIOBlockReq *req,
+                                      unsigned char status)
 {
-    VirtIOBlock *s = req->dev;
-    VirtIODevice *vdev = VIRTIO_DEVICE(s);
-
-    trace_virtio_blk_req_complete(vdev, req, status);
+    trace_virtio_blk_req_complete(VIRTIO_DEVICE(req->dev), req, status);
 
     stb_p(&req->in->status, status);
     iov_discard_undo(&req->inhdr_undo);
     iov_discard_undo(&req->outhdr_undo);
-    virtqueue_push(req->vq, &req->elem, req->in_len);
+}
+
+static void virtio_blk_notify(VirtIOBlock *s, VirtQueue *vq)
+{
     if (qemu_in_iothread()) {
-        virtio_notify_irqfd(vdev, req->vq);
+        virtio_notify_irqfd(VIRTIO_DEVICE(s), vq);
     } else {
-        virtio_notify(vdev, req->vq);
+        virtio_notify(VIRTIO_DEVICE(s), vq);
+    }
+}
+
+static void virtio_blk_req_complete(VirtIOBlockReq *req, unsigned char status)
+{
+    virtio_blk_req_set_status(req, status);
+    virtqueue_push(req->vq, &req->elem, req->in_len);
+    virtio_blk_notify(req->dev, req->vq);
+}
+
+/*
+ * Successfully complete and free the requests in @reqs.  Those that belong to
+ * the same virtqueue are published with a single used index update and
+ * notification.
+ */
+static void virtio_blk_req_complete_many(VirtIOBlock *s,
+                                         VirtIOBlockReq **reqs,
+                                         unsigned int num_reqs)
+{
+    VirtQueueElement *elems[VIRTIO_BLK_MAX_MERGE_REQS];
+    unsigned int lens[VIRTIO_BLK_MAX_MERGE_REQS];
+    bool pushed[VIRTIO_BLK_MAX_MERGE_REQS] = {};
+    unsigned int i, j, n;
+
+    assert(num_reqs <= VIRTIO_BLK_MAX_MERGE_REQS);
+
+    for (i = 0; i < num_reqs; i++) {
+        virtio_blk_req_set_status(reqs[i], VIRTIO_BLK_S_OK);
+    }
+
+    for (i = 0; i < num_reqs; i++) {
+        VirtQueue *vq = reqs[i]->vq;
+
+        if (pushed[i]) {
+            continue;
+        }
+
+        for (j = i, n = 0; j < num_reqs; j++) {
+            if (!pushed[j] && reqs[j]->vq == vq) {
+                elems[n] = &reqs[j]->elem;
+                lens[n++] = reqs[j]->in_len;
+                pushed[j] = true;
+            }
+        }
+        virtqueue_push_many(vq, elems, lens, n);
+        virtio_blk_notify(s, vq);
+    }
+
+    for (i = 0; i < num_reqs; i++) {
+        virtio_blk_free_request(reqs[i]);
     }
 }
 
@@ -105,6 +156,8 @@ static void virtio_blk_rw_complete(void *opaque, int ret)
     VirtIOBlockReq *next = opaque;
     VirtIOBlock *s = next->dev;
     VirtIODevice *vdev = VIRTIO_DEVICE(s);
+    VirtIOBlockReq *done[VIRTIO_BLK_MAX_MERGE_REQS];
+    unsigned int num_done = 0;
 
     while (next) {
         VirtIOBlockReq *req = next;
@@ -134,10 +187,15 @@ static void virtio_blk_rw_complete(void *opaque, int ret)
             }
         }
 
-        virtio_blk_req_complete(req, VIRTIO_BLK_S_OK);
         block_acct_done(blk_get_stats(s->blk), &req->acct);
-        virtio_blk_free_request(req);
+        done[num_done++] = req;
+        if (num_done == ARRAY_SIZE(done)) {
+            virtio_blk_req_complete_many(s, done, num_done);
+            num_done = 0;
+        }
     }
+
+    virtio_blk_req_complete_many(s, done, num_done);
 }
 
 static void virtio_blk_flush_complete(void *opaque, int ret)
@@ -156,30 +214,50 @@ static void virtio_blk_flush_complete(void *opaque, int ret)
 
 static void virtio_blk_discard_write_zeroes_complete(void *opaque, int ret)
 {
-    VirtIOBlockReq *req = opaque;
-    VirtIOBlock *s = req->dev;
-    bool is_write_zeroes = (virtio_ldl_p(VIRTIO_DEVICE(s), &req->out.type) &
+    VirtIOBlockReq *next = opaque;
+    VirtIOBlock *s = next->dev;
+    bool is_write_zeroes = (virtio_ldl_p(VIRTIO_DEVICE(s), &next->out.type) &
                             ~VIRTIO_BLK_T_BARRIER) == VIRTIO_BLK_T_WRITE_ZEROES;
+    VirtIOBlockReq *done[VIRTIO_BLK_MAX_MERGE_REQS];
+    unsigned int num_done = 0;
 
-    if (ret && virtio_blk_handle_rw_error(req, -ret, false, is_write_zeroes)) {
-        return;
-    }
+    /* Coalesced requests are all of the same type */
+    while (next) {
+        VirtIOBlockReq *req = next;
+        next = req->mr_next;
 
-    virtio_blk_req_complete(req, VIRTIO_BLK_S_OK);
-    if (is_write_zeroes) {
-        block_acct_done(blk_get_stats(s->blk), &req->acct);
+        if (ret &&
+            virtio_blk_handle_rw_error(req, -ret, false, is_write_zeroes)) {
+            continue;
+        }
+
+        if (is_write_zeroes) {
+            block_acct_done(blk_get_stats(s->blk), &req->acct);
+        }
+        done[num_done++] = req;
+        if (num_done == ARRAY_SIZE(done)) {
+            virtio_blk_req_complete_many(s, done, num_done);
+            num_done = 0;
+        }
     }
-    virtio_blk_free_request(req);
+
+    virtio_blk_req_complete_many(s, done, num_done);
 }
 
-static VirtIOBlockReq *virtio_blk_get_request(VirtIOBlock *s, VirtQueue *vq)
+/* Requests popped from the virtqueue at a time by virtio_blk_handle_vq() */
+#define VIRTIO_BLK_POP_BATCH 16
+
+static unsigned int virtio_blk_get_requests(VirtIOBlock *s, VirtQueue *vq,
+                                            VirtIOBlockReq **reqs,
+                                            unsigned int max)
 {
-    VirtIOBlockReq *req = virtqueue_pop(vq, sizeof(VirtIOBlockReq));
+    unsigned int i, n;
 
-    if (req) {
-        virtio_blk_init_request(s, vq, req);
+    n = virtqueue_pop_many(vq, sizeof(VirtIOBlockReq), (void **)reqs, max);
+    for (i = 0; i < n; i++) {
+        virtio_blk_init_request(s, vq, reqs[i]);
     }
-    return req;
+    return n;
 }
 
 static void virtio_blk_handle_scsi(VirtIOBlockReq *req)
@@ -217,6 +295,32 @@ fail:
     virtio_blk_free_request(req);
 }
 
+/*
+ * Account the requests in @reqs after the first one as merged into it, each
+ * to the virtqueue it came from
+ */
+static void virtio_blk_acct_merged(VirtIOBlock *s, VirtIOBlockReq **reqs,
+                                   int num_reqs, enum BlockAcctType type)
+{
+    BlockAcctStats *stats = blk_get_stats(s->blk);
+    unsigned int queue = 0;
+    int i, n = 0;
+
+    for (i = 1; i < num_reqs; i++) {
+        unsigned int q = virtio_get_queue_index(reqs[i]->vq);
+
+        if (n > 0 && q != queue) {
+            block_acct_queue_merge_done(stats, queue, type, n);
+            n = 0;
+        }
+        queue = q;
+        n++;
+    }
+    if (n > 0) {
+        block_acct_queue_merge_done(stats, queue, type, n);
+    }
+}
+
 static inline void submit_requests(VirtIOBlock *s, MultiReqBuffer *mrb,
                                    int start, int num_reqs, int niov)
 {
@@ -250,9 +354,8 @@ static inline void submit_requests(VirtIOBlock *s, MultiReqBuffer *mrb,
                                          mrb, start, num_reqs,
                                          sector_num << BDRV_SECTOR_BITS,
                                          qiov->size, is_write);
-        block_acct_merge_done(blk_get_stats(blk),
-                              is_write ? BLOCK_ACCT_WRITE : BLOCK_ACCT_READ,
-                              num_reqs - 1);
+        virtio_blk_acct_merged(s, &mrb->reqs[start], num_reqs,
+                               is_write ? BLOCK_ACCT_WRITE : BLOCK_ACCT_READ);
     }
 
     if (blk_ram_registrar_ok(&s->blk_ram_registrar)) {
@@ -270,21 +373,62 @@ static inline void submit_requests(VirtIOBlock *s, MultiReqBuffer *mrb,
     }
 }
 
-static int multireq_compare(const void *a, const void *b)
+/*
+ * Sort @reqs by sector_num, keeping requests for the same sector in order.
+ * Guests mostly queue requests in ascending order, which a single pass
+ * detects.  Otherwise this is an LSD radix sort that only looks at the bytes
+ * in which the sector numbers differ, so it stays linear in @num_reqs.
+ */
+static void virtio_blk_sort_reqs(VirtIOBlockReq **reqs, unsigned int num_reqs)
 {
-    const VirtIOBlockReq *req1 = *(VirtIOBlockReq **)a,
-                         *req2 = *(VirtIOBlockReq **)b;
+    VirtIOBlockReq *tmp[VIRTIO_BLK_MAX_MERGE_REQS];
+    VirtIOBlockReq **src = reqs, **dst = tmp;
+    uint64_t diff = 0;
+    bool sorted = true;
+    unsigned int i, shift;
 
-    /*
-     * Note that we can't simply subtract sector_num1 from sector_num2
-     * here as that could overflow the return value.
-     */
-    if (req1->sector_num > req2->sector_num) {
-        return 1;
-    } else if (req1->sector_num < req2->sector_num) {
-        return -1;
-    } else {
-        return 0;
+    assert(num_reqs <= VIRTIO_BLK_MAX_MERGE_REQS);
+
+    for (i = 1; i < num_reqs; i++) {
+        diff |= reqs[i]->sector_num ^ reqs[0]->sector_num;
+        sorted &= reqs[i - 1]->sector_num <= reqs[i]->sector_num;
+    }
+    if (sorted) {
+        return;
+    }
+
+    for (shift = 0; shift < 64 && (diff >> shift); shift += 8) {
+        unsigned int pos[256] = {};
+        VirtIOBlockReq **t;
+
+        if (!((diff >> shift) & 0xff)) {
+            continue;
+        }
+
+        /* pos[d] is where the first request with digit d goes */
+        for (i = 0; i < num_reqs; i++) {
+            uint8_t digit = (uint64_t)src[i]->sector_num >> shift;
+
+            if (digit < 255) {
+                pos[digit + 1]++;
+            }
+        }
+        for (i = 1; i < 256; i++) {
+            pos[i] += pos[i - 1];
+        }
+        for (i = 0; i < num_reqs; i++) {
+            uint8_t digit = (uint64_t)src[i]->sector_num >> shift;
+
+            dst[pos[digit]++] = src[i];
+        }
+
+        t = src;
+        src = dst;
+        dst = t;
+    }
+
+    if (src != reqs) {
+        memcpy(reqs, src, num_reqs * sizeof(*reqs));
     }
 }
 
@@ -300,10 +444,9 @@ static void virtio_blk_submit_multireq(VirtIOBlock *s, MultiReqBuffer *mrb)
         return;
     }
 
-    max_transfer = blk_get_max_transfer(mrb->reqs[0]->dev->blk);
+    virtio_blk_sort_reqs(mrb->reqs, mrb->num_reqs);
 
-    qsort(mrb->reqs, mrb->num_reqs, sizeof(*mrb->reqs),
-          &multireq_compare);
+    max_transfer = blk_get_max_transfer(mrb->reqs[0]->dev->blk);
 
     for (i = 0; i < mrb->num_reqs; i++) {
         VirtIOBlockReq *req = mrb->reqs[i];
@@ -339,6 +482,80 @@ static void virtio_blk_submit_multireq(VirtIOBlock *s, MultiReqBuffer *mrb)
     mrb->num_reqs = 0;
 }
 
+static void submit_dwz_requests(VirtIOBlock *s, MultiReqBuffer *mrb,
+                                unsigned int start, unsigned int num_reqs,
+                                uint32_t nb_sectors)
+{
+    VirtIOBlockReq **reqs = &mrb->dwz_reqs[start];
+    int64_t offset = reqs[0]->sector_num << BDRV_SECTOR_BITS;
+    int64_t bytes = (int64_t)nb_sectors << BDRV_SECTOR_BITS;
+    unsigned int i;
+
+    if (num_reqs > 1) {
+        for (i = 1; i < num_reqs; i++) {
+            reqs[i - 1]->mr_next = reqs[i];
+        }
+
+        trace_virtio_blk_submit_dwz(VIRTIO_DEVICE(s), mrb, start, num_reqs,
+                                    offset, bytes, mrb->dwz_is_write_zeroes);
+        virtio_blk_acct_merged(s, reqs, num_reqs,
+                               mrb->dwz_is_write_zeroes ? BLOCK_ACCT_WRITE :
+                               BLOCK_ACCT_UNMAP);
+    }
+
+    if (mrb->dwz_is_write_zeroes) {
+        blk_aio_pwrite_zeroes(s->blk, offset, bytes, mrb->dwz_flags,
+                              virtio_blk_discard_write_zeroes_complete,
+                              reqs[0]);
+    } else {
+        blk_aio_pdiscard(s->blk, offset, bytes,
+                         virtio_blk_discard_write_zeroes_complete, reqs[0]);
+    }
+}
+
+/*
+ * Submit the discard or write zeroes requests queued in @mrb, coalescing
+ * those that cover adjacent ranges as long as the result stays within the
+ * limit that the device advertises for a single request.
+ */
+static void virtio_blk_submit_dwz(VirtIOBlock *s, MultiReqBuffer *mrb)
+{
+    uint32_t max_sectors = mrb->dwz_is_write_zeroes ?
+                           s->conf.max_write_zeroes_sectors :
+                           s->conf.max_discard_sectors;
+    uint32_t nb_sectors = 0;
+    unsigned int i, start = 0;
+
+    virtio_blk_sort_reqs(mrb->dwz_reqs, mrb->num_dwz_reqs);
+
+    for (i = 0; i < mrb->num_dwz_reqs; i++) {
+        VirtIOBlockReq *req = mrb->dwz_reqs[i];
+
+        if (i > start &&
+            (mrb->dwz_reqs[start]->sector_num + nb_sectors != req->sector_num ||
+             nb_sectors > max_sectors - req->dwz_sectors)) {
+            submit_dwz_requests(s, mrb, start, i - start, nb_sectors);
+            start = i;
+            nb_sectors = 0;
+        }
+        nb_sectors += req->dwz_sectors;
+    }
+
+    submit_dwz_requests(s, mrb, start, i - start, nb_sectors);
+    mrb->num_dwz_reqs = 0;
+}
+
+/* Submit everything that is still queued in @mrb */
+static void virtio_blk_submit_mrb(VirtIOBlock *s, MultiReqBuffer *mrb)
+{
+    if (mrb->num_reqs) {
+        virtio_blk_submit_multireq(s, mrb);
+    }
+    if (mrb->num_dwz_reqs) {
+        virtio_blk_submit_dwz(s, mrb);
+    }
+}
+
 static void virtio_blk_handle_flush(VirtIOBlockReq *req, MultiReqBuffer *mrb)
 {
     VirtIOBlock *s = req->dev;
@@ -352,6 +569,9 @@ static void virtio_blk_handle_flush(VirtIOBlockReq *req, MultiReqBuffer *mrb)
     if (mrb->is_write && mrb->num_reqs > 0) {
         virtio_blk_submit_multireq(s, mrb);
     }
+    if (mrb->num_dwz_reqs > 0) {
+        virtio_blk_submit_dwz(s, mrb);
+    }
     blk_aio_flush(s->blk, virtio_blk_flush_complete, req);
 }
 
@@ -378,7 +598,8 @@ static bool virtio_blk_sect_range_ok(VirtIOBlock *dev,
 }
 
 static uint8_t virtio_blk_handle_discard_write_zeroes(VirtIOBlockReq *req,
-    struct virtio_blk_discard_write_zeroes *dwz_hdr, bool is_write_zeroes)
+    struct virtio_blk_discard_write_zeroes *dwz_hdr, bool is_write_zeroes,
+    MultiReqBuffer *mrb)
 {
     VirtIOBlock *s = req->dev;
     VirtIODevice *vdev = VIRTIO_DEVICE(s);
@@ -386,6 +607,7 @@ static uint8_t virtio_blk_handle_discard_write_zeroes(VirtIOBlockReq *req,
     uint32_t num_sectors, flags, max_sectors;
     uint8_t err_status;
     int bytes;
+    int blk_aio_flags = 0;
 
     sector = virtio_ldq_p(vdev, &dwz_hdr->sector);
     num_sectors = virtio_ldl_p(vdev, &dwz_hdr->num_sectors);
@@ -420,18 +642,12 @@ static uint8_t virtio_blk_handle_discard_write_zeroes(VirtIOBlockReq *req,
     }
 
     if (is_write_zeroes) { /* VIRTIO_BLK_T_WRITE_ZEROES */
-        int blk_aio_flags = 0;
-
         if (flags & VIRTIO_BLK_WRITE_ZEROES_FLAG_UNMAP) {
             blk_aio_flags |= BDRV_REQ_MAY_UNMAP;
         }
 
         block_acct_start(blk_get_stats(s->blk), &req->acct, bytes,
                          BLOCK_ACCT_WRITE);
-
-        blk_aio_pwrite_zeroes(s->blk, sector << BDRV_SECTOR_BITS,
-                              bytes, blk_aio_flags,
-                              virtio_blk_discard_write_zeroes_complete, req);
     } else { /* VIRTIO_BLK_T_DISCARD */
         /*
          * The device MUST set the status byte to VIRTIO_BLK_S_UNSUPP for
@@ -441,11 +657,23 @@ static uint8_t virtio_blk_handle_discard_write_zeroes(VirtIOBlockReq *req,
             err_status = VIRTIO_BLK_S_UNSUPP;
             goto err;
         }
+    }
 
-        blk_aio_pdiscard(s->blk, sector << BDRV_SECTOR_BITS, bytes,
-                         virtio_blk_discard_write_zeroes_complete, req);
+    /* merge would exceed maximum number of requests or the type changes */
+    if (mrb->num_dwz_reqs > 0 &&
+        (mrb->num_dwz_reqs == VIRTIO_BLK_MAX_MERGE_REQS ||
+         is_write_zeroes != mrb->dwz_is_write_zeroes ||
+         blk_aio_flags != mrb->dwz_flags ||
+         !s->conf.request_merging)) {
+        virtio_blk_submit_dwz(s, mrb);
     }
 
+    req->sector_num = sector;
+    req->dwz_sectors = num_sectors;
+    mrb->dwz_reqs[mrb->num_dwz_reqs++] = req;
+    mrb->dwz_is_write_zeroes = is_write_zeroes;
+    mrb->dwz_flags = blk_aio_flags;
+
     return VIRTIO_BLK_S_OK;
 
 err:
@@ -957,7 +1185,8 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
         }
 
         err_status = virtio_blk_handle_discard_write_zeroes(req, &dwz_hdr,
-                                                            is_write_zeroes);
+                                                            is_write_zeroes,
+                                                            mrb);
         if (err_status != VIRTIO_BLK_S_OK) {
             virtio_blk_req_complete(req, err_status);
             virtio_blk_free_request(req);
@@ -972,23 +1201,36 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
     return 0;
 }
 
-void virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
+/*
+ * Pop and handle everything on @vq, adding mergeable requests to @mrb.
+ * Returns false if the device broke while processing the queue.
+ */
+static bool virtio_blk_process_vq(VirtIOBlock *s, VirtQueue *vq,
+                                  MultiReqBuffer *mrb)
 {
-    VirtIOBlockReq *req;
-    MultiReqBuffer mrb = {};
+    VirtIOBlockReq *reqs[VIRTIO_BLK_POP_BATCH];
+    unsigned int i, n;
     bool suppress_notifications = virtio_queue_get_notification(vq);
-
-    defer_call_begin();
+    bool broken = false;
 
     do {
         if (suppress_notifications) {
             virtio_queue_set_notification(vq, 0);
         }
 
-        while ((req = virtio_blk_get_request(s, vq))) {
-            if (virtio_blk_handle_request(req, &mrb)) {
-                virtqueue_detach_element(req->vq, &req->elem, 0);
-                virtio_blk_free_request(req);
+        while ((n = virtio_blk_get_requests(s, vq, reqs, ARRAY_SIZE(reqs)))) {
+            for (i = 0; i < n; i++) {
+                if (virtio_blk_handle_request(reqs[i], mrb)) {
+                    break;
+                }
+            }
+            if (i < n) {
+                /* The device is broken, drop the rest of the batch too */
+                for (; i < n; i++) {
+                    virtqueue_detach_element(reqs[i]->vq, &reqs[i]->elem, 0);
+                    virtio_blk_free_request(reqs[i]);
+                }
+                broken = true;
                 break;
             }
         }
@@ -996,12 +1238,41 @@ void virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
         if (suppress_notifications) {
             virtio_queue_set_notification(vq, 1);
         }
-    } while (!virtio_queue_empty(vq));
+    } while (!broken && !virtio_queue_empty(vq));
+
+    return !broken;
+}
+
+void virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(s);
+    MultiReqBuffer mrb = {};
+    uint16_t idx = virtio_get_queue_index(vq);
+    AioContext *ctx;
+    bool ok;
+
+    defer_call_begin();
 
-    if (mrb.num_reqs) {
-        virtio_blk_submit_multireq(s, &mrb);
+    ok = virtio_blk_process_vq(s, vq, &mrb);
+
+    /*
+     * Queues that are mapped to the same AioContext are only ever handled
+     * from this thread, so drain them as well while we are here.  This lets
+     * sequential requests that the guest spread over several queues be
+     * merged, and their eventual handlers will find them empty.
+     */
+    if (ok && s->conf.request_merging && s->conf.num_queues > 1 &&
+        s->vq_aio_context) {
+        ctx = s->vq_aio_context[idx];
+        for (uint16_t i = 0; ok && i < s->conf.num_queues; i++) {
+            if (i != idx && s->vq_aio_context[i] == ctx) {
+                ok = virtio_blk_process_vq(s, virtio_get_queue(vdev, i), &mrb);
+            }
+        }
     }
 
+    virtio_blk_submit_mrb(s, &mrb);
+
     defer_call_end();
 }
 
@@ -1046,9 +1317,7 @@ static void virtio_blk_dma_restart_bh(void *opaque)
         req = next;
     }
 
-    if (mrb.num_reqs) {
-        virtio_blk_submit_multireq(s, &mrb);
-    }
+    virtio_blk_submit_mrb(s, &mrb);
 
     /* Paired with inc in virtio_blk_dma_restart_cb() */
     blk_dec_in_flight(s->conf.conf.blk);
@@ -1939,6 +2208,10 @@ static void virtio_blk_device_realize(DeviceState *dev, Error **errp)
 
     blk_iostatus_enable(s->blk);
 
+    if (conf->num_queues > 1) {
+        block_acct_set_queues(blk_get_stats(s->blk), conf->num_queues);
+    }
+
     add_boot_device_lchs(dev, "/disk@0,0",
                          conf->conf.lcyls,
                          conf->conf.lheads,
@@ -1953,6 +2226,7 @@ static void virtio_blk_device_unrealize(DeviceState *dev)
     unsigned i;
 
     blk_drain(s->blk);
+    block_acct_set_queues(blk_get_stats(s->blk), 0);
     del_boot_device_lchs(dev, "/disk@0,0");
     virtio_blk_vq_aio_context_cleanup(s);
     for (i = 0; i < conf->num_queues; i++) {
@@ -2727,7 +2727,7 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
     virtqueue_push(q->tx_vq, q->async_tx.elem, 0);
     virtio_notify(vdev, q->tx_vq);
 
-    g_free(q->async_tx.elem);
+    virtqueue_element_free(q->async_tx.elem);
     q->async_tx.elem = NULL;
 
     virtio_queue_set_notification(q->tx_vq, 1);
@@ -2749,12 +2749,51 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
     }
 }
 
+/*
+ * Elements popped from the TX queue at a time, and transmitted elements
+ * completed with a single used index update
+ */
+#define VIRTIO_NET_TX_BATCH 32
+
+static const unsigned int virtio_net_tx_lens[VIRTIO_NET_TX_BATCH];
+
+static void virtio_net_tx_push(VirtIONetQueue *q, VirtQueueElement **elems,
+                               unsigned int *num)
+{
+    unsigned int i;
+
+    if (!*num) {
+        return;
+    }
+
+    virtqueue_push_many(q->tx_vq, elems, virtio_net_tx_lens, *num);
+    virtio_notify(VIRTIO_DEVICE(q->n), q->tx_vq);
+    for (i = 0; i < *num; i++) {
+        virtqueue_element_free(elems[i]);
+    }
+    *num = 0;
+}
+
+/* Give back popped elements that were not processed, the last one first */
+static void virtio_net_tx_unpop(VirtIONetQueue *q, VirtQueueElement **elems,
+                                unsigned int num)
+{
+    while (num--) {
+        virtqueue_unpop(q->tx_vq, elems[num], 0);
+        virtqueue_element_free(elems[num]);
+    }
+}
+
 /* TX */
 static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
 {
     VirtIONet *n = q->n;
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
     VirtQueueElement *elem;
+    VirtQueueElement *popped[VIRTIO_NET_TX_BATCH];
+    VirtQueueElement *sent[VIRTIO_NET_TX_BATCH];
+    unsigned int num_popped = 0, next_popped = 0;
+    unsigned int num_sent = 0;
     int32_t num_packets = 0;
     int queue_index = vq2q(virtio_get_queue_index(q->tx_vq));
 
@@ -2774,10 +2813,17 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
         struct iovec sg[VIRTQUEUE_MAX_SIZE], sg2[VIRTQUEUE_MAX_SIZE + 1], *out_sg;
         struct virtio_net_hdr vhdr;
 
-        elem = virtqueue_pop(q->tx_vq, sizeof(VirtQueueElement));
-        if (!elem) {
-            break;
+        if (next_popped == num_popped) {
+            num_popped = virtqueue_pop_many(q->tx_vq, sizeof(VirtQueueElement),
+                                            (void **)popped,
+                                            MIN(ARRAY_SIZE(popped),
+                                                n->tx_burst - num_packets));
+            next_popped = 0;
+            if (!num_popped) {
+                break;
+            }
         }
+        elem = popped[next_popped++];
 
         out_num = elem->out_num;
         out_sg = elem->out_sg;
@@ -2834,13 +2880,17 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
         if (ret == 0) {
             virtio_queue_set_notification(q->tx_vq, 0);
             q->async_tx.elem = elem;
+            virtio_net_tx_unpop(q, &popped[next_popped],
+                                num_popped - next_popped);
+            virtio_net_tx_push(q, sent, &num_sent);
             return -EBUSY;
         }
 
 drop:
-        virtqueue_push(q->tx_vq, elem, 0);
-        virtio_notify(vdev, q->tx_vq);
-        g_free(elem);
+        sent[num_sent++] = elem;
+        if (num_sent == ARRAY_SIZE(sent)) {
+            virtio_net_tx_push(q, sent, &num_sent);
+        }
 
         //已发送的报文数超过burst,则停止发送
         if (++num_packets >= n->tx_burst) {
@@ -2848,12 +2898,16 @@ drop:
         }
     }
 
+    virtio_net_tx_push(q, sent, &num_sent);
+
     /*本轮发送的数目*/
     return num_packets;
 
 detach:
+    virtio_net_tx_unpop(q, &popped[next_popped], num_popped - next_popped);
+    virtio_net_tx_push(q, sent, &num_sent);
     virtqueue_detach_element(q->tx_vq, elem, 0);
-    g_free(elem);
+    virtqueue_element_free(elem);
     return -EINVAL;
 }
 
@@ -9,6 +9,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu/iova-tree.h"
+#include "qemu/lockable.h"
 #include "vhost-iova-tree.h"
 
 #define iova_min_addr qemu_real_host_page_size()
@@ -28,6 +29,20 @@ struct VhostIOVATree {
 
     /* IOVA address to qemu memory maps. */
     IOVATree *iova_taddr_map;
+
+    /*
+     * Serializes changes to the tree, done under the BQL, against lookups
+     * from shadow virtqueues that run in an IOThread.
+     */
+    QemuMutex lock;
+
+    /*
+     * Held by shadow virtqueues in an IOThread while they translate buffers
+     * and publish them to the device, and by the memory listener from the
+     * first change to the tree until the device has applied the matching
+     * DMA map or unmap.  Taken before @lock.
+     */
+    QemuMutex map_lock;
 };
 
 /**
@@ -44,6 +59,8 @@ VhostIOVATree *vhost_iova_tree_new(hwaddr iova_first, hwaddr iova_last)
     tree->iova_last = iova_last;
 
     tree->iova_taddr_map = iova_tree_new();
+    qemu_mutex_init(&tree->lock);
+    qemu_mutex_init(&tree->map_lock);
     return tree;
 }
 
@@ -53,6 +70,8 @@ VhostIOVATree *vhost_iova_tree_new(hwaddr iova_first, hwaddr iova_last)
 void vhost_iova_tree_delete(VhostIOVATree *iova_tree)
 {
     iova_tree_destroy(iova_tree->iova_taddr_map);
+    qemu_mutex_destroy(&iova_tree->map_lock);
+    qemu_mutex_destroy(&iova_tree->lock);
     g_free(iova_tree);
 }
 
@@ -62,7 +81,8 @@ void vhost_iova_tree_delete(VhostIOVATree *iova_tree)
  * @tree: The iova tree
  * @map: The map with the memory address
  *
- * Return the stored mapping, or NULL if not found.
+ * Return the stored mapping, or NULL if not found.  Only valid under the BQL,
+ * as the mapping can be removed as soon as it is released.
  */
 const DMAMap *vhost_iova_tree_find_iova(const VhostIOVATree *tree,
                                         const DMAMap *map)
@@ -70,6 +90,46 @@ const DMAMap *vhost_iova_tree_find_iova(const VhostIOVATree *tree,
     return iova_tree_find_iova(tree->iova_taddr_map, map);
 }
 
+/**
+ * Find the IOVA mapping of a memory address from any thread
+ *
+ * @tree: The iova tree
+ * @needle: The map with the memory address
+ * @map: Where to copy the stored mapping
+ *
+ * Return true if found.
+ */
+bool vhost_iova_tree_lookup(VhostIOVATree *tree, const DMAMap *needle,
+                            DMAMap *map)
+{
+    const DMAMap *found;
+
+    QEMU_LOCK_GUARD(&tree->lock);
+    found = iova_tree_find_iova(tree->iova_taddr_map, needle);
+    if (found) {
+        *map = *found;
+    }
+    return found != NULL;
+}
+
+/**
+ * Keep the mappings of the device in sync with the tree
+ *
+ * @tree: The iova tree
+ *
+ * While the lock is held, addresses that were translated with the tree stay
+ * mapped in the device.  See VhostIOVATree.map_lock.
+ */
+void vhost_iova_tree_map_lock(VhostIOVATree *tree)
+{
+    qemu_mutex_lock(&tree->map_lock);
+}
+
+void vhost_iova_tree_map_unlock(VhostIOVATree *tree)
+{
+    qemu_mutex_unlock(&tree->map_lock);
+}
+
 /**
  * Allocate a new mapping
  *
@@ -94,6 +154,7 @@ int vhost_iova_tree_map_alloc(VhostIOVATree *tree, DMAMap *map)
     }
 
     /* Allocate a node in IOVA address */
+    QEMU_LOCK_GUARD(&tree->lock);
     return iova_tree_alloc_map(tree->iova_taddr_map, map, iova_first,
                                tree->iova_last);
 }
@@ -106,5 +167,6 @@ int vhost_iova_tree_map_alloc(VhostIOVATree *tree, DMAMap *map)
  */
 void vhost_iova_tree_remove(VhostIOVATree *iova_tree, DMAMap map)
 {
+    QEMU_LOCK_GUARD(&iova_tree->lock);
     iova_tree_remove(iova_tree->iova_taddr_map, map);
 }
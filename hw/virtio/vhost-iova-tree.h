@@ -21,6 +21,10 @@ G_DEFINE_AUTOPTR_CLEANUP_FUNC(VhostIOVATree, vhost_iova_tree_delete);
 
 const DMAMap *vhost_iova_tree_find_iova(const VhostIOVATree *iova_tree,
                                         const DMAMap *map);
+bool vhost_iova_tree_lookup(VhostIOVATree *iova_tree, const DMAMap *needle,
+                            DMAMap *map);
+void vhost_iova_tree_map_lock(VhostIOVATree *iova_tree);
+void vhost_iova_tree_map_unlock(VhostIOVATree *iova_tree);
 int vhost_iova_tree_map_alloc(VhostIOVATree *iova_tree, DMAMap *map);
 void vhost_iova_tree_remove(VhostIOVATree *iova_tree, DMAMap map);
 
@@ -13,6 +13,7 @@
 #include "qemu/error-report.h"
 #include "qapi/error.h"
 #include "qemu/main-loop.h"
+#include "block/aio-wait.h"
 #include "qemu/log.h"
 #include "qemu/memalign.h"
 #include "linux-headers/linux/vhost.h"
@@ -78,10 +79,13 @@ uint16_t vhost_svq_available_slots(const VhostShadowVirtqueue *svq)
  * @vaddr: Translated IOVA addresses
  * @iovec: Source qemu's VA addresses
  * @num: Length of iovec and minimum length of vaddr
+ * @map: Copy of the last mapping used, IOMMU_NONE if none.  Buffers of an
+ *       element are usually backed by the same mapping, so the iova tree is
+ *       only searched when a buffer falls outside of it.
  */
 static bool vhost_svq_translate_addr(const VhostShadowVirtqueue *svq,
                                      hwaddr *addrs, const struct iovec *iovec,
-                                     size_t num)
+                                     size_t num, DMAMap *map)
 {
     if (num == 0) {
         return true;
@@ -95,16 +99,20 @@ static bool vhost_svq_translate_addr(const VhostShadowVirtqueue *svq,
         Int128 needle_last, map_last;
         size_t off;
 
-        const DMAMap *map = vhost_iova_tree_find_iova(svq->iova_tree, &needle);
-        /*
-         * Map cannot be NULL since iova map contains all guest space and
-         * qemu already has a physical address mapped
-         */
-        if (unlikely(!map)) {
-            qemu_log_mask(LOG_GUEST_ERROR,
-                          "Invalid address 0x%"HWADDR_PRIx" given by guest",
-                          needle.translated_addr);
-            return false;
+        if (map->perm == IOMMU_NONE ||
+            needle.translated_addr < map->translated_addr ||
+            needle.translated_addr - map->translated_addr > map->size) {
+            /*
+             * Map cannot be missing since iova map contains all guest space
+             * and qemu already has a physical address mapped
+             */
+            if (unlikely(!vhost_iova_tree_lookup(svq->iova_tree, &needle,
+                                                 map))) {
+                qemu_log_mask(LOG_GUEST_ERROR,
+                              "Invalid address 0x%"HWADDR_PRIx" given by guest",
+                              needle.translated_addr);
+                return false;
+            }
         }
 
         off = needle.translated_addr - map->translated_addr;
@@ -132,12 +140,14 @@ static bool vhost_svq_translate_addr(const VhostShadowVirtqueue *svq,
  * @num: iovec length
  * @more_descs: True if more descriptors come in the chain
  * @write: True if they are writeable descriptors
+ * @map: Translation cache, see vhost_svq_translate_addr
  *
  * Return true if success, false otherwise and print error.
  */
 static bool vhost_svq_vring_write_descs(VhostShadowVirtqueue *svq, hwaddr *sg,
                                         const struct iovec *iovec, size_t num,
-                                        bool more_descs, bool write)
+                                        bool more_descs, bool write,
+                                        DMAMap *map)
 {
     uint16_t i = svq->free_head, last = svq->free_head;
     unsigned n;
@@ -149,7 +159,7 @@ static bool vhost_svq_vring_write_descs(VhostShadowVirtqueue *svq, hwaddr *sg,
         return true;
     }
 
-    ok = vhost_svq_translate_addr(svq, sg, iovec, num);
+    ok = vhost_svq_translate_addr(svq, sg, iovec, num, map);
     if (unlikely(!ok)) {
         return false;
     }
@@ -179,6 +189,7 @@ static bool vhost_svq_add_split(VhostShadowVirtqueue *svq,
 {
     unsigned avail_idx;
     vring_avail_t *avail = svq->vring.avail;
+    DMAMap map = { .perm = IOMMU_NONE };
     bool ok;
     g_autofree hwaddr *sgs = g_new(hwaddr, MAX(out_num, in_num));
 
@@ -192,12 +203,13 @@ static bool vhost_svq_add_split(VhostShadowVirtqueue *svq,
     }
 
     ok = vhost_svq_vring_write_descs(svq, sgs, out_sg, out_num, in_num > 0,
-                                     false);
+                                     false, &map);
     if (unlikely(!ok)) {
         return false;
     }
 
-    ok = vhost_svq_vring_write_descs(svq, sgs, in_sg, in_num, false, true);
+    ok = vhost_svq_vring_write_descs(svq, sgs, in_sg, in_num, false, true,
+                                     &map);
     if (unlikely(!ok)) {
         return false;
     }
@@ -258,7 +270,18 @@ int vhost_svq_add(VhostShadowVirtqueue *svq, const struct iovec *out_sg,
         return -ENOSPC;
     }
 
+    /*
+     * In an IOThread, the memory listener may unmap guest memory at any time.
+     * Don't let it do so between translating the buffers and exposing them
+     * to the device.
+     */
+    if (svq->ctx) {
+        vhost_iova_tree_map_lock(svq->iova_tree);
+    }
     ok = vhost_svq_add_split(svq, out_sg, out_num, in_sg, in_num, &qemu_head);
+    if (svq->ctx) {
+        vhost_iova_tree_map_unlock(svq->iova_tree);
+    }
     if (unlikely(!ok)) {
         return -EINVAL;
     }
@@ -566,6 +589,135 @@ static void vhost_svq_handle_call(EventNotifier *n)
     vhost_svq_flush(svq, true);
 }
 
+static bool vhost_svq_kick_poll(void *opaque)
+{
+    EventNotifier *n = opaque;
+    VhostShadowVirtqueue *svq = container_of(n, VhostShadowVirtqueue,
+                                             svq_kick);
+
+    return !svq->next_guest_avail_elem && !virtio_queue_empty(svq->vq);
+}
+
+static void vhost_svq_kick_poll_ready(EventNotifier *n)
+{
+    VhostShadowVirtqueue *svq = container_of(n, VhostShadowVirtqueue,
+                                             svq_kick);
+
+    vhost_handle_guest_kick(svq);
+}
+
+static void vhost_svq_kick_poll_begin(EventNotifier *n)
+{
+    VhostShadowVirtqueue *svq = container_of(n, VhostShadowVirtqueue,
+                                             svq_kick);
+
+    virtio_queue_set_notification(svq->vq, false);
+}
+
+static void vhost_svq_kick_poll_end(EventNotifier *n)
+{
+    VhostShadowVirtqueue *svq = container_of(n, VhostShadowVirtqueue,
+                                             svq_kick);
+
+    /* Caller polls once more after this to catch kicks that race with us */
+    virtio_queue_set_notification(svq->vq, true);
+}
+
+static bool vhost_svq_call_poll(void *opaque)
+{
+    EventNotifier *n = opaque;
+    VhostShadowVirtqueue *svq = container_of(n, VhostShadowVirtqueue,
+                                             hdev_call);
+
+    return vhost_svq_more_used(svq);
+}
+
+static void vhost_svq_call_poll_ready(EventNotifier *n)
+{
+    VhostShadowVirtqueue *svq = container_of(n, VhostShadowVirtqueue,
+                                             hdev_call);
+
+    vhost_svq_flush(svq, true);
+}
+
+static void vhost_svq_call_poll_begin(EventNotifier *n)
+{
+    VhostShadowVirtqueue *svq = container_of(n, VhostShadowVirtqueue,
+                                             hdev_call);
+
+    vhost_svq_disable_notification(svq);
+}
+
+static void vhost_svq_call_poll_end(EventNotifier *n)
+{
+    VhostShadowVirtqueue *svq = container_of(n, VhostShadowVirtqueue,
+                                             hdev_call);
+
+    /* Caller polls once more after this, no need to check for used buffers */
+    vhost_svq_enable_notification(svq);
+}
+
+/**
+ * Relay the SVQ from its IOThread.
+ *
+ * @svq: Shadow virtqueue
+ *
+ * While the IOThread polls (see its poll-max-ns property), kicks and calls
+ * are disabled and the rings are checked directly instead.
+ */
+static void vhost_svq_attach_ctx(VhostShadowVirtqueue *svq)
+{
+    aio_set_event_notifier(svq->ctx, &svq->hdev_call, vhost_svq_handle_call,
+                           vhost_svq_call_poll, vhost_svq_call_poll_ready);
+    aio_set_event_notifier_poll(svq->ctx, &svq->hdev_call,
+                                vhost_svq_call_poll_begin,
+                                vhost_svq_call_poll_end);
+    if (event_notifier_get_fd(&svq->svq_kick) != VHOST_FILE_UNBIND) {
+        aio_set_event_notifier(svq->ctx, &svq->svq_kick,
+                               vhost_handle_guest_kick_notifier,
+                               vhost_svq_kick_poll, vhost_svq_kick_poll_ready);
+        aio_set_event_notifier_poll(svq->ctx, &svq->svq_kick,
+                                    vhost_svq_kick_poll_begin,
+                                    vhost_svq_kick_poll_end);
+        /* Process whatever the guest made available before the switch */
+        event_notifier_set(&svq->svq_kick);
+    }
+    /* And whatever the device used */
+    event_notifier_set(&svq->hdev_call);
+    svq->ctx_attached = true;
+}
+
+/* Called in the IOThread, so no handler can be running concurrently */
+static void vhost_svq_detach_ctx_bh(void *opaque)
+{
+    VhostShadowVirtqueue *svq = opaque;
+
+    aio_set_event_notifier(svq->ctx, &svq->hdev_call, NULL, NULL, NULL);
+    if (event_notifier_get_fd(&svq->svq_kick) != VHOST_FILE_UNBIND) {
+        aio_set_event_notifier(svq->ctx, &svq->svq_kick, NULL, NULL, NULL);
+    }
+}
+
+/* Stop relaying from the IOThread, so the SVQ can be changed under the BQL */
+static void vhost_svq_detach_ctx(VhostShadowVirtqueue *svq)
+{
+    qemu_bh_cancel(svq->attach_bh);
+    if (svq->ctx_attached) {
+        aio_wait_bh_oneshot(svq->ctx, vhost_svq_detach_ctx_bh, svq);
+        svq->ctx_attached = false;
+    }
+}
+
+/*
+ * Runs from the main loop once the device start that scheduled it is over,
+ * which is when the main loop handlers of a non-IOThread SVQ would start
+ * running too.
+ */
+static void vhost_svq_attach_bh(void *opaque)
+{
+    vhost_svq_attach_ctx(opaque);
+}
+
 /**
  * Set the call notifier for the SVQ to call the guest
  *
@@ -576,6 +728,12 @@ static void vhost_svq_handle_call(EventNotifier *n)
  */
 void vhost_svq_set_svq_call_fd(VhostShadowVirtqueue *svq, int call_fd)
 {
+    bool attached = svq->ctx_attached;
+
+    if (attached) {
+        vhost_svq_detach_ctx(svq);
+    }
+
     if (call_fd == VHOST_FILE_UNBIND) {
         /*
          * Fail event_notifier_set if called handling device call.
@@ -587,6 +745,10 @@ void vhost_svq_set_svq_call_fd(VhostShadowVirtqueue *svq, int call_fd)
     } else {
         event_notifier_init_fd(&svq->svq_call, call_fd);
     }
+
+    if (attached) {
+        vhost_svq_attach_ctx(svq);
+    }
 }
 
 /**
@@ -632,6 +794,19 @@ void vhost_svq_set_svq_kick_fd(VhostShadowVirtqueue *svq, int svq_kick_fd)
     bool poll_stop = VHOST_FILE_UNBIND != event_notifier_get_fd(svq_kick);
     bool poll_start = svq_kick_fd != VHOST_FILE_UNBIND;
 
+    if (svq->ctx) {
+        bool attached = svq->ctx_attached;
+
+        if (attached) {
+            vhost_svq_detach_ctx(svq);
+        }
+        event_notifier_init_fd(svq_kick, svq_kick_fd);
+        if (attached) {
+            vhost_svq_attach_ctx(svq);
+        }
+        return;
+    }
+
     if (poll_stop) {
         event_notifier_set_handler(svq_kick, NULL);
     }
@@ -661,7 +836,11 @@ void vhost_svq_start(VhostShadowVirtqueue *svq, VirtIODevice *vdev,
 {
     size_t desc_size;
 
-    event_notifier_set_handler(&svq->hdev_call, vhost_svq_handle_call);
+    if (svq->ctx) {
+        qemu_bh_schedule(svq->attach_bh);
+    } else {
+        event_notifier_set_handler(&svq->hdev_call, vhost_svq_handle_call);
+    }
     svq->next_guest_avail_elem = NULL;
     svq->shadow_avail_idx = 0;
     svq->shadow_used_idx = 0;
@@ -693,9 +872,13 @@ void vhost_svq_start(VhostShadowVirtqueue *svq, VirtIODevice *vdev,
  */
 void vhost_svq_stop(VhostShadowVirtqueue *svq)
 {
-    vhost_svq_set_svq_kick_fd(svq, VHOST_FILE_UNBIND);
     g_autofree VirtQueueElement *next_avail_elem = NULL;
 
+    if (svq->ctx) {
+        vhost_svq_detach_ctx(svq);
+    }
+    vhost_svq_set_svq_kick_fd(svq, VHOST_FILE_UNBIND);
+
     if (!svq->vq) {
         return;
     }
@@ -724,7 +907,9 @@ void vhost_svq_stop(VhostShadowVirtqueue *svq)
     g_free(svq->desc_state);
     munmap(svq->vring.desc, vhost_svq_driver_area_size(svq));
     munmap(svq->vring.used, vhost_svq_device_area_size(svq));
-    event_notifier_set_handler(&svq->hdev_call, NULL);
+    if (!svq->ctx) {
+        event_notifier_set_handler(&svq->hdev_call, NULL);
+    }
 }
 
 /**
@@ -733,15 +918,23 @@ void vhost_svq_stop(VhostShadowVirtqueue *svq)
  *
  * @ops: SVQ owner callbacks
  * @ops_opaque: ops opaque pointer
+ * @ctx: IOThread context to run the SVQ in, or NULL for the main loop.  The
+ *       owner callbacks always run in the main loop, so @ops must be NULL.
  */
 VhostShadowVirtqueue *vhost_svq_new(const VhostShadowVirtqueueOps *ops,
-                                    void *ops_opaque)
+                                    void *ops_opaque, AioContext *ctx)
 {
     VhostShadowVirtqueue *svq = g_new0(VhostShadowVirtqueue, 1);
 
+    assert(!ops || !ctx);
     event_notifier_init_fd(&svq->svq_kick, VHOST_FILE_UNBIND);
     svq->ops = ops;
     svq->ops_opaque = ops_opaque;
+    if (ctx) {
+        svq->ctx = ctx;
+        svq->attach_bh = aio_bh_new(iohandler_get_aio_context(),
+                                    vhost_svq_attach_bh, svq);
+    }
     return svq;
 }
 
@@ -754,5 +947,8 @@ void vhost_svq_free(gpointer pvq)
 {
     VhostShadowVirtqueue *vq = pvq;
     vhost_svq_stop(vq);
+    if (vq->attach_bh) {
+        qemu_bh_delete(vq->attach_bh);
+    }
     g_free(vq);
 }
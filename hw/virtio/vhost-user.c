@@ -266,10 +266,22 @@ struct vhost_user {
     struct vhost_memory_region shadow_regions[VHOST_USER_MAX_RAM_SLOTS];
 };
 
+/*
+ * Upper bound for the REPLY_ACK replies left unread while a batch of
+ * ADD_MEM_REG/REM_MEM_REG messages is sent.  A backend that answers each
+ * message before it reads the next one must not be able to fill the socket
+ * with replies while QEMU is still busy writing to it.
+ */
+#define VHOST_USER_MEM_REG_MAX_INFLIGHT 8
+
 struct scrub_regions {
     struct vhost_memory_region *region;
     int reg_idx;
     int fd_idx;
+    /* The REPLY_ACK reply to the message for this region is outstanding */
+    bool need_reply;
+    /* The backend applied the change, so the shadow table can follow */
+    bool done;
 };
 
 static int vhost_user_read_header(struct vhost_dev *dev, VhostUserMsg *msg)
@@ -624,8 +636,11 @@ static void scrub_shadow_regions(struct vhost_dev *dev,
          * create an entry for it in the removed list.
          */
         if (!matching) {
-            rem_reg[rm_idx].region = shadow_reg;
-            rem_reg[rm_idx++].reg_idx = i;
+            rem_reg[rm_idx] = (struct scrub_regions) {
+                .region = shadow_reg,
+                .reg_idx = i,
+            };
+            rm_idx++;
         }
     }
 
@@ -650,9 +665,12 @@ static void scrub_shadow_regions(struct vhost_dev *dev,
             continue;
         }
 
-        add_reg[add_idx].region = reg;
-        add_reg[add_idx].reg_idx = i;
-        add_reg[add_idx++].fd_idx = fd_num;
+        add_reg[add_idx] = (struct scrub_regions) {
+            .region = reg,
+            .reg_idx = i,
+            .fd_idx = fd_num,
+        };
+        add_idx++;
     }
     *nr_rem_reg = rm_idx;
     *nr_add_reg = add_idx;
@@ -660,25 +678,65 @@ static void scrub_shadow_regions(struct vhost_dev *dev,
     return;
 }
 
+/*
+ * Read the REPLY_ACK replies to the oldest pipelined @request messages for
+ * @regs until no more than @max_inflight of them are outstanding, and mark
+ * the regions that the backend acknowledged as done.
+ *
+ * Replies are read even after one reports an error so that the next
+ * message exchange is not confused by stale replies.  Only a broken
+ * connection or an unexpected message stops early.
+ */
+static int vhost_user_read_mem_reg_replies(struct vhost_dev *dev,
+                                           VhostUserRequest request,
+                                           struct scrub_regions *regs,
+                                           int nr_regs, int *inflight,
+                                           int max_inflight)
+{
+    VhostUserMsg msg_reply;
+    int i, ret, err = 0;
+
+    for (i = 0; i < nr_regs && *inflight > max_inflight; i++) {
+        if (!regs[i].need_reply) {
+            continue;
+        }
+        regs[i].need_reply = false;
+        (*inflight)--;
+
+        ret = vhost_user_read(dev, &msg_reply);
+        if (ret < 0) {
+            return ret;
+        }
+
+        if (msg_reply.hdr.request != request) {
+            error_report("Received unexpected msg type. "
+                         "Expected %d received %d",
+                         request, msg_reply.hdr.request);
+            return -EPROTO;
+        }
+
+        if (msg_reply.payload.u64) {
+            err = err ?: -EIO;
+        } else {
+            regs[i].done = true;
+        }
+    }
+
+    return err;
+}
+
 static int send_remove_regions(struct vhost_dev *dev,
                                struct scrub_regions *remove_reg,
                                int nr_rem_reg, VhostUserMsg *msg,
-                               bool reply_supported)
+                               bool reply_supported, int *inflight)
 {
-    struct vhost_user *u = dev->opaque;
     struct vhost_memory_region *shadow_reg;
-    int i, fd, shadow_reg_idx, ret;
+    int i, fd, ret;
     ram_addr_t offset;
     VhostUserMemoryRegion region_buffer;
 
-    /*
-     * The regions in remove_reg appear in the same order they do in the
-     * shadow table. Therefore we can minimize memory copies by iterating
-     * through remove_reg backwards.
-     */
-    for (i = nr_rem_reg - 1; i >= 0; i--) {
+    for (i = 0; i < nr_rem_reg; i++) {
         shadow_reg = remove_reg[i].region;
-        shadow_reg_idx = remove_reg[i].reg_idx;
 
         vhost_user_get_mr_data(shadow_reg->userspace_addr, &offset, &fd);
 
@@ -692,32 +750,62 @@ static int send_remove_regions(struct vhost_dev *dev,
                 return ret;
             }
 
-            if (reply_supported) {
-                ret = process_message_reply(dev, msg);
-                if (ret) {
+            if (reply_supported &&
+                (msg->hdr.flags & VHOST_USER_NEED_REPLY_MASK)) {
+                remove_reg[i].need_reply = true;
+                (*inflight)++;
+                ret = vhost_user_read_mem_reg_replies(dev,
+                        VHOST_USER_REM_MEM_REG, remove_reg, nr_rem_reg,
+                        inflight, VHOST_USER_MEM_REG_MAX_INFLIGHT - 1);
+                if (ret < 0) {
                     return ret;
                 }
+                continue;
             }
         }
 
-        /*
-         * At this point we know the backend has unmapped the region. It is now
-         * safe to remove it from the shadow table.
-         */
+        remove_reg[i].done = true;
+    }
+
+    return 0;
+}
+
+/*
+ * Removes the regions that the backend has unmapped from the shadow table.
+ * Regions whose removal failed stay in it, so that the next memory table
+ * update retries the removal.
+ */
+static void commit_remove_regions(struct vhost_dev *dev,
+                                  struct scrub_regions *remove_reg,
+                                  int nr_rem_reg)
+{
+    struct vhost_user *u = dev->opaque;
+    int i, shadow_reg_idx;
+
+    /*
+     * The regions in remove_reg appear in the same order they do in the
+     * shadow table. Therefore we can minimize memory copies by iterating
+     * through remove_reg backwards.
+     */
+    for (i = nr_rem_reg - 1; i >= 0; i--) {
+        if (!remove_reg[i].done) {
+            continue;
+        }
+
+        shadow_reg_idx = remove_reg[i].reg_idx;
         memmove(&u->shadow_regions[shadow_reg_idx],
                 &u->shadow_regions[shadow_reg_idx + 1],
                 sizeof(struct vhost_memory_region) *
                 (u->num_shadow_regions - shadow_reg_idx - 1));
         u->num_shadow_regions--;
     }
-
-    return 0;
 }
 
 static int send_add_regions(struct vhost_dev *dev,
                             struct scrub_regions *add_reg, int nr_add_reg,
                             VhostUserMsg *msg, uint64_t *shadow_pcb,
-                            bool reply_supported, bool track_ramblocks)
+                            bool reply_supported, bool track_ramblocks,
+                            int *inflight)
 {
     struct vhost_user *u = dev->opaque;
     int i, fd, ret, reg_idx, reg_fd_idx;
@@ -797,23 +885,54 @@ static int send_add_regions(struct vhost_dev *dev,
                                  dev->mem->regions[reg_idx].guest_phys_addr);
                     return -EPROTO;
                 }
-            } else if (reply_supported) {
-                ret = process_message_reply(dev, msg);
-                if (ret) {
+            } else if (reply_supported &&
+                       (msg->hdr.flags & VHOST_USER_NEED_REPLY_MASK)) {
+                add_reg[i].need_reply = true;
+                (*inflight)++;
+                ret = vhost_user_read_mem_reg_replies(dev,
+                        VHOST_USER_ADD_MEM_REG, add_reg, nr_add_reg,
+                        inflight, VHOST_USER_MEM_REG_MAX_INFLIGHT - 1);
+                if (ret < 0) {
                     return ret;
                 }
+                continue;
             }
         } else if (track_ramblocks) {
             u->region_rb_offset[reg_idx] = 0;
             u->region_rb[reg_idx] = NULL;
         }
 
-        /*
-         * At this point, we know the backend has mapped in the new
-         * region, if the region has a valid file descriptor.
-         *
-         * The region should now be added to the shadow table.
-         */
+        add_reg[i].done = true;
+    }
+
+    return 0;
+}
+
+/*
+ * Adds the regions that the backend has mapped to the shadow table.  Regions
+ * that the backend failed to map are left out, so that the next memory table
+ * update retries adding them.
+ */
+static int commit_add_regions(struct vhost_dev *dev,
+                              struct scrub_regions *add_reg, int nr_add_reg)
+{
+    struct vhost_user *u = dev->opaque;
+    struct vhost_memory_region *reg;
+    int i;
+
+    for (i = 0; i < nr_add_reg; i++) {
+        if (!add_reg[i].done) {
+            continue;
+        }
+
+        /* Only possible if removing old regions failed */
+        if (u->num_shadow_regions == VHOST_USER_MAX_RAM_SLOTS) {
+            error_report("vhost-user: Out of memory slots for the shadow "
+                         "memory table");
+            return -ENOSPC;
+        }
+
+        reg = add_reg[i].region;
         u->shadow_regions[u->num_shadow_regions].guest_phys_addr =
             reg->guest_phys_addr;
         u->shadow_regions[u->num_shadow_regions].userspace_addr =
@@ -826,6 +945,15 @@ static int send_add_regions(struct vhost_dev *dev,
     return 0;
 }
 
+/*
+ * The update is pipelined but stays synchronous: REM_MEM_REG and
+ * ADD_MEM_REG messages are sent back to back with at most
+ * VHOST_USER_MEM_REG_MAX_INFLIGHT REPLY_ACK replies left unread, so that
+ * neither side can block on a full socket while the other one does too.
+ * The shadow table only takes over the changes that the backend
+ * acknowledged, so after a failure it still describes the backend's memory
+ * table and the next update resends what is missing.
+ */
 static int vhost_user_add_remove_regions(struct vhost_dev *dev,
                                          VhostUserMsg *msg,
                                          bool reply_supported,
@@ -836,7 +964,9 @@ static int vhost_user_add_remove_regions(struct vhost_dev *dev,
     struct scrub_regions rem_reg[VHOST_USER_MAX_RAM_SLOTS];
     uint64_t shadow_pcb[VHOST_USER_MAX_RAM_SLOTS] = {};
     int nr_add_reg, nr_rem_reg;
-    int ret;
+    int64_t start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int inflight = 0;
+    int ret, reply_ret;
 
     msg->hdr.size = sizeof(msg->payload.mem_reg);
 
@@ -844,22 +974,46 @@ static int vhost_user_add_remove_regions(struct vhost_dev *dev,
     scrub_shadow_regions(dev, add_reg, &nr_add_reg, rem_reg, &nr_rem_reg,
                          shadow_pcb, track_ramblocks);
 
-    if (nr_rem_reg) {
-        ret = send_remove_regions(dev, rem_reg, nr_rem_reg, msg,
-                                  reply_supported);
-        if (ret < 0) {
-            goto err;
-        }
+    ret = send_remove_regions(dev, rem_reg, nr_rem_reg, msg, reply_supported,
+                              &inflight);
+
+    /*
+     * Don't add anything unless every region was removed, a region that is
+     * still mapped might overlap with a new one.  Draining the REM_MEM_REG
+     * replies first also keeps them out of the way of the replies postcopy
+     * reads for each ADD_MEM_REG.  If the connection itself is broken, the
+     * remaining replies are lost and the regions are treated as failed.
+     */
+    if (ret == 0 || ret == -EIO) {
+        reply_ret = vhost_user_read_mem_reg_replies(dev,
+                                                    VHOST_USER_REM_MEM_REG,
+                                                    rem_reg, nr_rem_reg,
+                                                    &inflight, 0);
+        ret = ret ?: reply_ret;
     }
 
-    if (nr_add_reg) {
+    if (ret == 0) {
         ret = send_add_regions(dev, add_reg, nr_add_reg, msg, shadow_pcb,
-                               reply_supported, track_ramblocks);
-        if (ret < 0) {
-            goto err;
+                               reply_supported, track_ramblocks, &inflight);
+        if (ret == 0 || ret == -EIO) {
+            reply_ret = vhost_user_read_mem_reg_replies(dev,
+                                                        VHOST_USER_ADD_MEM_REG,
+                                                        add_reg, nr_add_reg,
+                                                        &inflight, 0);
+            ret = ret ?: reply_ret;
         }
     }
 
+    commit_remove_regions(dev, rem_reg, nr_rem_reg);
+    reply_ret = commit_add_regions(dev, add_reg, nr_add_reg);
+    ret = ret ?: reply_ret;
+    if (ret < 0) {
+        goto err;
+    }
+
+    trace_vhost_user_add_remove_regions(nr_rem_reg, nr_add_reg,
+        qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start_ns);
+
     if (track_ramblocks) {
         memcpy(u->postcopy_client_bases, shadow_pcb,
                sizeof(uint64_t) * VHOST_USER_MAX_RAM_SLOTS);
@@ -173,17 +173,54 @@ static void vhost_vdpa_iotlb_batch_begin_once(VhostVDPAShared *s)
     s->iotlb_batch_begin_sent = true;
 }
 
-static void vhost_vdpa_listener_commit(MemoryListener *listener)
+static bool vhost_vdpa_iotlb_batching(VhostVDPAShared *s)
 {
-    VhostVDPAShared *s = container_of(listener, VhostVDPAShared, listener);
-    struct vhost_msg_v2 msg = {};
-    int fd = s->device_fd;
+    return s->backend_cap & (0x1ULL << VHOST_BACKEND_F_IOTLB_BATCH) &&
+           s->iotlb_batch_begin_sent;
+}
 
-    if (!(s->backend_cap & (0x1ULL << VHOST_BACKEND_F_IOTLB_BATCH))) {
-        return;
+/*
+ * Called before changing the iova tree.  Returns false if the tree is not
+ * in use.
+ *
+ * Shadow virtqueues in an IOThread translate guest buffers concurrently.
+ * Keep them from publishing an address that is being unmapped, or that the
+ * device only maps at the end of the batch, until the device has the new
+ * mappings.
+ */
+static bool vhost_vdpa_listener_map_lock(VhostVDPAShared *s)
+{
+    if (!s->shadow_data) {
+        return false;
+    }
+    if (!s->svq_ctx || s->iova_tree_map_locked) {
+        return true;
+    }
+
+    vhost_iova_tree_map_lock(s->iova_tree);
+    if (!s->shadow_data) {
+        vhost_iova_tree_map_unlock(s->iova_tree);
+        return false;
+    }
+    s->iova_tree_map_locked = true;
+    return true;
+}
+
+/* Called once the device has been sent the change to the iova tree */
+static void vhost_vdpa_listener_map_unlock(VhostVDPAShared *s)
+{
+    if (s->iova_tree_map_locked && !vhost_vdpa_iotlb_batching(s)) {
+        s->iova_tree_map_locked = false;
+        vhost_iova_tree_map_unlock(s->iova_tree);
     }
+}
+
+static void vhost_vdpa_listener_end_batch(VhostVDPAShared *s)
+{
+    struct vhost_msg_v2 msg = {};
+    int fd = s->device_fd;
 
-    if (!s->iotlb_batch_begin_sent) {
+    if (!vhost_vdpa_iotlb_batching(s)) {
         return;
     }
 
@@ -199,6 +236,14 @@ static void vhost_vdpa_listener_commit(MemoryListener *listener)
     s->iotlb_batch_begin_sent = false;
 }
 
+static void vhost_vdpa_listener_commit(MemoryListener *listener)
+{
+    VhostVDPAShared *s = container_of(listener, VhostVDPAShared, listener);
+
+    vhost_vdpa_listener_end_batch(s);
+    vhost_vdpa_listener_map_unlock(s);
+}
+
 static void vhost_vdpa_iommu_map_notify(IOMMUNotifier *n, IOMMUTLBEntry *iotlb)
 {
     struct vdpa_iommu *iommu = container_of(n, struct vdpa_iommu, n);
@@ -358,7 +403,7 @@ static void vhost_vdpa_listener_region_add(MemoryListener *listener,
                                          vaddr, section->readonly);
 
     llsize = int128_sub(llend, int128_make64(iova));
-    if (s->shadow_data) {
+    if (vhost_vdpa_listener_map_lock(s)) {
         int r;
 
         mem_region.translated_addr = (hwaddr)(uintptr_t)vaddr,
@@ -368,6 +413,7 @@ static void vhost_vdpa_listener_region_add(MemoryListener *listener,
         r = vhost_iova_tree_map_alloc(s->iova_tree, &mem_region);
         if (unlikely(r != IOVA_OK)) {
             error_report("Can't allocate a mapping (%d)", r);
+            vhost_vdpa_listener_map_unlock(s);
             goto fail;
         }
 
@@ -382,12 +428,14 @@ static void vhost_vdpa_listener_region_add(MemoryListener *listener,
         goto fail_map;
     }
 
+    vhost_vdpa_listener_map_unlock(s);
     return;
 
 fail_map:
     if (s->shadow_data) {
         vhost_iova_tree_remove(s->iova_tree, mem_region);
     }
+    vhost_vdpa_listener_map_unlock(s);
 
 fail:
     /*
@@ -438,7 +486,7 @@ static void vhost_vdpa_listener_region_del(MemoryListener *listener,
 
     llsize = int128_sub(llend, int128_make64(iova));
 
-    if (s->shadow_data) {
+    if (vhost_vdpa_listener_map_lock(s)) {
         const DMAMap *result;
         const void *vaddr = memory_region_get_ram_ptr(section->mr) +
             section->offset_within_region +
@@ -451,6 +499,7 @@ static void vhost_vdpa_listener_region_del(MemoryListener *listener,
         result = vhost_iova_tree_find_iova(s->iova_tree, &mem_region);
         if (!result) {
             /* The memory listener map wasn't mapped */
+            vhost_vdpa_listener_map_unlock(s);
             return;
         }
         iova = result->iova;
@@ -480,6 +529,7 @@ static void vhost_vdpa_listener_region_del(MemoryListener *listener,
                      "0x%" HWADDR_PRIx ") = %d (%m)",
                      s, iova, int128_get64(llsize), ret);
     }
+    vhost_vdpa_listener_map_unlock(s);
 
     memory_region_unref(section->mr);
 }
@@ -587,7 +637,9 @@ static void vhost_vdpa_init_svq(struct vhost_dev *hdev, struct vhost_vdpa *v)
     for (unsigned n = 0; n < hdev->nvqs; ++n) {
         VhostShadowVirtqueue *svq;
 
-        svq = vhost_svq_new(v->shadow_vq_ops, v->shadow_vq_ops_opaque);
+        /* Only SVQs without owner callbacks can leave the main loop */
+        svq = vhost_svq_new(v->shadow_vq_ops, v->shadow_vq_ops_opaque,
+                            v->shadow_vq_ops ? NULL : v->shared->svq_ctx);
         g_ptr_array_add(shadow_vqs, svq);
     }
 
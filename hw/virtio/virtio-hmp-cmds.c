@@ -241,6 +241,8 @@ void hmp_virtio_queue_status(Monitor *mon, const QDict *qdict)
                    s->signalled_used);
     monitor_printf(mon, "  signalled_used_valid: %s\n",
                    s->signalled_used_valid ? "true" : "false");
+    monitor_printf(mon, "  notify_avoided:       %"PRIu64"\n",
+                   s->notify_avoided);
     if (s->has_last_avail_idx) {
         monitor_printf(mon, "  last_avail_idx:       %d\n",
                        s->last_avail_idx);
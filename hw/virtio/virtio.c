@@ -12,11 +12,14 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/units.h"
 #include "qapi/error.h"
+#include "qapi/visitor.h"
 #include "qapi/qapi-commands-virtio.h"
 #include "trace.h"
 #include "qemu/defer-call.h"
 #include "qemu/error-report.h"
+#include "qemu/lockable.h"
 #include "qemu/log.h"
 #include "qemu/main-loop.h"
 #include "qemu/module.h"
@@ -27,11 +30,13 @@
 #include "hw/virtio/vhost.h"
 #include "migration/qemu-file-types.h"
 #include "qemu/atomic.h"
+#include "qemu/coroutine-tls.h"
 #include "hw/virtio/virtio-bus.h"
 #include "hw/qdev-properties.h"
 #include "hw/virtio/virtio-access.h"
 #include "sysemu/dma.h"
 #include "sysemu/runstate.h"
+#include "sysemu/xen.h"
 #include "virtio-qmp.h"
 
 #include "standard-headers/linux/virtio_ids.h"
@@ -94,11 +99,30 @@ typedef struct VRingUsed
     VRingUsedElem ring[];
 } VRingUsed;
 
+/*
+ * Windows of guest RAM that virtqueue_map_desc() maps with a range check
+ * instead of an address_space_map() lookup.
+ */
+#define VIRTIO_MAP_CACHE_SIZE 4
+#define VIRTIO_MAP_CACHE_WINDOW (1 * GiB)
+
+typedef struct VRingMapCacheEntry {
+    hwaddr addr;
+    MemoryRegionCache cache;
+} VRingMapCacheEntry;
+
 typedef struct VRingMemoryRegionCaches {
     struct rcu_head rcu;
     MemoryRegionCache desc;
     MemoryRegionCache avail;
     MemoryRegionCache used;
+
+    /*
+     * Filled lazily by the thread that pops from the virtqueue, and thrown
+     * away with the rest of the caches on every memory topology change.
+     */
+    VRingMapCacheEntry map[VIRTIO_MAP_CACHE_SIZE];
+    unsigned int map_next;
 } VRingMemoryRegionCaches;
 
 typedef struct VRing
@@ -155,6 +179,19 @@ struct VirtQueue
     EventNotifier host_notifier;
     bool host_notifier_enabled;
     QLIST_ENTRY(VirtQueue) node;
+
+    /* Interrupt moderation state, see virtio_irq_coalesce() */
+    QEMUTimer *irq_timer;
+    AioContext *irq_timer_ctx;
+    int64_t irq_last_ns;
+    int64_t irq_interval_ns;
+    unsigned int irq_frames;
+    bool irq_pending;
+    bool irq_pending_irqfd;
+
+    /* Between io_poll_begin and io_poll_end of the host notifier */
+    bool polling;
+    uint64_t notify_avoided;
 };
 
 const char *virtio_device_names[] = {
@@ -210,10 +247,15 @@ static const char *virtio_id_to_name(uint16_t device_id)
 /* Called within call_rcu().  */
 static void virtio_free_region_cache(VRingMemoryRegionCaches *caches)
 {
+    int i;
+
     assert(caches != NULL);
     address_space_cache_destroy(&caches->desc);
     address_space_cache_destroy(&caches->avail);
     address_space_cache_destroy(&caches->used);
+    for (i = 0; i < VIRTIO_MAP_CACHE_SIZE; i++) {
+        address_space_cache_destroy(&caches->map[i].cache);
+    }
     g_free(caches);
 }
 
@@ -881,8 +923,9 @@ void virtqueue_unpop(VirtQueue *vq, const VirtQueueElement *elem,
                      unsigned int len)
 {
 
+    /* A packed ring element takes up one slot per descriptor */
     if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
-        virtqueue_packed_rewind(vq, 1);
+        virtqueue_packed_rewind(vq, elem->ndescs);
     } else {
         virtqueue_split_rewind(vq, 1);
     }
@@ -1183,6 +1226,31 @@ void virtqueue_push(VirtQueue *vq, const VirtQueueElement *elem,
     virtqueue_flush(vq, 1);
 }
 
+/* virtqueue_push_many:
+ * @vq: The #VirtQueue
+ * @elems: Elements to complete
+ * @lens: Number of bytes written to each element
+ * @n: Number of elements
+ *
+ * Complete @n elements and publish them to the guest with a single used
+ * index update.  The caller still owns, and must free, the elements.
+ */
+void virtqueue_push_many(VirtQueue *vq, VirtQueueElement *const *elems,
+                         const unsigned int *lens, unsigned int n)
+{
+    unsigned int i;
+
+    if (!n) {
+        return;
+    }
+
+    RCU_READ_LOCK_GUARD();
+    for (i = 0; i < n; i++) {
+        virtqueue_fill(vq, elems[i], lens[i], i);
+    }
+    virtqueue_flush(vq, n);
+}
+
 /* Called within rcu_read_lock().  */
 static int virtqueue_num_heads(VirtQueue *vq, unsigned int idx)
 {
@@ -1567,7 +1635,67 @@ int virtqueue_avail_bytes(VirtQueue *vq, unsigned int in_bytes,
     return in_bytes <= in_total && out_bytes <= out_total;
 }
 
-static bool virtqueue_map_desc(VirtIODevice *vdev, unsigned int *p_num_sg,
+/* Called within rcu_read_lock().  */
+static bool virtqueue_map_cache_fill(VirtIODevice *vdev,
+                                     VRingMapCacheEntry *e, hwaddr addr)
+{
+    address_space_cache_destroy(&e->cache);
+    e->addr = addr;
+    address_space_cache_init(&e->cache, vdev->dma_as, addr,
+                             VIRTIO_MAP_CACHE_WINDOW, true);
+    trace_virtqueue_map_cache_fill(vdev, addr, e->cache.ptr ? e->cache.len : 0);
+    return e->cache.ptr != NULL;
+}
+
+/*
+ * Map @pa through the per-queue RAM windows, like dma_memory_map() would
+ * for writable RAM.  The mapping is released by the usual dma_memory_unmap(),
+ * so take the same MemoryRegion reference address_space_map() takes.
+ *
+ * Returns NULL if @pa is not plain RAM; the caller then falls back to
+ * dma_memory_map().  Called within rcu_read_lock().
+ */
+static void *virtqueue_map_cached(VirtIODevice *vdev,
+                                  VRingMemoryRegionCaches *caches,
+                                  hwaddr pa, hwaddr *plen)
+{
+    VRingMapCacheEntry *e;
+    hwaddr offset;
+    int i;
+
+    /* The Xen map cache needs to see every mapping */
+    if (!caches || xen_enabled()) {
+        return NULL;
+    }
+
+    for (i = 0; i < VIRTIO_MAP_CACHE_SIZE; i++) {
+        e = &caches->map[i];
+        if (e->cache.ptr && pa >= e->addr && pa - e->addr < e->cache.len) {
+            goto hit;
+        }
+    }
+
+    e = &caches->map[caches->map_next];
+    caches->map_next = (caches->map_next + 1) % VIRTIO_MAP_CACHE_SIZE;
+    offset = pa % VIRTIO_MAP_CACHE_WINDOW;
+    if (!virtqueue_map_cache_fill(vdev, e, pa - offset) ||
+        offset >= e->cache.len) {
+        /* RAM that does not start on a window boundary */
+        if (!virtqueue_map_cache_fill(vdev, e, pa)) {
+            return NULL;
+        }
+    }
+
+hit:
+    offset = pa - e->addr;
+    *plen = MIN(*plen, e->cache.len - offset);
+    memory_region_ref(e->cache.mrs.mr);
+    return e->cache.ptr + offset;
+}
+
+static bool virtqueue_map_desc(VirtIODevice *vdev,
+                               VRingMemoryRegionCaches *caches,
+                               unsigned int *p_num_sg,
                                hwaddr *addr, struct iovec *iov,
                                unsigned int max_num_sg, bool is_write,
                                hwaddr pa, size_t sz)
@@ -1591,11 +1719,14 @@ static bool virtqueue_map_desc(VirtIODevice *vdev, unsigned int *p_num_sg,
             goto out;
         }
 
-        iov[num_sg].iov_base = dma_memory_map(vdev->dma_as, pa, &len,
-                                              is_write ?
-                                              DMA_DIRECTION_FROM_DEVICE :
-                                              DMA_DIRECTION_TO_DEVICE,
-                                              MEMTXATTRS_UNSPECIFIED);
+        iov[num_sg].iov_base = virtqueue_map_cached(vdev, caches, pa, &len);
+        if (!iov[num_sg].iov_base) {
+            iov[num_sg].iov_base = dma_memory_map(vdev->dma_as, pa, &len,
+                                                  is_write ?
+                                                  DMA_DIRECTION_FROM_DEVICE :
+                                                  DMA_DIRECTION_TO_DEVICE,
+                                                  MEMTXATTRS_UNSPECIFIED);
+        }
         if (!iov[num_sg].iov_base) {
             virtio_error(vdev, "virtio: bogus descriptor or out of resources");
             goto out;
@@ -1665,6 +1796,87 @@ void virtqueue_map(VirtIODevice *vdev, VirtQueueElement *elem)
 }
 
 //申请in,out指定数目的elem
+/*
+ * Elements are allocated and freed for every request, so small ones are
+ * recycled through a per-thread pool of fixed size buffers instead of going
+ * through malloc each time.  Only virtqueue_element_free() returns buffers
+ * to the pool; pooled elements that are released with g_free() are simply
+ * not reused.
+ */
+#define VIRTQUEUE_ELEM_POOL_BUF_SIZE 1024
+#define VIRTQUEUE_ELEM_POOL_MAX_SIZE 256
+
+typedef struct VirtQueueElementPoolBuf {
+    QSLIST_ENTRY(VirtQueueElementPoolBuf) next;
+} VirtQueueElementPoolBuf;
+
+typedef struct VirtQueueElementPool {
+    QSLIST_HEAD(, VirtQueueElementPoolBuf) bufs;
+    unsigned int size;
+    Notifier cleanup_notifier;
+} VirtQueueElementPool;
+
+QEMU_DEFINE_STATIC_CO_TLS(VirtQueueElementPool, elem_pool);
+
+static void elem_pool_cleanup(Notifier *n, void *value)
+{
+    VirtQueueElementPool *pool = get_ptr_elem_pool();
+    VirtQueueElementPoolBuf *buf;
+
+    while ((buf = QSLIST_FIRST(&pool->bufs))) {
+        QSLIST_REMOVE_HEAD(&pool->bufs, next);
+        g_free(buf);
+    }
+    pool->size = 0;
+}
+
+static void *elem_pool_get(void)
+{
+    VirtQueueElementPool *pool = get_ptr_elem_pool();
+    VirtQueueElementPoolBuf *buf = QSLIST_FIRST(&pool->bufs);
+
+    if (!buf) {
+        return g_malloc(VIRTQUEUE_ELEM_POOL_BUF_SIZE);
+    }
+    QSLIST_REMOVE_HEAD(&pool->bufs, next);
+    pool->size--;
+    return buf;
+}
+
+/*
+ * virtqueue_element_free:
+ * @elem: An element returned by virtqueue_pop() or virtqueue_pop_many(),
+ *        or NULL
+ *
+ * Free @elem, keeping its memory for later elements if it came from the
+ * element pool.  Elements may also be freed with g_free(), but then their
+ * memory is not recycled.
+ */
+void virtqueue_element_free(void *elem)
+{
+    VirtQueueElement *e = elem;
+    VirtQueueElementPool *pool;
+    VirtQueueElementPoolBuf *buf = elem;
+
+    if (!e || !e->pooled) {
+        g_free(elem);
+        return;
+    }
+
+    pool = get_ptr_elem_pool();
+    if (pool->size >= VIRTQUEUE_ELEM_POOL_MAX_SIZE) {
+        g_free(elem);
+        return;
+    }
+
+    if (!pool->cleanup_notifier.notify) {
+        pool->cleanup_notifier.notify = elem_pool_cleanup;
+        qemu_thread_atexit_add(&pool->cleanup_notifier);
+    }
+    QSLIST_INSERT_HEAD(&pool->bufs, buf, next);
+    pool->size++;
+}
+
 static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_num)
 {
     VirtQueueElement *elem;
@@ -1684,7 +1896,13 @@ static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_nu
     assert(sz >= sizeof(VirtQueueElement));
 
     //申请elem
-    elem = g_malloc(out_sg_end);
+    if (out_sg_end <= VIRTQUEUE_ELEM_POOL_BUF_SIZE) {
+        elem = elem_pool_get();
+        elem->pooled = true;
+    } else {
+        elem = g_malloc(out_sg_end);
+        elem->pooled = false;
+    }
     trace_virtqueue_alloc_element(elem, sz, in_num, out_num);
     elem->out_num = out_num;
     elem->in_num = in_num;
@@ -1695,7 +1913,12 @@ static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_nu
     return elem;
 }
 
-static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
+/*
+ * Called within rcu_read_lock(), once the caller has seen a non-empty
+ * avail ring and issued the matching smp_rmb().  The caller is also
+ * responsible for publishing the avail event.
+ */
+static void *virtqueue_split_pop_rcu(VirtQueue *vq, size_t sz)
 {
     unsigned int i, head, max, idx;
     VRingMemoryRegionCaches *caches;
@@ -1712,14 +1935,6 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
 
     address_space_cache_init_empty(&indirect_desc_cache);
 
-    RCU_READ_LOCK_GUARD();
-    if (virtio_queue_empty_rcu(vq)) {
-        goto done;
-    }
-    /* Needed after virtio_queue_empty(), see comment in
-     * virtqueue_num_heads(). */
-    smp_rmb();
-
     /* When we start there are none of either input nor output. */
     out_num = in_num = elem_entries = 0;
 
@@ -1734,10 +1949,6 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
         goto done;
     }
 
-    if (virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
-        vring_set_avail_event(vq, vq->last_avail_idx);
-    }
-
     i = head;
 
     caches = vring_get_region_caches(vq);
@@ -1778,7 +1989,7 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
         bool map_ok;
 
         if (desc.flags & VRING_DESC_F_WRITE) {
-            map_ok = virtqueue_map_desc(vdev, &in_num, addr + out_num,
+            map_ok = virtqueue_map_desc(vdev, caches, &in_num, addr + out_num,
                                         iov + out_num,
                                         VIRTQUEUE_MAX_SIZE - out_num, true,
                                         desc.addr, desc.len);
@@ -1787,7 +1998,7 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
                 virtio_error(vdev, "Incorrect order for descriptors");
                 goto err_undo_map;
             }
-            map_ok = virtqueue_map_desc(vdev, &out_num, addr, iov,
+            map_ok = virtqueue_map_desc(vdev, caches, &out_num, addr, iov,
                                         VIRTQUEUE_MAX_SIZE, false,
                                         desc.addr, desc.len);
         }
@@ -1841,6 +2052,67 @@ err_undo_map:
     goto done;
 }
 
+static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
+{
+    VirtQueueElement *elem;
+    uint16_t old_avail_idx = vq->last_avail_idx;
+
+    RCU_READ_LOCK_GUARD();
+    if (virtio_queue_empty_rcu(vq)) {
+        return NULL;
+    }
+    /* Needed after virtio_queue_empty(), see comment in
+     * virtqueue_num_heads(). */
+    smp_rmb();
+
+    elem = virtqueue_split_pop_rcu(vq, sz);
+
+    if (vq->last_avail_idx != old_avail_idx &&
+        virtio_vdev_has_feature(vq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
+        vring_set_avail_event(vq, vq->last_avail_idx);
+    }
+    return elem;
+}
+
+/*
+ * Pop up to @max elements with a single read of the avail index, a single
+ * read barrier and, with VIRTIO_RING_F_EVENT_IDX, a single avail event
+ * update for the whole batch.
+ */
+static unsigned int virtqueue_split_pop_many(VirtQueue *vq, size_t sz,
+                                             void **elems, unsigned int max)
+{
+    uint16_t old_avail_idx = vq->last_avail_idx;
+    unsigned int n = 0;
+    int num_heads;
+
+    RCU_READ_LOCK_GUARD();
+    if (unlikely(!vq->vring.avail)) {
+        return 0;
+    }
+
+    /* Issues the smp_rmb() that orders the descriptor reads below. */
+    num_heads = virtqueue_num_heads(vq, vq->last_avail_idx);
+    if (num_heads <= 0) {
+        return 0;
+    }
+
+    max = MIN(max, (unsigned int)num_heads);
+    while (n < max) {
+        elems[n] = virtqueue_split_pop_rcu(vq, sz);
+        if (!elems[n]) {
+            break;
+        }
+        n++;
+    }
+
+    if (vq->last_avail_idx != old_avail_idx &&
+        virtio_vdev_has_feature(vq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
+        vring_set_avail_event(vq, vq->last_avail_idx);
+    }
+    return n;
+}
+
 static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
 {
     unsigned int i, max;
@@ -1916,7 +2188,7 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
         bool map_ok;
 
         if (desc.flags & VRING_DESC_F_WRITE) {
-            map_ok = virtqueue_map_desc(vdev, &in_num, addr + out_num,
+            map_ok = virtqueue_map_desc(vdev, caches, &in_num, addr + out_num,
                                         iov + out_num,
                                         VIRTQUEUE_MAX_SIZE - out_num, true,
                                         desc.addr, desc.len);
@@ -1925,7 +2197,7 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
                 virtio_error(vdev, "Incorrect order for descriptors");
                 goto err_undo_map;
             }
-            map_ok = virtqueue_map_desc(vdev, &out_num, addr, iov,
+            map_ok = virtqueue_map_desc(vdev, caches, &out_num, addr, iov,
                                         VIRTQUEUE_MAX_SIZE, false,
                                         desc.addr, desc.len);
         }
@@ -2006,6 +2278,43 @@ void *virtqueue_pop(VirtQueue *vq, size_t sz)
     }
 }
 
+/* virtqueue_pop_many:
+ * @vq: The #VirtQueue
+ * @sz: Size of each element, as for virtqueue_pop()
+ * @elems: Array receiving the popped elements
+ * @max: Maximum number of elements to pop
+ *
+ * Pop up to @max elements at once.  For split rings the avail index is read,
+ * and the avail event published, once per batch rather than once per
+ * element.  Elements are returned in ring order and are freed exactly like
+ * those returned by virtqueue_pop().
+ *
+ * Returns: the number of elements stored in @elems.
+ */
+unsigned int virtqueue_pop_many(VirtQueue *vq, size_t sz, void **elems,
+                                unsigned int max)
+{
+    unsigned int n = 0;
+
+    if (virtio_device_disabled(vq->vdev)) {
+        return 0;
+    }
+
+    if (!virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+        return virtqueue_split_pop_many(vq, sz, elems, max);
+    }
+
+    RCU_READ_LOCK_GUARD();
+    while (n < max) {
+        elems[n] = virtqueue_packed_pop(vq, sz);
+        if (!elems[n]) {
+            break;
+        }
+        n++;
+    }
+    return n;
+}
+
 //丢掉vq中所有报文
 static unsigned int virtqueue_packed_drop_all(VirtQueue *vq)
 {
@@ -2310,6 +2619,17 @@ static void __virtio_queue_reset(VirtIODevice *vdev, uint32_t i)
     vdev->vq[i].notification = true;
     vdev->vq[i].vring.num = vdev->vq[i].vring.num_default;
     vdev->vq[i].inuse = 0;
+    WITH_QEMU_LOCK_GUARD(&vdev->irq_coalesce_lock) {
+        /* The guest must not see an interrupt for a ring it has reset */
+        if (vdev->vq[i].irq_timer) {
+            timer_del(vdev->vq[i].irq_timer);
+        }
+        qatomic_set(&vdev->vq[i].irq_pending, false);
+        vdev->vq[i].irq_frames = 0;
+        vdev->vq[i].irq_last_ns = 0;
+        vdev->vq[i].irq_interval_ns = 0;
+    }
+    vdev->vq[i].notify_avoided = 0;
     virtio_virtqueue_reset_region_cache(&vdev->vq[i]);
 }
 
@@ -2605,6 +2925,8 @@ void virtio_delete_queue(VirtQueue *vq)
     vq->handle_output = NULL;
     g_free(vq->used_elems);
     vq->used_elems = NULL;
+    timer_free(vq->irq_timer);
+    vq->irq_timer = NULL;
     virtio_virtqueue_reset_region_cache(vq);
 }
 
@@ -2706,6 +3028,127 @@ static bool virtio_should_notify(VirtIODevice *vdev, VirtQueue *vq)
     }
 }
 
+/* Deliver a notification that virtio_irq_coalesce() held back */
+static void virtio_irq_coalesce_fire_locked(VirtQueue *vq)
+{
+    if (!qatomic_read(&vq->irq_pending)) {
+        return;
+    }
+
+    trace_virtio_irq_coalesce_fire(vq->vdev, vq, vq->irq_frames);
+    qatomic_set(&vq->irq_pending, false);
+    vq->irq_frames = 0;
+    virtio_set_isr(vq->vdev, 0x1);
+    if (vq->irq_pending_irqfd) {
+        event_notifier_set(&vq->guest_notifier);
+    } else {
+        virtio_notify_vector(vq->vdev, vq->vector);
+    }
+}
+
+static void virtio_irq_coalesce_fire(VirtQueue *vq)
+{
+    if (!qatomic_read(&vq->irq_pending)) {
+        return;
+    }
+
+    QEMU_LOCK_GUARD(&vq->vdev->irq_coalesce_lock);
+    virtio_irq_coalesce_fire_locked(vq);
+}
+
+static void virtio_irq_coalesce_timer_cb(void *opaque)
+{
+    virtio_irq_coalesce_fire(opaque);
+}
+
+/*
+ * Apply the device's interrupt moderation policy to a completion on @vq.
+ * @notify is the result of virtio_should_notify(), so EVENT_IDX and
+ * VRING_AVAIL_F_NO_INTERRUPT still decide whether the guest wants an
+ * interrupt at all; moderation only delays the ones it asked for, by at
+ * most irq-coalesce-max-usecs of guest time, and sends them early once
+ * irq-coalesce-max-frames completions are waiting.  In adaptive mode,
+ * queues whose completions are further apart than the time limit are not
+ * delayed at all.
+ *
+ * The moderation state is protected by vdev->irq_coalesce_lock, because
+ * the timer may fire in a different thread than the one completing
+ * requests, and the main loop flushes it when the VM stops.  The timer is
+ * created in the AioContext that completed the first deferred request and
+ * stays there until virtio_queue_aio_detach_host_notifier() cancels and
+ * frees it when the queue leaves that context.
+ *
+ * Returns true if no interrupt must be sent now.
+ */
+static bool virtio_irq_coalesce(VirtIODevice *vdev, VirtQueue *vq,
+                                bool notify, bool irqfd)
+{
+    uint32_t usecs = qatomic_read(&vdev->irq_coalesce_usecs);
+    uint32_t frames = qatomic_read(&vdev->irq_coalesce_frames);
+    AioContext *ctx;
+    int64_t now, delta;
+
+    /* Moderation off and nothing held back: keep the lock off this path */
+    if (!usecs && !qatomic_read(&vq->irq_pending)) {
+        return !notify;
+    }
+
+    QEMU_LOCK_GUARD(&vdev->irq_coalesce_lock);
+
+    /* Also keep the guest from missing interrupts across migration */
+    if (!usecs || !vdev->vm_running) {
+        if (vq->irq_pending) {
+            notify = true;
+            goto send;
+        }
+        return !notify;
+    }
+
+    now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    if (vq->irq_last_ns) {
+        delta = MIN(now - vq->irq_last_ns, NANOSECONDS_PER_SECOND);
+        vq->irq_interval_ns = vq->irq_interval_ns ?
+            (vq->irq_interval_ns * 7 + delta) / 8 : delta;
+    }
+    vq->irq_last_ns = now;
+
+    if (!notify && !vq->irq_pending) {
+        return true;
+    }
+
+    vq->irq_frames++;
+    if (qatomic_read(&vdev->irq_coalesce_adaptive) &&
+        vq->irq_interval_ns >= (int64_t)usecs * SCALE_US) {
+        goto send;
+    }
+    if (frames && vq->irq_frames >= frames) {
+        goto send;
+    }
+
+    if (!vq->irq_pending) {
+        if (!vq->irq_timer) {
+            ctx = qemu_get_current_aio_context();
+            vq->irq_timer = aio_timer_new(ctx, QEMU_CLOCK_VIRTUAL, SCALE_NS,
+                                          virtio_irq_coalesce_timer_cb, vq);
+            vq->irq_timer_ctx = ctx;
+        }
+        vq->irq_pending_irqfd = irqfd;
+        qatomic_set(&vq->irq_pending, true);
+        timer_mod(vq->irq_timer, now + (int64_t)usecs * SCALE_US);
+        trace_virtio_irq_coalesce_defer(vdev, vq, usecs);
+    }
+    return true;
+
+send:
+    if (vq->irq_pending) {
+        qatomic_set(&vq->irq_pending, false);
+        timer_del(vq->irq_timer);
+        notify = true;
+    }
+    vq->irq_frames = 0;
+    return !notify;
+}
+
 /* Batch irqs while inside a defer_call_begin()/defer_call_end() section */
 static void virtio_notify_irqfd_deferred_fn(void *opaque)
 {
@@ -2718,10 +3161,13 @@ static void virtio_notify_irqfd_deferred_fn(void *opaque)
 
 void virtio_notify_irqfd(VirtIODevice *vdev, VirtQueue *vq)
 {
+    bool notify;
+
     WITH_RCU_READ_LOCK_GUARD() {
-        if (!virtio_should_notify(vdev, vq)) {
-            return;
-        }
+        notify = virtio_should_notify(vdev, vq);
+    }
+    if (virtio_irq_coalesce(vdev, vq, notify, true)) {
+        return;
     }
 
     trace_virtio_notify_irqfd(vdev, vq);
@@ -2753,10 +3199,13 @@ static void virtio_irq(VirtQueue *vq)
 
 void virtio_notify(VirtIODevice *vdev, VirtQueue *vq)
 {
+    bool notify;
+
     WITH_RCU_READ_LOCK_GUARD() {
-        if (!virtio_should_notify(vdev, vq)) {
-            return;
-        }
+        notify = virtio_should_notify(vdev, vq);
+    }
+    if (virtio_irq_coalesce(vdev, vq, notify, false)) {
+        return;
     }
 
     trace_virtio_notify(vdev, vq);
@@ -3469,8 +3918,17 @@ static void virtio_vmstate_change(void *opaque, bool running, RunState state)
     BusState *qbus = qdev_get_parent_bus(DEVICE(vdev));
     VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
     bool backend_run = running && virtio_device_started(vdev, vdev->status);
+    int i;
+
     vdev->vm_running = running;
 
+    /* Interrupts still held back must reach the guest before it is saved */
+    if (!running) {
+        for (i = 0; i < VIRTIO_QUEUE_MAX; i++) {
+            virtio_irq_coalesce_fire(&vdev->vq[i]);
+        }
+    }
+
     if (backend_run) {
         virtio_set_status(vdev, vdev->status);
     }
@@ -3820,6 +4278,18 @@ static void virtio_queue_host_notifier_aio_poll_begin(EventNotifier *n)
 {
     VirtQueue *vq = container_of(n, VirtQueue, host_notifier);
 
+    if (vq->polling) {
+        /*
+         * The AioContext resumed polling before it ended our lingering
+         * polling section, so notifications are still disabled.
+         */
+        if (vq->vring.desc && !virtio_queue_empty(vq)) {
+            vq->notify_avoided++;
+        }
+        return;
+    }
+
+    vq->polling = true;
     virtio_queue_set_notification(vq, 0);
 }
 
@@ -3842,12 +4312,16 @@ static void virtio_queue_host_notifier_aio_poll_end(EventNotifier *n)
 {
     VirtQueue *vq = container_of(n, VirtQueue, host_notifier);
 
+    vq->polling = false;
+
     /* Caller polls once more after this to catch requests that race with us */
     virtio_queue_set_notification(vq, 1);
 }
 
 void virtio_queue_aio_attach_host_notifier(VirtQueue *vq, AioContext *ctx)
 {
+    bool linger;
+
     /*
      * virtio_queue_aio_detach_host_notifier() can leave notifications disabled.
      * Re-enable them.  (And if detach has not been used before, notifications
@@ -3867,6 +4341,15 @@ void virtio_queue_aio_attach_host_notifier(VirtQueue *vq, AioContext *ctx)
                                 virtio_queue_host_notifier_aio_poll_begin,
                                 virtio_queue_host_notifier_aio_poll_end);
 
+    /*
+     * If this queue had work while the AioContext was polling, the guest is
+     * likely to submit more soon.  Let the AioContext keep notifications
+     * disabled for another adaptive polling interval instead of making the
+     * guest kick us for requests that we are about to poll for again anyway.
+     */
+    linger = qatomic_read(&vq->vdev->poll_notify_linger);
+    aio_set_event_notifier_poll_linger(ctx, &vq->host_notifier, linger);
+
     /*
      * We will have ignored notifications about new requests from the guest
      * while no notifiers were attached, so "kick" the virt queue to process
@@ -3905,6 +4388,22 @@ void virtio_queue_aio_detach_host_notifier(VirtQueue *vq, AioContext *ctx)
 {
     aio_set_event_notifier(ctx, &vq->host_notifier, NULL, NULL, NULL);
 
+    vq->polling = false;
+
+    /*
+     * Completions for this queue may move to another AioContext, so send
+     * what is still held back and drop the coalescing timer while this one
+     * still runs it.  The next deferral creates it in the new context.
+     */
+    WITH_QEMU_LOCK_GUARD(&vq->vdev->irq_coalesce_lock) {
+        virtio_irq_coalesce_fire_locked(vq);
+        if (vq->irq_timer && vq->irq_timer_ctx == ctx) {
+            timer_free(vq->irq_timer);
+            vq->irq_timer = NULL;
+            vq->irq_timer_ctx = NULL;
+        }
+    }
+
     /*
      * aio_set_event_notifier_poll() does not guarantee whether io_poll_end()
      * will run after io_poll_begin(), so by removing the notifier, we do not
@@ -4058,11 +4557,19 @@ static void virtio_device_free_virtqueues(VirtIODevice *vdev)
     g_free(vdev->vq);
 }
 
+static void virtio_device_instance_init(Object *obj)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(obj);
+
+    qemu_mutex_init(&vdev->irq_coalesce_lock);
+}
+
 static void virtio_device_instance_finalize(Object *obj)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(obj);
 
     virtio_device_free_virtqueues(vdev);
+    qemu_mutex_destroy(&vdev->irq_coalesce_lock);
 
     g_free(vdev->config);
     g_free(vdev->vector_queues);
@@ -4199,6 +4706,52 @@ void virtio_device_release_ioeventfd(VirtIODevice *vdev)
     virtio_bus_release_ioeventfd(vbus);
 }
 
+/* @opaque is the offset of the uint32_t field in VirtIODevice */
+static void virtio_device_get_irq_coalesce(Object *obj, Visitor *v,
+                                           const char *name, void *opaque,
+                                           Error **errp)
+{
+    uint32_t *field = (void *)obj + (uintptr_t)opaque;
+    uint32_t value = qatomic_read(field);
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void virtio_device_set_irq_coalesce(Object *obj, Visitor *v,
+                                           const char *name, void *opaque,
+                                           Error **errp)
+{
+    uint32_t *field = (void *)obj + (uintptr_t)opaque;
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    qatomic_set(field, value);
+}
+
+static bool virtio_device_get_irq_coalesce_adaptive(Object *obj, Error **errp)
+{
+    return VIRTIO_DEVICE(obj)->irq_coalesce_adaptive;
+}
+
+static void virtio_device_set_irq_coalesce_adaptive(Object *obj, bool value,
+                                                    Error **errp)
+{
+    qatomic_set(&VIRTIO_DEVICE(obj)->irq_coalesce_adaptive, value);
+}
+
+static bool virtio_device_get_poll_notify_linger(Object *obj, Error **errp)
+{
+    return VIRTIO_DEVICE(obj)->poll_notify_linger;
+}
+
+static void virtio_device_set_poll_notify_linger(Object *obj, bool value,
+                                                 Error **errp)
+{
+    qatomic_set(&VIRTIO_DEVICE(obj)->poll_notify_linger, value);
+}
+
 static void virtio_device_class_init(ObjectClass *klass, void *data)
 {
     /* Set the default value here. */
@@ -4209,6 +4762,38 @@ static void virtio_device_class_init(ObjectClass *klass, void *data)
     dc->unrealize = virtio_device_unrealize;
     dc->bus_type = TYPE_VIRTIO_BUS;
     device_class_set_props(dc, virtio_properties);
+
+    /* Not qdev properties, so that they can be changed at runtime */
+    object_class_property_add(klass, "irq-coalesce-max-usecs", "uint32",
+                              virtio_device_get_irq_coalesce,
+                              virtio_device_set_irq_coalesce, NULL,
+                              (void *)offsetof(VirtIODevice,
+                                               irq_coalesce_usecs));
+    object_class_property_set_description(klass, "irq-coalesce-max-usecs",
+        "Longest guest time a virtqueue interrupt may be delayed, 0 to "
+        "disable interrupt moderation");
+    object_class_property_add(klass, "irq-coalesce-max-frames", "uint32",
+                              virtio_device_get_irq_coalesce,
+                              virtio_device_set_irq_coalesce, NULL,
+                              (void *)offsetof(VirtIODevice,
+                                               irq_coalesce_frames));
+    object_class_property_set_description(klass, "irq-coalesce-max-frames",
+        "Completions after which a delayed interrupt is sent right away, "
+        "0 for no limit");
+    object_class_property_add_bool(klass, "irq-coalesce-adaptive",
+                                   virtio_device_get_irq_coalesce_adaptive,
+                                   virtio_device_set_irq_coalesce_adaptive);
+    object_class_property_set_description(klass, "irq-coalesce-adaptive",
+        "Only delay interrupts of virtqueues that complete requests faster "
+        "than irq-coalesce-max-usecs");
+    object_class_property_add_bool(klass, "poll-notify-linger",
+                                   virtio_device_get_poll_notify_linger,
+                                   virtio_device_set_poll_notify_linger);
+    object_class_property_set_description(klass, "poll-notify-linger",
+        "Keep guest notifications disabled for one adaptive polling "
+        "interval after an IOThread stops polling a busy virtqueue; "
+        "applies when the virtqueues are next attached to an IOThread");
+
     vdc->start_ioeventfd = virtio_device_start_ioeventfd_impl;
     vdc->stop_ioeventfd = virtio_device_stop_ioeventfd_impl;
 
@@ -4254,6 +4839,7 @@ VirtQueueStatus *qmp_x_query_virtio_queue_status(const char *path,
     status->used_idx = vdev->vq[queue].used_idx;
     status->signalled_used = vdev->vq[queue].signalled_used;
     status->signalled_used_valid = vdev->vq[queue].signalled_used_valid;
+    status->notify_avoided = vdev->vq[queue].notify_avoided;
 
     if (vdev->vhost_started) {
         VirtioDeviceClass *vdc = VIRTIO_DEVICE_GET_CLASS(vdev);
@@ -4429,6 +5015,7 @@ static const TypeInfo virtio_device_info = {
     .parent = TYPE_DEVICE,
     .instance_size = sizeof(VirtIODevice),
     .class_init = virtio_device_class_init,
+    .instance_init = virtio_device_instance_init,
     .instance_finalize = virtio_device_instance_finalize,
     .abstract = true,
     .class_size = sizeof(VirtioDeviceClass),
@@ -248,6 +248,12 @@ struct AioContext {
     /* Are we in polling mode or monitoring file descriptors? */
     bool poll_started;
 
+    /*
+     * When handlers whose polling section was extended must have their
+     * ->io_poll_end() called, or 0 if there are none.
+     */
+    int64_t poll_linger_deadline;
+
     /* epoll(7) state used when built with CONFIG_EPOLL */
     int epollfd;
 
@@ -495,6 +501,22 @@ void aio_set_event_notifier_poll(AioContext *ctx,
                                  EventNotifierHandler *io_poll_begin,
                                  EventNotifierHandler *io_poll_end);
 
+/*
+ * Let the polling section of an event notifier that has already been
+ * registered with aio_set_event_notifier outlast polling mode.  Do nothing if
+ * the event notifier is not registered.
+ *
+ * If @linger is true and polling found events for the notifier, leaving
+ * polling mode does not call io_poll_end() right away.  The event loop keeps
+ * waiting for file descriptors as usual, but calls io_poll_end() and polls
+ * the notifier once more after the current adaptive polling time unless
+ * polling mode resumes first.  In the latter case io_poll_begin() is called
+ * again without an io_poll_end() in between.
+ */
+void aio_set_event_notifier_poll_linger(AioContext *ctx,
+                                        EventNotifier *notifier,
+                                        bool linger);
+
 /* Return a GSource that lets the main loop poll the file descriptors attached
  * to this AioContext.
  */
@@ -705,6 +727,15 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
                                  int64_t grow, int64_t shrink,
                                  Error **errp);
 
+/**
+ * aio_context_get_poll_ns:
+ * @ctx: the aio context
+ *
+ * Return the current adaptive polling time in nanoseconds, or 0 if @ctx
+ * doesn't poll.  Must be called from @ctx's home thread.
+ */
+int64_t aio_context_get_poll_ns(AioContext *ctx);
+
 /**
  * aio_context_set_aio_params:
  * @ctx: the aio context
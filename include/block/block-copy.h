@@ -36,6 +36,19 @@ void block_copy_set_copy_opts(BlockCopyState *s, bool use_copy_range,
                               bool compress);
 void block_copy_set_progress_meter(BlockCopyState *s, ProgressMeter *pm);
 
+/*
+ * Let calls from block_copy_async() adjust their request length and number
+ * of parallel requests to the observed throughput and latency, up to
+ * @max_workers requests and @max_chunk bytes (zero means no limit beyond the
+ * default one).  block_copy() calls, which serve guest writes, are not
+ * affected.  Must be called prior to any copy request.
+ */
+void block_copy_set_adaptive(BlockCopyState *s, int max_workers,
+                             int64_t max_chunk);
+
+/* Current state of the adaptive mode, or NULL if it is not enabled */
+BlockJobAdaptiveInfo *block_copy_get_adaptive_info(BlockCopyState *s);
+
 void block_copy_state_free(BlockCopyState *s);
 
 void block_copy_reset(BlockCopyState *s, int64_t offset, int64_t bytes);
@@ -0,0 +1,97 @@
+/*
+ * copy_tuner API
+ *
+ * Adaptive request size and queue depth for block jobs that copy data
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef BLOCK_COPY_TUNER_H
+#define BLOCK_COPY_TUNER_H
+
+#include "qemu/thread.h"
+#include "qapi/qapi-types-block-core.h"
+
+/*
+ * CopyTuner chooses the request size (chunk) and the number of parallel
+ * requests (depth) of a copy job from the throughput and latency of the
+ * requests that completed, in the manner of delay-based TCP congestion
+ * control:
+ *
+ * - Every sampling period, the average latency per byte is compared with
+ *   the lowest one seen so far.  If it has grown to more than twice that
+ *   base, requests are queueing up somewhere without making the copy any
+ *   faster, so both the depth and the chunk size are halved.
+ *
+ * - If the throughput dropped by more than an eighth right after the chunk
+ *   size was doubled, the chunk size goes back and is not grown past that
+ *   again.
+ *
+ * - Otherwise, the depth is increased by one, and once it reaches its
+ *   maximum, the chunk size is doubled.  Larger requests help most with
+ *   high-latency targets such as remote NBD servers, where the fixed per
+ *   request cost dominates.
+ *
+ * The API is thread-safe, so that the statistics can be queried from the
+ * main loop while the job runs in an iothread.
+ */
+typedef struct CopyTuner {
+    QemuMutex lock;
+
+    /* Fields initialized in copy_tuner_init() and never changed */
+    int64_t min_chunk;
+    int64_t max_chunk;
+    int max_depth;
+    int64_t max_bytes;      /* limit for chunk * depth, 0 for none */
+
+    /* Current settings */
+    int64_t chunk;
+    int depth;
+
+    /* Largest chunk size that hasn't made the copy slower */
+    int64_t chunk_ceiling;
+    /* The chunk size was doubled at the end of the last sampling period */
+    bool chunk_grown;
+
+    /* Results of the last complete sampling period */
+    uint64_t throughput;    /* bytes per second */
+    uint64_t latency_ns;    /* average latency of a request */
+
+    /* Lowest latency per KiB seen so far, slowly decaying upwards */
+    uint64_t base_ns_per_kib;
+
+    /* Current sampling period */
+    int64_t period_start_ns;
+    uint64_t period_bytes;
+    uint64_t period_reqs;
+    uint64_t period_latency_ns;
+} CopyTuner;
+
+/*
+ * Initialize @t to start with @chunk and @depth.  The chunk size is kept
+ * within [@min_chunk, @max_chunk] and a multiple of @min_chunk, the depth
+ * within [1, @max_depth].  If @max_bytes is not 0, the depth is further
+ * limited so that chunk * depth doesn't exceed it, e.g. for jobs whose
+ * requests share a buffer of that size.
+ */
+void copy_tuner_init(CopyTuner *t, int64_t min_chunk, int64_t max_chunk,
+                     int max_depth, int64_t max_bytes,
+                     int64_t chunk, int depth);
+void copy_tuner_destroy(CopyTuner *t);
+
+/* Current settings */
+int64_t copy_tuner_chunk(CopyTuner *t);
+int copy_tuner_depth(CopyTuner *t);
+
+/*
+ * Record that a copy request of @bytes bytes has completed successfully,
+ * @latency_ns after it was started.  Requests that don't transfer data
+ * (write zeroes, discard) should not be recorded.
+ */
+void copy_tuner_request_done(CopyTuner *t, int64_t bytes, int64_t latency_ns);
+
+/* Return the current state for query-block-jobs */
+BlockJobAdaptiveInfo *copy_tuner_get_info(CopyTuner *t);
+
+#endif /* BLOCK_COPY_TUNER_H */
@@ -45,6 +45,12 @@ typedef struct BlockExportDriver {
      * shutting down.
      */
     void (*request_shutdown)(BlockExport *);
+
+    /*
+     * True if the driver can spread its work over the AioContexts returned by
+     * blk_exp_get_aio_context(), i.e. it supports the iothreads option.
+     */
+    bool supports_multithread;
 } BlockExportDriver;
 
 struct BlockExport {
@@ -73,6 +79,13 @@ struct BlockExport {
     /* The AioContext whose lock protects this BlockExport object. */
     AioContext *ctx;
 
+    /*
+     * The AioContexts of the iothreads option, or NULL if it wasn't given.
+     * Unlike ctx, these don't change when the block node is moved.
+     */
+    AioContext **multithread_ctxs;
+    size_t num_multithread_ctxs;
+
     /* The block device to export */
     BlockBackend *blk;
 
@@ -82,6 +95,7 @@ struct BlockExport {
 
 BlockExport *blk_exp_add(BlockExportOptions *export, Error **errp);
 BlockExport *blk_exp_find(const char *id);
+AioContext *blk_exp_get_aio_context(BlockExport *exp, unsigned int idx);
 void blk_exp_ref(BlockExport *exp);
 void blk_exp_unref(BlockExport *exp);
 void blk_exp_request_shutdown(BlockExport *exp);
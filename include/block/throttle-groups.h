@@ -26,6 +26,7 @@
 #define THROTTLE_GROUPS_H
 
 #include "qemu/coroutine.h"
+#include "qemu/thread.h"
 #include "qemu/throttle.h"
 #include "qom/object.h"
 
@@ -49,6 +50,14 @@ typedef struct ThrottleGroupMember {
      */
     unsigned int restart_pending;
 
+    /* I/O that has already been accounted in the group and that can be
+     * started without taking the ThrottleGroup lock, see
+     * throttle_group_co_io_limits_intercept(). Protected by credit_lock.
+     */
+    QemuSpin     credit_lock;
+    uint64_t     credit_ops[THROTTLE_MAX];
+    uint64_t     credit_bytes[THROTTLE_MAX];
+
     /* The following fields are protected by the ThrottleGroup lock.
      * See the ThrottleGroup documentation for details.
      * throttle_state tells us if I/O limits are configured. */
@@ -29,6 +29,10 @@
 
 #define XTS_BLOCK_SIZE 16
 
+/*
+ * Encrypts or decrypts @length bytes in ECB mode.  @length is always a
+ * multiple of XTS_BLOCK_SIZE, but may cover more than one block.
+ */
 typedef void xts_cipher_func(const void *ctx,
                              size_t length,
                              uint8_t *dst,
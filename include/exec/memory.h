@@ -1142,6 +1142,14 @@ struct FlatView {
     unsigned nr_allocated;//申请的可用ranges数组大小
     struct AddressSpaceDispatch *dispatch;
     MemoryRegion *root;
+    /*
+     * Where each MemoryRegion reached while rendering was placed in the
+     * view.  A transaction re-renders only the windows of the view that
+     * its changes can reach, and reuses the view if there are none.
+     */
+    GHashTable *regions;
+    /* Incremental updates since the view was last rendered in full */
+    unsigned nr_updates;
 };
 
 static inline FlatView *address_space_to_flatview(AddressSpace *as)
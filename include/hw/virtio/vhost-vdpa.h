@@ -17,6 +17,7 @@
 #include "hw/virtio/vhost-iova-tree.h"
 #include "hw/virtio/vhost-shadow-virtqueue.h"
 #include "hw/virtio/virtio.h"
+#include "sysemu/iothread.h"
 #include "standard-headers/linux/vhost_types.h"
 
 /*
@@ -56,6 +57,16 @@ typedef struct vhost_vdpa_shared {
 
     /* SVQ switching is in progress, or already completed? */
     SVQTransitionState svq_switching;
+
+    /* IOThread that relays the data shadow virtqueues, if any */
+    IOThread *svq_iothread;
+    AioContext *svq_ctx;
+
+    /*
+     * The listener holds the iova tree's map_lock, from a change to the tree
+     * until the device has applied it
+     */
+    bool iova_tree_map_locked;
 } VhostVDPAShared;
 
 typedef struct vhost_vdpa {
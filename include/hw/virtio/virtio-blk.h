@@ -79,6 +79,7 @@ struct VirtIOBlock {
 typedef struct VirtIOBlockReq {
     VirtQueueElement elem;
     int64_t sector_num;
+    uint32_t dwz_sectors; /* length of a queued discard or write zeroes */
     VirtIOBlock *dev;
     VirtQueue *vq;
     IOVDiscardUndo inhdr_undo;
@@ -98,6 +99,11 @@ typedef struct MultiReqBuffer {
     VirtIOBlockReq *reqs[VIRTIO_BLK_MAX_MERGE_REQS];
     unsigned int num_reqs;
     bool is_write;
+    /* Discard or write zeroes requests, coalesced when they are adjacent */
+    VirtIOBlockReq *dwz_reqs[VIRTIO_BLK_MAX_MERGE_REQS];
+    unsigned int num_dwz_reqs;
+    bool dwz_is_write_zeroes;
+    int dwz_flags;
 } MultiReqBuffer;
 
 void virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq);
@@ -71,6 +71,8 @@ typedef struct VirtQueueElement
     unsigned int in_num;//in_addr数组长度
     /* Element has been processed (VIRTIO_F_IN_ORDER) */
     bool in_order_filled;
+    /* Buffer comes from the element pool, see virtqueue_element_free() */
+    bool pooled;
     hwaddr *in_addr;//平坦内存（长度为in_num)
     hwaddr *out_addr;//平坦内存（长度为out_num)
     struct iovec *in_sg;//平坦内存（长度为in_num)
@@ -167,6 +169,25 @@ struct VirtIODevice
      */
     EventNotifier config_notifier;
     bool device_iotlb_enabled;
+    /**
+     * @irq_coalesce_usecs, @irq_coalesce_frames, @irq_coalesce_adaptive:
+     * interrupt moderation policy applied to each virtqueue by
+     * virtio_notify() and virtio_notify_irqfd().  Changeable at runtime.
+     */
+    uint32_t irq_coalesce_usecs;
+    uint32_t irq_coalesce_frames;
+    bool irq_coalesce_adaptive;
+    /**
+     * @irq_coalesce_lock: protects the per-virtqueue interrupt moderation
+     * state against the coalescing timers and the VM state handler.
+     */
+    QemuMutex irq_coalesce_lock;
+    /**
+     * @poll_notify_linger: keep notifications of busy virtqueues disabled
+     * across short gaps between AioContext polling sections.  Read when the
+     * virtqueues are attached to an AioContext.
+     */
+    bool poll_notify_linger;
 };
 
 struct VirtioDeviceClass {
@@ -259,6 +280,8 @@ void virtio_delete_queue(VirtQueue *vq);
 
 void virtqueue_push(VirtQueue *vq, const VirtQueueElement *elem,
                     unsigned int len);
+void virtqueue_push_many(VirtQueue *vq, VirtQueueElement *const *elems,
+                         const unsigned int *lens, unsigned int n);
 void virtqueue_flush(VirtQueue *vq, unsigned int count);
 void virtqueue_detach_element(VirtQueue *vq, const VirtQueueElement *elem,
                               unsigned int len);
@@ -270,6 +293,9 @@ void virtqueue_fill(VirtQueue *vq, const VirtQueueElement *elem,
 
 void virtqueue_map(VirtIODevice *vdev, VirtQueueElement *elem);
 void *virtqueue_pop(VirtQueue *vq, size_t sz);
+unsigned int virtqueue_pop_many(VirtQueue *vq, size_t sz, void **elems,
+                                unsigned int max);
+void virtqueue_element_free(void *elem);
 unsigned int virtqueue_drop_all(VirtQueue *vq);
 void *qemu_get_virtqueue_element(VirtIODevice *vdev, QEMUFile *f, size_t sz);
 void qemu_put_virtqueue_element(VirtIODevice *vdev, QEMUFile *f,
@@ -33,6 +33,11 @@ OBJECT_DECLARE_TYPE(QIOChannel, QIOChannelClass,
 #define QIO_CHANNEL_ERR_BLOCK -2
 
 #define QIO_CHANNEL_WRITE_FLAG_ZERO_COPY 0x1
+/*
+ * With QIO_CHANNEL_WRITE_FLAG_ZERO_COPY, copy the data instead of failing
+ * if the kernel can't pin it, e.g. because of RLIMIT_MEMLOCK
+ */
+#define QIO_CHANNEL_WRITE_FLAG_ZERO_COPY_FALLBACK 0x2
 
 #define QIO_CHANNEL_READ_FLAG_MSG_PEEK 0x1
 
@@ -160,6 +165,10 @@ struct QIOChannelClass {
                                   void *opaque);
     int (*io_flush)(QIOChannel *ioc,
                     Error **errp);
+    int (*io_zero_copy_progress)(QIOChannel *ioc,
+                                 uint64_t *queued,
+                                 uint64_t *completed,
+                                 Error **errp);
     int (*io_peerpid)(QIOChannel *ioc,
                        unsigned int *pid,
                        Error **errp);
@@ -984,6 +993,31 @@ int coroutine_mixed_fn qio_channel_writev_full_all(QIOChannel *ioc,
 int qio_channel_flush(QIOChannel *ioc,
                       Error **errp);
 
+/**
+ * qio_channel_zero_copy_progress:
+ * @ioc: the channel object
+ * @queued: filled with the number of writes queued so far
+ * @completed: filled with the number of writes completed so far
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Like qio_channel_flush(), processes the completion notifications of
+ * writes done with QIO_CHANNEL_WRITE_FLAG_ZERO_COPY, but never blocks.
+ * Writes complete in the order in which they were queued, so the buffer
+ * of a write may be reused once @completed has reached the value that
+ * @queued had right after the write.
+ *
+ * A write may count more than once if it needs several system calls,
+ * so the counters are only meaningful relative to each other.
+ *
+ * If not implemented, sets both counters to 0 and returns 0.
+ *
+ * Returns -1 if any error is found, 0 otherwise.
+ */
+int qio_channel_zero_copy_progress(QIOChannel *ioc,
+                                   uint64_t *queued,
+                                   uint64_t *completed,
+                                   Error **errp);
+
 /**
  * qio_channel_get_peercred:
  * @ioc: the channel object
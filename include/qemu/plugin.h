@@ -72,6 +72,7 @@ enum plugin_dyn_cb_type {
     PLUGIN_CB_MEM_REGULAR,
     PLUGIN_CB_INLINE_ADD_U64,
     PLUGIN_CB_INLINE_STORE_U64,
+    PLUGIN_CB_MEM_BUFFER,
 };
 
 struct qemu_plugin_regular_cb {
@@ -96,6 +97,14 @@ struct qemu_plugin_conditional_cb {
     uint64_t imm;
 };
 
+struct qemu_plugin_mem_buffer_cb {
+    union qemu_plugin_cb_sig f;
+    TCGHelperInfo *info;
+    struct qemu_plugin_mem_buffer *buf;
+    uint64_t pc;
+    enum qemu_plugin_mem_rw rw;
+};
+
 /*
  * A dynamic callback has an insertion point that is determined at run-time.
  * Usually the insertion point is somewhere in the code cache; think for
@@ -107,6 +116,7 @@ struct qemu_plugin_dyn_cb {
         struct qemu_plugin_regular_cb regular;
         struct qemu_plugin_conditional_cb cond;
         struct qemu_plugin_inline_cb inline_insn;
+        struct qemu_plugin_mem_buffer_cb mem_buffer;
     };
 };
 
@@ -128,6 +138,24 @@ struct qemu_plugin_scoreboard {
     QLIST_ENTRY(qemu_plugin_scoreboard) entry;
 };
 
+/*
+ * A memory access buffer keeps one scoreboard entry per vcpu_index,
+ * holding a qemu_plugin_mem_buffer_entry with room for n_records.
+ */
+struct qemu_plugin_mem_buffer {
+    struct qemu_plugin_scoreboard *score;
+    size_t n_records;
+    /* Most records any translated instruction reserves room for */
+    size_t max_need;
+    qemu_plugin_vcpu_mem_buffer_cb_t cb;
+    void *userp;
+};
+
+struct qemu_plugin_mem_buffer_entry {
+    uint64_t count;
+    struct qemu_plugin_mem_record records[];
+};
+
 /* Internal context for this TranslationBlock */
 struct qemu_plugin_tb {
     GPtrArray *insns;
@@ -65,11 +65,15 @@ typedef uint64_t qemu_plugin_id_t;
  *
  * version 4:
  * - added qemu_plugin_read_memory_vaddr
+ *
+ * version 5:
+ * - added qemu_plugin_mem_buffer_{new,free,flush} and
+ *   qemu_plugin_register_vcpu_mem_buffer
  */
 
 extern QEMU_PLUGIN_EXPORT int qemu_plugin_version;
 
-#define QEMU_PLUGIN_VERSION 4
+#define QEMU_PLUGIN_VERSION 5
 
 /**
  * struct qemu_info_t - system information for plugins
@@ -701,6 +705,102 @@ void qemu_plugin_register_vcpu_mem_inline_per_vcpu(
     qemu_plugin_u64 entry,
     uint64_t imm);
 
+/**
+ * struct qemu_plugin_mem_record - a buffered memory access
+ * @vaddr: the virtual address of the transaction
+ * @pc: the virtual address of the instruction performing it
+ * @info: an opaque handle for further queries about the memory
+ *
+ * Note that qemu_plugin_get_hwaddr() cannot be used on a buffered
+ * record, as the translation is long gone by the time it is delivered.
+ */
+struct qemu_plugin_mem_record {
+    uint64_t vaddr;
+    uint64_t pc;
+    qemu_plugin_meminfo_t info;
+};
+
+/** struct qemu_plugin_mem_buffer - Opaque handle for a memory access buffer */
+struct qemu_plugin_mem_buffer;
+
+/**
+ * typedef qemu_plugin_vcpu_mem_buffer_cb_t - memory buffer callback type
+ * @vcpu_index: the vCPU the accesses took place on
+ * @records: the accesses, in execution order
+ * @n: number of entries in @records
+ * @userdata: any user data attached to the buffer
+ *
+ * @records is only valid for the duration of the callback.
+ */
+typedef void (*qemu_plugin_vcpu_mem_buffer_cb_t)(
+    unsigned int vcpu_index,
+    const struct qemu_plugin_mem_record *records,
+    size_t n,
+    void *userdata);
+
+/**
+ * qemu_plugin_mem_buffer_new() - alloc a new memory access buffer
+ * @n_records: number of records held per vCPU before @cb is called
+ * @cb: callback of type qemu_plugin_vcpu_mem_buffer_cb_t
+ * @userdata: opaque pointer for userdata
+ *
+ * Each vCPU gets its own buffer of @n_records entries. Instrumented
+ * accesses are recorded inline by the generated code, and @cb is only
+ * called, on the vCPU thread, once that vCPU's buffer is full or when
+ * qemu_plugin_mem_buffer_flush() is used.
+ *
+ * Returns a pointer to a new buffer. It must be freed using
+ * qemu_plugin_mem_buffer_free.
+ */
+QEMU_PLUGIN_API
+struct qemu_plugin_mem_buffer *
+qemu_plugin_mem_buffer_new(size_t n_records,
+                           qemu_plugin_vcpu_mem_buffer_cb_t cb,
+                           void *userdata);
+
+/**
+ * qemu_plugin_mem_buffer_free() - free a memory access buffer
+ * @buf: buffer to free
+ *
+ * Pending records are discarded.
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_mem_buffer_free(struct qemu_plugin_mem_buffer *buf);
+
+/**
+ * qemu_plugin_mem_buffer_flush() - deliver pending records of a vCPU
+ * @buf: buffer to flush
+ * @vcpu_index: vCPU whose records are delivered
+ *
+ * Call the buffer callback for any records not delivered yet. This
+ * should be called from the vCPU exit callback, or once all vCPUs
+ * have stopped, e.g. from the atexit callback.
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_mem_buffer_flush(struct qemu_plugin_mem_buffer *buf,
+                                  unsigned int vcpu_index);
+
+/**
+ * qemu_plugin_register_vcpu_mem_buffer() - buffer memory accesses
+ * @insn: handle for instruction to instrument
+ * @rw: record reads, writes or both
+ * @buf: buffer to record into
+ *
+ * This records every memory access generated by the instruction into
+ * @buf, without calling back into the plugin for each of them. It is
+ * much cheaper than qemu_plugin_register_vcpu_mem_cb() for plugins that
+ * need to see every access, but not immediately.
+ *
+ * The buffer is flushed before an instruction if it may not have room
+ * for all of its accesses.  If a single instruction performs more
+ * accesses than the buffer has records, the excess ones are dropped, so
+ * @buf should have more records than any instruction has accesses.
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_register_vcpu_mem_buffer(struct qemu_plugin_insn *insn,
+                                          enum qemu_plugin_mem_rw rw,
+                                          struct qemu_plugin_mem_buffer *buf);
+
 /**
  * qemu_plugin_request_time_control() - request the ability to control time
  *
@@ -24,6 +24,7 @@ typedef struct VuFdWatch {
     int fd; /*kick fd*/
     void *pvt;
     vu_watch_cb cb;
+    AioContext *ctx; /* where the fd is monitored, NULL while it is not */
     QTAILQ_ENTRY(VuFdWatch) next;
 } VuFdWatch;
 
@@ -31,21 +32,30 @@ typedef struct VuFdWatch {
  * VuServer:
  * A vhost-user server instance with user-defined VuDevIface callbacks.
  * Vhost-user device backends can be implemented using VuServer. VuDevIface
- * callbacks and virtqueue kicks run in the given AioContext.
+ * callbacks run in the given AioContext. Virtqueue kicks run there too,
+ * unless get_queue_aio_context() assigns the virtqueue to another one.
  */
-typedef struct {
+typedef struct VuServer {
     QIONetListener *listener;
     QEMUBH *restart_listener_bh;
     AioContext *ctx;
     int max_queues;
     const VuDevIface *vu_iface;
 
+    /*
+     * Optional, set after vhost_user_server_start(). Returns the AioContext
+     * in which the kicks of virtqueue @idx are handled, or NULL for ctx. It
+     * is called again whenever ctx changes.
+     */
+    AioContext *(*get_queue_aio_context)(struct VuServer *server, int idx);
+
     unsigned int in_flight; /* atomic */
+    bool wait_idle; /* atomic */
 
     /* Protected by ctx lock */
     bool in_qio_channel_yield;
-    bool wait_idle;
     bool quiescing;
+    bool kicks_paused; /* kick fds are not monitored, see vu_pause_kicks() */
     VuDev vu_dev;
     QIOChannel *ioc; /* The I/O channel with the client */
     QIOChannelSocket *sioc; /* The underlying data channel with the client */
@@ -35,11 +35,15 @@ typedef struct KVMSlot
     ram_addr_t ram_start_offset;
     int guest_memfd;
     hwaddr guest_memfd_offset;
+    /* Re-added unchanged by the current memory transaction */
+    bool keep;
 } KVMSlot;
 
 typedef struct KVMMemoryUpdate {
     QSIMPLEQ_ENTRY(KVMMemoryUpdate) next;
     MemoryRegionSection section;
+    /* All the slots of an added section already exist */
+    bool keep;
 } KVMMemoryUpdate;
 
 typedef struct KVMMemoryListener {
@@ -92,11 +96,19 @@ enum KVMDirtyRingReaperState {
 
 /*
  * KVM reaper instance, responsible for collecting the KVM dirty bits
- * via the dirty ring.
+ * via the dirty ring.  Each reaper owns the vCPUs whose cpu_index is
+ * equal to its index modulo the number of reapers.
  */
 struct KVMDirtyRingReaper {
     /* The reaper thread */
     QemuThread reaper_thr;
+    /*
+     * Serializes harvesting of the rings owned by this reaper.  Taken by
+     * kvm_slots_lock() too, so that slots and their dirty bitmaps cannot
+     * change while a reaper publishes dirty bits without the slots lock.
+     */
+    QemuMutex lock;
+    unsigned int index;
     volatile uint64_t reaper_iteration; /* iteration number of reaper thr */
     volatile enum KVMDirtyRingReaperState reaper_state; /* reap thr state */
 };
@@ -157,7 +169,9 @@ struct KVMState
     uint32_t kvm_dirty_ring_size;   /* Number of dirty GFNs per ring */
     bool kvm_dirty_ring_with_bitmap;
     uint64_t kvm_eager_split_size;  /* Eager Page Splitting chunk size */
-    struct KVMDirtyRingReaper reaper;
+    uint32_t kvm_dirty_ring_reapers; /* Requested reapers, 0 for auto */
+    unsigned int nr_reapers;
+    struct KVMDirtyRingReaper *reapers;
     struct KVMMsrEnergy msr_energy;
     NotifyVmexitOption notify_vmexit;
     uint32_t notify_window;
@@ -309,6 +309,34 @@ DEF(last_generic, 0, 0, 0, TCG_OPF_NOT_PRESENT)
 /* These opcodes are only for use between the tci generator and interpreter. */
 DEF(tci_movi, 1, 0, 1, TCG_OPF_NOT_PRESENT)
 DEF(tci_movl, 1, 0, 1, TCG_OPF_NOT_PRESENT)
+/*
+ * Superinstructions, which also run the insn that follows them.
+ * See tcg_out_insn_fused() in tcg/tci/tcg-target.c.inc.
+ */
+DEF(tci_ld2_i32, 0, 0, 0, TCG_OPF_NOT_PRESENT)
+DEF(tci_st2_i32, 0, 0, 0, TCG_OPF_NOT_PRESENT)
+DEF(tci_ld_add_i32, 0, 0, 0, TCG_OPF_NOT_PRESENT)
+DEF(tci_ld_sub_i32, 0, 0, 0, TCG_OPF_NOT_PRESENT)
+DEF(tci_ld_and_i32, 0, 0, 0, TCG_OPF_NOT_PRESENT)
+DEF(tci_ld_or_i32, 0, 0, 0, TCG_OPF_NOT_PRESENT)
+DEF(tci_ld_xor_i32, 0, 0, 0, TCG_OPF_NOT_PRESENT)
+DEF(tci_add_st_i32, 0, 0, 0, TCG_OPF_NOT_PRESENT)
+DEF(tci_sub_st_i32, 0, 0, 0, TCG_OPF_NOT_PRESENT)
+DEF(tci_and_st_i32, 0, 0, 0, TCG_OPF_NOT_PRESENT)
+DEF(tci_or_st_i32, 0, 0, 0, TCG_OPF_NOT_PRESENT)
+DEF(tci_xor_st_i32, 0, 0, 0, TCG_OPF_NOT_PRESENT)
+DEF(tci_ld2_i64, 0, 0, 0, TCG_OPF_NOT_PRESENT)
+DEF(tci_st2_i64, 0, 0, 0, TCG_OPF_NOT_PRESENT)
+DEF(tci_ld_add_i64, 0, 0, 0, TCG_OPF_NOT_PRESENT)
+DEF(tci_ld_sub_i64, 0, 0, 0, TCG_OPF_NOT_PRESENT)
+DEF(tci_ld_and_i64, 0, 0, 0, TCG_OPF_NOT_PRESENT)
+DEF(tci_ld_or_i64, 0, 0, 0, TCG_OPF_NOT_PRESENT)
+DEF(tci_ld_xor_i64, 0, 0, 0, TCG_OPF_NOT_PRESENT)
+DEF(tci_add_st_i64, 0, 0, 0, TCG_OPF_NOT_PRESENT)
+DEF(tci_sub_st_i64, 0, 0, 0, TCG_OPF_NOT_PRESENT)
+DEF(tci_and_st_i64, 0, 0, 0, TCG_OPF_NOT_PRESENT)
+DEF(tci_or_st_i64, 0, 0, 0, TCG_OPF_NOT_PRESENT)
+DEF(tci_xor_st_i64, 0, 0, 0, TCG_OPF_NOT_PRESENT)
 #endif
 
 #undef DATA64_ARGS
@@ -221,6 +221,13 @@ struct TCGLabel {
     QSIMPLEQ_HEAD(, TCGLabelUse) branches;
     QSIMPLEQ_HEAD(, TCGRelocation) relocs;
     QSIMPLEQ_ENTRY(TCGLabel) next;
+    /*
+     * Register allocation state at the branches to this label seen so
+     * far: the global held (synced) in each host register on every one
+     * of them, or NULL.  Only valid during tcg_gen_code.
+     */
+    struct TCGTemp **join_regs;
+    unsigned join_seen;
 };
 
 typedef struct TCGPool {
@@ -148,6 +148,19 @@ qio_channel_socket_new_fd(int fd,
 }
 
 
+static void qio_channel_socket_probe_zero_copy(QIOChannelSocket *ioc)
+{
+#ifdef QEMU_MSG_ZEROCOPY
+    int ret, v = 1;
+    ret = setsockopt(ioc->fd, SOL_SOCKET, SO_ZEROCOPY, &v, sizeof(v));
+    if (ret == 0) {
+        /* Zero copy available on host */
+        qio_channel_set_feature(QIO_CHANNEL(ioc),
+                                QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY);
+    }
+#endif
+}
+
 int qio_channel_socket_connect_sync(QIOChannelSocket *ioc,
                                     SocketAddress *addr,
                                     Error **errp)
@@ -168,15 +181,7 @@ int qio_channel_socket_connect_sync(QIOChannelSocket *ioc,
         return -1;
     }
 
-#ifdef QEMU_MSG_ZEROCOPY
-    int ret, v = 1;
-    ret = setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &v, sizeof(v));
-    if (ret == 0) {
-        /* Zero copy available on host */
-        qio_channel_set_feature(QIO_CHANNEL(ioc),
-                                QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY);
-    }
-#endif
+    qio_channel_socket_probe_zero_copy(ioc);
 
     qio_channel_set_feature(QIO_CHANNEL(ioc),
                             QIO_CHANNEL_FEATURE_READ_MSG_PEEK);
@@ -417,6 +422,8 @@ qio_channel_socket_accept(QIOChannelSocket *ioc,
     }
 #endif /* WIN32 */
 
+    qio_channel_socket_probe_zero_copy(cioc);
+
     qio_channel_set_feature(QIO_CHANNEL(cioc),
                             QIO_CHANNEL_FEATURE_READ_MSG_PEEK);
 
@@ -559,6 +566,12 @@ static ssize_t qio_channel_socket_readv(QIOChannel *ioc,
     return ret;
 }
 
+#ifdef QEMU_MSG_ZEROCOPY
+static int qio_channel_socket_reap_zero_copy(QIOChannelSocket *sioc,
+                                             bool block,
+                                             Error **errp);
+#endif
+
 static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
                                          const struct iovec *iov,
                                          size_t niov,
@@ -615,11 +628,25 @@ static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
     if (ret <= 0) {
         switch (errno) {
         case EAGAIN:
+#ifdef QEMU_MSG_ZEROCOPY
+            /*
+             * Pending completion notifications make the socket report
+             * G_IO_ERR, which would wake up the caller right away again
+             */
+            if (qio_channel_socket_reap_zero_copy(sioc, false, errp) < 0) {
+                return -1;
+            }
+#endif
             return QIO_CHANNEL_ERR_BLOCK;
         case EINTR:
             goto retry;
         case ENOBUFS:
             if (flags & QIO_CHANNEL_WRITE_FLAG_ZERO_COPY) {
+                if (flags & QIO_CHANNEL_WRITE_FLAG_ZERO_COPY_FALLBACK) {
+                    flags &= ~QIO_CHANNEL_WRITE_FLAG_ZERO_COPY;
+                    sflags = 0;
+                    goto retry;
+                }
                 error_setg_errno(errp, errno,
                                  "Process can't lock enough memory for using MSG_ZEROCOPY");
                 return -1;
@@ -733,10 +760,16 @@ static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
 
 
 #ifdef QEMU_MSG_ZEROCOPY
-static int qio_channel_socket_flush(QIOChannel *ioc,
-                                    Error **errp)
+/*
+ * Processes the zero copy completion notifications on the error queue
+ * until all zero copy writes have completed.  If @block is false, stops
+ * instead as soon as the queue is empty.  Returns like qio_channel_flush().
+ */
+static int qio_channel_socket_reap_zero_copy(QIOChannelSocket *sioc,
+                                             bool block,
+                                             Error **errp)
 {
-    QIOChannelSocket *sioc = QIO_CHANNEL_SOCKET(ioc);
+    QIOChannel *ioc = QIO_CHANNEL(sioc);
     struct msghdr msg = {};
     struct sock_extended_err *serr;
     struct cmsghdr *cm;
@@ -759,6 +792,9 @@ static int qio_channel_socket_flush(QIOChannel *ioc,
         if (received < 0) {
             switch (errno) {
             case EAGAIN:
+                if (!block) {
+                    return ret;
+                }
                 /* Nothing on errqueue, wait until something is available */
                 qio_channel_wait(ioc, G_IO_ERR);
                 continue;
@@ -808,6 +844,28 @@ static int qio_channel_socket_flush(QIOChannel *ioc,
     return ret;
 }
 
+static int qio_channel_socket_flush(QIOChannel *ioc,
+                                    Error **errp)
+{
+    return qio_channel_socket_reap_zero_copy(QIO_CHANNEL_SOCKET(ioc), true,
+                                             errp);
+}
+
+static int qio_channel_socket_zero_copy_progress(QIOChannel *ioc,
+                                                 uint64_t *queued,
+                                                 uint64_t *completed,
+                                                 Error **errp)
+{
+    QIOChannelSocket *sioc = QIO_CHANNEL_SOCKET(ioc);
+    int ret;
+
+    ret = qio_channel_socket_reap_zero_copy(sioc, false, errp);
+    *queued = sioc->zero_copy_queued;
+    *completed = sioc->zero_copy_sent;
+
+    return ret < 0 ? -1 : 0;
+}
+
 #endif /* QEMU_MSG_ZEROCOPY */
 
 static int
@@ -972,6 +1030,7 @@ static void qio_channel_socket_class_init(ObjectClass *klass,
     ioc_klass->io_set_aio_fd_handler = qio_channel_socket_set_aio_fd_handler;
 #ifdef QEMU_MSG_ZEROCOPY
     ioc_klass->io_flush = qio_channel_socket_flush;
+    ioc_klass->io_zero_copy_progress = qio_channel_socket_zero_copy_progress;
 #endif
     ioc_klass->io_peerpid = qio_channel_socket_get_peerpid;
 }
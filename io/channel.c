@@ -101,6 +101,13 @@ ssize_t qio_channel_writev_full(QIOChannel *ioc,
         }
     }
 
+    if ((flags & QIO_CHANNEL_WRITE_FLAG_ZERO_COPY_FALLBACK) &&
+        !(flags & QIO_CHANNEL_WRITE_FLAG_ZERO_COPY)) {
+        error_setg_errno(errp, EINVAL,
+                         "Zero Copy fallback requires Zero Copy");
+        return -1;
+    }
+
     if ((flags & QIO_CHANNEL_WRITE_FLAG_ZERO_COPY) &&
         !qio_channel_has_feature(ioc, QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY)) {
         error_setg_errno(errp, EINVAL,
@@ -593,6 +600,23 @@ int qio_channel_flush(QIOChannel *ioc,
     return klass->io_flush(ioc, errp);
 }
 
+int qio_channel_zero_copy_progress(QIOChannel *ioc,
+                                   uint64_t *queued,
+                                   uint64_t *completed,
+                                   Error **errp)
+{
+    QIOChannelClass *klass = QIO_CHANNEL_GET_CLASS(ioc);
+
+    if (!klass->io_zero_copy_progress ||
+        !qio_channel_has_feature(ioc, QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY)) {
+        *queued = 0;
+        *completed = 0;
+        return 0;
+    }
+
+    return klass->io_zero_copy_progress(ioc, queued, completed, errp);
+}
+
 
 static void qio_channel_restart_read(void *opaque)
 {
@@ -29,6 +29,10 @@
 #include "qemu/units.h"
 #include "qemu/memalign.h"
 
+#ifdef CONFIG_LINUX
+#include <sys/resource.h>
+#endif
+
 #define NBD_META_ID_BASE_ALLOCATION 0
 #define NBD_META_ID_ALLOCATION_DEPTH 1
 /* Dirty bitmaps use 'NBD_META_ID_DIRTY_BITMAP + i', so keep this id last. */
@@ -42,6 +46,16 @@
  */
 #define NBD_MAX_BLOCK_STATUS_EXTENTS (1 * MiB / 8)
 
+/*
+ * MSG_ZEROCOPY only pays off for large writes, smaller read replies are
+ * copied.  The read buffers that the kernel may still reference are kept
+ * per client up to NBD_ZERO_COPY_MAX_PENDING bytes, or half of
+ * RLIMIT_MEMLOCK if that is lower; beyond that, replies are copied again
+ * until the client has caught up.
+ */
+#define NBD_ZERO_COPY_MIN_SIZE (32 * KiB)
+#define NBD_ZERO_COPY_MAX_PENDING (8 * MiB)
+
 static int system_errno_to_nbd_errno(int err)
 {
     switch (err) {
@@ -83,8 +97,19 @@ struct NBDRequestData {
     NBDClient *client;/*对应的client*/
     uint8_t *data;
     bool complete;
+    /* If non-zero, @data was sent with MSG_ZEROCOPY, see NBDZeroCopyBuffer */
+    uint64_t zero_copy_seq;
 };
 
+/* A read buffer that zero copy writes may still reference */
+typedef struct NBDZeroCopyBuffer {
+    void *buf;
+    size_t size;
+    /* Buffer can be freed once this many zero copy writes have completed */
+    uint64_t seq;
+    QTAILQ_ENTRY(NBDZeroCopyBuffer) next;
+} NBDZeroCopyBuffer;
+
 struct NBDExport {
     BlockExport common;
 
@@ -99,8 +124,13 @@ struct NBDExport {
     Notifier eject_notifier;
 
     bool allocation_depth;
+    bool zero_copy;
+    size_t zero_copy_max_pending;
     BdrvDirtyBitmap **export_bitmaps;
     size_t nr_export_bitmaps;
+
+    /* Round-robin assignment of clients to the export's iothreads */
+    unsigned int next_ctx_idx;
 };
 
 static QTAILQ_HEAD(, NBDExport) exports = QTAILQ_HEAD_INITIALIZER(exports);
@@ -140,6 +170,10 @@ struct NBDClient {
     CoMutex send_lock;
     Coroutine *send_coroutine;
 
+    /* Buffers of zero copy writes in flight, protected by lock */
+    QTAILQ_HEAD(, NBDZeroCopyBuffer) zero_copy_bufs;
+    size_t zero_copy_bytes;
+
     bool read_yielding; /* protected by lock */
     bool quiescing; /* protected by lock */
 
@@ -149,6 +183,7 @@ struct NBDClient {
     bool closing; /* protected by lock */
 
     uint32_t check_align; /* If non-zero, check for aligned client requests */
+    unsigned int ctx_idx; /* See nbd_client_aio_context() */
 
     NBDMode mode;
     NBDMetaContexts contexts; /* Negotiated meta contexts */
@@ -159,6 +194,13 @@ struct NBDClient {
 };
 
 static void nbd_client_receive_next_request(NBDClient *client);
+static int nbd_zero_copy_reap(NBDClient *client, Error **errp);
+
+/* The AioContext in which the requests of @client are processed */
+static AioContext *nbd_client_aio_context(NBDClient *client)
+{
+    return blk_exp_get_aio_context(&client->exp->common, client->ctx_idx);
+}
 
 /* Basic flow for negotiation
 
@@ -537,6 +579,7 @@ nbd_negotiate_handle_export_name(NBDClient *client, bool no_zeroes,
         return ret;
     }
 
+    client->ctx_idx = client->exp->next_ctx_idx++;
     QTAILQ_INSERT_TAIL(&client->exp->clients, client, next);
     blk_exp_ref(&client->exp->common);
 
@@ -753,6 +796,7 @@ nbd_negotiate_handle_info(NBDClient *client, Error **errp)
     if (client->opt == NBD_OPT_GO) {
         client->exp = exp;
         client->check_align = check_align;
+        client->ctx_idx = client->exp->next_ctx_idx++;
         QTAILQ_INSERT_TAIL(&client->exp->clients, client, next);
         blk_exp_ref(&client->exp->common);
         rc = 1;
@@ -1465,6 +1509,13 @@ nbd_read_eof(NBDClient *client, void *buffer, size_t size, Error **errp)
 
         len = qio_channel_readv(client->ioc, &iov, 1, errp);
         if (len == QIO_CHANNEL_ERR_BLOCK) {
+            /*
+             * Completion notifications of zero copy writes wake us up
+             * with G_IO_ERR until they are processed
+             */
+            if (nbd_zero_copy_reap(client, errp) < 0) {
+                return -EIO;
+            }
             WITH_QEMU_LOCK_GUARD(&client->lock) {
                 client->read_yielding = true;
 
@@ -1568,6 +1619,47 @@ void nbd_client_get(NBDClient *client)
     qatomic_inc(&client->refcount);
 }
 
+/*
+ * Pages sent with MSG_ZEROCOPY are pinned and count against RLIMIT_MEMLOCK
+ * until the kernel is done with them.  Stay well below it, so that there is
+ * room left for other clients.
+ */
+static size_t nbd_zero_copy_max_pending(void)
+{
+    size_t max_pending = NBD_ZERO_COPY_MAX_PENDING;
+#ifdef CONFIG_LINUX
+    struct rlimit rlim;
+
+    if (getrlimit(RLIMIT_MEMLOCK, &rlim) == 0 &&
+        rlim.rlim_cur != RLIM_INFINITY) {
+        max_pending = MIN(max_pending, rlim.rlim_cur / 2);
+    }
+#endif
+    return max_pending;
+}
+
+static void nbd_zero_copy_buffer_free(NBDClient *client,
+                                      NBDZeroCopyBuffer *zc)
+{
+    QTAILQ_REMOVE(&client->zero_copy_bufs, zc, next);
+    client->zero_copy_bytes -= zc->size;
+    qemu_vfree(zc->buf);
+    g_free(zc);
+}
+
+/*
+ * Called when the client is gone.  The connection is closed at this point,
+ * so whatever the kernel may still send from the buffers doesn't matter.
+ */
+static void nbd_zero_copy_free_all(NBDClient *client)
+{
+    NBDZeroCopyBuffer *zc, *next_zc;
+
+    QTAILQ_FOREACH_SAFE(zc, &client->zero_copy_bufs, next, next_zc) {
+        nbd_zero_copy_buffer_free(client, zc);
+    }
+}
+
 void nbd_client_put(NBDClient *client)
 {
     assert(qemu_in_main_thread());
@@ -1589,6 +1681,7 @@ void nbd_client_put(NBDClient *client)
             blk_exp_unref(&client->exp->common);
         }
         g_free(client->contexts.bitmaps);
+        nbd_zero_copy_free_all(client);
         qemu_mutex_destroy(&client->lock);
         g_free(client);
     }
@@ -1735,7 +1828,7 @@ static void nbd_drained_end(void *opaque)
     }
 }
 
-/* Runs in export AioContext */
+/* Runs in the client's AioContext */
 static void nbd_wake_read_bh(void *opaque)
 {
     NBDClient *client = opaque;
@@ -1761,7 +1854,7 @@ static bool nbd_drained_poll(void *opaque)
                  * qio_channel_yield().
                  */
                 if (client->recv_coroutine != NULL && client->read_yielding) {
-                    aio_bh_schedule_oneshot(nbd_export_aio_context(client->exp),
+                    aio_bh_schedule_oneshot(nbd_client_aio_context(client),
                                             nbd_wake_read_bh, client);
                 }
 
@@ -1939,6 +2032,8 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
     }
 
     exp->allocation_depth = arg->allocation_depth;
+    exp->zero_copy = arg->zero_copy;
+    exp->zero_copy_max_pending = nbd_zero_copy_max_pending();
 
     /*
      * We need to inhibit request queuing in the block layer to ensure we can
@@ -2037,6 +2132,7 @@ const BlockExportDriver blk_exp_nbd = {
     .create             = nbd_export_create,
     .delete             = nbd_export_delete,
     .request_shutdown   = nbd_export_request_shutdown,
+    .supports_multithread = true,
 };
 
 static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
@@ -2056,6 +2152,132 @@ static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
     return ret;
 }
 
+/*
+ * Frees the read buffers whose zero copy writes have completed.  An error
+ * reported by the kernel for any zero copy write is fatal for the
+ * connection, as the client may not have received all data.
+ * Runs in the AioContext of @client.
+ */
+static int nbd_zero_copy_reap(NBDClient *client, Error **errp)
+{
+    NBDZeroCopyBuffer *zc, *next_zc;
+    uint64_t queued, completed;
+
+    QEMU_LOCK_GUARD(&client->lock);
+
+    if (QTAILQ_EMPTY(&client->zero_copy_bufs)) {
+        return 0;
+    }
+
+    if (qio_channel_zero_copy_progress(client->ioc, &queued, &completed,
+                                       errp) < 0) {
+        return -EIO;
+    }
+
+    QTAILQ_FOREACH_SAFE(zc, &client->zero_copy_bufs, next, next_zc) {
+        if (zc->seq <= completed) {
+            nbd_zero_copy_buffer_free(client, zc);
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Like nbd_co_send_iov(), but the last element of @iov is read data from
+ * @req->data.  If the export allows it, it is sent with MSG_ZEROCOPY, in
+ * which case @req->zero_copy_seq is set and the buffer must be passed to
+ * nbd_zero_copy_hold() instead of being freed.
+ */
+static int coroutine_fn nbd_co_send_iov_data(NBDClient *client,
+                                             struct iovec *iov, unsigned niov,
+                                             NBDRequestData *req,
+                                             Error **errp)
+{
+    struct iovec *data_iov = &iov[niov - 1];
+    uint64_t queued, completed;
+    size_t pending;
+    int ret;
+
+    if (!client->exp->zero_copy || data_iov->iov_len < NBD_ZERO_COPY_MIN_SIZE ||
+        !qio_channel_has_feature(client->ioc,
+                                 QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY)) {
+        return nbd_co_send_iov(client, iov, niov, errp);
+    }
+
+    g_assert(qemu_in_coroutine());
+    qemu_co_mutex_lock(&client->send_lock);
+    client->send_coroutine = qemu_coroutine_self();
+
+    ret = nbd_zero_copy_reap(client, errp);
+    if (ret < 0) {
+        goto out;
+    }
+
+    WITH_QEMU_LOCK_GUARD(&client->lock) {
+        pending = client->zero_copy_bytes;
+    }
+    if (pending >= client->exp->zero_copy_max_pending) {
+        trace_nbd_co_send_zero_copy_throttled(pending);
+        ret = qio_channel_writev_all(client->ioc, iov, niov, errp);
+        goto out;
+    }
+
+    /* The reply headers are on the stack, so only the data can be zero copy */
+    ret = qio_channel_writev_all(client->ioc, iov, niov - 1, errp);
+    if (ret < 0) {
+        goto out;
+    }
+
+    /*
+     * Even a failed write may have queued parts of the data.  If the kernel
+     * can't pin the data, e.g. because of RLIMIT_MEMLOCK, it is copied.
+     */
+    req->zero_copy_seq = UINT64_MAX;
+    ret = qio_channel_writev_full_all(client->ioc, data_iov, 1, NULL, 0,
+                                      QIO_CHANNEL_WRITE_FLAG_ZERO_COPY |
+                                      QIO_CHANNEL_WRITE_FLAG_ZERO_COPY_FALLBACK,
+                                      errp);
+    if (ret < 0) {
+        goto out;
+    }
+
+    ret = qio_channel_zero_copy_progress(client->ioc, &queued, &completed,
+                                         errp);
+    if (ret < 0) {
+        goto out;
+    }
+    req->zero_copy_seq = queued;
+
+out:
+    client->send_coroutine = NULL;
+    qemu_co_mutex_unlock(&client->send_lock);
+
+    return ret < 0 ? -EIO : 0;
+}
+
+/*
+ * Takes over @req->data after it was sent with MSG_ZEROCOPY, until the
+ * kernel doesn't reference it anymore.
+ */
+static void coroutine_fn nbd_zero_copy_hold(NBDClient *client,
+                                            NBDRequestData *req, size_t size)
+{
+    NBDZeroCopyBuffer *zc = g_new(NBDZeroCopyBuffer, 1);
+
+    *zc = (NBDZeroCopyBuffer) {
+        .buf = req->data,
+        .size = size,
+        .seq = req->zero_copy_seq,
+    };
+    req->data = NULL;
+
+    WITH_QEMU_LOCK_GUARD(&client->lock) {
+        QTAILQ_INSERT_TAIL(&client->zero_copy_bufs, zc, next);
+        client->zero_copy_bytes += size;
+    }
+}
+
 static inline void set_be_simple_reply(NBDSimpleReply *reply, uint64_t error,
                                        uint64_t cookie)
 {
@@ -2064,9 +2286,14 @@ static inline void set_be_simple_reply(NBDSimpleReply *reply, uint64_t error,
     stq_be_p(&reply->cookie, cookie);
 }
 
+/*
+ * @req must be given if @data is read data from @req->data, so that it can
+ * be sent with MSG_ZEROCOPY.
+ */
 static int coroutine_fn nbd_co_send_simple_reply(NBDClient *client,
                                                  NBDRequest *request,
                                                  uint32_t error,
+                                                 NBDRequestData *req,
                                                  void *data,
                                                  uint64_t len,
                                                  Error **errp)
@@ -2087,6 +2314,9 @@ static int coroutine_fn nbd_co_send_simple_reply(NBDClient *client,
                                    nbd_err_lookup(nbd_err), len);
     set_be_simple_reply(&reply, nbd_err, request->cookie);
 
+    if (req) {
+        return nbd_co_send_iov_data(client, iov, 2, req, errp);
+    }
     return nbd_co_send_iov(client, iov, 2, errp);
 }
 
@@ -2148,6 +2378,7 @@ static int coroutine_fn nbd_co_send_chunk_done(NBDClient *client,
 
 static int coroutine_fn nbd_co_send_chunk_read(NBDClient *client,
                                                NBDRequest *request,
+                                               NBDRequestData *req,
                                                uint64_t offset,
                                                void *data,
                                                uint64_t size,
@@ -2168,7 +2399,7 @@ static int coroutine_fn nbd_co_send_chunk_read(NBDClient *client,
                  NBD_REPLY_TYPE_OFFSET_DATA, request);
     stq_be_p(&chunk.offset, offset);
 
-    return nbd_co_send_iov(client, iov, 3, errp);
+    return nbd_co_send_iov_data(client, iov, 3, req, errp);
 }
 
 static int coroutine_fn nbd_co_send_chunk_error(NBDClient *client,
@@ -2203,13 +2434,14 @@ static int coroutine_fn nbd_co_send_chunk_error(NBDClient *client,
  */
 static int coroutine_fn nbd_co_send_sparse_read(NBDClient *client,
                                                 NBDRequest *request,
+                                                NBDRequestData *req,
                                                 uint64_t offset,
-                                                uint8_t *data,
                                                 uint64_t size,
                                                 Error **errp)
 {
     int ret = 0;
     NBDExport *exp = client->exp;
+    uint8_t *data = req->data;
     size_t progress = 0;
 
     assert(size <= NBD_MAX_BUFFER_SIZE);
@@ -2254,8 +2486,9 @@ static int coroutine_fn nbd_co_send_sparse_read(NBDClient *client,
                 error_setg_errno(errp, -ret, "reading from file failed");
                 break;
             }
-            ret = nbd_co_send_chunk_read(client, request, offset + progress,
-                                         data + progress, pnum, final, errp);
+            ret = nbd_co_send_chunk_read(client, request, req,
+                                         offset + progress, data + progress,
+                                         pnum, final, errp);
         }
 
         if (ret < 0) {
@@ -2845,7 +3078,7 @@ static coroutine_fn int nbd_send_generic_reply(NBDClient *client,
         return nbd_co_send_chunk_done(client, request, errp);
     } else {
         return nbd_co_send_simple_reply(client, request, ret < 0 ? -ret : 0,
-                                        NULL, 0, errp);
+                                        NULL, NULL, 0, errp);
     }
 }
 
@@ -2853,10 +3086,11 @@ static coroutine_fn int nbd_send_generic_reply(NBDClient *client,
  * Return -errno if sending fails. Other errors are reported directly to the
  * client as an error reply. */
 static coroutine_fn int nbd_do_cmd_read(NBDClient *client, NBDRequest *request,
-                                        uint8_t *data, Error **errp)
+                                        NBDRequestData *req, Error **errp)
 {
     int ret;
     NBDExport *exp = client->exp;
+    uint8_t *data = req->data;
 
     assert(request->type == NBD_CMD_READ);
     assert(request->len <= NBD_MAX_BUFFER_SIZE);
@@ -2873,8 +3107,8 @@ static coroutine_fn int nbd_do_cmd_read(NBDClient *client, NBDRequest *request,
     if (client->mode >= NBD_MODE_STRUCTURED &&
         !(request->flags & NBD_CMD_FLAG_DF) && request->len)
     {
-        return nbd_co_send_sparse_read(client, request, request->from,
-                                       data, request->len, errp);
+        return nbd_co_send_sparse_read(client, request, req, request->from,
+                                       request->len, errp);
     }
 
     ret = blk_co_pread(exp->common.blk, request->from/*偏移量*/, request->len/*要读取的长度*/, data/*读要写入的buffer*/, 0);
@@ -2885,13 +3119,13 @@ static coroutine_fn int nbd_do_cmd_read(NBDClient *client, NBDRequest *request,
 
     if (client->mode >= NBD_MODE_STRUCTURED) {
         if (request->len) {
-            return nbd_co_send_chunk_read(client, request, request->from, data,
-                                          request->len, true, errp);
+            return nbd_co_send_chunk_read(client, request, req, request->from,
+                                          data, request->len, true, errp);
         } else {
             return nbd_co_send_chunk_done(client, request, errp);
         }
     } else {
-        return nbd_co_send_simple_reply(client, request, 0,
+        return nbd_co_send_simple_reply(client, request, 0, req,
                                         data, request->len, errp);
     }
 }
@@ -2924,11 +3158,12 @@ static coroutine_fn int nbd_do_cmd_cache(NBDClient *client, NBDRequest *request,
  * client as an error reply. */
 static coroutine_fn int nbd_handle_request(NBDClient *client,
                                            NBDRequest *request,
-                                           uint8_t *data, Error **errp)
+                                           NBDRequestData *req, Error **errp)
 {
     int ret;
     int flags;
     NBDExport *exp = client->exp;
+    uint8_t *data = req->data;
     char *msg;
     size_t i;
 
@@ -2938,7 +3173,7 @@ static coroutine_fn int nbd_handle_request(NBDClient *client,
         return nbd_do_cmd_cache(client, request, errp);
 
     case NBD_CMD_READ:/*请求读*/
-        return nbd_do_cmd_read(client, request, data, errp);
+        return nbd_do_cmd_read(client, request, req, errp);
 
     case NBD_CMD_WRITE:
         flags = 0;
@@ -3144,7 +3379,10 @@ static coroutine_fn void nbd_trip(void *opaque)
         error_free(export_err);
     } else {
     	/*处理收到的request*/
-        ret = nbd_handle_request(client, &request, req->data, &local_err);
+        ret = nbd_handle_request(client, &request, req, &local_err);
+    }
+    if (req->zero_copy_seq) {
+        nbd_zero_copy_hold(client, req, request.len);
     }
     if (request.contexts && request.contexts != &client->contexts) {
         assert(request.type == NBD_CMD_BLOCK_STATUS);
@@ -3207,7 +3445,8 @@ static void nbd_client_receive_next_request(NBDClient *client)
         /*初始化收协程*/
         req = nbd_request_get(client);
         client->recv_coroutine = qemu_coroutine_create(nbd_trip, req);
-        aio_co_schedule(client->exp->common.ctx, client->recv_coroutine);
+        aio_co_schedule(nbd_client_aio_context(client),
+                        client->recv_coroutine);
     }
 }
 
@@ -3276,6 +3515,7 @@ void nbd_client_new(QIOChannelSocket *sioc,
 
     client = g_new0(NBDClient, 1);
     qemu_mutex_init(&client->lock);
+    QTAILQ_INIT(&client->zero_copy_bufs);
     client->refcount = 1;
     client->tlscreds = tlscreds;
     if (tlscreds) {
@@ -28,6 +28,7 @@
 #include "monitor/monitor.h"
 #include "migration/misc.h"
 #include "hw/virtio/vhost.h"
+#include "sysemu/iothread.h"
 #include "trace.h"
 
 /* Todo:need to add the multiqueue support here */
@@ -244,6 +245,9 @@ static void vhost_vdpa_cleanup(NetClientState *nc)
         return;
     }
     qemu_close(s->vhost_vdpa.shared->device_fd);
+    if (s->vhost_vdpa.shared->svq_iothread) {
+        object_unref(OBJECT(s->vhost_vdpa.shared->svq_iothread));
+    }
     g_free(s->vhost_vdpa.shared);
 }
 
@@ -1680,6 +1684,7 @@ static NetClientState *net_vhost_vdpa_init(NetClientState *peer,
                                        struct vhost_vdpa_iova_range iova_range,
                                        uint64_t features,
                                        VhostVDPAShared *shared,
+                                       IOThread *svq_iothread,
                                        Error **errp)
 {
     NetClientState *nc = NULL;
@@ -1716,6 +1721,12 @@ static NetClientState *net_vhost_vdpa_init(NetClientState *peer,
         s->vhost_vdpa.shared->device_fd = vdpa_device_fd;
         s->vhost_vdpa.shared->iova_range = iova_range;
         s->vhost_vdpa.shared->shadow_data = svq;
+        if (svq_iothread) {
+            object_ref(OBJECT(svq_iothread));
+            s->vhost_vdpa.shared->svq_iothread = svq_iothread;
+            s->vhost_vdpa.shared->svq_ctx =
+                iothread_get_aio_context(svq_iothread);
+        }
     } else if (!is_datapath) {
         s->cvq_cmd_out_buffer = mmap(NULL, vhost_vdpa_net_cvq_cmd_page_len(),
                                      PROT_READ | PROT_WRITE,
@@ -1794,6 +1805,7 @@ int net_init_vhost_vdpa(const Netdev *netdev, const char *name,
     g_autofree NetClientState **ncs = NULL;
     struct vhost_vdpa_iova_range iova_range;
     NetClientState *nc;
+    IOThread *svq_iothread = NULL;
     int queue_pairs, r, i = 0, has_cvq = 0;
 
     assert(netdev->type == NET_CLIENT_DRIVER_VHOST_VDPA);
@@ -1810,6 +1822,15 @@ int net_init_vhost_vdpa(const Netdev *netdev, const char *name,
         return -1;
     }
 
+    if (opts->x_svq_iothread) {
+        svq_iothread = iothread_by_id(opts->x_svq_iothread);
+        if (!svq_iothread) {
+            error_setg(errp, "vhost-vdpa: IOThread '%s' not found",
+                       opts->x_svq_iothread);
+            return -1;
+        }
+    }
+
     if (opts->vhostdev) {
         vdpa_device_fd = qemu_open(opts->vhostdev, O_RDWR, errp);
         if (vdpa_device_fd == -1) {
@@ -1857,7 +1878,8 @@ int net_init_vhost_vdpa(const Netdev *netdev, const char *name,
         }
         ncs[i] = net_vhost_vdpa_init(peer, TYPE_VHOST_VDPA, name,
                                      vdpa_device_fd, i, 2, true, opts->x_svq,
-                                     iova_range, features, shared, errp);
+                                     iova_range, features, shared,
+                                     svq_iothread, errp);
         if (!ncs[i])
             goto err;
     }
@@ -1869,7 +1891,7 @@ int net_init_vhost_vdpa(const Netdev *netdev, const char *name,
         nc = net_vhost_vdpa_init(peer, TYPE_VHOST_VDPA, name,
                                  vdpa_device_fd, i, 1, false,
                                  opts->x_svq, iova_range, features, shared,
-                                 errp);
+                                 NULL, errp);
         if (!nc)
             goto err;
     }
@@ -465,6 +465,39 @@ void plugin_register_vcpu_mem_cb(GArray **arr,
     dyn_cb->regular = regular_cb;
 }
 
+static void plugin_mem_buffer_flush__cb(unsigned int vcpu_index, void *udata)
+{
+    plugin_mem_buffer_flush(udata, vcpu_index);
+}
+
+void plugin_register_vcpu_mem_buffer(GArray **arr,
+                                     enum qemu_plugin_mem_rw rw,
+                                     struct qemu_plugin_mem_buffer *buf,
+                                     uint64_t pc)
+{
+    static TCGHelperInfo info = {
+        .flags = TCG_CALL_NO_RWG,
+        /*
+         * Match plugin_mem_buffer_flush__cb:
+         *   void (*)(uint32_t, void *)
+         */
+        .typemask = (dh_typemask(void, 0) |
+                     dh_typemask(i32, 1) |
+                     dh_typemask(ptr, 2))
+    };
+
+    struct qemu_plugin_dyn_cb *dyn_cb = plugin_get_dyn_cb(arr);
+    struct qemu_plugin_mem_buffer_cb buffer_cb = {
+        .f.vcpu_udata = plugin_mem_buffer_flush__cb,
+        .info = &info,
+        .buf = buf,
+        .pc = pc,
+        .rw = rw,
+    };
+    dyn_cb->type = PLUGIN_CB_MEM_BUFFER;
+    dyn_cb->mem_buffer = buffer_cb;
+}
+
 /*
  * Disable CFI checks.
  * The callback function has been loaded from an external library so we do not
@@ -601,6 +634,44 @@ void exec_inline_op(enum plugin_dyn_cb_type type,
     }
 }
 
+static struct qemu_plugin_mem_buffer_entry *
+plugin_mem_buffer_entry(struct qemu_plugin_mem_buffer *buf,
+                        unsigned int vcpu_index)
+{
+    GArray *arr = buf->score->data;
+
+    return (void *)(arr->data + vcpu_index * g_array_get_element_size(arr));
+}
+
+/*
+ * Record an access performed from a helper, as the generated code would.
+ *
+ * The generated code reserves room for the accesses of an instruction
+ * when it starts, but doesn't know about accesses from helpers.  Keep
+ * enough room after this record for the inline accesses of any
+ * instruction, so that they don't need the reservation to be redone.
+ */
+static void exec_mem_buffer_op(struct qemu_plugin_mem_buffer_cb *cb,
+                               unsigned int vcpu_index, uint64_t vaddr,
+                               qemu_plugin_meminfo_t info)
+{
+    struct qemu_plugin_mem_buffer *buf = cb->buf;
+    struct qemu_plugin_mem_buffer_entry *e =
+        plugin_mem_buffer_entry(buf, vcpu_index);
+    size_t max_need = qatomic_read(&buf->max_need);
+    size_t limit = buf->n_records > max_need ? buf->n_records - max_need : 0;
+    struct qemu_plugin_mem_record *rec;
+
+    if (e->count >= MAX(limit, 1)) {
+        plugin_mem_buffer_flush(buf, vcpu_index);
+    }
+
+    rec = &e->records[e->count++];
+    rec->vaddr = vaddr;
+    rec->pc = cb->pc;
+    rec->info = info;
+}
+
 void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
                              uint64_t value_low,
                              uint64_t value_high,
@@ -634,6 +705,12 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
                 exec_inline_op(cb->type, &cb->inline_insn, cpu->cpu_index);
             }
             break;
+        case PLUGIN_CB_MEM_BUFFER:
+            if (rw & cb->mem_buffer.rw) {
+                exec_mem_buffer_op(&cb->mem_buffer, cpu->cpu_index, vaddr,
+                                   make_plugin_meminfo(oi, rw));
+            }
+            break;
         default:
             g_assert_not_reached();
         }
@@ -768,3 +845,45 @@ void plugin_scoreboard_free(struct qemu_plugin_scoreboard *score)
     g_array_free(score->data, TRUE);
     g_free(score);
 }
+
+struct qemu_plugin_mem_buffer *
+plugin_mem_buffer_new(size_t n_records, qemu_plugin_vcpu_mem_buffer_cb_t cb,
+                      void *udata)
+{
+    struct qemu_plugin_mem_buffer *buf;
+
+    g_assert(n_records > 0);
+    buf = g_new0(struct qemu_plugin_mem_buffer, 1);
+    buf->n_records = n_records;
+    buf->cb = cb;
+    buf->userp = udata;
+    buf->score = plugin_scoreboard_new(
+        sizeof(struct qemu_plugin_mem_buffer_entry) +
+        n_records * sizeof(struct qemu_plugin_mem_record));
+    return buf;
+}
+
+void plugin_mem_buffer_free(struct qemu_plugin_mem_buffer *buf)
+{
+    plugin_scoreboard_free(buf->score);
+    g_free(buf);
+}
+
+/*
+ * Disable CFI checks.
+ * The callback function has been loaded from an external library so we do not
+ * have type information
+ */
+QEMU_DISABLE_CFI
+void plugin_mem_buffer_flush(struct qemu_plugin_mem_buffer *buf,
+                             unsigned int vcpu_index)
+{
+    struct qemu_plugin_mem_buffer_entry *e =
+        plugin_mem_buffer_entry(buf, vcpu_index);
+    size_t n = e->count;
+
+    if (n) {
+        buf->cb(vcpu_index, e->records, n, buf->userp);
+        e->count = 0;
+    }
+}
@@ -188,6 +188,7 @@ DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "                split-wx=on|off (enable TCG split w^x mapping)\n"
     "                tb-size=n (TCG translation block cache size)\n"
     "                dirty-ring-size=n (KVM dirty ring GFN count, default 0)\n"
+    "                dirty-ring-reapers=n (KVM dirty ring reaper threads, default 0, auto)\n"
     "                eager-split-size=n (KVM Eager Page Split chunk size, default 0, disabled. ARM only)\n"
     "                notify-vmexit=run|internal-error|disable,notify-window=n (enable notify VM exit and set notify window, x86 only)\n"
     "                thread=single|multi (enable multi-threaded TCG)\n"
@@ -248,6 +249,17 @@ SRST
         is disabled (dirty-ring-size=0).  When enabled, KVM will instead
         record dirty pages in a bitmap.
 
+    ``dirty-ring-reapers=n``
+        When the KVM dirty ring is enabled, it controls the number of
+        threads that collect the per-vCPU dirty rings.  Each thread owns
+        an equal share of the vCPUs, and a vCPU whose ring is full
+        collects the rings of its share itself.  The default value of 0
+        uses one thread per 64 vCPUs, up to 8 threads.  It must not be
+        larger than the maximum number of vCPUs.  The number of
+        times each vCPU found its ring full is reported by
+        ``query-stats`` as the ``dirty_ring_full_exits`` statistic of the
+        ``kvm`` provider.
+
     ``eager-split-size=n``
         KVM implements dirty page logging at the PAGE_SIZE granularity and
         enabling dirty-logging on a huge-page requires breaking it into
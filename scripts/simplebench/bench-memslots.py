@@ -0,0 +1,158 @@
+#!/usr/bin/env python3
+#
+# Benchmark KVM memslot updates by hot-plugging many memory devices
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+
+import sys
+import os
+import tempfile
+import time
+import socket
+
+import simplebench
+from results_to_text import results_to_text
+
+sys.path.append(os.path.join(os.path.dirname(__file__), '..', '..', 'python'))
+from qemu.machine import QEMUMachine
+from qemu.machine.qtest import QEMUQtestProtocol
+from qemu.qmp import ConnectError
+
+
+DIMM_SIZE_MB = 32
+
+# ACPI memory hotplug registers of the pc machine
+MEMHP_IO_BASE = 0x0a00
+MEMHP_SLOT_SELECTOR = MEMHP_IO_BASE + 0x0
+MEMHP_SLOT_FLAGS = MEMHP_IO_BASE + 0x14
+MEMHP_FLAG_EJECT = 8
+
+
+def plug_dimm(vm, i):
+    res = vm.qmp('object-add', qom_type='memory-backend-ram',
+                 id='mem{}'.format(i), size=DIMM_SIZE_MB << 20)
+    if res != {'return': {}}:
+        return 'object-add failed: ' + str(res)
+    res = vm.qmp('device_add', driver='pc-dimm', id='dimm{}'.format(i),
+                 memdev='mem{}'.format(i), slot=i)
+    if res != {'return': {}}:
+        return 'device_add failed: ' + str(res)
+    return None
+
+
+def unplug_dimm(vm, qtest, i):
+    # The guest is paused and couldn't handle the ACPI unplug request
+    # anyway, so eject the DIMM through the hotplug registers like the
+    # guest's _EJ0 method would
+    res = vm.qmp('device_del', id='dimm{}'.format(i))
+    if res != {'return': {}}:
+        return 'device_del failed: ' + str(res)
+    qtest.cmd('outl {:#x} {}'.format(MEMHP_SLOT_SELECTOR, i))
+    qtest.cmd('outl {:#x} {}'.format(MEMHP_SLOT_FLAGS, MEMHP_FLAG_EJECT))
+    if not vm.event_wait('DEVICE_DELETED',
+                         match={'data': {'device': 'dimm{}'.format(i)}}):
+        return 'dimm{} was not ejected'.format(i)
+    res = vm.qmp('object-del', id='mem{}'.format(i))
+    if res != {'return': {}}:
+        return 'object-del failed: ' + str(res)
+    return None
+
+
+def bench_hotplug(qemu_binary, nr_dimms, replug):
+    """Benchmark hot-plugging @nr_dimms pc-dimm devices into a paused x86
+    guest running under KVM.  Every hot-plug is a memory transaction that
+    adds a KVM memslot, so the total time grows with the cost of memslot
+    updates.
+
+    With @replug, all DIMMs are plugged first, and then each of them is
+    unplugged and plugged again while all the others stay in place.  This
+    measures removing memslots as well as adding them, with the largest
+    number of memslots present.
+
+    Returns {'seconds': float} on success and {'error': str} on failure.
+    Return value is compatible with simplebench lib.
+    """
+
+    tmpdir = tempfile.TemporaryDirectory()
+    qtest_sock = os.path.join(tmpdir.name, 'qtest.sock')
+    vm = QEMUMachine(qemu_binary,
+                     args=['-accel', 'kvm', '-machine', 'pc', '-S',
+                           '-nodefaults', '-display', 'none',
+                           '-m', '512M,slots={},maxmem={}M'.format(
+                               nr_dimms, 512 + nr_dimms * DIMM_SIZE_MB),
+                           '-chardev', 'socket,id=qtest,path={},server=on,'
+                           'wait=off'.format(qtest_sock),
+                           '-qtest', 'chardev:qtest'])
+
+    try:
+        vm.launch()
+    except OSError as e:
+        tmpdir.cleanup()
+        return {'error': 'popen failed: ' + str(e)}
+    except (ConnectError, socket.timeout):
+        tmpdir.cleanup()
+        return {'error': 'qemu failed: ' + str(vm.get_log())}
+
+    qtest = QEMUQtestProtocol(qtest_sock)
+    try:
+        qtest.connect()
+
+        if replug:
+            for i in range(nr_dimms):
+                err = plug_dimm(vm, i)
+                if err:
+                    return {'error': err}
+
+        start = time.monotonic()
+        for i in range(nr_dimms):
+            if replug:
+                err = unplug_dimm(vm, qtest, i)
+                if err:
+                    return {'error': err}
+            err = plug_dimm(vm, i)
+            if err:
+                return {'error': err}
+        seconds = time.monotonic() - start
+    finally:
+        qtest.close()
+        vm.shutdown()
+        tmpdir.cleanup()
+
+    return {'seconds': seconds}
+
+
+def bench_func(env, case):
+    """ Handle one "cell" of benchmarking table. """
+    return bench_hotplug(env['qemu_binary'], case['dimms'], case['replug'])
+
+
+if __name__ == '__main__':
+    if len(sys.argv) < 2:
+        print('Usage: {} QEMU_BINARY [QEMU_BINARY...]'.format(sys.argv[0]))
+        sys.exit(1)
+
+    test_cases = []
+    for replug in (False, True):
+        for n in (64, 128, 255):
+            test_cases.append({
+                'id': '{} dimms{}'.format(n, ', replug' if replug else ''),
+                'dimms': n,
+                'replug': replug
+            })
+    test_envs = [{'id': path, 'qemu_binary': path} for path in sys.argv[1:]]
+
+    result = simplebench.bench(bench_func, test_envs, test_cases, count=3)
+    print(results_to_text(result))
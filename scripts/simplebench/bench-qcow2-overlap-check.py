@@ -0,0 +1,111 @@
+#!/usr/bin/env python3
+#
+# Benchmark qcow2 writes under the different overlap-check modes
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+
+import sys
+import os
+import subprocess
+import time
+
+import simplebench
+from results_to_text import results_to_text
+
+
+IMAGE_SIZE = '64G'
+NR_SNAPSHOTS = 8
+
+
+def run(*args):
+    p = subprocess.run(list(args), stdout=subprocess.PIPE,
+                       stderr=subprocess.STDOUT, universal_newlines=True)
+    if p.returncode != 0:
+        return p.stdout
+    return None
+
+
+def prepare_image(qemu_img, image):
+    """Create a qcow2 image with many L2 tables referenced both by the
+    active L1 table and by @NR_SNAPSHOTS internal snapshots, so that the
+    overlap checks have lots of metadata to look at.
+    """
+
+    err = run(qemu_img, 'create', '-f', 'qcow2', '-o', 'cluster_size=64k',
+              image, IMAGE_SIZE)
+    if err:
+        return err
+
+    for i in range(NR_SNAPSHOTS):
+        # One write per 512M touches a new L2 table each time
+        err = run(qemu_img, 'bench', '-w', '-t', 'none', '-f', 'qcow2',
+                  '-c', '128', '-s', '4k', '-S', '512M',
+                  '-o', str(i * 4096), image)
+        if err:
+            return err
+        err = run(qemu_img, 'snapshot', '-c', 'snap{}'.format(i), image)
+        if err:
+            return err
+
+    return None
+
+
+def bench_overlap_check(qemu_img, image, mode):
+    """Benchmark 4k writes spread over the whole image with the given
+    overlap-check mode.  Every write triggers a copy-on-write of an L2 table
+    shared with the snapshots, followed by the pre-write overlap checks.
+
+    Returns {'seconds': float} on success and {'error': str} on failure.
+    Return value is compatible with simplebench lib.
+    """
+
+    err = prepare_image(qemu_img, image)
+    if err:
+        return {'error': err}
+
+    try:
+        start = time.monotonic()
+        err = run(qemu_img, 'bench', '-w', '-t', 'none', '-c', '100000',
+                  '-s', '4k', '-S', '640k', '--image-opts',
+                  'driver=qcow2,file.filename={},overlap-check={}'.format(
+                      image, mode))
+        seconds = time.monotonic() - start
+    finally:
+        os.unlink(image)
+
+    if err:
+        return {'error': err}
+
+    return {'seconds': seconds}
+
+
+def bench_func(env, case):
+    """ Handle one "cell" of benchmarking table. """
+    return bench_overlap_check(env['qemu_img'], env['image'], case['mode'])
+
+
+if __name__ == '__main__':
+    if len(sys.argv) < 3:
+        print('Usage: {} IMAGE QEMU_IMG [QEMU_IMG...]'.format(sys.argv[0]))
+        sys.exit(1)
+
+    test_cases = [{'id': mode, 'mode': mode}
+                  for mode in ('none', 'constant', 'cached', 'all')]
+    test_envs = [{'id': path, 'qemu_img': path, 'image': sys.argv[1]}
+                 for path in sys.argv[2:]]
+
+    result = simplebench.bench(bench_func, test_envs, test_cases, count=3)
+    print(results_to_text(result))
@@ -0,0 +1,100 @@
+#!/usr/bin/env python3
+#
+# Benchmark the TCG interpreter by running host programs under linux-user
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+
+import sys
+import os
+import random
+import shutil
+import subprocess
+import tempfile
+import time
+
+import simplebench
+from results_to_text import results_to_text
+
+
+DATA_SIZE_MB = 8
+
+
+def bench_program(qemu_binary, args):
+    """Benchmark running the host program @args under the linux-user
+    emulator @qemu_binary.  The emulator must be built for the host
+    architecture with --enable-tcg-interpreter, so that all guest code
+    runs in the TCG interpreter.
+
+    Returns {'seconds': float} on success and {'error': str} on failure.
+    Return value is compatible with simplebench lib.
+    """
+
+    start = time.monotonic()
+    try:
+        subprocess.run([qemu_binary] + args, check=True,
+                       stdout=subprocess.DEVNULL, stderr=subprocess.PIPE)
+    except OSError as e:
+        return {'error': 'popen failed: ' + str(e)}
+    except subprocess.CalledProcessError as e:
+        return {'error': 'program failed: ' + e.stderr.decode()}
+
+    return {'seconds': time.monotonic() - start}
+
+
+def bench_func(env, case):
+    """ Handle one "cell" of benchmarking table. """
+    return bench_program(env['qemu_binary'], case['args'])
+
+
+def make_data(path):
+    # Compressible, but not trivially so
+    rnd = random.Random(0)
+    words = [bytes(rnd.choices(b'abcdefghijklmnopqrstuvwxyz',
+                               k=rnd.randint(2, 10)))
+             for _ in range(4096)]
+    with open(path, 'wb') as f:
+        for _ in range(DATA_SIZE_MB):
+            chunk = b''
+            while len(chunk) < 1 << 20:
+                chunk += rnd.choice(words) + b' '
+            f.write(chunk[:1 << 20])
+
+
+if __name__ == '__main__':
+    if len(sys.argv) < 2:
+        print('Usage: {} QEMU_USER_BINARY [QEMU_USER_BINARY...]'.format(
+            sys.argv[0]))
+        print('Compare for example builds with the switch interpreter and '
+              'with threaded dispatch.')
+        sys.exit(1)
+
+    with tempfile.TemporaryDirectory() as tmpdir:
+        data = os.path.join(tmpdir, 'data')
+        make_data(data)
+
+        test_cases = []
+        for name, args in (('gzip', ['-c', data]),
+                           ('sha256sum', [data]),
+                           ('sort', ['-o', os.devnull, data])):
+            path = shutil.which(name)
+            if path:
+                test_cases.append({'id': name, 'args': [path] + args})
+
+        test_envs = [{'id': path, 'qemu_binary': path}
+                     for path in sys.argv[1:]]
+
+        result = simplebench.bench(bench_func, test_envs, test_cases, count=3)
+        print(results_to_text(result))
@@ -40,6 +40,9 @@
 static unsigned memory_region_transaction_depth;
 static bool memory_region_update_pending;
 static bool ioeventfd_update_pending;
+/* Changes made by the current transaction, unless all FlatViews changed */
+static GArray *memory_region_changes;
+static bool memory_region_changes_all;
 unsigned int global_dirty_tracking;
 
 static QTAILQ_HEAD(, MemoryListener) memory_listeners
@@ -236,6 +239,15 @@ struct FlatRange {
 #define FOR_EACH_FLAT_RANGE(var, view)          \
     for (var = (view)->ranges; var < (view)->ranges + (view)->nr; ++var)
 
+/*
+ * One place a MemoryRegion was rendered at: offset 0 of the region lands
+ * at @base, and only the part of it within @clip can be visible.
+ */
+typedef struct FlatViewVisit {
+    Int128 base;
+    AddrRange clip;
+} FlatViewVisit;
+
 static inline MemoryRegionSection
 section_from_flat_range(FlatRange *fr, FlatView *fv)
 {
@@ -270,6 +282,8 @@ static FlatView *flatview_new(MemoryRegion *mr_root)
     view = g_new0(FlatView, 1);
     view->ref = 1;
     view->root = mr_root;
+    view->regions = g_hash_table_new_full(NULL, NULL, NULL,
+                                          (GDestroyNotify)g_array_unref);
     memory_region_ref(mr_root);
     trace_flatview_new(view, mr_root);
 
@@ -309,6 +323,7 @@ static void flatview_destroy(FlatView *view)
         memory_region_unref(view->ranges[i].mr);
     }
     g_free(view->ranges);
+    g_hash_table_destroy(view->regions);
     memory_region_unref(view->root);
     g_free(view);
 }
@@ -614,13 +629,35 @@ static AddressSpace *memory_region_to_address_space(MemoryRegion *mr)
     return NULL;
 }
 
+static void flatview_add_visit(FlatView *view, MemoryRegion *mr,
+                               Int128 base, AddrRange clip)
+{
+    GArray *visits = g_hash_table_lookup(view->regions, mr);
+    FlatViewVisit visit = { .base = base, .clip = clip };
+    unsigned i;
+
+    if (!visits) {
+        visits = g_array_new(false, false, sizeof(FlatViewVisit));
+        g_hash_table_insert(view->regions, mr, visits);
+    }
+    for (i = 0; i < visits->len; i++) {
+        FlatViewVisit *old = &g_array_index(visits, FlatViewVisit, i);
+
+        if (int128_eq(old->base, base) && addrrange_equal(old->clip, clip)) {
+            return;
+        }
+    }
+    g_array_append_val(visits, visit);
+}
+
 /* Render a memory region into the global view.  Ranges in @view obscure
- * ranges in @mr.
+ * ranges in @mr.  Only the part of the view inside @window is rendered.
  */
 static void render_memory_region(FlatView *view,
                                  MemoryRegion *mr,
                                  Int128 base/*基准地址*/,
                                  AddrRange clip,
+                                 AddrRange window,
                                  bool readonly,
                                  bool nonvolatile,
                                  bool unmergeable)
@@ -633,6 +670,9 @@ static void render_memory_region(FlatView *view,
     FlatRange fr;
     AddrRange tmp;
 
+    flatview_add_visit(view, mr, int128_add(base, int128_make64(mr->addr)),
+                       clip);
+
     //mr必须已开启
     if (!mr->enabled) {
         return;
@@ -654,17 +694,25 @@ static void render_memory_region(FlatView *view,
     //取两者相交部分
     clip = addrrange_intersection(tmp, clip);
 
+    /*
+     * Outside @window the view keeps its old ranges, and the places of
+     * the regions below are already recorded.
+     */
+    if (!addrrange_intersects(clip, window)) {
+        return;
+    }
+
     if (mr->alias) {
         int128_subfrom(&base, int128_make64(mr->alias->addr));
         int128_subfrom(&base, int128_make64(mr->alias_offset));
-        render_memory_region(view, mr->alias, base, clip,
+        render_memory_region(view, mr->alias, base, clip, window,
                              readonly, nonvolatile, unmergeable);
         return;
     }
 
     /* Render subregions in priority order. */
     QTAILQ_FOREACH(subregion, &mr->subregions, subregions_link) {
-        render_memory_region(view, subregion, base, clip,
+        render_memory_region(view, subregion, base, clip, window,
                              readonly, nonvolatile, unmergeable);
     }
 
@@ -672,9 +720,10 @@ static void render_memory_region(FlatView *view,
         return;
     }
 
-    offset_in_region = int128_get64(int128_sub(clip.start, base));
-    base = clip.start;
-    remain = clip.size;
+    tmp = addrrange_intersection(clip, window);
+    offset_in_region = int128_get64(int128_sub(tmp.start, base));
+    base = tmp.start;
+    remain = tmp.size;
 
     fr.mr = mr;
     fr.dirty_log_mask = memory_region_get_dirty_log_mask(mr);
@@ -772,19 +821,11 @@ static MemoryRegion *memory_region_get_flatview_root(MemoryRegion *mr)
     return NULL;
 }
 
-/* Render a memory topology into a list of disjoint absolute ranges. */
-static FlatView *generate_memory_topology(MemoryRegion *mr)
+/* Build the dispatch tree of a rendered view and make it current */
+static void flatview_publish(FlatView *view)
 {
     int i;
-    FlatView *view;
-
-    view = flatview_new(mr);
 
-    if (mr) {
-        render_memory_region(view, mr, int128_zero(),
-                             addrrange_make(int128_zero(), int128_2_64()),
-                             false, false, false);
-    }
     flatview_simplify(view);
 
     view->dispatch = address_space_dispatch_new(view);
@@ -795,7 +836,95 @@ static FlatView *generate_memory_topology(MemoryRegion *mr)
     }
     address_space_dispatch_compact(view->dispatch);
     //更新mr对应的view
-    g_hash_table_replace(flat_views, mr, view);
+    g_hash_table_replace(flat_views, view->root, view);
+}
+
+/* Render a memory topology into a list of disjoint absolute ranges. */
+static FlatView *generate_memory_topology(MemoryRegion *mr)
+{
+    int64_t start = g_get_monotonic_time();
+    AddrRange all = addrrange_make(int128_zero(), int128_2_64());
+    FlatView *view;
+
+    view = flatview_new(mr);
+
+    if (mr) {
+        render_memory_region(view, mr, int128_zero(), all, all,
+                             false, false, false);
+    }
+    flatview_publish(view);
+
+    trace_flatview_render(view, mr ? memory_region_name(mr) : "(empty)",
+                          view->nr, g_get_monotonic_time() - start);
+
+    return view;
+}
+
+/*
+ * Build the successor of @old by rendering its root again only inside
+ * @windows, which are sorted and disjoint; the ranges outside of them are
+ * copied over.  The dispatch tree is still built from scratch.
+ */
+static FlatView *flatview_update(FlatView *old, GArray *windows)
+{
+    int64_t start = g_get_monotonic_time();
+    AddrRange all = addrrange_make(int128_zero(), int128_2_64());
+    GHashTable *regions;
+    FlatView *view;
+    unsigned i, j, w = 0;
+
+    view = flatview_new(old->root);
+    view->nr_updates = old->nr_updates + 1;
+
+    /* Nothing looks @old up any more, so take over where regions are */
+    regions = view->regions;
+    view->regions = old->regions;
+    old->regions = regions;
+
+    for (i = 0; i < old->nr; i++) {
+        FlatRange fr = old->ranges[i];
+        Int128 end = addrrange_end(fr.addr);
+
+        while (w < windows->len &&
+               int128_le(addrrange_end(g_array_index(windows, AddrRange, w)),
+                         fr.addr.start)) {
+            w++;
+        }
+        for (j = w; j < windows->len && int128_nz(fr.addr.size); j++) {
+            AddrRange win = g_array_index(windows, AddrRange, j);
+
+            if (int128_ge(win.start, end)) {
+                break;
+            }
+            if (int128_lt(fr.addr.start, win.start)) {
+                FlatRange head = fr;
+
+                head.addr.size = int128_sub(win.start, fr.addr.start);
+                flatview_insert(view, view->nr, &head);
+            }
+            if (int128_ge(addrrange_end(win), end)) {
+                fr.addr.size = int128_zero();
+                break;
+            }
+            fr.offset_in_region += int128_get64(
+                int128_sub(addrrange_end(win), fr.addr.start));
+            fr.addr = addrrange_make(addrrange_end(win),
+                                     int128_sub(end, addrrange_end(win)));
+        }
+        if (int128_nz(fr.addr.size)) {
+            flatview_insert(view, view->nr, &fr);
+        }
+    }
+
+    for (i = 0; i < windows->len; i++) {
+        render_memory_region(view, view->root, int128_zero(), all,
+                             g_array_index(windows, AddrRange, i),
+                             false, false, false);
+    }
+    flatview_publish(view);
+
+    trace_flatview_update(view, memory_region_name(view->root), windows->len,
+                          view->nr, g_get_monotonic_time() - start);
 
     return view;
 }
@@ -1090,27 +1219,163 @@ static void flatviews_init(void)
     }
 }
 
+/* A change to @range of @mr, in the address space of @mr itself */
+typedef struct MemoryRegionChange {
+    MemoryRegion *mr;
+    AddrRange range;
+} MemoryRegionChange;
+
+/*
+ * Past this many windows to render again, or this many incremental updates
+ * of a view (whose record of regions only grows), render it in full.
+ */
+#define FLATVIEW_MAX_WINDOWS 16
+#define FLATVIEW_MAX_UPDATES 64
+
+/*
+ * Record that the FlatViews showing @size bytes at @offset of @mr need to
+ * be rendered again there.
+ */
+static void memory_region_update_pending_range(MemoryRegion *mr,
+                                               hwaddr offset, Int128 size)
+{
+    MemoryRegionChange change = {
+        .mr = mr,
+        .range = addrrange_make(int128_make64(offset), size),
+    };
+
+    memory_region_update_pending = true;
+    if (!memory_region_changes) {
+        memory_region_changes = g_array_new(false, false,
+                                            sizeof(MemoryRegionChange));
+    }
+    g_array_append_val(memory_region_changes, change);
+}
+
+/*
+ * Record that a change to @mr needs the FlatViews it was rendered into to
+ * be rendered again; NULL stands for a change that affects all of them.
+ * The place of @mr in its container is recorded too, as @mr may have moved
+ * there since the last render, or never been reached if it was disabled.
+ */
+static void memory_region_update_pending_for(MemoryRegion *mr)
+{
+    if (!mr) {
+        memory_region_update_pending = true;
+        memory_region_changes_all = true;
+        return;
+    }
+    memory_region_update_pending_range(mr, 0, mr->size);
+    if (mr->container) {
+        memory_region_update_pending_range(mr->container, mr->addr, mr->size);
+    }
+}
+
+static gint addrrange_compare(gconstpointer a, gconstpointer b)
+{
+    const AddrRange *r1 = a, *r2 = b;
+
+    if (int128_lt(r1->start, r2->start)) {
+        return -1;
+    }
+    return int128_gt(r1->start, r2->start);
+}
+
+/*
+ * Collect in @windows the sorted, disjoint parts of @view that the pending
+ * changes can reach.  Returns false if the view has to be rendered in full.
+ */
+static bool flatview_changed_windows(FlatView *view, GArray *windows)
+{
+    unsigned i, j, n = 0;
+
+    if (memory_region_changes_all) {
+        return false;
+    }
+    for (i = 0; memory_region_changes && i < memory_region_changes->len; i++) {
+        MemoryRegionChange *change =
+            &g_array_index(memory_region_changes, MemoryRegionChange, i);
+        GArray *visits = g_hash_table_lookup(view->regions, change->mr);
+
+        for (j = 0; visits && j < visits->len; j++) {
+            FlatViewVisit *visit = &g_array_index(visits, FlatViewVisit, j);
+            AddrRange r = addrrange_shift(change->range, visit->base);
+
+            if (addrrange_intersects(r, visit->clip)) {
+                r = addrrange_intersection(r, visit->clip);
+                g_array_append_val(windows, r);
+            }
+        }
+    }
+
+    g_array_sort(windows, addrrange_compare);
+    for (i = 0; i < windows->len; i++) {
+        AddrRange r = g_array_index(windows, AddrRange, i);
+        AddrRange *last = n ? &g_array_index(windows, AddrRange, n - 1) : NULL;
+
+        if (!int128_nz(r.size)) {
+            continue;
+        }
+        if (last && int128_le(r.start, addrrange_end(*last))) {
+            last->size = int128_sub(int128_max(addrrange_end(*last),
+                                               addrrange_end(r)),
+                                    last->start);
+        } else {
+            g_array_index(windows, AddrRange, n++) = r;
+        }
+    }
+    g_array_set_size(windows, n);
+
+    return !n || (n <= FLATVIEW_MAX_WINDOWS &&
+                  view->nr_updates < FLATVIEW_MAX_UPDATES);
+}
+
 static void flatviews_reset(void)
 {
+    GHashTable *old_views = flat_views;
+    GArray *windows = g_array_new(false, false, sizeof(AddrRange));
     AddressSpace *as;
 
-    if (flat_views) {
-        //减引用
-        g_hash_table_unref(flat_views);
-        flat_views = NULL;
-    }
+    flat_views = NULL;
     flatviews_init();
 
-    /* Render unique FVs */
+    /*
+     * Render unique FVs.  Those that no change reaches are reused, the
+     * others are rendered again only where the changes are if possible.
+     */
     QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
         MemoryRegion *physmr = memory_region_get_flatview_root(as->root);
+        FlatView *view;
 
         if (g_hash_table_lookup(flat_views, physmr)) {
             continue;
         }
 
+        view = old_views ? g_hash_table_lookup(old_views, physmr) : NULL;
+        g_array_set_size(windows, 0);
+        if (view && flatview_changed_windows(view, windows)) {
+            if (windows->len) {
+                flatview_update(view, windows);
+            } else {
+                flatview_ref(view);
+                g_hash_table_replace(flat_views, physmr, view);
+                trace_flatview_reuse(view, physmr);
+            }
+            continue;
+        }
+
         generate_memory_topology(physmr);
     }
+
+    g_array_free(windows, true);
+    if (old_views) {
+        //减引用
+        g_hash_table_unref(old_views);
+    }
+    if (memory_region_changes) {
+        g_array_set_size(memory_region_changes, 0);
+    }
+    memory_region_changes_all = false;
 }
 
 static void address_space_set_flatview(AddressSpace *as)
@@ -1123,6 +1388,14 @@ static void address_space_set_flatview(AddressSpace *as)
     assert(new_view);
 
     if (old_view == new_view) {
+        /*
+         * Nothing changed in this address space, but listeners may be
+         * rebuilding their view of it between begin and commit.
+         */
+        if (!QTAILQ_EMPTY(&as->listeners)) {
+            address_space_update_topology_pass(as, old_view, new_view, false);
+            address_space_update_topology_pass(as, old_view, new_view, true);
+        }
         return;
     }
 
@@ -1134,12 +1407,15 @@ static void address_space_set_flatview(AddressSpace *as)
 
     if (!QTAILQ_EMPTY(&as->listeners)) {
         FlatView tmpview = { .nr = 0 }, *old_view2 = old_view;
+        int64_t start = g_get_monotonic_time();
 
         if (!old_view2) {
             old_view2 = &tmpview;
         }
         address_space_update_topology_pass(as, old_view2, new_view, false);
         address_space_update_topology_pass(as, old_view2, new_view, true);
+        trace_address_space_update_topology(as->name, new_view,
+                                            g_get_monotonic_time() - start);
     }
 
     /* Writes are protected by the BQL.  */
@@ -2318,7 +2594,9 @@ void memory_region_set_log(MemoryRegion *mr, bool log, unsigned client)
 
     memory_region_transaction_begin();
     mr->dirty_log_mask = (mr->dirty_log_mask & ~mask) | (log * mask);
-    memory_region_update_pending |= mr->enabled;
+    if (mr->enabled) {
+        memory_region_update_pending_for(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2448,7 +2726,9 @@ void memory_region_set_readonly(MemoryRegion *mr, bool readonly)
     if (mr->readonly != readonly) {
         memory_region_transaction_begin();
         mr->readonly = readonly;
-        memory_region_update_pending |= mr->enabled;
+        if (mr->enabled) {
+            memory_region_update_pending_for(mr);
+        }
         memory_region_transaction_commit();
     }
 }
@@ -2458,7 +2738,9 @@ void memory_region_set_nonvolatile(MemoryRegion *mr, bool nonvolatile)
     if (mr->nonvolatile != nonvolatile) {
         memory_region_transaction_begin();
         mr->nonvolatile = nonvolatile;
-        memory_region_update_pending |= mr->enabled;
+        if (mr->enabled) {
+            memory_region_update_pending_for(mr);
+        }
         memory_region_transaction_commit();
     }
 }
@@ -2468,7 +2750,9 @@ void memory_region_rom_device_set_romd(MemoryRegion *mr, bool romd_mode)
     if (mr->romd_mode != romd_mode) {
         memory_region_transaction_begin();
         mr->romd_mode = romd_mode;
-        memory_region_update_pending |= mr->enabled;
+        if (mr->enabled) {
+            memory_region_update_pending_for(mr);
+        }
         memory_region_transaction_commit();
     }
 }
@@ -2708,7 +2992,10 @@ static void memory_region_update_container_subregions(MemoryRegion *subregion)
     QTAILQ_INSERT_TAIL(&mr->subregions, subregion, subregions_link);
 done:
     //mr待更新的条件取决于：1。mr是否被开启；2。此subregion是否被开启
-    memory_region_update_pending |= mr->enabled && subregion->enabled;
+    if (mr->enabled && subregion->enabled) {
+        memory_region_update_pending_range(mr, subregion->addr,
+                                           subregion->size);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2760,8 +3047,11 @@ void memory_region_del_subregion(MemoryRegion *mr,
         assert(alias->mapped_via_alias >= 0);
     }
     QTAILQ_REMOVE(&mr->subregions, subregion, subregions_link);
+    if (mr->enabled && subregion->enabled) {
+        memory_region_update_pending_range(mr, subregion->addr,
+                                           subregion->size);
+    }
     memory_region_unref(subregion);
-    memory_region_update_pending |= mr->enabled && subregion->enabled;
     memory_region_transaction_commit();
 }
 
@@ -2772,7 +3062,7 @@ void memory_region_set_enabled(MemoryRegion *mr, bool enabled)
     }
     memory_region_transaction_begin();
     mr->enabled = enabled;
-    memory_region_update_pending = true;
+    memory_region_update_pending_for(mr);
     memory_region_transaction_commit();
 }
 
@@ -2787,8 +3077,9 @@ void memory_region_set_size(MemoryRegion *mr, uint64_t size)
         return;
     }
     memory_region_transaction_begin();
+    memory_region_update_pending_for(mr);
     mr->size = s;
-    memory_region_update_pending = true;
+    memory_region_update_pending_for(mr);
     memory_region_transaction_commit();
 }
 
@@ -2809,8 +3100,15 @@ static void memory_region_readd_subregion(MemoryRegion *mr)
 void memory_region_set_address(MemoryRegion *mr, hwaddr addr)
 {
     if (addr != mr->addr) {
+        memory_region_transaction_begin();
+        if (mr->container && mr->container->enabled && mr->enabled) {
+            /* The old place; readding records the new one */
+            memory_region_update_pending_range(mr->container, mr->addr,
+                                               mr->size);
+        }
         mr->addr = addr;
         memory_region_readd_subregion(mr);
+        memory_region_transaction_commit();
     }
 }
 
@@ -2824,7 +3122,9 @@ void memory_region_set_alias_offset(MemoryRegion *mr, hwaddr offset)
 
     memory_region_transaction_begin();
     mr->alias_offset = offset;
-    memory_region_update_pending |= mr->enabled;
+    if (mr->enabled) {
+        memory_region_update_pending_for(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2836,7 +3136,9 @@ void memory_region_set_unmergeable(MemoryRegion *mr, bool unmergeable)
 
     memory_region_transaction_begin();
     mr->unmergeable = unmergeable;
-    memory_region_update_pending |= mr->enabled;
+    if (mr->enabled) {
+        memory_region_update_pending_for(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -3035,7 +3337,8 @@ bool memory_global_dirty_log_start(unsigned int flags, Error **errp)
         }
 
         memory_region_transaction_begin();
-        memory_region_update_pending = true;
+        /* The dirty log mask of every RAM range changes */
+        memory_region_update_pending_for(NULL);
         memory_region_transaction_commit();
     }
     return true;
@@ -3051,7 +3354,8 @@ static void memory_global_dirty_log_do_stop(unsigned int flags)
 
     if (!global_dirty_tracking) {
         memory_region_transaction_begin();
-        memory_region_update_pending = true;
+        /* The dirty log mask of every RAM range changes */
+        memory_region_update_pending_for(NULL);
         memory_region_transaction_commit();
         MEMORY_LISTENER_CALL_GLOBAL(log_global_stop, Reverse);
     }
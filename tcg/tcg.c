@@ -3488,6 +3488,48 @@ static void la_bb_sync(TCGContext *s, int ng, int nt)
     }
 }
 
+/*
+ * liveness analysis: end of basic block flowing into a label (either
+ * the label itself, or an unconditional branch to it): all temps are
+ * dead, local temps should be in memory, globals should be synced but
+ * may remain live in registers across the join.
+ */
+static void la_bb_join(TCGContext *s, int ng, int nt)
+{
+    for (int i = 0; i < nt; ++i) {
+        TCGTemp *ts = &s->temps[i];
+        int state;
+
+        switch (ts->kind) {
+        case TEMP_FIXED:
+        case TEMP_GLOBAL:
+            /*
+             * Indirect globals are lowered to ebb temps by liveness_pass_2,
+             * which must not see them live across the join.
+             */
+            if (!ts->indirect_reg) {
+                state = ts->state;
+                ts->state = state | TS_MEM;
+                if (state != TS_DEAD) {
+                    continue;
+                }
+                break;
+            }
+            /* fall through */
+        case TEMP_TB:
+            ts->state = TS_DEAD | TS_MEM;
+            break;
+        case TEMP_EBB:
+        case TEMP_CONST:
+            ts->state = TS_DEAD;
+            break;
+        default:
+            g_assert_not_reached();
+        }
+        la_reset_pref(ts);
+    }
+}
+
 /* liveness analysis: sync globals back to memory and kill.  */
 static void la_global_kill(TCGContext *s, int ng)
 {
@@ -3865,6 +3907,8 @@ liveness_pass_1(TCGContext *s)
                 la_func_end(s, nb_globals, nb_temps);
             } else if (def->flags & TCG_OPF_COND_BRANCH) {
                 la_bb_sync(s, nb_globals, nb_temps);
+            } else if (opc == INDEX_op_br || opc == INDEX_op_set_label) {
+                la_bb_join(s, nb_globals, nb_temps);
             } else if (def->flags & TCG_OPF_BB_END) {
                 la_bb_end(s, nb_globals, nb_temps);
             } else if (def->flags & TCG_OPF_SIDE_EFFECTS) {
@@ -4515,6 +4559,19 @@ static void tcg_reg_alloc_bb_end(TCGContext *s, TCGRegSet allocated_regs)
 {
     int i;
 
+    for (i = 0; i < s->nb_globals; i++) {
+        TCGTemp *ts = &s->temps[i];
+
+        /*
+         * At a join point, the liveness analysis only ensures that globals
+         * are synced; release any that are still held in a register.
+         */
+        if (ts->val_type != TEMP_VAL_MEM && !temp_readonly(ts)) {
+            tcg_debug_assert(ts->mem_coherent);
+            temp_free_or_dead(s, ts, -1);
+        }
+    }
+
     for (i = s->nb_globals; i < s->nb_temps; i++) {
         TCGTemp *ts = &s->temps[i];
 
@@ -4539,6 +4596,88 @@ static void tcg_reg_alloc_bb_end(TCGContext *s, TCGRegSet allocated_regs)
     save_globals(s, allocated_regs);
 }
 
+/*
+ * Return the global held in @reg, if its canonical location is up to date,
+ * so that the register may be carried across a branch to a label.
+ */
+static TCGTemp *tcg_reg_join_global(TCGContext *s, TCGReg reg)
+{
+    TCGTemp *ts = s->reg_to_temp[reg];
+
+    if (ts && ts->kind == TEMP_GLOBAL && ts->mem_coherent) {
+        return ts;
+    }
+    return NULL;
+}
+
+/*
+ * Record the register state at a branch to @l, keeping only those
+ * globals which have been held in the same register at every branch
+ * to @l seen so far.
+ */
+static void tcg_reg_alloc_join_pred(TCGContext *s, TCGLabel *l)
+{
+    TCGTemp **regs = l->join_regs;
+    int i;
+
+    if (l->join_seen++ == 0) {
+        regs = tcg_malloc(sizeof(TCGTemp *) * TCG_TARGET_NB_REGS);
+        l->join_regs = regs;
+        for (i = 0; i < TCG_TARGET_NB_REGS; i++) {
+            regs[i] = tcg_reg_join_global(s, i);
+        }
+    } else {
+        for (i = 0; i < TCG_TARGET_NB_REGS; i++) {
+            if (regs[i] && regs[i] != tcg_reg_join_global(s, i)) {
+                regs[i] = NULL;
+            }
+        }
+    }
+}
+
+/*
+ * At a label, all temporaries are dead and all globals are synced.
+ * If every branch to the label has already been allocated, i.e. there
+ * are no backward branches, then a global which is held in the same
+ * register on every incoming edge remains there; all others are
+ * reloaded from their canonical location on demand.  @fallthrough is
+ * true if the label may be reached from the preceding op.
+ */
+static void tcg_reg_alloc_label(TCGContext *s, TCGLabel *l, bool fallthrough)
+{
+    TCGTemp *keep[TCG_TARGET_NB_REGS];
+    TCGLabelUse *u;
+    unsigned nb_branches = 0;
+    int i;
+
+    QSIMPLEQ_FOREACH(u, &l->branches, next) {
+        nb_branches++;
+    }
+
+    if (nb_branches == 0 || l->join_seen != nb_branches) {
+        memset(keep, 0, sizeof(keep));
+    } else {
+        memcpy(keep, l->join_regs, sizeof(keep));
+        if (fallthrough) {
+            for (i = 0; i < TCG_TARGET_NB_REGS; i++) {
+                if (keep[i] && keep[i] != tcg_reg_join_global(s, i)) {
+                    keep[i] = NULL;
+                }
+            }
+        }
+    }
+
+    tcg_reg_alloc_bb_end(s, s->reserved_regs);
+
+    for (i = 0; i < TCG_TARGET_NB_REGS; i++) {
+        TCGTemp *ts = keep[i];
+        if (ts) {
+            set_temp_val_reg(s, ts, i);
+            ts->mem_coherent = 1;
+        }
+    }
+}
+
 /*
  * At a conditional branch, we assume all temporaries are dead unless
  * explicitly live-across-conditional-branch; all globals and local
@@ -5058,7 +5197,11 @@ static void tcg_reg_alloc_op(TCGContext *s, const TCGOp *op)
 
     if (def->flags & TCG_OPF_COND_BRANCH) {
         tcg_reg_alloc_cbranch(s, i_allocated_regs);
+        tcg_reg_alloc_join_pred(s, arg_label(op->args[def->nb_args - 1]));
     } else if (def->flags & TCG_OPF_BB_END) {
+        if (op->opc == INDEX_op_br) {
+            tcg_reg_alloc_join_pred(s, arg_label(op->args[0]));
+        }
         tcg_reg_alloc_bb_end(s, i_allocated_regs);
     } else {
         if (def->flags & TCG_OPF_CALL_CLOBBER) {
@@ -6091,6 +6234,7 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb, uint64_t pc_start)
 {
     int i, start_words, num_insns;
     TCGOp *op;
+    bool fallthrough;
 
     if (unlikely(qemu_loglevel_mask(CPU_LOG_TB_OP)
                  && qemu_log_in_addr_range(pc_start))) {
@@ -6187,6 +6331,7 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb, uint64_t pc_start)
     tcg_out_tb_start(s);
 
     num_insns = -1;
+    fallthrough = true;
     QTAILQ_FOREACH(op, &s->ops, link) {
         TCGOpcode opc = op->opc;
 
@@ -6216,7 +6361,7 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb, uint64_t pc_start)
             temp_dead(s, arg_temp(op->args[0]));
             break;
         case INDEX_op_set_label:
-            tcg_reg_alloc_bb_end(s, s->reserved_regs);
+            tcg_reg_alloc_label(s, arg_label(op->args[0]), fallthrough);
             tcg_out_label(s, arg_label(op->args[0]));
             break;
         case INDEX_op_call:
@@ -6242,6 +6387,20 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb, uint64_t pc_start)
             tcg_reg_alloc_op(s, op);
             break;
         }
+        /* Note whether the next op may be reached without a branch.  */
+        switch (opc) {
+        case INDEX_op_br:
+        case INDEX_op_exit_tb:
+        case INDEX_op_goto_ptr:
+            fallthrough = false;
+            break;
+        case INDEX_op_set_label:
+            fallthrough = true;
+            break;
+        default:
+            break;
+        }
+
         /* Test for (pending) buffer overflow.  The assumption is that any
            one operation beginning below the high water mark cannot overrun
            the buffer completely.  Thus we can test for overflow after
@@ -351,6 +351,38 @@ static void tci_qemu_st(CPUArchState *env, uint64_t taddr, uint64_t val,
 # define CASE_64(x)
 #endif
 
+/*
+ * The most frequent opcodes are dispatched directly through a table of
+ * label addresses, with each of their handlers fetching the next insn and
+ * jumping to its handler.  This replicates the indirect branch per handler,
+ * which the host can predict much better than the single shared one of the
+ * switch.  All other opcodes go through the switch.
+ *
+ * Superinstructions, produced by tcg_out_insn_fused(), run their own insn
+ * and then jump directly to the handler of the next one, which follows in
+ * the bytecode with its opcode left unchanged.  Operands are still decoded
+ * from the bytecode each time an insn runs; there is no pre-decoded format
+ * with handler pointers.  scripts/simplebench/bench-tci.py compares builds.
+ */
+#if TCG_TARGET_REG_BITS == 64
+# define DISPATCH_32_64(x, l) \
+        [glue(glue(INDEX_op_, x), _i64)] = &&l, \
+        [glue(glue(INDEX_op_, x), _i32)] = &&l,
+# define DISPATCH_64(x, l) \
+        [glue(glue(INDEX_op_, x), _i64)] = &&l,
+#else
+# define DISPATCH_32_64(x, l) \
+        [glue(glue(INDEX_op_, x), _i32)] = &&l,
+# define DISPATCH_64(x, l)
+#endif
+
+#define TCI_NEXT()                          \
+    do {                                    \
+        insn = *tb_ptr++;                   \
+        opc = extract32(insn, 0, 8);        \
+        goto *tci_dispatch[opc];            \
+    } while (0)
+
 /* Interpret pseudo code in tb. */
 /*
  * Disable CFI checks.
@@ -360,6 +392,56 @@ static void tci_qemu_st(CPUArchState *env, uint64_t taddr, uint64_t val,
 uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
                                             const void *v_tb_ptr)
 {
+    static const void * const tci_dispatch[256] = {
+        [0 ... 255] = &&op_switch,
+        DISPATCH_32_64(mov, op_mov)
+        [INDEX_op_tci_movi] = &&op_movi,
+        [INDEX_op_tci_movl] = &&op_movl,
+        DISPATCH_32_64(ld8u, op_ld8u)
+        [INDEX_op_ld_i32] = &&op_ld32u,
+        DISPATCH_64(ld32u, op_ld32u)
+        DISPATCH_64(ld, op_ld_i64)
+        DISPATCH_32_64(st8, op_st8)
+        [INDEX_op_st_i32] = &&op_st32,
+        DISPATCH_64(st32, op_st32)
+        DISPATCH_64(st, op_st_i64)
+        DISPATCH_32_64(add, op_add)
+        DISPATCH_32_64(sub, op_sub)
+        DISPATCH_32_64(and, op_and)
+        DISPATCH_32_64(or, op_or)
+        DISPATCH_32_64(xor, op_xor)
+        [INDEX_op_setcond_i32] = &&op_setcond_i32,
+        [INDEX_op_brcond_i32] = &&op_brcond_i32,
+        DISPATCH_64(brcond, op_brcond_i64)
+        [INDEX_op_br] = &&op_br,
+        [INDEX_op_goto_tb] = &&op_goto_tb,
+        [INDEX_op_tci_ld2_i32] = &&op_ld2_i32,
+        [INDEX_op_tci_st2_i32] = &&op_st2_i32,
+        [INDEX_op_tci_ld_add_i32] = &&op_ld_add_i32,
+        [INDEX_op_tci_ld_sub_i32] = &&op_ld_sub_i32,
+        [INDEX_op_tci_ld_and_i32] = &&op_ld_and_i32,
+        [INDEX_op_tci_ld_or_i32] = &&op_ld_or_i32,
+        [INDEX_op_tci_ld_xor_i32] = &&op_ld_xor_i32,
+        [INDEX_op_tci_add_st_i32] = &&op_add_st_i32,
+        [INDEX_op_tci_sub_st_i32] = &&op_sub_st_i32,
+        [INDEX_op_tci_and_st_i32] = &&op_and_st_i32,
+        [INDEX_op_tci_or_st_i32] = &&op_or_st_i32,
+        [INDEX_op_tci_xor_st_i32] = &&op_xor_st_i32,
+#if TCG_TARGET_REG_BITS == 64
+        [INDEX_op_tci_ld2_i64] = &&op_ld2_i64,
+        [INDEX_op_tci_st2_i64] = &&op_st2_i64,
+        [INDEX_op_tci_ld_add_i64] = &&op_ld_add_i64,
+        [INDEX_op_tci_ld_sub_i64] = &&op_ld_sub_i64,
+        [INDEX_op_tci_ld_and_i64] = &&op_ld_and_i64,
+        [INDEX_op_tci_ld_or_i64] = &&op_ld_or_i64,
+        [INDEX_op_tci_ld_xor_i64] = &&op_ld_xor_i64,
+        [INDEX_op_tci_add_st_i64] = &&op_add_st_i64,
+        [INDEX_op_tci_sub_st_i64] = &&op_sub_st_i64,
+        [INDEX_op_tci_and_st_i64] = &&op_and_st_i64,
+        [INDEX_op_tci_or_st_i64] = &&op_or_st_i64,
+        [INDEX_op_tci_xor_st_i64] = &&op_xor_st_i64,
+#endif
+    };
     const uint32_t *tb_ptr = v_tb_ptr;
     tcg_target_ulong regs[TCG_TARGET_NB_REGS];
     uint64_t stack[(TCG_STATIC_CALL_ARGS_SIZE + TCG_STATIC_FRAME_SIZE)
@@ -385,7 +467,160 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
 
         insn = *tb_ptr++;
         opc = extract32(insn, 0, 8);
+        goto *tci_dispatch[opc];
+
+        /*
+         * Superinstructions, see tcg_out_insn_fused().  Each one runs its
+         * own insn, then the next one with the handler for its original
+         * opcode, which only looks at the operand fields.
+         */
+    op_ld2_i32:
+        tci_args_rrs(insn, &r0, &r1, &ofs);
+        regs[r0] = *(uint32_t *)(regs[r1] + ofs);
+        insn = *tb_ptr++;
+        goto op_ld32u;
+
+    op_st2_i32:
+        tci_args_rrs(insn, &r0, &r1, &ofs);
+        *(uint32_t *)(regs[r1] + ofs) = regs[r0];
+        insn = *tb_ptr++;
+        goto op_st32;
+
+    op_ld_add_i32:
+        tci_args_rrs(insn, &r0, &r1, &ofs);
+        regs[r0] = *(uint32_t *)(regs[r1] + ofs);
+        insn = *tb_ptr++;
+        goto op_add;
+
+    op_ld_sub_i32:
+        tci_args_rrs(insn, &r0, &r1, &ofs);
+        regs[r0] = *(uint32_t *)(regs[r1] + ofs);
+        insn = *tb_ptr++;
+        goto op_sub;
+
+    op_ld_and_i32:
+        tci_args_rrs(insn, &r0, &r1, &ofs);
+        regs[r0] = *(uint32_t *)(regs[r1] + ofs);
+        insn = *tb_ptr++;
+        goto op_and;
+
+    op_ld_or_i32:
+        tci_args_rrs(insn, &r0, &r1, &ofs);
+        regs[r0] = *(uint32_t *)(regs[r1] + ofs);
+        insn = *tb_ptr++;
+        goto op_or;
+
+    op_ld_xor_i32:
+        tci_args_rrs(insn, &r0, &r1, &ofs);
+        regs[r0] = *(uint32_t *)(regs[r1] + ofs);
+        insn = *tb_ptr++;
+        goto op_xor;
+
+    op_add_st_i32:
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        regs[r0] = regs[r1] + regs[r2];
+        insn = *tb_ptr++;
+        goto op_st32;
+
+    op_sub_st_i32:
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        regs[r0] = regs[r1] - regs[r2];
+        insn = *tb_ptr++;
+        goto op_st32;
+
+    op_and_st_i32:
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        regs[r0] = regs[r1] & regs[r2];
+        insn = *tb_ptr++;
+        goto op_st32;
+
+    op_or_st_i32:
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        regs[r0] = regs[r1] | regs[r2];
+        insn = *tb_ptr++;
+        goto op_st32;
+
+    op_xor_st_i32:
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        regs[r0] = regs[r1] ^ regs[r2];
+        insn = *tb_ptr++;
+        goto op_st32;
+
+#if TCG_TARGET_REG_BITS == 64
+    op_ld2_i64:
+        tci_args_rrs(insn, &r0, &r1, &ofs);
+        regs[r0] = *(uint64_t *)(regs[r1] + ofs);
+        insn = *tb_ptr++;
+        goto op_ld_i64;
+
+    op_st2_i64:
+        tci_args_rrs(insn, &r0, &r1, &ofs);
+        *(uint64_t *)(regs[r1] + ofs) = regs[r0];
+        insn = *tb_ptr++;
+        goto op_st_i64;
 
+    op_ld_add_i64:
+        tci_args_rrs(insn, &r0, &r1, &ofs);
+        regs[r0] = *(uint64_t *)(regs[r1] + ofs);
+        insn = *tb_ptr++;
+        goto op_add;
+
+    op_ld_sub_i64:
+        tci_args_rrs(insn, &r0, &r1, &ofs);
+        regs[r0] = *(uint64_t *)(regs[r1] + ofs);
+        insn = *tb_ptr++;
+        goto op_sub;
+
+    op_ld_and_i64:
+        tci_args_rrs(insn, &r0, &r1, &ofs);
+        regs[r0] = *(uint64_t *)(regs[r1] + ofs);
+        insn = *tb_ptr++;
+        goto op_and;
+
+    op_ld_or_i64:
+        tci_args_rrs(insn, &r0, &r1, &ofs);
+        regs[r0] = *(uint64_t *)(regs[r1] + ofs);
+        insn = *tb_ptr++;
+        goto op_or;
+
+    op_ld_xor_i64:
+        tci_args_rrs(insn, &r0, &r1, &ofs);
+        regs[r0] = *(uint64_t *)(regs[r1] + ofs);
+        insn = *tb_ptr++;
+        goto op_xor;
+
+    op_add_st_i64:
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        regs[r0] = regs[r1] + regs[r2];
+        insn = *tb_ptr++;
+        goto op_st_i64;
+
+    op_sub_st_i64:
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        regs[r0] = regs[r1] - regs[r2];
+        insn = *tb_ptr++;
+        goto op_st_i64;
+
+    op_and_st_i64:
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        regs[r0] = regs[r1] & regs[r2];
+        insn = *tb_ptr++;
+        goto op_st_i64;
+
+    op_or_st_i64:
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        regs[r0] = regs[r1] | regs[r2];
+        insn = *tb_ptr++;
+        goto op_st_i64;
+
+    op_xor_st_i64:
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        regs[r0] = regs[r1] ^ regs[r2];
+        insn = *tb_ptr++;
+        goto op_st_i64;
+#endif
+
+    op_switch:
         switch (opc) {
         case INDEX_op_call:
             {
@@ -441,13 +676,15 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             break;
 
         case INDEX_op_br:
+        op_br:
             tci_args_l(insn, tb_ptr, &ptr);
             tb_ptr = ptr;
-            continue;
+            TCI_NEXT();
         case INDEX_op_setcond_i32:
+        op_setcond_i32:
             tci_args_rrrc(insn, &r0, &r1, &r2, &condition);
             regs[r0] = tci_compare32(regs[r1], regs[r2], condition);
-            break;
+            TCI_NEXT();
         case INDEX_op_movcond_i32:
             tci_args_rrrrrc(insn, &r0, &r1, &r2, &r3, &r4, &condition);
             tmp32 = tci_compare32(regs[r1], regs[r2], condition);
@@ -472,25 +709,29 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             break;
 #endif
         CASE_32_64(mov)
+        op_mov:
             tci_args_rr(insn, &r0, &r1);
             regs[r0] = regs[r1];
-            break;
+            TCI_NEXT();
         case INDEX_op_tci_movi:
+        op_movi:
             tci_args_ri(insn, &r0, &t1);
             regs[r0] = t1;
-            break;
+            TCI_NEXT();
         case INDEX_op_tci_movl:
+        op_movl:
             tci_args_rl(insn, tb_ptr, &r0, &ptr);
             regs[r0] = *(tcg_target_ulong *)ptr;
-            break;
+            TCI_NEXT();
 
             /* Load/store operations (32 bit). */
 
         CASE_32_64(ld8u)
+        op_ld8u:
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             regs[r0] = *(uint8_t *)ptr;
-            break;
+            TCI_NEXT();
         CASE_32_64(ld8s)
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
@@ -508,15 +749,17 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             break;
         case INDEX_op_ld_i32:
         CASE_64(ld32u)
+        op_ld32u:
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             regs[r0] = *(uint32_t *)ptr;
-            break;
+            TCI_NEXT();
         CASE_32_64(st8)
+        op_st8:
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             *(uint8_t *)ptr = regs[r0];
-            break;
+            TCI_NEXT();
         CASE_32_64(st16)
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
@@ -524,37 +767,43 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             break;
         case INDEX_op_st_i32:
         CASE_64(st32)
+        op_st32:
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             *(uint32_t *)ptr = regs[r0];
-            break;
+            TCI_NEXT();
 
             /* Arithmetic operations (mixed 32/64 bit). */
 
         CASE_32_64(add)
+        op_add:
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] + regs[r2];
-            break;
+            TCI_NEXT();
         CASE_32_64(sub)
+        op_sub:
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] - regs[r2];
-            break;
+            TCI_NEXT();
         CASE_32_64(mul)
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] * regs[r2];
             break;
         CASE_32_64(and)
+        op_and:
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] & regs[r2];
-            break;
+            TCI_NEXT();
         CASE_32_64(or)
+        op_or:
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] | regs[r2];
-            break;
+            TCI_NEXT();
         CASE_32_64(xor)
+        op_xor:
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] ^ regs[r2];
-            break;
+            TCI_NEXT();
 #if TCG_TARGET_HAS_andc_i32 || TCG_TARGET_HAS_andc_i64
         CASE_32_64(andc)
             tci_args_rrr(insn, &r0, &r1, &r2);
@@ -668,11 +917,12 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             break;
 #endif
         case INDEX_op_brcond_i32:
+        op_brcond_i32:
             tci_args_rl(insn, tb_ptr, &r0, &ptr);
             if ((uint32_t)regs[r0]) {
                 tb_ptr = ptr;
             }
-            break;
+            TCI_NEXT();
 #if TCG_TARGET_REG_BITS == 32 || TCG_TARGET_HAS_add2_i32
         case INDEX_op_add2_i32:
             tci_args_rrrrrr(insn, &r0, &r1, &r2, &r3, &r4, &r5);
@@ -759,15 +1009,17 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             regs[r0] = *(int32_t *)ptr;
             break;
         case INDEX_op_ld_i64:
+        op_ld_i64:
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             regs[r0] = *(uint64_t *)ptr;
-            break;
+            TCI_NEXT();
         case INDEX_op_st_i64:
+        op_st_i64:
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             *(uint64_t *)ptr = regs[r0];
-            break;
+            TCI_NEXT();
 
             /* Arithmetic operations (64 bit). */
 
@@ -879,11 +1131,12 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             break;
 #endif
         case INDEX_op_brcond_i64:
+        op_brcond_i64:
             tci_args_rl(insn, tb_ptr, &r0, &ptr);
             if (regs[r0]) {
                 tb_ptr = ptr;
             }
-            break;
+            TCI_NEXT();
         case INDEX_op_ext32s_i64:
         case INDEX_op_ext_i32_i64:
             tci_args_rr(insn, &r0, &r1);
@@ -909,9 +1162,10 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             return (uintptr_t)ptr;
 
         case INDEX_op_goto_tb:
+        op_goto_tb:
             tci_args_l(insn, tb_ptr, &ptr);
             tb_ptr = *(void **)ptr;
-            break;
+            TCI_NEXT();
 
         case INDEX_op_goto_ptr:
             tci_args_r(insn, &r0);
@@ -1151,6 +1405,20 @@ int print_insn_tci(bfd_vma addr, disassemble_info *info)
     case INDEX_op_st32_i64:
     case INDEX_op_st_i32:
     case INDEX_op_st_i64:
+    case INDEX_op_tci_ld2_i32:
+    case INDEX_op_tci_ld2_i64:
+    case INDEX_op_tci_st2_i32:
+    case INDEX_op_tci_st2_i64:
+    case INDEX_op_tci_ld_add_i32:
+    case INDEX_op_tci_ld_add_i64:
+    case INDEX_op_tci_ld_sub_i32:
+    case INDEX_op_tci_ld_sub_i64:
+    case INDEX_op_tci_ld_and_i32:
+    case INDEX_op_tci_ld_and_i64:
+    case INDEX_op_tci_ld_or_i32:
+    case INDEX_op_tci_ld_or_i64:
+    case INDEX_op_tci_ld_xor_i32:
+    case INDEX_op_tci_ld_xor_i64:
         tci_args_rrs(insn, &r0, &r1, &s2);
         info->fprintf_func(info->stream, "%-12s  %s, %s, %d",
                            op_name, str_r(r0), str_r(r1), s2);
@@ -1229,6 +1497,16 @@ int print_insn_tci(bfd_vma addr, disassemble_info *info)
     case INDEX_op_clz_i64:
     case INDEX_op_ctz_i32:
     case INDEX_op_ctz_i64:
+    case INDEX_op_tci_add_st_i32:
+    case INDEX_op_tci_add_st_i64:
+    case INDEX_op_tci_sub_st_i32:
+    case INDEX_op_tci_sub_st_i64:
+    case INDEX_op_tci_and_st_i32:
+    case INDEX_op_tci_and_st_i64:
+    case INDEX_op_tci_or_st_i32:
+    case INDEX_op_tci_or_st_i64:
+    case INDEX_op_tci_xor_st_i32:
+    case INDEX_op_tci_xor_st_i64:
         tci_args_rrr(insn, &r0, &r1, &r2);
         info->fprintf_func(info->stream, "%-12s  %s, %s, %s",
                            op_name, str_r(r0), str_r(r1), str_r(r2));
@@ -12,6 +12,7 @@
  */
 #include "qemu/osdep.h"
 #include "qemu/units.h"
+#include "qemu/bswap.h"
 #include "crypto/init.h"
 #include "crypto/cipher.h"
 
@@ -164,6 +165,118 @@ static void test_cipher_speed_xts_aes_256(const void *opaque)
                       QCRYPTO_CIPHER_ALGO_AES_256);
 }
 
+/*
+ * Disk encryption processes whole requests as a series of sectors, each
+ * with its own IV (plain64 here), and may split them across threads.
+ */
+#define SECTOR_SIZE 512
+
+typedef struct SectorBenchData {
+    QCryptoCipherAlgo alg;
+    const uint8_t *key;
+    size_t nkey;
+    size_t chunk_size;
+    size_t total;
+    bool encrypt;
+} SectorBenchData;
+
+static gpointer test_cipher_sectors_thread(gpointer opaque)
+{
+    SectorBenchData *data = opaque;
+    QCryptoCipher *cipher;
+    uint8_t *buf;
+    uint64_t sector = 0;
+    size_t remain, i;
+    Error *err = NULL;
+
+    cipher = qcrypto_cipher_new(data->alg, QCRYPTO_CIPHER_MODE_XTS,
+                                data->key, data->nkey, &err);
+    g_assert(cipher != NULL);
+
+    buf = g_new0(uint8_t, data->chunk_size);
+    memset(buf, 0x5a, data->chunk_size);
+
+    for (remain = data->total; remain; remain -= data->chunk_size) {
+        for (i = 0; i < data->chunk_size; i += SECTOR_SIZE, sector++) {
+            uint64_t iv[2] = { cpu_to_le64(sector), 0 };
+
+            g_assert(qcrypto_cipher_setiv(cipher, (uint8_t *)iv, sizeof(iv),
+                                          &err) == 0);
+            if (data->encrypt) {
+                g_assert(qcrypto_cipher_encrypt(cipher, buf + i, buf + i,
+                                                SECTOR_SIZE, &err) == 0);
+            } else {
+                g_assert(qcrypto_cipher_decrypt(cipher, buf + i, buf + i,
+                                                SECTOR_SIZE, &err) == 0);
+            }
+        }
+    }
+
+    qcrypto_cipher_free(cipher);
+    g_free(buf);
+    return NULL;
+}
+
+static void test_cipher_speed_sectors(size_t chunk_size,
+                                      QCryptoCipherAlgo alg,
+                                      unsigned int nthreads)
+{
+    const size_t total = 2 * GiB;
+    g_autofree GThread **threads = g_new(GThread *, nthreads);
+    g_autofree uint8_t *key = NULL;
+    SectorBenchData data;
+    size_t nkey;
+    unsigned int i;
+    int encrypt;
+
+    if (!qcrypto_cipher_supports(alg, QCRYPTO_CIPHER_MODE_XTS)) {
+        return;
+    }
+
+    nkey = qcrypto_cipher_get_key_len(alg) * 2;
+    key = g_new0(uint8_t, nkey);
+    memset(key, g_test_rand_int(), nkey);
+
+    for (encrypt = 1; encrypt >= 0; encrypt--) {
+        data = (SectorBenchData) {
+            .alg = alg,
+            .key = key,
+            .nkey = nkey,
+            .chunk_size = chunk_size,
+            .total = QEMU_ALIGN_UP(total / nthreads, chunk_size),
+            .encrypt = encrypt,
+        };
+
+        g_test_timer_start();
+        for (i = 0; i < nthreads; i++) {
+            threads[i] = g_thread_new("bench", test_cipher_sectors_thread,
+                                      &data);
+        }
+        for (i = 0; i < nthreads; i++) {
+            g_thread_join(threads[i]);
+        }
+        g_test_timer_elapsed();
+
+        g_test_message("%s(%s-xts) sectors chunk %zu bytes %u threads "
+                       "%.2f MB/sec ", encrypt ? "enc" : "dec",
+                       QCryptoCipherAlgo_str(alg), chunk_size, nthreads,
+                       (double)data.total * nthreads / MiB /
+                       g_test_timer_last());
+    }
+}
+
+static void test_cipher_speed_sectors_aes_256(const void *opaque)
+{
+    size_t chunk_size = (size_t)opaque;
+    test_cipher_speed_sectors(chunk_size, QCRYPTO_CIPHER_ALGO_AES_256, 1);
+}
+
+static void test_cipher_speed_sectors_aes_256_mt(const void *opaque)
+{
+    size_t chunk_size = (size_t)opaque;
+    test_cipher_speed_sectors(chunk_size, QCRYPTO_CIPHER_ALGO_AES_256, 4);
+}
+
 
 int main(int argc, char **argv)
 {
@@ -180,6 +293,17 @@ int main(int argc, char **argv)
         (void *)chunk,                                                  \
         test_cipher_speed_ ## mode ## _ ## cipher ## _ ## keysize)
 
+#define ADD_SECTOR_TEST(chunk)                                          \
+    if ((!alg || g_str_equal(alg, "sectors")) &&                        \
+        (!size || g_str_equal(size, #chunk))) {                         \
+        g_test_add_data_func(                                           \
+            "/crypto/cipher/sectors-aes-256/chunk-" #chunk,             \
+            (void *)chunk, test_cipher_speed_sectors_aes_256);          \
+        g_test_add_data_func(                                           \
+            "/crypto/cipher/sectors-aes-256-threads-4/chunk-" #chunk,   \
+            (void *)chunk, test_cipher_speed_sectors_aes_256_mt);       \
+    }
+
     if (argc >= 2) {
         alg = argv[1];
     }
@@ -197,6 +321,7 @@ int main(int argc, char **argv)
         ADD_TEST(ctr, aes, 256, chunk);         \
         ADD_TEST(xts, aes, 128, chunk);         \
         ADD_TEST(xts, aes, 256, chunk);         \
+        ADD_SECTOR_TEST(chunk);                 \
     } while (0)
 
     ADD_TESTS(512);
@@ -0,0 +1,209 @@
+/*
+ * Throttle group scalability benchmark
+ *
+ * Runs a number of throttle group members, all in the same group, spread
+ * over several IOThreads, and measures how many requests per second get
+ * through throttle_group_co_io_limits_intercept().
+ *
+ * With -b and a request size larger than 1/100 of the limit, e.g.
+ * "-b 10000000 -s 131072", no request fits into the credit that members
+ * pay for in advance; the limit utilization should still be close to 100%.
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu/main-loop.h"
+#include "qemu/module.h"
+#include "block/aio.h"
+#include "block/throttle-groups.h"
+#include "iothread.h"
+
+typedef struct BenchMember {
+    ThrottleGroupMember tgm;
+    AioContext *ctx;
+    uint64_t ops;
+} QEMU_ALIGNED(64) BenchMember;
+
+static IOThread **iothreads;
+static BenchMember *members;
+static unsigned int n_iothreads = 8;
+static unsigned int n_members = 32;
+static unsigned int duration = 5;
+static unsigned int req_size = 4096;
+static uint64_t iops_limit;
+static uint64_t bps_limit;
+static unsigned int n_done;
+static bool test_stop;
+
+static const char commands_string[] =
+    " -n = number of throttle group members\n"
+    " -t = number of IOThreads\n"
+    " -d = duration in seconds\n"
+    " -s = request size in bytes\n"
+    " -l = iops limit of the group (0 = unlimited)\n"
+    " -b = bps limit of the group (0 = unlimited)";
+
+static void usage_complete(char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "options:\n%s\n", commands_string);
+}
+
+static void coroutine_fn member_co(void *opaque)
+{
+    BenchMember *m = opaque;
+
+    while (!qatomic_read(&test_stop)) {
+        throttle_group_co_io_limits_intercept(&m->tgm, req_size,
+                                              THROTTLE_READ);
+        m->ops++;
+
+        /* Let the other members of this IOThread run, too */
+        if (m->ops % 16 == 0) {
+            aio_co_schedule(m->ctx, qemu_coroutine_self());
+            qemu_coroutine_yield();
+        }
+    }
+
+    qatomic_inc(&n_done);
+}
+
+static void create_members(void)
+{
+    ThrottleConfig cfg;
+    unsigned int i;
+
+    iothreads = g_new(IOThread *, n_iothreads);
+    for (i = 0; i < n_iothreads; i++) {
+        iothreads[i] = iothread_new();
+    }
+
+    members = g_new0(BenchMember, n_members);
+    for (i = 0; i < n_members; i++) {
+        BenchMember *m = &members[i];
+
+        m->ctx = iothread_get_aio_context(iothreads[i % n_iothreads]);
+        throttle_group_register_tgm(&m->tgm, "bench", m->ctx);
+    }
+
+    throttle_config_init(&cfg);
+    cfg.buckets[THROTTLE_OPS_TOTAL].avg = iops_limit;
+    cfg.buckets[THROTTLE_BPS_TOTAL].avg = bps_limit;
+    throttle_group_config(&members[0].tgm, &cfg);
+}
+
+static void run_test(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < n_members; i++) {
+        Coroutine *co = qemu_coroutine_create(member_co, &members[i]);
+        aio_co_enter(members[i].ctx, co);
+    }
+
+    g_usleep(duration * G_USEC_PER_SEC);
+    qatomic_set(&test_stop, true);
+
+    while (qatomic_read(&n_done) != n_members) {
+        g_usleep(1000);
+    }
+}
+
+static void pr_params(void)
+{
+    printf("Parameters:\n");
+    printf(" # of members:      %u\n", n_members);
+    printf(" # of IOThreads:    %u\n", n_iothreads);
+    printf(" duration:          %u\n", duration);
+    printf(" request size:      %u\n", req_size);
+    printf(" iops limit:        %" PRIu64 "\n", iops_limit);
+    printf(" bps limit:         %" PRIu64 "\n", bps_limit);
+}
+
+static void pr_stats(void)
+{
+    uint64_t val = 0;
+    unsigned int i;
+    double tx;
+
+    for (i = 0; i < n_members; i++) {
+        val += members[i].ops;
+    }
+    tx = (double)val / duration;
+
+    printf("Results:\n");
+    printf("Duration:            %u s\n", duration);
+    printf(" Throughput:         %.2f Mops/s\n", tx / 1e6);
+    printf(" Throughput/thread:  %.2f Mops/s/thread\n",
+           tx / 1e6 / n_iothreads);
+    if (iops_limit) {
+        printf(" Limit utilization:  %.2f%%\n", tx * 100 / iops_limit);
+    }
+    if (bps_limit) {
+        printf(" Bytes/s:            %.2f MB/s\n", tx * req_size / 1e6);
+        printf(" Bps utilization:    %.2f%%\n",
+               tx * req_size * 100 / bps_limit);
+    }
+}
+
+static void parse_args(int argc, char *argv[])
+{
+    int c;
+
+    for (;;) {
+        c = getopt(argc, argv, "hd:n:t:s:l:b:");
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+        case 'h':
+            usage_complete(argv);
+            exit(0);
+        case 'd':
+            duration = atoi(optarg);
+            break;
+        case 'n':
+            n_members = atoi(optarg);
+            break;
+        case 't':
+            n_iothreads = atoi(optarg);
+            break;
+        case 's':
+            req_size = atoi(optarg);
+            break;
+        case 'l':
+            iops_limit = g_ascii_strtoull(optarg, NULL, 10);
+            break;
+        case 'b':
+            bps_limit = g_ascii_strtoull(optarg, NULL, 10);
+            break;
+        }
+    }
+
+    if (!n_members || !n_iothreads) {
+        usage_complete(argv);
+        exit(1);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    parse_args(argc, argv);
+
+    qemu_init_main_loop(&error_fatal);
+    module_call_init(MODULE_INIT_QOM);
+
+    pr_params();
+    create_members();
+    run_test();
+    pr_stats();
+
+    /*
+     * Members are not unregistered and the IOThreads are left running:
+     * timers may still be armed and nothing is leaked once we exit anyway.
+     */
+    return 0;
+}
@@ -0,0 +1,147 @@
+/*
+ * QTest testcase for moving PCI BARs around
+ *
+ * Moving a BAR only renders the affected windows of the memory map again;
+ * check that every device stays reachable at its BAR, and nowhere else.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "libqtest.h"
+#include "libqos/pci.h"
+#include "libqos/pci-pc.h"
+#include "hw/pci/pci_regs.h"
+
+#define EDU_ID              0x00
+#define EDU_ID_VALUE        0x010000ed
+/* Reads back the inverse of what was written */
+#define EDU_LIVENESS        0x04
+#define EDU_BAR_SIZE        (1 * MiB)
+
+#define NR_DEVS             4
+#define NR_SLOTS            32
+#define SLOT_BASE           0xe0000000ULL
+
+typedef struct RemapTest {
+    QTestState *qts;
+    QPCIBus *pcibus;
+    QPCIDevice *dev[NR_DEVS];
+    int slot[NR_DEVS];
+    bool mapped[NR_DEVS];
+} RemapTest;
+
+static uint64_t slot_addr(int slot)
+{
+    return SLOT_BASE + slot * EDU_BAR_SIZE;
+}
+
+/* The device whose BAR is at @slot, whether it decodes it or not */
+static int slot_owner(RemapTest *t, int slot)
+{
+    int i;
+
+    for (i = 0; i < NR_DEVS; i++) {
+        if (t->slot[i] == slot) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void check_map(RemapTest *t, uint32_t round)
+{
+    int i, slot;
+
+    for (i = 0; i < NR_DEVS; i++) {
+        if (t->mapped[i]) {
+            qtest_writel(t->qts, slot_addr(t->slot[i]) + EDU_LIVENESS,
+                         round * NR_DEVS + i);
+        }
+    }
+    for (i = 0; i < NR_DEVS; i++) {
+        if (t->mapped[i]) {
+            g_assert_cmphex(qtest_readl(t->qts, slot_addr(t->slot[i]) +
+                                        EDU_LIVENESS),
+                            ==, ~(round * NR_DEVS + i));
+        }
+    }
+    for (slot = 0; slot < NR_SLOTS; slot++) {
+        uint32_t id = qtest_readl(t->qts, slot_addr(slot) + EDU_ID);
+        int owner = slot_owner(t, slot);
+
+        if (owner >= 0 && t->mapped[owner]) {
+            g_assert_cmphex(id, ==, EDU_ID_VALUE);
+        } else {
+            g_assert_cmphex(id, !=, EDU_ID_VALUE);
+        }
+    }
+}
+
+static void move_bar(RemapTest *t, int i, int slot)
+{
+    qpci_config_writel(t->dev[i], PCI_BASE_ADDRESS_0, slot_addr(slot));
+    t->slot[i] = slot;
+}
+
+static void set_decode(RemapTest *t, int i, bool on)
+{
+    uint16_t cmd = qpci_config_readw(t->dev[i], PCI_COMMAND);
+
+    cmd = on ? cmd | PCI_COMMAND_MEMORY : cmd & ~PCI_COMMAND_MEMORY;
+    qpci_config_writew(t->dev[i], PCI_COMMAND, cmd);
+    t->mapped[i] = on;
+}
+
+static void test_bar_remap(void)
+{
+    RemapTest t = { 0 };
+    GString *args = g_string_new("-machine pc");
+    uint32_t round;
+    int i;
+
+    for (i = 0; i < NR_DEVS; i++) {
+        g_string_append_printf(args, " -device edu,addr=%02x.0", 4 + i);
+    }
+    t.qts = qtest_init(args->str);
+    g_string_free(args, true);
+    t.pcibus = qpci_new_pc(t.qts, NULL);
+
+    for (i = 0; i < NR_DEVS; i++) {
+        t.dev[i] = qpci_device_find(t.pcibus, QPCI_DEVFN(4 + i, 0));
+        g_assert(t.dev[i]);
+        move_bar(&t, i, 2 * i);
+        qpci_device_enable(t.dev[i]);
+        t.mapped[i] = true;
+    }
+    check_map(&t, 0);
+
+    for (round = 1; round <= 64; round++) {
+        int slot = (round * 7) % NR_SLOTS;
+
+        i = round % NR_DEVS;
+        if (round % 5 == 0) {
+            set_decode(&t, i, !t.mapped[i]);
+        } else if (slot_owner(&t, slot) < 0) {
+            move_bar(&t, i, slot);
+        }
+        check_map(&t, round);
+    }
+
+    for (i = 0; i < NR_DEVS; i++) {
+        g_free(t.dev[i]);
+    }
+    qpci_free_pc(t.pcibus);
+    qtest_quit(t.qts);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/pci-bar-remap/remap", test_bar_remap);
+
+    return g_test_run();
+}
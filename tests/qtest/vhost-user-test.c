@@ -61,8 +61,12 @@
 
 #define VHOST_USER_PROTOCOL_F_MQ 0
 #define VHOST_USER_PROTOCOL_F_LOG_SHMFD 1
+#define VHOST_USER_PROTOCOL_F_REPLY_ACK 3
 #define VHOST_USER_PROTOCOL_F_CROSS_ENDIAN   6
 #define VHOST_USER_PROTOCOL_F_CONFIG 9
+#define VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS 15
+
+#define VHOST_USER_MEM_REG_MAX_INFLIGHT 8
 
 #define VHOST_LOG_PAGE 0x1000
 
@@ -88,6 +92,9 @@ typedef enum VhostUserRequest {
     VHOST_USER_SET_VRING_ENABLE = 18,
     VHOST_USER_GET_CONFIG = 24,
     VHOST_USER_SET_CONFIG = 25,
+    VHOST_USER_GET_MAX_MEM_SLOTS = 36,
+    VHOST_USER_ADD_MEM_REG = 37,
+    VHOST_USER_REM_MEM_REG = 38,
     VHOST_USER_MAX
 } VhostUserRequest;
 
@@ -104,6 +111,11 @@ typedef struct VhostUserMemory {
     VhostUserMemoryRegion regions[VHOST_MEMORY_MAX_NREGIONS];
 } VhostUserMemory;
 
+typedef struct VhostUserMemRegMsg {
+    uint64_t padding;
+    VhostUserMemoryRegion region;
+} VhostUserMemRegMsg;
+
 typedef struct VhostUserLog {
     uint64_t mmap_size;
     uint64_t mmap_offset;
@@ -114,6 +126,7 @@ typedef struct VhostUserMsg {
 
 #define VHOST_USER_VERSION_MASK     (0x3)
 #define VHOST_USER_REPLY_MASK       (0x1<<2)
+#define VHOST_USER_NEED_REPLY_MASK  (0x1<<3)
     uint32_t flags;
     uint32_t size; /* the following payload size */
     union {
@@ -123,6 +136,7 @@ typedef struct VhostUserMsg {
         struct vhost_vring_state state;
         struct vhost_vring_addr addr;
         VhostUserMemory memory;
+        VhostUserMemRegMsg mem_reg;
         VhostUserLog log;
     } payload;
 } QEMU_PACKED VhostUserMsg;
@@ -151,6 +165,11 @@ enum {
     VHOST_USER_SCMI,
 };
 
+#define TEST_MAX_MEM_SLOTS      64
+#define TEST_MEM_DIMMS          32
+/* How long ADD_MEM_REG/REM_MEM_REG replies are held back */
+#define TEST_MEM_REG_ACK_DELAY_MS 10
+
 typedef struct TestServer {
     gchar *socket_path;
     gchar *mig_path;
@@ -170,7 +189,19 @@ typedef struct TestServer {
     bool test_fail;
     int test_flags;
     int queues;
+    uint64_t protocol_features;
     struct vhost_user_ops *vu_ops;
+
+    /* Memory table built from ADD_MEM_REG/REM_MEM_REG */
+    VhostUserMemoryRegion mem_regs[TEST_MAX_MEM_SLOTS];
+    int nr_mem_regs;
+    VhostUserMsg held_acks[TEST_MAX_MEM_SLOTS];
+    int nr_held_acks;
+    int max_held_acks;
+    GSource *ack_source;
+    bool nak_rem;
+    bool rem_failed;
+    int adds_after_nak;
 } TestServer;
 
 struct vhost_user_ops {
@@ -324,6 +355,106 @@ static void *thread_function(void *data)
     return NULL;
 }
 
+static void flush_held_acks(TestServer *s)
+{
+    int i;
+
+    if (s->ack_source) {
+        g_source_destroy(s->ack_source);
+        g_source_unref(s->ack_source);
+        s->ack_source = NULL;
+    }
+
+    for (i = 0; i < s->nr_held_acks; i++) {
+        qemu_chr_fe_write_all(&s->chr, (uint8_t *) &s->held_acks[i],
+                              VHOST_USER_HDR_SIZE + s->held_acks[i].size);
+    }
+    s->nr_held_acks = 0;
+}
+
+static gboolean held_acks_timeout(gpointer opaque)
+{
+    TestServer *s = opaque;
+
+    g_mutex_lock(&s->data_mutex);
+    flush_held_acks(s);
+    g_mutex_unlock(&s->data_mutex);
+
+    return G_SOURCE_REMOVE;
+}
+
+/*
+ * Replies to ADD_MEM_REG/REM_MEM_REG are held back until QEMU stops sending,
+ * so the number of held replies shows how far ahead QEMU runs.
+ */
+static void hold_mem_reg_ack(TestServer *s, VhostUserMsg *msg, uint64_t status)
+{
+    if (!(msg->flags & VHOST_USER_NEED_REPLY_MASK)) {
+        return;
+    }
+
+    msg->flags &= ~VHOST_USER_NEED_REPLY_MASK;
+    msg->flags |= VHOST_USER_REPLY_MASK;
+    msg->size = sizeof(m.payload.u64);
+    msg->payload.u64 = status;
+
+    g_assert_cmpint(s->nr_held_acks, <, G_N_ELEMENTS(s->held_acks));
+    s->held_acks[s->nr_held_acks++] = *msg;
+    s->max_held_acks = MAX(s->max_held_acks, s->nr_held_acks);
+
+    if (s->ack_source) {
+        g_source_destroy(s->ack_source);
+        g_source_unref(s->ack_source);
+    }
+    s->ack_source = g_timeout_source_new(TEST_MEM_REG_ACK_DELAY_MS);
+    g_source_set_callback(s->ack_source, held_acks_timeout, s, NULL);
+    g_source_attach(s->ack_source, s->context);
+}
+
+static void add_mem_reg(TestServer *s, VhostUserMsg *msg)
+{
+    int fd = -1;
+
+    /* The test only tracks the layout, it doesn't map the memory */
+    if (qemu_chr_fe_get_msgfds(&s->chr, &fd, 1) > 0 && fd >= 0) {
+        close(fd);
+    }
+
+    if (s->rem_failed) {
+        s->adds_after_nak++;
+    }
+
+    g_assert_cmpint(s->nr_mem_regs, <, G_N_ELEMENTS(s->mem_regs));
+    s->mem_regs[s->nr_mem_regs++] = msg->payload.mem_reg.region;
+    hold_mem_reg_ack(s, msg, 0);
+}
+
+static void rem_mem_reg(TestServer *s, VhostUserMsg *msg)
+{
+    VhostUserMemoryRegion *reg = &msg->payload.mem_reg.region;
+    int i;
+
+    if (s->nak_rem) {
+        s->nak_rem = false;
+        s->rem_failed = true;
+        hold_mem_reg_ack(s, msg, 1);
+        return;
+    }
+
+    for (i = 0; i < s->nr_mem_regs; i++) {
+        if (s->mem_regs[i].guest_phys_addr == reg->guest_phys_addr &&
+            s->mem_regs[i].memory_size == reg->memory_size) {
+            break;
+        }
+    }
+    g_assert_cmpint(i, <, s->nr_mem_regs);
+
+    memmove(&s->mem_regs[i], &s->mem_regs[i + 1],
+            sizeof(s->mem_regs[0]) * (s->nr_mem_regs - i - 1));
+    s->nr_mem_regs--;
+    hold_mem_reg_ack(s, msg, 0);
+}
+
 static int chr_can_read(void *opaque)
 {
     return VHOST_USER_HDR_SIZE;
@@ -362,6 +493,12 @@ static void chr_read(void *opaque, const uint8_t *buf, int size)
         }
     }
 
+    /* Replies must go out in order */
+    if (msg.request != VHOST_USER_ADD_MEM_REG &&
+        msg.request != VHOST_USER_REM_MEM_REG) {
+        flush_held_acks(s);
+    }
+
     switch (msg.request) {
     case VHOST_USER_GET_FEATURES:
         /* Mandatory for tests to define get_features */
@@ -514,11 +651,39 @@ static void chr_read(void *opaque, const uint8_t *buf, int size)
                    msg.payload.state.num ? "enabled" : "disabled");
         break;
 
+    case VHOST_USER_GET_MAX_MEM_SLOTS:
+        msg.flags |= VHOST_USER_REPLY_MASK;
+        msg.size = sizeof(m.payload.u64);
+        msg.payload.u64 = TEST_MAX_MEM_SLOTS;
+        p = (uint8_t *) &msg;
+        qemu_chr_fe_write_all(chr, p, VHOST_USER_HDR_SIZE + msg.size);
+        break;
+
+    case VHOST_USER_ADD_MEM_REG:
+        add_mem_reg(s, &msg);
+        g_cond_broadcast(&s->data_cond);
+        break;
+
+    case VHOST_USER_REM_MEM_REG:
+        rem_mem_reg(s, &msg);
+        g_cond_broadcast(&s->data_cond);
+        break;
+
     default:
         qos_printf("vhost-user: un-handled message: %d\n", msg.request);
         break;
     }
 
+    /* REPLY_ACK for the requests that have no reply of their own */
+    if (msg.flags & VHOST_USER_NEED_REPLY_MASK) {
+        msg.flags &= ~VHOST_USER_NEED_REPLY_MASK;
+        msg.flags |= VHOST_USER_REPLY_MASK;
+        msg.size = sizeof(m.payload.u64);
+        msg.payload.u64 = 0;
+        p = (uint8_t *) &msg;
+        qemu_chr_fe_write_all(chr, p, VHOST_USER_HDR_SIZE + msg.size);
+    }
+
 out:
     g_mutex_unlock(&s->data_mutex);
 }
@@ -658,6 +823,11 @@ static void test_server_free(TestServer *server)
 
     qemu_chr_fe_deinit(&server->chr, true);
 
+    if (server->ack_source) {
+        g_source_destroy(server->ack_source);
+        g_source_unref(server->ack_source);
+    }
+
     for (i = 0; i < server->fds_num; i++) {
         close(server->fds[i]);
     }
@@ -1040,6 +1210,95 @@ static void test_multiqueue(void *obj, void *arg, QGuestAllocator *alloc)
     wait_for_rings_started(s, s->queues * 2);
 }
 
+static void *vhost_user_test_setup_mem_slots(GString *cmd_line, void *arg)
+{
+    TestServer *s = test_server_new("mem-slots", arg);
+    int i;
+
+    test_server_listen(s);
+    s->protocol_features = 1ULL << VHOST_USER_PROTOCOL_F_REPLY_ACK |
+        1ULL << VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS;
+
+    /* One memory region per DIMM on top of the RAM around the VGA hole */
+    g_string_append_printf(cmd_line,
+                           " -m 256,slots=%d,maxmem=1G"
+                           " -object memory-backend-memfd,id=mem,size=256M"
+                           " -numa node,memdev=mem", TEST_MEM_DIMMS);
+    for (i = 0; i < TEST_MEM_DIMMS; i++) {
+        g_string_append_printf(cmd_line,
+                               " -object memory-backend-memfd,id=dimm-mem%d,"
+                               "size=2M -device pc-dimm,id=dimm%d,"
+                               "memdev=dimm-mem%d", i, i, i);
+    }
+    s->vu_ops->append_opts(s, cmd_line, "");
+
+    g_test_queue_destroy(vhost_user_test_cleanup, s);
+
+    return s;
+}
+
+static int find_mem_reg(TestServer *s, uint64_t gpa, uint64_t size)
+{
+    int i;
+
+    for (i = 0; i < s->nr_mem_regs; i++) {
+        if (s->mem_regs[i].guest_phys_addr == gpa &&
+            s->mem_regs[i].memory_size == size) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Map the 32 KiB of legacy BIOS area behind i440FX PAM register @reg as RAM.
+ * Each step extends the RAM at 0xc0000, so vhost-user has to replace that
+ * region with a larger one.
+ */
+static void i440fx_pam_map_ram(QTestState *qts, uint8_t reg)
+{
+    qtest_outl(qts, 0xcf8, 0x80000000 | (reg & ~3));
+    qtest_outb(qts, 0xcfc + (reg & 3), 0x33);
+}
+
+static void test_mem_slots(void *obj, void *arg, QGuestAllocator *alloc)
+{
+    TestServer *s = arg;
+
+    wait_for_rings_started(s, 2);
+
+    g_mutex_lock(&s->data_mutex);
+    g_assert_cmpint(s->nr_mem_regs, >=, TEST_MEM_DIMMS + 2);
+    /* Pipelined, but never further ahead than the REPLY_ACK window */
+    g_assert_cmpint(s->max_held_acks, >, 1);
+    g_assert_cmpint(s->max_held_acks, <=, VHOST_USER_MEM_REG_MAX_INFLIGHT);
+    g_mutex_unlock(&s->data_mutex);
+
+    i440fx_pam_map_ram(global_qtest, 0x5a);
+    g_mutex_lock(&s->data_mutex);
+    g_assert_cmpint(find_mem_reg(s, 0xc0000, 0x8000), >=, 0);
+    s->nak_rem = true;
+    g_mutex_unlock(&s->data_mutex);
+
+    /* The old region can't be removed, so the larger one must not be added */
+    i440fx_pam_map_ram(global_qtest, 0x5b);
+    g_mutex_lock(&s->data_mutex);
+    g_assert_true(s->rem_failed);
+    g_assert_cmpint(s->adds_after_nak, ==, 0);
+    g_assert_cmpint(find_mem_reg(s, 0xc0000, 0x8000), >=, 0);
+    g_assert_cmpint(find_mem_reg(s, 0xc0000, 0x10000), <, 0);
+    s->rem_failed = false;
+    g_mutex_unlock(&s->data_mutex);
+
+    /* The next update retries the removal */
+    i440fx_pam_map_ram(global_qtest, 0x5c);
+    g_mutex_lock(&s->data_mutex);
+    g_assert_cmpint(find_mem_reg(s, 0xc0000, 0x8000), <, 0);
+    g_assert_cmpint(find_mem_reg(s, 0xc0000, 0x18000), >=, 0);
+    g_mutex_unlock(&s->data_mutex);
+}
+
 
 static uint64_t vu_net_get_features(TestServer *s)
 {
@@ -1071,6 +1330,7 @@ static void vu_net_get_protocol_features(TestServer *s, CharBackend *chr,
     msg->size = sizeof(m.payload.u64);
     msg->payload.u64 = 1 << VHOST_USER_PROTOCOL_F_LOG_SHMFD;
     msg->payload.u64 |= 1 << VHOST_USER_PROTOCOL_F_CROSS_ENDIAN;
+    msg->payload.u64 |= s->protocol_features;
     if (s->queues > 1) {
         msg->payload.u64 |= 1 << VHOST_USER_PROTOCOL_F_MQ;
     }
@@ -1135,6 +1395,16 @@ static void register_vhost_user_test(void)
     qos_add_test("vhost-user/multiqueue",
                  "virtio-net",
                  test_multiqueue, &opts);
+
+    if (qemu_memfd_check(MFD_ALLOW_SEALING) &&
+        (g_str_equal(qtest_get_arch(), "i386") ||
+         g_str_equal(qtest_get_arch(), "x86_64"))) {
+        opts.before = vhost_user_test_setup_mem_slots;
+        opts.edge.extra_device_opts = NULL;
+        qos_add_test("vhost-user/mem-slots",
+                     "virtio-net",
+                     test_mem_slots, &opts);
+    }
 }
 libqos_init(register_vhost_user_test);
 
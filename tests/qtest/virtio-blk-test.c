@@ -12,6 +12,8 @@
 #include "libqtest-single.h"
 #include "qemu/bswap.h"
 #include "qemu/module.h"
+#include "qapi/qmp/qdict.h"
+#include "qapi/qmp/qlist.h"
 #include "standard-headers/linux/virtio_blk.h"
 #include "standard-headers/linux/virtio_pci.h"
 #include "libqos/qgraph.h"
@@ -694,6 +696,565 @@ static void idx(void *obj, void *u_data, QGuestAllocator *t_alloc)
     qvirtqueue_cleanup(dev->bus, vq, t_alloc);
 }
 
+/* Make @n chains available with a single avail index update */
+static void virtqueue_make_available(QTestState *qts, QVirtioDevice *d,
+                                     QVirtQueue *vq, uint32_t *heads, int n)
+{
+    /* vq->avail->idx */
+    uint16_t idx = qvirtio_readw(d, qts, vq->avail + 2);
+    int i;
+
+    for (i = 0; i < n; i++) {
+        /* vq->avail->ring[(idx + i) % vq->size] */
+        qvirtio_writew(d, qts, vq->avail + 4 + 2 * ((idx + i) % vq->size),
+                       heads[i]);
+    }
+    qvirtio_writew(d, qts, vq->avail + 2, idx + n);
+}
+
+/*
+ * Make @n chains available and notify the device once, so that it can pop
+ * them as one batch
+ */
+static void virtqueue_kick_many(QTestState *qts, QVirtioDevice *d,
+                                QVirtQueue *vq, uint32_t *heads, int n)
+{
+    virtqueue_make_available(qts, d, vq, heads, n);
+    d->bus->virtqueue_kick(d, vq);
+}
+
+/*
+ * Submit full batches of requests and wait for all of them.  Each request
+ * takes a single ring descriptor that points to an indirect table, so all
+ * rounds fit into the queue without reusing descriptors.  With -m perf,
+ * report the rate at which the device completes virtqueue elements.  This
+ * includes the qtest protocol overhead for polling the used ring, so it is
+ * only meaningful for comparing builds of the same host.
+ */
+static void batch(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    QVirtioBlk *blk_if = obj;
+    QVirtioDevice *dev = blk_if->vdev;
+    QTestState *qts = global_qtest;
+    QVirtQueue *vq;
+    QVirtioBlkReq req;
+    uint64_t features;
+    const int nr_reqs = 64;
+    int rounds, round, i;
+    uint64_t *req_addr;
+    uint32_t *heads;
+    QVRingIndirectDesc **indirect;
+    double elapsed = 0;
+
+    features = qvirtio_get_features(dev);
+    g_assert_cmphex(features & (1u << VIRTIO_RING_F_INDIRECT_DESC), !=, 0);
+    features = features & ~(QVIRTIO_F_BAD_FEATURE |
+                            (1u << VIRTIO_RING_F_EVENT_IDX) |
+                            (1u << VIRTIO_BLK_F_SCSI));
+    qvirtio_set_features(dev, features);
+
+    vq = qvirtqueue_setup(dev, t_alloc, 0);
+    qvirtio_set_driver_ok(dev);
+
+    rounds = g_test_perf() ? vq->size / nr_reqs : 4;
+    g_assert_cmpint(rounds * nr_reqs, <=, vq->size);
+
+    req_addr = g_new(uint64_t, nr_reqs);
+    heads = g_new(uint32_t, nr_reqs);
+    indirect = g_new(QVRingIndirectDesc *, nr_reqs);
+
+    for (round = 0; round < rounds; round++) {
+        int64_t end_time;
+        int done = 0;
+
+        for (i = 0; i < nr_reqs; i++) {
+            req.type = VIRTIO_BLK_T_IN;
+            req.ioprio = 1;
+            req.sector = (round * nr_reqs + i) % (TEST_IMAGE_SIZE / 512);
+            req.data = g_malloc0(512);
+
+            req_addr[i] = virtio_blk_request(t_alloc, dev, &req, 512);
+
+            g_free(req.data);
+
+            indirect[i] = qvring_indirect_desc_setup(qts, dev, t_alloc, 3);
+            qvring_indirect_desc_add(dev, qts, indirect[i], req_addr[i], 16,
+                                     false);
+            qvring_indirect_desc_add(dev, qts, indirect[i], req_addr[i] + 16,
+                                     512, true);
+            qvring_indirect_desc_add(dev, qts, indirect[i], req_addr[i] + 528,
+                                     1, true);
+            heads[i] = qvirtqueue_add_indirect(qts, vq, indirect[i]);
+        }
+
+        g_test_timer_start();
+        virtqueue_kick_many(qts, dev, vq, heads, nr_reqs);
+
+        end_time = g_get_monotonic_time() + QVIRTIO_BLK_TIMEOUT_US;
+        while (done < nr_reqs) {
+            if (qvirtqueue_get_buf(qts, vq, NULL, NULL)) {
+                done++;
+                continue;
+            }
+            g_assert(g_get_monotonic_time() < end_time);
+            qtest_clock_step(qts, 100);
+        }
+        elapsed += g_test_timer_elapsed();
+
+        for (i = 0; i < nr_reqs; i++) {
+            g_assert_cmpint(readb(req_addr[i] + 528), ==, 0);
+            guest_free(t_alloc, indirect[i]->desc);
+            g_free(indirect[i]);
+            guest_free(t_alloc, req_addr[i]);
+        }
+    }
+
+    if (g_test_perf()) {
+        g_test_maximized_result(rounds * nr_reqs / elapsed,
+                                "%.0f elements/s", rounds * nr_reqs / elapsed);
+    }
+
+    g_free(indirect);
+    g_free(heads);
+    g_free(req_addr);
+    qvirtqueue_cleanup(dev->bus, vq, t_alloc);
+}
+
+/* Returns the query-blockstats statistics of drive0 */
+static QDict *get_blockstats(QTestState *qts)
+{
+    QDict *rsp = qtest_qmp(qts, "{ 'execute': 'query-blockstats' }");
+    QDict *stats = NULL;
+    QListEntry *e;
+
+    QLIST_FOREACH_ENTRY(qdict_get_qlist(rsp, "return"), e) {
+        QDict *d = qobject_to(QDict, qlist_entry_obj(e));
+
+        if (qdict_haskey(d, "device") &&
+            !strcmp(qdict_get_str(d, "device"), "drive0")) {
+            stats = qdict_get_qdict(d, "stats");
+            qobject_ref(stats);
+        }
+    }
+    qobject_unref(rsp);
+
+    g_assert(stats);
+    return stats;
+}
+
+static int64_t get_blockstat(QTestState *qts, const char *name)
+{
+    QDict *stats = get_blockstats(qts);
+    int64_t val = qdict_get_int(stats, name);
+
+    qobject_unref(stats);
+    return val;
+}
+
+/* Fills @wr_merged with the number of merged writes for each queue */
+static void get_queue_wr_merged(QTestState *qts, int64_t *wr_merged,
+                                int nr_queues)
+{
+    QDict *stats = get_blockstats(qts);
+    QListEntry *e;
+    int i = 0;
+
+    QLIST_FOREACH_ENTRY(qdict_get_qlist(stats, "queues"), e) {
+        QDict *q = qobject_to(QDict, qlist_entry_obj(e));
+
+        g_assert_cmpint(i, <, nr_queues);
+        wr_merged[i++] = qdict_get_int(q, "wr-merged");
+    }
+    g_assert_cmpint(i, ==, nr_queues);
+
+    qobject_unref(stats);
+}
+
+/*
+ * Requests that the guest makes available out of order are sorted by
+ * sector when they are queued for merging, so that adjacent ones are
+ * submitted as a single request
+ */
+static void merge(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    static const int order[] = { 5, 2, 7, 0, 3, 6, 1, 4 };
+    const int nr_reqs = ARRAY_SIZE(order);
+    const uint64_t req_size = 4096;
+    QVirtioBlk *blk_if = obj;
+    QVirtioDevice *dev = blk_if->vdev;
+    QTestState *qts = global_qtest;
+    QVirtQueue *vq;
+    QVirtioBlkReq req;
+    uint64_t req_addr[ARRAY_SIZE(order)];
+    uint32_t heads[ARRAY_SIZE(order)];
+    uint64_t features;
+    uint32_t free_head;
+    int64_t wr_merged;
+    int64_t end_time;
+    char *buf;
+    int done = 0;
+    int i;
+
+    features = qvirtio_get_features(dev);
+    features = features & ~(QVIRTIO_F_BAD_FEATURE |
+                            (1u << VIRTIO_RING_F_INDIRECT_DESC) |
+                            (1u << VIRTIO_RING_F_EVENT_IDX) |
+                            (1u << VIRTIO_BLK_F_SCSI));
+    qvirtio_set_features(dev, features);
+
+    vq = qvirtqueue_setup(dev, t_alloc, 0);
+    qvirtio_set_driver_ok(dev);
+
+    wr_merged = get_blockstat(qts, "wr_merged");
+
+    /* Write adjacent chunks, each with its own pattern, in shuffled order */
+    for (i = 0; i < nr_reqs; i++) {
+        req.type = VIRTIO_BLK_T_OUT;
+        req.ioprio = 1;
+        req.sector = order[i] * req_size / 512;
+        req.data = g_malloc(req_size);
+        memset(req.data, 'a' + order[i], req_size);
+
+        req_addr[i] = virtio_blk_request(t_alloc, dev, &req, req_size);
+
+        g_free(req.data);
+
+        heads[i] = qvirtqueue_add(qts, vq, req_addr[i], 16, false, true);
+        qvirtqueue_add(qts, vq, req_addr[i] + 16, req_size, false, true);
+        qvirtqueue_add(qts, vq, req_addr[i] + 16 + req_size, 1, true, false);
+    }
+
+    virtqueue_kick_many(qts, dev, vq, heads, nr_reqs);
+
+    end_time = g_get_monotonic_time() + QVIRTIO_BLK_TIMEOUT_US;
+    while (done < nr_reqs) {
+        if (qvirtqueue_get_buf(qts, vq, NULL, NULL)) {
+            done++;
+            continue;
+        }
+        g_assert(g_get_monotonic_time() < end_time);
+        qtest_clock_step(qts, 100);
+    }
+
+    for (i = 0; i < nr_reqs; i++) {
+        g_assert_cmpint(readb(req_addr[i] + 16 + req_size), ==, 0);
+        guest_free(t_alloc, req_addr[i]);
+    }
+
+    /* All of them were popped in one go and merged into one request */
+    g_assert_cmpint(get_blockstat(qts, "wr_merged") - wr_merged, ==,
+                    nr_reqs - 1);
+
+    /* Each chunk has been written to the right place */
+    req.type = VIRTIO_BLK_T_IN;
+    req.ioprio = 1;
+    req.sector = 0;
+    req.data = g_malloc0(nr_reqs * req_size);
+
+    req_addr[0] = virtio_blk_request(t_alloc, dev, &req, nr_reqs * req_size);
+
+    g_free(req.data);
+
+    free_head = qvirtqueue_add(qts, vq, req_addr[0], 16, false, true);
+    qvirtqueue_add(qts, vq, req_addr[0] + 16, nr_reqs * req_size, true, true);
+    qvirtqueue_add(qts, vq, req_addr[0] + 16 + nr_reqs * req_size, 1, true,
+                   false);
+    qvirtqueue_kick(qts, dev, vq, free_head);
+
+    qvirtio_wait_used_elem(qts, dev, vq, free_head, NULL,
+                           QVIRTIO_BLK_TIMEOUT_US);
+    g_assert_cmpint(readb(req_addr[0] + 16 + nr_reqs * req_size), ==, 0);
+
+    buf = g_malloc(req_size);
+    for (i = 0; i < nr_reqs; i++) {
+        int j;
+
+        memread(req_addr[0] + 16 + i * req_size, buf, req_size);
+        for (j = 0; j < req_size; j++) {
+            g_assert_cmpint(buf[j], ==, 'a' + i);
+        }
+    }
+    g_free(buf);
+
+    guest_free(t_alloc, req_addr[0]);
+    qvirtqueue_cleanup(dev->bus, vq, t_alloc);
+}
+
+/*
+ * Adjacent writes that the guest spreads over two queues served by the same
+ * thread are all handled when the first queue is kicked, and merged into a
+ * single request.  Each merge is accounted to the queue it came from.
+ */
+static void merge_mq(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    const int nr_reqs = 8;
+    const uint64_t req_size = 4096;
+    QVirtioBlk *blk_if = obj;
+    QVirtioDevice *dev = blk_if->vdev;
+    QTestState *qts = global_qtest;
+    QVirtQueue *vq[2];
+    QVirtioBlkReq req;
+    uint64_t req_addr[8];
+    uint32_t heads[2][4];
+    uint64_t features;
+    int64_t wr_merged, queue_wr_merged[2], queue_wr_merged_after[2];
+    int64_t end_time;
+    int done = 0;
+    int i;
+
+    features = qvirtio_get_features(dev);
+    g_assert(features & (1u << VIRTIO_BLK_F_MQ));
+    features = features & ~(QVIRTIO_F_BAD_FEATURE |
+                            (1u << VIRTIO_RING_F_INDIRECT_DESC) |
+                            (1u << VIRTIO_RING_F_EVENT_IDX) |
+                            (1u << VIRTIO_BLK_F_SCSI));
+    qvirtio_set_features(dev, features);
+
+    for (i = 0; i < 2; i++) {
+        vq[i] = qvirtqueue_setup(dev, t_alloc, i);
+    }
+    qvirtio_set_driver_ok(dev);
+
+    wr_merged = get_blockstat(qts, "wr_merged");
+    get_queue_wr_merged(qts, queue_wr_merged, 2);
+
+    /* Even chunks go to queue 0, odd ones to queue 1 */
+    for (i = 0; i < nr_reqs; i++) {
+        req.type = VIRTIO_BLK_T_OUT;
+        req.ioprio = 1;
+        req.sector = i * req_size / 512;
+        req.data = g_malloc0(req_size);
+
+        req_addr[i] = virtio_blk_request(t_alloc, dev, &req, req_size);
+
+        g_free(req.data);
+
+        heads[i % 2][i / 2] = qvirtqueue_add(qts, vq[i % 2], req_addr[i],
+                                             16, false, true);
+        qvirtqueue_add(qts, vq[i % 2], req_addr[i] + 16, req_size, false,
+                       true);
+        qvirtqueue_add(qts, vq[i % 2], req_addr[i] + 16 + req_size, 1, true,
+                       false);
+    }
+
+    /* Queue 1 is never kicked, handling queue 0 must pick it up */
+    virtqueue_make_available(qts, dev, vq[1], heads[1], nr_reqs / 2);
+    virtqueue_kick_many(qts, dev, vq[0], heads[0], nr_reqs / 2);
+
+    end_time = g_get_monotonic_time() + QVIRTIO_BLK_TIMEOUT_US;
+    while (done < nr_reqs) {
+        if (qvirtqueue_get_buf(qts, vq[0], NULL, NULL) ||
+            qvirtqueue_get_buf(qts, vq[1], NULL, NULL)) {
+            done++;
+            continue;
+        }
+        g_assert(g_get_monotonic_time() < end_time);
+        qtest_clock_step(qts, 100);
+    }
+
+    for (i = 0; i < nr_reqs; i++) {
+        g_assert_cmpint(readb(req_addr[i] + 16 + req_size), ==, 0);
+        guest_free(t_alloc, req_addr[i]);
+    }
+
+    g_assert_cmpint(get_blockstat(qts, "wr_merged") - wr_merged, ==,
+                    nr_reqs - 1);
+
+    /* Everything was merged into the request for sector 0 from queue 0 */
+    get_queue_wr_merged(qts, queue_wr_merged_after, 2);
+    g_assert_cmpint(queue_wr_merged_after[0] - queue_wr_merged[0], ==,
+                    nr_reqs / 2 - 1);
+    g_assert_cmpint(queue_wr_merged_after[1] - queue_wr_merged[1], ==,
+                    nr_reqs / 2);
+
+    for (i = 0; i < 2; i++) {
+        qvirtqueue_cleanup(dev->bus, vq[i], t_alloc);
+    }
+}
+
+/* Adjacent discard requests are coalesced into one */
+static void merge_discard(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    static const int order[] = { 3, 0, 2, 1 };
+    const int nr_reqs = ARRAY_SIZE(order);
+    QVirtioBlk *blk_if = obj;
+    QVirtioDevice *dev = blk_if->vdev;
+    QTestState *qts = global_qtest;
+    struct virtio_blk_discard_write_zeroes dwz_hdr;
+    QVirtQueue *vq;
+    QVirtioBlkReq req;
+    uint64_t req_addr[ARRAY_SIZE(order)];
+    uint32_t heads[ARRAY_SIZE(order)];
+    uint64_t features;
+    int64_t unmap_merged;
+    int64_t end_time;
+    int done = 0;
+    int i;
+
+    features = qvirtio_get_features(dev);
+    if (!(features & (1u << VIRTIO_BLK_F_DISCARD))) {
+        g_test_skip("discard not supported");
+        return;
+    }
+    features = features & ~(QVIRTIO_F_BAD_FEATURE |
+                            (1u << VIRTIO_RING_F_INDIRECT_DESC) |
+                            (1u << VIRTIO_RING_F_EVENT_IDX) |
+                            (1u << VIRTIO_BLK_F_SCSI));
+    qvirtio_set_features(dev, features);
+
+    vq = qvirtqueue_setup(dev, t_alloc, 0);
+    qvirtio_set_driver_ok(dev);
+
+    unmap_merged = get_blockstat(qts, "unmap_merged");
+
+    for (i = 0; i < nr_reqs; i++) {
+        req.type = VIRTIO_BLK_T_DISCARD;
+        req.data = (char *) &dwz_hdr;
+        dwz_hdr.sector = order[i] * 8;
+        dwz_hdr.num_sectors = 8;
+        dwz_hdr.flags = 0;
+
+        virtio_blk_fix_dwz_hdr(dev, &dwz_hdr);
+
+        req_addr[i] = virtio_blk_request(t_alloc, dev, &req, sizeof(dwz_hdr));
+
+        heads[i] = qvirtqueue_add(qts, vq, req_addr[i], 16, false, true);
+        qvirtqueue_add(qts, vq, req_addr[i] + 16, sizeof(dwz_hdr), false,
+                       true);
+        qvirtqueue_add(qts, vq, req_addr[i] + 16 + sizeof(dwz_hdr), 1, true,
+                       false);
+    }
+
+    virtqueue_kick_many(qts, dev, vq, heads, nr_reqs);
+
+    end_time = g_get_monotonic_time() + QVIRTIO_BLK_TIMEOUT_US;
+    while (done < nr_reqs) {
+        if (qvirtqueue_get_buf(qts, vq, NULL, NULL)) {
+            done++;
+            continue;
+        }
+        g_assert(g_get_monotonic_time() < end_time);
+        qtest_clock_step(qts, 100);
+    }
+
+    for (i = 0; i < nr_reqs; i++) {
+        g_assert_cmpint(readb(req_addr[i] + 16 + sizeof(dwz_hdr)), ==, 0);
+        guest_free(t_alloc, req_addr[i]);
+    }
+
+    g_assert_cmpint(get_blockstat(qts, "unmap_merged") - unmap_merged, ==,
+                    nr_reqs - 1);
+
+    qvirtqueue_cleanup(dev->bus, vq, t_alloc);
+}
+
+/* Guest time that a virtqueue interrupt may be held back in "coalesce" */
+#define COALESCE_USECS 1000000
+#define COALESCE_NS (COALESCE_USECS * 1000LL)
+
+static uint64_t coalesce_submit(QTestState *qts, QVirtioDevice *dev,
+                                QVirtQueue *vq, QGuestAllocator *alloc,
+                                uint64_t sector)
+{
+    QVirtioBlkReq req;
+    uint64_t req_addr;
+    uint32_t free_head;
+
+    req.type = VIRTIO_BLK_T_IN;
+    req.ioprio = 1;
+    req.sector = sector;
+    req.data = g_malloc0(512);
+
+    req_addr = virtio_blk_request(alloc, dev, &req, 512);
+
+    g_free(req.data);
+
+    free_head = qvirtqueue_add(qts, vq, req_addr, 16, false, true);
+    qvirtqueue_add(qts, vq, req_addr + 16, 512, true, true);
+    qvirtqueue_add(qts, vq, req_addr + 528, 1, true, false);
+    qvirtqueue_kick(qts, dev, vq, free_head);
+
+    return req_addr;
+}
+
+/*
+ * With irq-coalesce-max-usecs, completions raise no interrupt until the
+ * window that the first of them opened has passed in guest time, or until
+ * irq-coalesce-max-frames of them are waiting.  Interrupts still held back
+ * when the driver resets the device are dropped.
+ */
+static void coalesce(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    QVirtioBlk *blk_if = obj;
+    QVirtioDevice *dev = blk_if->vdev;
+    QTestState *qts = global_qtest;
+    QVirtQueue *vq;
+    uint64_t features;
+    uint64_t req_addr[3];
+    uint8_t status;
+    int i;
+
+    features = qvirtio_get_features(dev);
+    features = features & ~(QVIRTIO_F_BAD_FEATURE |
+                            (1u << VIRTIO_RING_F_INDIRECT_DESC) |
+                            (1u << VIRTIO_RING_F_EVENT_IDX) |
+                            (1u << VIRTIO_BLK_F_SCSI));
+    qvirtio_set_features(dev, features);
+
+    vq = qvirtqueue_setup(dev, t_alloc, 0);
+    qvirtio_set_driver_ok(dev);
+
+    /* The first completion opens the window... */
+    req_addr[0] = coalesce_submit(qts, dev, vq, t_alloc, 0);
+    status = qvirtio_wait_status_byte_no_isr(qts, dev, vq, req_addr[0] + 528,
+                                             QVIRTIO_BLK_TIMEOUT_US);
+    g_assert_cmpint(status, ==, 0);
+    qtest_clock_step(qts, COALESCE_NS / 2);
+    g_assert(!dev->bus->get_queue_isr_status(dev, vq));
+
+    /* ...and later ones do not extend it */
+    req_addr[1] = coalesce_submit(qts, dev, vq, t_alloc, 1);
+    status = qvirtio_wait_status_byte_no_isr(qts, dev, vq, req_addr[1] + 528,
+                                             QVIRTIO_BLK_TIMEOUT_US);
+    g_assert_cmpint(status, ==, 0);
+    qtest_clock_step(qts, COALESCE_NS / 2 + 1000000);
+    g_assert(dev->bus->get_queue_isr_status(dev, vq));
+
+    for (i = 0; i < 2; i++) {
+        g_assert(qvirtqueue_get_buf(qts, vq, NULL, NULL));
+        guest_free(t_alloc, req_addr[i]);
+    }
+
+    /* The third waiting completion is signalled right away */
+    for (i = 0; i < 3; i++) {
+        req_addr[i] = coalesce_submit(qts, dev, vq, t_alloc, i);
+        if (i < 2) {
+            status = qvirtio_wait_status_byte_no_isr(qts, dev, vq,
+                                                     req_addr[i] + 528,
+                                                     QVIRTIO_BLK_TIMEOUT_US);
+            g_assert_cmpint(status, ==, 0);
+        }
+    }
+    qvirtio_wait_queue_isr(qts, dev, vq, QVIRTIO_BLK_TIMEOUT_US);
+
+    for (i = 0; i < 3; i++) {
+        g_assert(qvirtqueue_get_buf(qts, vq, NULL, NULL));
+        guest_free(t_alloc, req_addr[i]);
+    }
+
+    /* Nothing is delivered for a ring that was reset in the meantime */
+    req_addr[0] = coalesce_submit(qts, dev, vq, t_alloc, 0);
+    status = qvirtio_wait_status_byte_no_isr(qts, dev, vq, req_addr[0] + 528,
+                                             QVIRTIO_BLK_TIMEOUT_US);
+    g_assert_cmpint(status, ==, 0);
+    qvirtio_reset(dev);
+    qtest_clock_step(qts, 2 * COALESCE_NS);
+    g_assert(!dev->bus->get_queue_isr_status(dev, vq));
+
+    guest_free(t_alloc, req_addr[0]);
+    qvirtqueue_cleanup(dev->bus, vq, t_alloc);
+}
+
 static void pci_hotplug(void *obj, void *data, QGuestAllocator *t_alloc)
 {
     QVirtioPCIDevice *dev1 = obj;
@@ -796,6 +1357,22 @@ static void register_virtio_blk_test(void)
     qos_add_test("basic", "virtio-blk", basic, &opts);
     qos_add_test("resize", "virtio-blk", resize, &opts);
 
+    opts.edge.extra_device_opts = "queue-size=1024";
+    qos_add_test("batch", "virtio-blk", batch, &opts);
+    opts.edge.extra_device_opts = NULL;
+
+    qos_add_test("merge", "virtio-blk", merge, &opts);
+    qos_add_test("merge-discard", "virtio-blk", merge_discard, &opts);
+
+    opts.edge.extra_device_opts = "num-queues=2";
+    qos_add_test("merge-mq", "virtio-blk", merge_mq, &opts);
+    opts.edge.extra_device_opts = NULL;
+
+    opts.edge.extra_device_opts = "irq-coalesce-max-usecs="
+        stringify(COALESCE_USECS) ",irq-coalesce-max-frames=3";
+    qos_add_test("coalesce", "virtio-blk", coalesce, &opts);
+    opts.edge.extra_device_opts = NULL;
+
     /* tests just for virtio-blk-pci */
     qos_add_test("msix", "virtio-blk-pci", msix, &opts);
     qos_add_test("idx", "virtio-blk-pci", idx, &opts);
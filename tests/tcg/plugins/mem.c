@@ -59,8 +59,9 @@ typedef struct {
 static struct qemu_plugin_scoreboard *counts;
 static qemu_plugin_u64 mem_count;
 static qemu_plugin_u64 io_count;
+static struct qemu_plugin_mem_buffer *buffer;
 static bool do_inline, do_callback, do_print_accesses, do_region_summary;
-static bool do_haddr;
+static bool do_haddr, do_buffer;
 static enum qemu_plugin_mem_rw rw = QEMU_PLUGIN_MEM_RW;
 
 
@@ -80,7 +81,13 @@ static void plugin_exit(qemu_plugin_id_t id, void *p)
 {
     g_autoptr(GString) out = g_string_new("");
 
-    if (do_inline || do_callback) {
+    if (do_buffer) {
+        for (int i = 0; i < qemu_plugin_num_vcpus(); i++) {
+            qemu_plugin_mem_buffer_flush(buffer, i);
+        }
+    }
+
+    if (do_inline || do_callback || do_buffer) {
         g_string_printf(out, "mem accesses: %" PRIu64 "\n",
                         qemu_plugin_u64_sum(mem_count));
     }
@@ -115,6 +122,9 @@ static void plugin_exit(qemu_plugin_id_t id, void *p)
     }
 
     qemu_plugin_scoreboard_free(counts);
+    if (buffer) {
+        qemu_plugin_mem_buffer_free(buffer);
+    }
 }
 
 /*
@@ -253,6 +263,13 @@ static void vcpu_mem(unsigned int cpu_index, qemu_plugin_meminfo_t meminfo,
     }
 }
 
+static void vcpu_mem_buffer(unsigned int cpu_index,
+                            const struct qemu_plugin_mem_record *records,
+                            size_t n, void *udata)
+{
+    qemu_plugin_u64_add(mem_count, cpu_index, n);
+}
+
 static void print_access(unsigned int cpu_index, qemu_plugin_meminfo_t meminfo,
                          uint64_t vaddr, void *udata)
 {
@@ -305,6 +322,9 @@ static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
                 QEMU_PLUGIN_INLINE_ADD_U64,
                 mem_count, 1);
         }
+        if (do_buffer) {
+            qemu_plugin_register_vcpu_mem_buffer(insn, rw, buffer);
+        }
         if (do_callback || do_region_summary) {
             qemu_plugin_register_vcpu_mem_cb(insn, vcpu_mem,
                                              QEMU_PLUGIN_CB_NO_REGS,
@@ -358,6 +378,11 @@ QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id,
                 fprintf(stderr, "boolean argument parsing failed: %s\n", opt);
                 return -1;
             }
+        } else if (g_strcmp0(tokens[0], "buffer") == 0) {
+            if (!qemu_plugin_bool_parse(tokens[0], tokens[1], &do_buffer)) {
+                fprintf(stderr, "boolean argument parsing failed: %s\n", opt);
+                return -1;
+            }
         } else if (g_strcmp0(tokens[0], "print-accesses") == 0) {
             if (!qemu_plugin_bool_parse(tokens[0], tokens[1],
                                         &do_print_accesses)) {
@@ -376,12 +401,17 @@ QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id,
         }
     }
 
-    if (do_inline && do_callback) {
+    if (do_inline + do_callback + do_buffer > 1) {
         fprintf(stderr,
-                "can't enable inline and callback counting at the same time\n");
+                "can't enable more than one of inline, callback and buffer "
+                "counting at the same time\n");
         return -1;
     }
 
+    if (do_buffer) {
+        buffer = qemu_plugin_mem_buffer_new(4096, vcpu_mem_buffer, NULL);
+    }
+
     if (do_print_accesses) {
         g_autoptr(GString) out = g_string_new("");
         g_string_printf(out,
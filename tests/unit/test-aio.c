@@ -825,6 +825,137 @@ static void test_worker_thread_co_enter(void)
     g_assert(!aio_poll(ctx, false));
 }
 
+#ifndef _WIN32
+static void test_poll_ns(void)
+{
+    aio_context_set_poll_params(ctx, NANOSECONDS_PER_SECOND, 0, 0,
+                                &error_abort);
+    g_assert_cmpint(aio_context_get_poll_ns(ctx), ==, 0);
+
+    /* An aio_poll() much shorter than the maximum makes it poll longer */
+    aio_poll(ctx, false);
+    g_assert_cmpint(aio_context_get_poll_ns(ctx), >, 0);
+    g_assert_cmpint(aio_context_get_poll_ns(ctx), <=, NANOSECONDS_PER_SECOND);
+
+    /* Disabling polling resets it */
+    aio_context_set_poll_params(ctx, 0, 0, 0, &error_abort);
+    g_assert_cmpint(aio_context_get_poll_ns(ctx), ==, 0);
+}
+
+typedef struct {
+    EventNotifier e;
+    bool pending;
+    int ready;
+    int begin;
+    int end;
+} PollLingerTestData;
+
+static void poll_linger_read(EventNotifier *e)
+{
+    event_notifier_test_and_clear(e);
+}
+
+static bool poll_linger_poll(void *opaque)
+{
+    PollLingerTestData *data = container_of(opaque, PollLingerTestData, e);
+
+    return data->pending;
+}
+
+static bool poll_linger_poll_false(void *opaque)
+{
+    return false;
+}
+
+static void poll_linger_ready(EventNotifier *e)
+{
+    PollLingerTestData *data = container_of(e, PollLingerTestData, e);
+
+    data->pending = false;
+    data->ready++;
+}
+
+static void poll_linger_begin(EventNotifier *e)
+{
+    PollLingerTestData *data = container_of(e, PollLingerTestData, e);
+
+    data->begin++;
+}
+
+static void poll_linger_end(EventNotifier *e)
+{
+    PollLingerTestData *data = container_of(e, PollLingerTestData, e);
+
+    data->end++;
+}
+
+static void test_poll_linger(void)
+{
+    PollLingerTestData data = { 0 };
+    TimerTestData timer = { .max = 1 };
+    EventNotifier other;
+
+    aio_context_set_poll_params(ctx, NANOSECONDS_PER_SECOND, 0, 0,
+                                &error_abort);
+
+    event_notifier_init(&data.e, false);
+    aio_set_event_notifier(ctx, &data.e, poll_linger_read, poll_linger_poll,
+                           poll_linger_ready);
+    aio_set_event_notifier_poll(ctx, &data.e, poll_linger_begin,
+                                poll_linger_end);
+    aio_set_event_notifier_poll_linger(ctx, &data.e, true);
+    event_notifier_init(&other, false);
+    aio_set_event_notifier(ctx, &other, poll_linger_read,
+                           poll_linger_poll_false, dummy_io_handler_read);
+
+    /* Handlers are only polled once they have been ready */
+    event_notifier_set(&data.e);
+    aio_poll(ctx, true);
+
+    /* Poll long enough that the checks below can't race with the deadline */
+    aio_timer_init(ctx, &timer.timer, QEMU_CLOCK_REALTIME, SCALE_NS,
+                   timer_test_cb, &timer);
+    while (aio_context_get_poll_ns(ctx) < SCALE_MS) {
+        timer_mod(&timer.timer,
+                  qemu_clock_get_ns(QEMU_CLOCK_REALTIME) + 2 * SCALE_MS);
+        aio_poll(ctx, true);
+    }
+    timer_del(&timer.timer);
+    g_assert_cmpint(data.begin, ==, data.end);
+    data.begin = data.end = 0;
+
+    /* Polling finds an event */
+    data.pending = true;
+    aio_poll(ctx, true);
+    g_assert_cmpint(data.ready, ==, 1);
+    g_assert_cmpint(data.begin, ==, 1);
+    g_assert_cmpint(data.end, ==, 0);
+
+    /* Blocking for another handler keeps the polling section open... */
+    event_notifier_set(&other);
+    aio_poll(ctx, true);
+    g_assert_cmpint(data.end, ==, 0);
+
+    /* ...so that polling resumes without an io_poll_end() in between */
+    data.pending = true;
+    aio_poll(ctx, true);
+    g_assert_cmpint(data.ready, ==, 2);
+    g_assert_cmpint(data.begin, ==, 2);
+    g_assert_cmpint(data.end, ==, 0);
+
+    /* Without events, the section ends after one polling interval */
+    aio_poll(ctx, true);
+    g_assert_cmpint(data.end, ==, 1);
+    g_assert_cmpint(data.ready, ==, 2);
+
+    aio_set_event_notifier(ctx, &other, NULL, NULL, NULL);
+    event_notifier_cleanup(&other);
+    aio_set_event_notifier(ctx, &data.e, NULL, NULL, NULL);
+    event_notifier_cleanup(&data.e);
+    aio_context_set_poll_params(ctx, 0, 0, 0, &error_abort);
+}
+#endif
+
 /* End of tests.  */
 
 int main(int argc, char **argv)
@@ -847,6 +978,10 @@ int main(int argc, char **argv)
     g_test_add_func("/aio/event/wait/no-flush-cb",  test_wait_event_notifier_noflush);
     g_test_add_func("/aio/event/flush",             test_flush_event_notifier);
     g_test_add_func("/aio/timer/schedule",          test_timer_schedule);
+#ifndef _WIN32
+    g_test_add_func("/aio/poll/poll-ns",            test_poll_ns);
+    g_test_add_func("/aio/poll/linger",             test_poll_linger);
+#endif
 
     g_test_add_func("/aio/coroutine/queue-chaining", test_queue_chaining);
     g_test_add_func("/aio/coroutine/worker-thread-co-enter", test_worker_thread_co_enter);
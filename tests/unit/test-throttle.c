@@ -20,8 +20,10 @@
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
 #include "qemu/module.h"
+#include "qemu/units.h"
 #include "block/throttle-groups.h"
 #include "sysemu/block-backend.h"
+#include "sysemu/qtest.h"
 
 static AioContext     *ctx;
 static LeakyBucket    bkt;
@@ -30,6 +32,14 @@ static ThrottleGroupMember tgm;
 static ThrottleState  ts;
 static ThrottleTimers *tt;
 
+/* This is the clock for QEMU_CLOCK_VIRTUAL */
+static int64_t virtual_clock_ns;
+
+int64_t cpu_get_clock(void)
+{
+    return virtual_clock_ns;
+}
+
 /* useful function */
 static bool double_cmp(double x, double y)
 {
@@ -734,6 +744,28 @@ static void test_accounting(void)
                                 (64.0 / 13)));
 }
 
+static void test_accounting_batch(void)
+{
+    throttle_config_init(&cfg);
+    cfg.buckets[THROTTLE_BPS_TOTAL].avg = 150;
+    cfg.buckets[THROTTLE_OPS_READ].avg = 150;
+    /* op_size must not change the number of ops of a batch */
+    cfg.op_size = 512;
+
+    throttle_init(&ts);
+    throttle_config(&ts, QEMU_CLOCK_VIRTUAL, &cfg);
+
+    throttle_account_batch(&ts, THROTTLE_READ, 10, 64 * 512);
+    throttle_account_batch(&ts, THROTTLE_WRITE, 3, 4 * 512);
+
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_BPS_TOTAL].level, 68 * 512));
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_BPS_READ].level, 64 * 512));
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_BPS_WRITE].level, 4 * 512));
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_OPS_TOTAL].level, 13));
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_OPS_READ].level, 10));
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_OPS_WRITE].level, 3));
+}
+
 static void test_groups(void)
 {
     ThrottleConfig cfg1, cfg2;
@@ -801,6 +833,143 @@ static void test_groups(void)
     g_assert(tgm3->throttle_state == NULL);
 }
 
+/*
+ * Like with qtest, throttle groups created while qtest_allowed is set use
+ * QEMU_CLOCK_VIRTUAL, which the tests below advance by hand.
+ */
+static void register_virtual_clock_tgm(ThrottleGroupMember *tgm,
+                                       const char *groupname)
+{
+    qtest_allowed = true;
+    throttle_group_register_tgm(tgm, groupname, ctx);
+    qtest_allowed = false;
+}
+
+typedef struct {
+    ThrottleGroupMember *tgm;
+    int64_t deadline;
+    uint64_t bytes;
+    bool done;
+} ThroughputData;
+
+static void coroutine_fn throughput_co(void *opaque)
+{
+    ThroughputData *data = opaque;
+
+    while (qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) < data->deadline) {
+        throttle_group_co_io_limits_intercept(data->tgm, 128 * KiB,
+                                              THROTTLE_READ);
+        data->bytes += 128 * KiB;
+    }
+    data->done = true;
+}
+
+/*
+ * Requests larger than the credit a member pays for in advance must still
+ * get the whole bandwidth of the group.
+ */
+static void test_groups_throughput(void)
+{
+    const uint64_t bps = 10 * 1000 * 1000;
+    ThrottleConfig cfg1;
+    BlockBackend *blk;
+    ThroughputData data = {};
+    Coroutine *co;
+    double ratio;
+
+    blk = blk_new(qemu_get_aio_context(), 0, BLK_PERM_ALL);
+    data.tgm = &blk_get_public(blk)->throttle_group_member;
+    register_virtual_clock_tgm(data.tgm, "throughput");
+
+    throttle_config_init(&cfg1);
+    cfg1.buckets[THROTTLE_BPS_TOTAL].avg = bps;
+    throttle_group_config(data.tgm, &cfg1);
+
+    /* Run for two seconds of virtual time, in steps of 1 ms */
+    qemu_clock_enable(QEMU_CLOCK_VIRTUAL, true);
+    data.deadline = virtual_clock_ns + 2 * NANOSECONDS_PER_SECOND;
+    co = qemu_coroutine_create(throughput_co, &data);
+    qemu_coroutine_enter(co);
+    while (!data.done) {
+        virtual_clock_ns += SCALE_MS;
+        while (aio_poll(ctx, false)) {
+            /* run throttle timers and the restarted requests */
+        }
+    }
+    qemu_clock_enable(QEMU_CLOCK_VIRTUAL, false);
+
+    /* Allow for the initial burst of the bucket, which is 1/10 s */
+    ratio = (double)data.bytes / (2 * bps);
+    g_assert_cmpfloat(ratio, >, 0.9);
+    g_assert_cmpfloat(ratio, <, 1.15);
+
+    throttle_group_unregister_tgm(data.tgm);
+    blk_unref(blk);
+}
+
+static void coroutine_fn intercept_co(void *opaque)
+{
+    ThrottleGroupMember *tgm = opaque;
+
+    throttle_group_co_io_limits_intercept(tgm, 512, THROTTLE_READ);
+}
+
+/*
+ * However many members a group has, the credit they hold altogether is
+ * worth at most 1/100 s of the group's limits, and the group gets at most
+ * that much ahead of the I/O that was actually done.
+ */
+static void test_groups_credit(void)
+{
+    const uint64_t iops = 10000;
+    const uint64_t slice = iops / 100;
+    enum { NR_MEMBERS = 8 };
+    BlockBackend *blk[NR_MEMBERS];
+    ThrottleGroupMember *tgms[NR_MEMBERS];
+    ThrottleConfig cfg1;
+    LeakyBucket *bucket;
+    uint64_t requests = 0;
+    int i, round;
+
+    for (i = 0; i < NR_MEMBERS; i++) {
+        blk[i] = blk_new(qemu_get_aio_context(), 0, BLK_PERM_ALL);
+        tgms[i] = &blk_get_public(blk[i])->throttle_group_member;
+        register_virtual_clock_tgm(tgms[i], "credit");
+    }
+
+    throttle_config_init(&cfg1);
+    cfg1.buckets[THROTTLE_OPS_TOTAL].avg = iops;
+    throttle_group_config(tgms[0], &cfg1);
+    bucket = &tgms[0]->throttle_state->cfg.buckets[THROTTLE_OPS_TOTAL];
+
+    /*
+     * The virtual clock stands still, so nothing leaks from the bucket, and
+     * these few requests stay well within its burst
+     */
+    for (round = 0; round < 4; round++) {
+        for (i = 0; i < NR_MEMBERS; i++) {
+            uint64_t credit = 0;
+            int j;
+
+            qemu_coroutine_enter(qemu_coroutine_create(intercept_co,
+                                                       tgms[i]));
+            requests++;
+
+            for (j = 0; j < NR_MEMBERS; j++) {
+                credit += tgms[j]->credit_ops[THROTTLE_READ];
+            }
+            g_assert_cmpuint(credit, >, 0);
+            g_assert_cmpuint(credit, <=, slice);
+            g_assert(double_cmp(bucket->level, requests + credit));
+        }
+    }
+
+    for (i = 0; i < NR_MEMBERS; i++) {
+        throttle_group_unregister_tgm(tgms[i]);
+        blk_unref(blk[i]);
+    }
+}
+
 int main(int argc, char **argv)
 {
     qemu_init_main_loop(&error_fatal);
@@ -829,7 +998,10 @@ int main(int argc, char **argv)
                     test_iops_size_is_missing_limit);
     g_test_add_func("/throttle/config_functions",   test_config_functions);
     g_test_add_func("/throttle/accounting",         test_accounting);
+    g_test_add_func("/throttle/accounting_batch",   test_accounting_batch);
     g_test_add_func("/throttle/groups",             test_groups);
+    g_test_add_func("/throttle/groups/throughput",  test_groups_throughput);
+    g_test_add_func("/throttle/groups/credit",      test_groups_credit);
     return g_test_run();
 }
 
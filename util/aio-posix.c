@@ -204,6 +204,19 @@ static void aio_set_fd_poll(AioContext *ctx, int fd,
     node->io_poll_end = io_poll_end;
 }
 
+void aio_set_event_notifier_poll_linger(AioContext *ctx,
+                                        EventNotifier *notifier,
+                                        bool linger)
+{
+    AioHandler *node = find_aio_handler(ctx, event_notifier_get_fd(notifier));
+
+    if (!node) {
+        return;
+    }
+
+    node->poll_linger = linger;
+}
+
 void aio_set_event_notifier(AioContext *ctx,
                             EventNotifier *notifier,
                             EventNotifierHandler *io_read,
@@ -226,8 +239,13 @@ void aio_set_event_notifier_poll(AioContext *ctx,
                     (IOHandler *)io_poll_end);
 }
 
+/*
+ * With @linger, handlers that asked for it and had events during this polling
+ * section keep it open for one more adaptive polling time, so that a short
+ * gap between polling sections doesn't re-enable their notifications.
+ */
 static bool poll_set_started(AioContext *ctx, AioHandlerList *ready_list,
-                             bool started)
+                             bool started, bool linger)
 {
     AioHandler *node;
     bool progress = false;
@@ -237,6 +255,9 @@ static bool poll_set_started(AioContext *ctx, AioHandlerList *ready_list,
     }
 
     ctx->poll_started = started;
+    if (started) {
+        ctx->poll_linger_deadline = 0;
+    }
 
     qemu_lockcnt_inc(&ctx->list_lock);
     QLIST_FOREACH(node, &ctx->poll_aio_handlers, node_poll) {
@@ -247,10 +268,21 @@ static bool poll_set_started(AioContext *ctx, AioHandlerList *ready_list,
         }
 
         if (started) {
+            node->poll_lingering = false;
             fn = node->io_poll_begin;
+        } else if (linger && node->poll_linger && node->poll_progress &&
+                   ctx->poll_ns) {
+            if (!ctx->poll_linger_deadline) {
+                ctx->poll_linger_deadline =
+                    qemu_clock_get_ns(QEMU_CLOCK_REALTIME) + ctx->poll_ns;
+            }
+            trace_poll_linger_begin(ctx, node, node->pfd.fd, ctx->poll_ns);
+            node->poll_lingering = true;
+            fn = NULL;
         } else {
             fn = node->io_poll_end;
         }
+        node->poll_progress = false;
 
         if (fn) {
             fn(node->opaque);
@@ -267,13 +299,47 @@ static bool poll_set_started(AioContext *ctx, AioHandlerList *ready_list,
     return progress;
 }
 
+/* Close the polling sections that poll_set_started() left open */
+static bool poll_linger_end(AioContext *ctx, AioHandlerList *ready_list)
+{
+    AioHandler *node;
+    bool progress = false;
+
+    ctx->poll_linger_deadline = 0;
+
+    qemu_lockcnt_inc(&ctx->list_lock);
+    QLIST_FOREACH(node, &ctx->poll_aio_handlers, node_poll) {
+        if (!node->poll_lingering || QLIST_IS_INSERTED(node, node_deleted)) {
+            continue;
+        }
+
+        node->poll_lingering = false;
+        trace_poll_linger_end(ctx, node, node->pfd.fd);
+
+        if (node->io_poll_end) {
+            node->io_poll_end(node->opaque);
+        }
+
+        /* Poll one last time in case ->io_poll_end() raced with the event */
+        if (node->io_poll(node->opaque)) {
+            aio_add_poll_ready_handler(ready_list, node);
+            progress = true;
+        }
+    }
+    qemu_lockcnt_dec(&ctx->list_lock);
+
+    return progress;
+}
 
 bool aio_prepare(AioContext *ctx)
 {
     AioHandlerList ready_list = QLIST_HEAD_INITIALIZER(ready_list);
 
     /* Poll mode cannot be used with glib's event loop, disable it. */
-    poll_set_started(ctx, &ready_list, false);
+    poll_set_started(ctx, &ready_list, false, false);
+    if (ctx->poll_linger_deadline) {
+        poll_linger_end(ctx, &ready_list);
+    }
     /* TODO what to do with this list? */
 
     return false;
@@ -455,6 +521,7 @@ static bool run_poll_handlers_once(AioContext *ctx,
             aio_add_poll_ready_handler(ready_list, node);
 
             node->poll_idle_timeout = now + POLL_IDLE_INTERVAL_NS;
+            node->poll_progress = true;
 
             /*
              * Polling was successful, exit try_poll_mode immediately
@@ -603,7 +670,7 @@ static bool try_poll_mode(AioContext *ctx, AioHandlerList *ready_list,
          * Enable poll mode. It pairs with the poll_set_started() in
          * aio_poll() which disables poll mode.
          */
-        poll_set_started(ctx, ready_list, true);
+        poll_set_started(ctx, ready_list, true, false);
 
         if (run_poll_handlers(ctx, ready_list, max_ns, timeout)) {
             return true;
@@ -675,11 +742,19 @@ bool aio_poll(AioContext *ctx, bool blocking)
          * up IO threads when some work becomes pending. It is essential to
          * avoid hangs or unnecessary latency.
          */
-        if (poll_set_started(ctx, &ready_list, false)) {
+        if (poll_set_started(ctx, &ready_list, false, true)) {
             timeout = 0;
             progress = true;
         }
 
+        /* Wake up in time to end the polling sections that were extended */
+        if (ctx->poll_linger_deadline) {
+            int64_t linger_ns = ctx->poll_linger_deadline -
+                                qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+
+            timeout = qemu_soonest_timeout(timeout, MAX(linger_ns, 0));
+        }
+
         ctx->fdmon_ops->wait(ctx, &ready_list, timeout);
     }
 
@@ -691,6 +766,11 @@ bool aio_poll(AioContext *ctx, bool blocking)
 
     aio_notify_accept(ctx);
 
+    if (ctx->poll_linger_deadline &&
+        qemu_clock_get_ns(QEMU_CLOCK_REALTIME) >= ctx->poll_linger_deadline) {
+        progress |= poll_linger_end(ctx, &ready_list);
+    }
+
     /* Adjust polling time */
     if (ctx->poll_max_ns) {
         int64_t block_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start;
@@ -790,6 +870,11 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
     aio_notify(ctx);
 }
 
+int64_t aio_context_get_poll_ns(AioContext *ctx)
+{
+    return ctx->poll_ns;
+}
+
 void aio_context_set_aio_params(AioContext *ctx, int64_t max_batch)
 {
     /*
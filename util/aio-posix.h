@@ -38,6 +38,9 @@ struct AioHandler {
 #endif
     int64_t poll_idle_timeout; /* when to stop userspace polling */
     bool poll_ready; /* has polling detected an event? */
+    bool poll_progress; /* has polling detected an event since it started? */
+    bool poll_linger; /* see aio_set_event_notifier_poll_linger() */
+    bool poll_lingering; /* ->io_poll_end() deferred by poll_set_started() */
 };
 
 /* Add a handler to a ready list */
@@ -178,6 +178,13 @@ void aio_set_event_notifier_poll(AioContext *ctx,
     /* Not implemented */
 }
 
+void aio_set_event_notifier_poll_linger(AioContext *ctx,
+                                        EventNotifier *notifier,
+                                        bool linger)
+{
+    /* Not implemented */
+}
+
 bool aio_prepare(AioContext *ctx)
 {
     static struct timeval tv0;
@@ -439,6 +446,11 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
     }
 }
 
+int64_t aio_context_get_poll_ns(AioContext *ctx)
+{
+    return 0;
+}
+
 void aio_context_set_aio_params(AioContext *ctx, int64_t max_batch)
 {
 }
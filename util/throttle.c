@@ -462,13 +462,14 @@ bool throttle_schedule_timer(ThrottleState *ts,
     return true;
 }
 
-/* do the accounting for this operation
+/* add @size bytes and @units operations to the buckets of @direction
  *
  * @direction: throttle direction
- * @size:     the size of the operation
+ * @size:      the number of bytes
+ * @units:     the number of operations
  */
-void throttle_account(ThrottleState *ts, ThrottleDirection direction,
-                      uint64_t size)
+static void throttle_do_account(ThrottleState *ts, ThrottleDirection direction,
+                                uint64_t size, double units)
 {
     static const BucketType bucket_types_size[THROTTLE_MAX][2] = {
         { THROTTLE_BPS_TOTAL, THROTTLE_BPS_READ },
@@ -478,14 +479,9 @@ void throttle_account(ThrottleState *ts, ThrottleDirection direction,
         { THROTTLE_OPS_TOTAL, THROTTLE_OPS_READ },
         { THROTTLE_OPS_TOTAL, THROTTLE_OPS_WRITE }
     };
-    double units = 1.0;
     unsigned i;
 
     assert(direction < THROTTLE_MAX);
-    /* if cfg.op_size is defined and smaller than size we compute unit count */
-    if (ts->cfg.op_size && size > ts->cfg.op_size) {
-        units = (double) size / ts->cfg.op_size;
-    }
 
     for (i = 0; i < ARRAY_SIZE(bucket_types_size[THROTTLE_READ]); i++) {
         LeakyBucket *bkt;
@@ -504,6 +500,38 @@ void throttle_account(ThrottleState *ts, ThrottleDirection direction,
     }
 }
 
+/* do the accounting for this operation
+ *
+ * @direction: throttle direction
+ * @size:     the size of the operation
+ */
+void throttle_account(ThrottleState *ts, ThrottleDirection direction,
+                      uint64_t size)
+{
+    double units = 1.0;
+
+    /* if cfg.op_size is defined and smaller than size we compute unit count */
+    if (ts->cfg.op_size && size > ts->cfg.op_size) {
+        units = (double) size / ts->cfg.op_size;
+    }
+
+    throttle_do_account(ts, direction, size, units);
+}
+
+/* do the accounting for a batch of operations at once, e.g. to pay for I/O
+ * in advance.  Unlike throttle_account(), cfg.op_size is not taken into
+ * account: every operation counts as one unit.
+ *
+ * @direction: throttle direction
+ * @ops:       the number of operations
+ * @size:      the total size of the operations
+ */
+void throttle_account_batch(ThrottleState *ts, ThrottleDirection direction,
+                            uint64_t ops, uint64_t size)
+{
+    throttle_do_account(ts, direction, size, ops);
+}
+
 /* return a ThrottleConfig based on the options in a ThrottleLimits
  *
  * @arg:    the ThrottleLimits object to read from
@@ -27,7 +27,15 @@
  * protocol messages over the UNIX domain socket.
  *
  * When virtqueues are set up libvhost-user calls set_watch() to monitor kick
- * fds. These fds are also handled in the VuServer->ctx AioContext.
+ * fds. These fds are also handled in the VuServer->ctx AioContext, unless
+ * VuServer->get_queue_aio_context() places a virtqueue in another one.
+ *
+ * libvhost-user is not thread-safe. While kick fds are monitored outside of
+ * VuServer->ctx, each vhost-user message is handled with virtqueue processing
+ * paused: vu_message_read() stops monitoring all kick fds, visits the other
+ * AioContexts so that no kick handler still runs there, and waits until no
+ * request is in flight. vu_client_trip() resumes monitoring after
+ * vu_dispatch().
  *
  * Both vu_client_trip() and kick fd monitoring can be stopped by shutting down
  * the socket connection. Shutting down the socket connection causes
@@ -89,16 +97,20 @@ static void panic_cb(VuDev *vu_dev, const char *buf)
 
 void vhost_user_server_inc_in_flight(VuServer *server)
 {
-    assert(!server->wait_idle);
+    assert(!qatomic_read(&server->wait_idle));
     qatomic_inc(&server->in_flight);
 }
 
 void vhost_user_server_dec_in_flight(VuServer *server)
 {
     if (qatomic_fetch_dec(&server->in_flight) == 1) {
-        if (server->wait_idle) {
+        /* Only one of this and vu_wait_idle() may clear wait_idle */
+        if (qatomic_xchg(&server->wait_idle, false)) {
             aio_co_wake(server->co_trip);
         }
+
+        /* Wake AIO_WAIT_WHILE() in drained_poll, we may be in an iothread */
+        aio_wait_kick();
     }
 }
 
@@ -107,6 +119,127 @@ bool vhost_user_server_has_in_flight(VuServer *server)
     return qatomic_load_acquire(&server->in_flight) > 0;
 }
 
+/*
+ * Wait in co_trip until no request is in flight. Callers must have stopped
+ * the kick handlers first, see vu_pause_kicks().
+ */
+static void coroutine_fn vu_wait_idle(VuServer *server)
+{
+    qatomic_set(&server->wait_idle, true);
+    smp_mb(); /* read in_flight after publishing wait_idle */
+    if (vhost_user_server_has_in_flight(server) ||
+        !qatomic_xchg(&server->wait_idle, false)) {
+        /* vhost_user_server_dec_in_flight() wakes us */
+        qemu_coroutine_yield();
+    }
+}
+
+/* The AioContext in which the kick fd of virtqueue @idx is monitored */
+static AioContext *vu_queue_aio_context(VuServer *server, int idx)
+{
+    AioContext *ctx = NULL;
+
+    if (!server->ctx) {
+        return NULL;
+    }
+    if (server->get_queue_aio_context) {
+        ctx = server->get_queue_aio_context(server, idx);
+    }
+    return ctx ? ctx : server->ctx;
+}
+
+static void kick_handler(void *opaque);
+
+static void vu_fd_watch_attach(VuServer *server, VuFdWatch *vu_fd_watch)
+{
+    /* libvhost-user passes the virtqueue index as pvt of its kick watches */
+    int idx = (intptr_t)vu_fd_watch->pvt;
+    AioContext *ctx = vu_queue_aio_context(server, idx);
+
+    if (vu_fd_watch->ctx || !ctx) {
+        return;
+    }
+    vu_fd_watch->ctx = ctx;
+    aio_set_fd_handler(ctx, vu_fd_watch->fd, kick_handler,
+                       NULL, NULL, NULL, vu_fd_watch);
+}
+
+static void vu_fd_watch_detach(VuFdWatch *vu_fd_watch)
+{
+    if (!vu_fd_watch->ctx) {
+        return;
+    }
+    aio_set_fd_handler(vu_fd_watch->ctx, vu_fd_watch->fd,
+                       NULL, NULL, NULL, NULL, NULL);
+    vu_fd_watch->ctx = NULL;
+}
+
+static bool vu_has_foreign_kicks(VuServer *server)
+{
+    VuFdWatch *vu_fd_watch;
+
+    QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
+        if (vu_fd_watch->ctx && vu_fd_watch->ctx != server->ctx) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Stop virtqueue processing in all AioContexts and wait for it to finish. A
+ * kick handler that another thread started before the fd was detached has
+ * returned once this coroutine has run in that thread's AioContext.
+ */
+static void coroutine_fn vu_pause_kicks(VuServer *server)
+{
+    AioContext *home = qemu_get_current_aio_context();
+    g_autoptr(GPtrArray) ctxs = g_ptr_array_new();
+    VuFdWatch *vu_fd_watch;
+    guint i;
+
+    if (server->kicks_paused) {
+        return;
+    }
+    server->kicks_paused = true;
+
+    QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
+        AioContext *ctx = vu_fd_watch->ctx;
+
+        if (ctx && ctx != home && !g_ptr_array_find(ctxs, ctx, NULL)) {
+            g_ptr_array_add(ctxs, ctx);
+        }
+        vu_fd_watch_detach(vu_fd_watch);
+    }
+
+    for (i = 0; i < ctxs->len; i++) {
+        aio_co_reschedule_self(g_ptr_array_index(ctxs, i));
+    }
+    if (ctxs->len) {
+        aio_co_reschedule_self(home);
+    }
+
+    vu_wait_idle(server);
+}
+
+static void vu_resume_kicks(VuServer *server)
+{
+    VuFdWatch *vu_fd_watch;
+
+    if (!server->kicks_paused) {
+        return;
+    }
+    server->kicks_paused = false;
+
+    /* While quiescing, vhost_user_server_attach_aio_context() does this */
+    if (server->quiescing) {
+        return;
+    }
+    QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
+        vu_fd_watch_attach(server, vu_fd_watch);
+    }
+}
+
 static bool coroutine_fn
 vu_message_read(VuDev *vu_dev, int conn_fd, VhostUserMsg *vmsg)
 {
@@ -199,6 +332,9 @@ vu_message_read(VuDev *vu_dev, int conn_fd, VhostUserMsg *vmsg)
         }
     }
 
+    if (vu_has_foreign_kicks(server)) {
+        vu_pause_kicks(server);
+    }
     return true;
 
 fail:
@@ -222,17 +358,14 @@ static coroutine_fn void vu_client_trip(void *opaque)
         if (!vu_dispatch(vu_dev) && server->ctx) {
             break;
         }
+        vu_resume_kicks(server);
     }
 
-    if (vhost_user_server_has_in_flight(server)) {
-        /* Wait for requests to complete before we can unmap the memory */
-        server->wait_idle = true;
-        qemu_coroutine_yield();
-        server->wait_idle = false;
-    }
-    assert(!vhost_user_server_has_in_flight(server));
+    /* Wait for requests to complete before we can unmap the memory */
+    vu_pause_kicks(server);
 
     vu_deinit(vu_dev);
+    server->kicks_paused = false;
 
     /* vu_deinit() should have called remove_watch() */
     assert(QTAILQ_EMPTY(&server->vu_fd_watches));
@@ -304,10 +437,13 @@ set_watch(VuDev *vu_dev, int fd, int vu_evt,
         vu_fd_watch->fd = fd;
         vu_fd_watch->cb = cb;
         qemu_socket_set_nonblock(fd);
-        aio_set_fd_handler(server->ctx, fd, kick_handler,
-                           NULL, NULL, NULL, vu_fd_watch);
         vu_fd_watch->vu_dev = vu_dev;
         vu_fd_watch->pvt = pvt;
+
+        /* Otherwise vu_resume_kicks() attaches it */
+        if (!server->kicks_paused) {
+            vu_fd_watch_attach(server, vu_fd_watch);
+        }
     }
 }
 
@@ -325,7 +461,7 @@ static void remove_watch(VuDev *vu_dev, int fd)
     if (!vu_fd_watch) {
         return;
     }
-    aio_set_fd_handler(server->ctx, fd, NULL, NULL, NULL, NULL, NULL);
+    vu_fd_watch_detach(vu_fd_watch);
 
     QTAILQ_REMOVE(&server->vu_fd_watches, vu_fd_watch, next);
     g_free(vu_fd_watch);
@@ -385,8 +521,7 @@ void vhost_user_server_stop(VuServer *server)
         VuFdWatch *vu_fd_watch;
 
         QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
-            aio_set_fd_handler(server->ctx, vu_fd_watch->fd,
-                               NULL, NULL, NULL, NULL, vu_fd_watch);
+            vu_fd_watch_detach(vu_fd_watch);
         }
 
         qio_channel_shutdown(server->ioc, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
@@ -423,9 +558,11 @@ void vhost_user_server_attach_aio_context(VuServer *server, AioContext *ctx)
         return;
     }
 
-    QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
-        aio_set_fd_handler(ctx, vu_fd_watch->fd, kick_handler, NULL,
-                           NULL, NULL, vu_fd_watch);
+    /* Otherwise vu_resume_kicks() attaches them */
+    if (!server->kicks_paused) {
+        QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
+            vu_fd_watch_attach(server, vu_fd_watch);
+        }
     }
 
     if (server->co_trip) {
@@ -456,8 +593,7 @@ void vhost_user_server_detach_aio_context(VuServer *server)
         VuFdWatch *vu_fd_watch;
 
         QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
-            aio_set_fd_handler(server->ctx, vu_fd_watch->fd,
-                               NULL, NULL, NULL, NULL, vu_fd_watch);
+            vu_fd_watch_detach(vu_fd_watch);
         }
     }
 